@@ -19,20 +19,20 @@ limitations under the License.
 
 #include "ValidateMP4.h"
 
-extern ValidateGlobals vg;
+extern THREAD_LOCAL ValidateGlobals vg;
 
 	// for use with ostypetostr_r() and int64todstr_r() for example;
     // when you're using one of these routines more than once in the same print statement
-	char   tempStr1[32];
-	char   tempStr2[32];
-	char   tempStr3[32];
-	char   tempStr4[32];
-	char   tempStr5[32];
-	char   tempStr6[32];
-	char   tempStr7[32];
-	char   tempStr8[32];
-	char   tempStr9[32];
-	char   tempStr10[32];
+	THREAD_LOCAL char   tempStr1[32];
+	THREAD_LOCAL char   tempStr2[32];
+	THREAD_LOCAL char   tempStr3[32];
+	THREAD_LOCAL char   tempStr4[32];
+	THREAD_LOCAL char   tempStr5[32];
+	THREAD_LOCAL char   tempStr6[32];
+	THREAD_LOCAL char   tempStr7[32];
+	THREAD_LOCAL char   tempStr8[32];
+	THREAD_LOCAL char   tempStr9[32];
+	THREAD_LOCAL char   tempStr10[32];
 
 
 //==========================================================================================
@@ -80,6 +80,8 @@ int FindAtomOffsets( atomOffsetEntry *aoe, UInt64 minOffset, UInt64 maxOffset,
 		if (atomOffsets[cnt].size == 0) {
 			// we go to the end
 			atomOffsets[cnt].size = maxOffset - atomOffsets[cnt].offset;
+			atomOffsets[cnt].maxOffset = maxOffset;
+			cnt++;
 			break;
 		}
 		
@@ -112,17 +114,40 @@ OSErr ValidateFileAtoms( atomOffsetEntry *aoe, void *refcon )
 #pragma unused(refcon)
 	OSErr err = noErr;
 	long cnt;
-	atomOffsetEntry *list;
-	long i;
+	atomOffsetEntry *list = nil;
 	OSErr atomerr = noErr;
-	long moovCnt = 0;
-	atomOffsetEntry *entry;
 	UInt64 minOffset, maxOffset;
 	
 	minOffset = aoe->offset + aoe->atomStartSize;
 	maxOffset = aoe->offset + aoe->size - aoe->atomStartSize;
 	
 	BAILIFERR( FindAtomOffsets( aoe, minOffset, maxOffset, &cnt, &list ) );
+	BAILIFERR( BuildMediaDataIndex( cnt, list ) );
+	BAILIFERR( StartMediaDataDigests() );
+	
+	err = ValidateFileMovieAtoms( cnt, list );
+	atomerr = ValidateFileRemainingAtoms( cnt, list );
+	if (!err) err = atomerr;
+	
+	aoe->aoeflags |= kAtomValidated;
+bail:
+	if (list) free( list );
+	if ( vg.mir != NULL) {
+		dispose_mir(vg.mir);
+	}
+	DisposeMediaDataDigests();
+	DisposeMediaDataIndex();
+
+	return err;
+}
+
+//==========================================================================================
+
+//   the 'ftyp' and the 'moov'; a stream (see ValidateStream.c) may get to these early
+OSErr ValidateFileMovieAtoms( long cnt, atomOffsetEntry *list )
+{
+	OSErr err = noErr;
+	OSErr atomerr = noErr;
 	
 	// Process 'ftyp' atom
 	
@@ -136,16 +161,85 @@ OSErr ValidateFileAtoms( atomOffsetEntry *aoe, void *refcon )
 		Validate_moov_Atom, cnt, list, nil );
 	if (!err) err = atomerr;
 	
+	return err;
+}
+
+//==========================================================================================
+
+OSErr ValidateFileRemainingAtoms( long cnt, atomOffsetEntry *list )
+{
+	OSErr err = noErr;
+	long i;
+	OSErr atomerr = noErr;
+	Boolean moovSeen = false;
+	atomOffsetEntry *entry;
+	FileAtomList fileAtoms;
+	
+	fileAtoms.cnt = cnt;
+	fileAtoms.list = list;
+	
 	// Process 'meta' atoms
 	atomerr = ValidateAtomOfType( 'meta', kTypeAtomFlagCanHaveAtMostOne, 
 		Validate_meta_Atom, cnt, list, nil );
 	if (!err) err = atomerr;
 	
+	// Process 'sidx' atoms
+	atomerr = ValidateAtomOfType( 'sidx', 0, 
+		Validate_sidx_Atom, cnt, list, &fileAtoms );
+	if (!err) err = atomerr;
+	
+	// Process 'mfra' atoms
+	atomerr = ValidateAtomOfType( 'mfra', kTypeAtomFlagCanHaveAtMostOne, 
+		Validate_mfra_Atom, cnt, list, &fileAtoms );
+	if (!err) err = atomerr;
+	
+	// Process 'moof' atoms, on worker threads with -jobs
+	atomerr = ValidateMovieFragments( cnt, list );
+	if (!err) err = atomerr;
+	
+	if (vg.coverage && vg.mir) {
+		ReportMediaDataCoverage( vg.mir );
+	}
+	if (vg.keyframeindexstr[0] && vg.mir) {
+		atomerr = WriteKeyframeIndex( vg.mir, vg.keyframeindexstr );
+		if (!err) err = atomerr;
+	}
+	if (vg.faststartstr[0]) {
+		atomerr = WriteRewrittenFile( vg.mir, cnt, list, vg.faststartstr, kRewriteFastStart );
+		if (!err) err = atomerr;
+	}
+	if (vg.optimizestr[0]) {
+		atomerr = WriteRewrittenFile( vg.mir, cnt, list, vg.optimizestr, kRewriteCompactTables );
+		if (!err) err = atomerr;
+	}
+	if (vg.digest && vg.mir) {
+		atomerr = FinishContentDigests( vg.mir );
+		if (!err) err = atomerr;
+	}
+	if (vg.extractstr[0]) {
+		atomerr = WriteElementaryStream( vg.mir, vg.extractstr );
+		if (!err) err = atomerr;
+	}
+	if (vg.library && vg.mir) {
+		atomerr = KeepLibraryMovie( vg.mir );
+		if (!err) err = atomerr;
+	}
+	
 	//
 	for (i = 0; i < cnt; i++) {
 		entry = &list[i];
 
 		switch (entry->type) {
+			case 'moov':
+				moovSeen = true;
+				break;
+				
+			case 'moof':
+				if (!moovSeen) {
+					errprint("Movie fragment ('moof') found before the 'moov' atom\n");
+				}
+				break;
+				
 			case 'mdat':
 
 			case 'skip':
@@ -168,12 +262,6 @@ OSErr ValidateFileAtoms( atomOffsetEntry *aoe, void *refcon )
 		if (!err) err = atomerr;
 	}
 	
-	aoe->aoeflags |= kAtomValidated;
-bail:
-	if ( vg.mir != NULL) {
-		dispose_mir(vg.mir);
-	}
-
 	return err;
 }
 
@@ -181,10 +269,9 @@ bail:
 
 OSErr Validate_dinf_Atom( atomOffsetEntry *aoe, void *refcon )
 {
-#pragma unused(refcon)
 	OSErr err = noErr;
 	long cnt;
-	atomOffsetEntry *list;
+	atomOffsetEntry *list = nil;
 	long i;
 	OSErr atomerr = noErr;
 	long mvhdCnt = 0;
@@ -202,7 +289,7 @@ OSErr Validate_dinf_Atom( atomOffsetEntry *aoe, void *refcon )
 	
 	// Process 'dref' atoms
 	atomerr = ValidateAtomOfType( 'dref', kTypeAtomFlagMustHaveOne | kTypeAtomFlagCanHaveAtMostOne, 
-		Validate_dref_Atom, cnt, list, nil );
+		Validate_dref_Atom, cnt, list, refcon );
 	if (!err) err = atomerr;
 
 	//
@@ -222,6 +309,7 @@ OSErr Validate_dinf_Atom( atomOffsetEntry *aoe, void *refcon )
 	
 	aoe->aoeflags |= kAtomValidated;
 bail:
+	if (list) free( list );
 	return err;
 }
 //==========================================================================================
@@ -230,7 +318,7 @@ OSErr Validate_edts_Atom( atomOffsetEntry *aoe, void *refcon )
 #pragma unused(refcon)
 	OSErr err = noErr;
 	long cnt;
-	atomOffsetEntry *list;
+	atomOffsetEntry *list = nil;
 	long i;
 	OSErr atomerr = noErr;
 	long mvhdCnt = 0;
@@ -268,6 +356,7 @@ OSErr Validate_edts_Atom( atomOffsetEntry *aoe, void *refcon )
 	
 	aoe->aoeflags |= kAtomValidated;
 bail:
+	if (list) free( list );
 	return err;
 }
 //==========================================================================================
@@ -277,7 +366,7 @@ OSErr Validate_minf_Atom( atomOffsetEntry *aoe, void *refcon )
 #pragma unused(refcon)
 	OSErr err = noErr;
 	long cnt;
-	atomOffsetEntry *list;
+	atomOffsetEntry *list = nil;
 	long i;
 	OSErr atomerr = noErr;
 	long mvhdCnt = 0;
@@ -313,7 +402,7 @@ OSErr Validate_minf_Atom( atomOffsetEntry *aoe, void *refcon )
 		case 'hint':
 			// Process 'hmhd' atoms
 			atomerr = ValidateAtomOfType( 'hmhd',kTypeAtomFlagMustHaveOne | kTypeAtomFlagCanHaveAtMostOne, 
-				Validate_hmhd_Atom, cnt, list, nil );
+				Validate_hmhd_Atom, cnt, list, tir );
 			if (!err) err = atomerr;
 			break;
 		
@@ -331,7 +420,7 @@ OSErr Validate_minf_Atom( atomOffsetEntry *aoe, void *refcon )
 
 	// Process 'dinf' atoms
 	atomerr = ValidateAtomOfType( 'dinf', kTypeAtomFlagMustHaveOne | kTypeAtomFlagCanHaveAtMostOne, 
-		Validate_dinf_Atom, cnt, list, nil );
+		Validate_dinf_Atom, cnt, list, tir );
 	if (!err) err = atomerr;
 
 	// Process 'stbl' atoms
@@ -370,6 +459,7 @@ OSErr Validate_minf_Atom( atomOffsetEntry *aoe, void *refcon )
 	
 	aoe->aoeflags |= kAtomValidated;
 bail:
+	if (list) free( list );
 	return err;
 }
 
@@ -380,7 +470,7 @@ OSErr Validate_mdia_Atom( atomOffsetEntry *aoe, void *refcon )
 #pragma unused(refcon)
 	OSErr err = noErr;
 	long cnt;
-	atomOffsetEntry *list;
+	atomOffsetEntry *list = nil;
 	long i;
 	OSErr atomerr = noErr;
 	long mvhdCnt = 0;
@@ -434,6 +524,7 @@ OSErr Validate_mdia_Atom( atomOffsetEntry *aoe, void *refcon )
 	
 	aoe->aoeflags |= kAtomValidated;
 bail:
+	if (list) free( list );
 	return err;
 }
 
@@ -443,14 +534,14 @@ OSErr Get_trak_Type( atomOffsetEntry *aoe, TrackInfoRec *tir )
 {
 	OSErr err = noErr;
 	long cnt;
-	atomOffsetEntry *list;
+	atomOffsetEntry *list = nil;
 	long i;
 	OSErr atomerr = noErr;
 	atomOffsetEntry *entry;
 	UInt64 minOffset, maxOffset;
 
 	long entrycnt;
-	atomOffsetEntry *entrylist;
+	atomOffsetEntry *entrylist = nil;
 	atomOffsetEntry *entryentry;
 	long	j;
 	
@@ -477,6 +568,8 @@ OSErr Get_trak_Type( atomOffsetEntry *aoe, TrackInfoRec *tir )
 	}
 
 bail:
+	if (entrylist) free( entrylist );
+	if (list) free( list );
 	return err;
 }
 
@@ -486,7 +579,7 @@ OSErr Validate_trak_Atom( atomOffsetEntry *aoe, void *refcon )
 {
 	OSErr err = noErr;
 	long cnt;
-	atomOffsetEntry *list;
+	atomOffsetEntry *list = nil;
 	long i;
 	OSErr atomerr = noErr;
 	long mvhdCnt = 0;
@@ -569,22 +662,28 @@ OSErr Validate_trak_Atom( atomOffsetEntry *aoe, void *refcon )
 				UInt64 sampleOffset;
 				UInt32 sampleSize;
 				UInt32 sampleDescriptionIndex;
+				UInt32 firstSample, lastSample;
 				Ptr dataP = nil;
 				BitBuffer bb;
 				
 				sampleprint("<vide_SAMPLE_DATA>\n"); vg.tabcnt++;
-					for (i = 1; i <= tir->sampleSizeEntryCnt; i++) {
-						if ((vg.samplenumber==0) || (vg.samplenumber==i)) {
+					GetSelectedSampleRange( tir, &firstSample, &lastSample );
+					for (i = GetNextSelectedSample( tir, firstSample, lastSample ); i <= lastSample; i = GetNextSelectedSample( tir, i + 1, lastSample )) {
+						if (SampleIsSelected( tir, i )) {
 							err = GetSampleOffsetSize( tir, i, &sampleOffset, &sampleSize, &sampleDescriptionIndex );
 							sampleprint("<sample num=\"%d\" offset=\"%s\" size=\"%d\" />\n",i,int64toxstr(sampleOffset),sampleSize); vg.tabcnt++;
 							BAILIFNIL( dataP = malloc(sampleSize), allocFailedErr );
 							err = GetFileData( vg.fileaoe, dataP, sampleOffset, sampleSize, nil );
-							
-							BitBuffer_Init(&bb, (void *)dataP, sampleSize);
-
-							Validate_vide_sample_Bitstream( &bb, tir );
+							if (!err) {
+								DigestSample( tir, i, dataP, sampleSize );
+								BitBuffer_Init(&bb, (void *)dataP, sampleSize);
+								Validate_vide_sample_Bitstream( &bb, tir );
+							} else if (err != userCanceledErr) {
+								errprint("couldn't read sample %ld\n", i);
+							}
 							free( dataP );
 							--vg.tabcnt; sampleprint("</sample>\n");
+							if (err == userCanceledErr) goto bail;		// the server stopped the job
 						}
 					}
 				--vg.tabcnt; sampleprint("</vide_SAMPLE_DATA>\n");
@@ -600,22 +699,28 @@ OSErr Validate_trak_Atom( atomOffsetEntry *aoe, void *refcon )
 				UInt64 sampleOffset;
 				UInt32 sampleSize;
 				UInt32 sampleDescriptionIndex;
+				UInt32 firstSample, lastSample;
 				Ptr dataP = nil;
 				BitBuffer bb;
 				
 				sampleprint("<audi_SAMPLE_DATA>\n"); vg.tabcnt++;
-					for (i = 1; i <= tir->sampleSizeEntryCnt; i++) {
-						if ((vg.samplenumber==0) || (vg.samplenumber==i)) {
+					GetSelectedSampleRange( tir, &firstSample, &lastSample );
+					for (i = GetNextSelectedSample( tir, firstSample, lastSample ); i <= lastSample; i = GetNextSelectedSample( tir, i + 1, lastSample )) {
+						if (SampleIsSelected( tir, i )) {
 							err = GetSampleOffsetSize( tir, i, &sampleOffset, &sampleSize, &sampleDescriptionIndex );
 							sampleprint("<sample num=\"%d\" offset=\"%s\" size=\"%d\" />\n",i,int64toxstr(sampleOffset),sampleSize); vg.tabcnt++;
 							BAILIFNIL( dataP = malloc(sampleSize), allocFailedErr );
 							err = GetFileData( vg.fileaoe, dataP, sampleOffset, sampleSize, nil );
-							
-							BitBuffer_Init(&bb, (void *)dataP, sampleSize);
-
-							Validate_soun_sample_Bitstream( &bb, tir );
+							if (!err) {
+								DigestSample( tir, i, dataP, sampleSize );
+								BitBuffer_Init(&bb, (void *)dataP, sampleSize);
+								Validate_soun_sample_Bitstream( &bb, tir );
+							} else if (err != userCanceledErr) {
+								errprint("couldn't read sample %ld\n", i);
+							}
 							free( dataP );
 							--vg.tabcnt; sampleprint("</sample>\n");
+							if (err == userCanceledErr) goto bail;		// the server stopped the job
 						}
 					}
 				--vg.tabcnt; sampleprint("</audi_SAMPLE_DATA>\n");
@@ -631,22 +736,28 @@ OSErr Validate_trak_Atom( atomOffsetEntry *aoe, void *refcon )
 				UInt64 sampleOffset;
 				UInt32 sampleSize;
 				UInt32 sampleDescriptionIndex;
+				UInt32 firstSample, lastSample;
 				Ptr dataP = nil;
 				BitBuffer bb;
 				
 				sampleprint("<odsm_SAMPLE_DATA>\n"); vg.tabcnt++;
-				for (i = 1; i <= tir->sampleSizeEntryCnt; i++) {
-					if ((vg.samplenumber==0) || (vg.samplenumber==i)) {
+				GetSelectedSampleRange( tir, &firstSample, &lastSample );
+				for (i = GetNextSelectedSample( tir, firstSample, lastSample ); i <= lastSample; i = GetNextSelectedSample( tir, i + 1, lastSample )) {
+					if (SampleIsSelected( tir, i )) {
 						err = GetSampleOffsetSize( tir, i, &sampleOffset, &sampleSize, &sampleDescriptionIndex );
 						sampleprint("<sample num=\"%d\" offset=\"%s\" size=\"%d\" />\n",1,int64toxstr(sampleOffset),sampleSize); vg.tabcnt++;
 							BAILIFNIL( dataP = malloc(sampleSize), allocFailedErr );
 							err = GetFileData( vg.fileaoe, dataP, sampleOffset, sampleSize, nil );
-							
-							BitBuffer_Init(&bb, (void *)dataP, sampleSize);
-
-							Validate_odsm_sample_Bitstream( &bb, tir );
+							if (!err) {
+								DigestSample( tir, i, dataP, sampleSize );
+								BitBuffer_Init(&bb, (void *)dataP, sampleSize);
+								Validate_odsm_sample_Bitstream( &bb, tir );
+							} else if (err != userCanceledErr) {
+								errprint("couldn't read sample %ld\n", i);
+							}
 							free( dataP );
 						--vg.tabcnt; sampleprint("</sample>\n");
+						if (err == userCanceledErr) goto bail;		// the server stopped the job
 					}
 				}
 				--vg.tabcnt; sampleprint("</odsm_SAMPLE_DATA>\n");
@@ -662,21 +773,27 @@ OSErr Validate_trak_Atom( atomOffsetEntry *aoe, void *refcon )
 				UInt64 sampleOffset;
 				UInt32 sampleSize;
 				UInt32 sampleDescriptionIndex;
+				UInt32 firstSample, lastSample;
 				Ptr dataP = nil;
 				BitBuffer bb;
 				sampleprint("<sdsm_SAMPLE_DATA>\n"); vg.tabcnt++;
-				for (i = 1; i <= tir->sampleSizeEntryCnt; i++) {
-					if ((vg.samplenumber==0) || (vg.samplenumber==i)) {
+				GetSelectedSampleRange( tir, &firstSample, &lastSample );
+				for (i = GetNextSelectedSample( tir, firstSample, lastSample ); i <= lastSample; i = GetNextSelectedSample( tir, i + 1, lastSample )) {
+					if (SampleIsSelected( tir, i )) {
 						err = GetSampleOffsetSize( tir, i, &sampleOffset, &sampleSize, &sampleDescriptionIndex );
 						sampleprint("<sample num=\"%d\" offset=\"%s\" size=\"%d\" />\n",1,int64toxstr(sampleOffset),sampleSize); vg.tabcnt++;
 							BAILIFNIL( dataP = malloc(sampleSize), allocFailedErr );
 							err = GetFileData( vg.fileaoe, dataP, sampleOffset, sampleSize, nil );
-							
-							BitBuffer_Init(&bb, (void *)dataP, sampleSize);
-
-							Validate_sdsm_sample_Bitstream( &bb, tir);
+							if (!err) {
+								DigestSample( tir, i, dataP, sampleSize );
+								BitBuffer_Init(&bb, (void *)dataP, sampleSize);
+								Validate_sdsm_sample_Bitstream( &bb, tir);
+							} else if (err != userCanceledErr) {
+								errprint("couldn't read sample %ld\n", i);
+							}
 							free( dataP );
 						--vg.tabcnt; sampleprint("</sample>\n");
+						if (err == userCanceledErr) goto bail;		// the server stopped the job
 					}
 				}
 				--vg.tabcnt; sampleprint("</sdsm_SAMPLE_DATA>\n");
@@ -697,6 +814,7 @@ OSErr Validate_trak_Atom( atomOffsetEntry *aoe, void *refcon )
 	
 	aoe->aoeflags |= kAtomValidated;
 bail:
+	if (list) free( list );
 	return err;
 }
 //==========================================================================================
@@ -705,7 +823,7 @@ OSErr Validate_stbl_Atom( atomOffsetEntry *aoe, void *refcon )
 {
 	OSErr err = noErr;
 	long cnt;
-	atomOffsetEntry *list;
+	atomOffsetEntry *list = nil;
 	long i;
 	OSErr atomerr = noErr;
 	long mvhdCnt = 0;
@@ -815,19 +933,22 @@ OSErr Validate_stbl_Atom( atomOffsetEntry *aoe, void *refcon )
 				  int64todstr_r( tir->timeToSampleDuration, tempStr2 ));
 		err = badAtomErr;
 	}
-	if (tir->sampleToChunk) {
+	BAILIFERR( BuildTrackTimeline( tir ) );
+
+	if (tir->sampleToChunk || tir->sampleToChunkView) {
 		UInt32 s;		// number of samples
 		UInt32 leftover;
+		SampleToChunk lastStsc;
 
-		if (tir->sampleToChunk[tir->sampleToChunkEntryCnt].firstChunk 
-			> tir->chunkOffsetEntryCnt) {
+		GetSampleToChunk( tir, tir->sampleToChunkEntryCnt, &lastStsc );
+		if (lastStsc.firstChunk > tir->chunkOffsetEntryCnt) {
 			errprint("SampleToChunk table describes more chunks than"
 					 " the ChunkOffsetTable table\n");
 			err = badAtomErr;
 		} 
 		
 		s = tir->sampleSizeEntryCnt - tir->sampleToChunkSampleSubTotal;
-		leftover = s % (tir->sampleToChunk[tir->sampleToChunkEntryCnt].samplesPerChunk);
+		leftover = lastStsc.samplesPerChunk ? (s % lastStsc.samplesPerChunk) : s;		// the table may be empty
 		if (leftover) {
 			errprint("SampleToChunk table does not evenly describe"
 					 " the number of samples as defined by the SampleToSize table\n");
@@ -837,11 +958,51 @@ OSErr Validate_stbl_Atom( atomOffsetEntry *aoe, void *refcon )
 
 	aoe->aoeflags |= kAtomValidated;
 bail:
+	if (list) free( list );
 	return err;
 }
 //==========================================================================================
 
 
+//==========================================================================================
+
+OSErr ValidateAtomEntry( atomOffsetEntry *entry, long typeCnt, ValidateAtomTypeProcPtr validateProc, void *refcon )
+{
+	OSType theType = entry->type;
+	char cstr[5] = {0};
+	OSErr atomerr;
+	atompathType curatompath;
+	Boolean curatomprint;
+	Boolean cursampleprint;
+	
+	cstr[0] = (theType >> 24) & 0xff;
+	cstr[1] = (theType >> 16) & 0xff;
+	cstr[2] = (theType >>  8) & 0xff;
+	cstr[3] = (theType >>  0) & 0xff;
+	
+	addAtomToPath( vg.curatompath, theType, typeCnt, curatompath );
+	if (vg.print_atompath) {
+		fprintf(_stdout,"%s\n", vg.curatompath);
+	}
+	curatomprint = vg.printatom;
+	cursampleprint = vg.printsample;
+	if ((vg.atompath[0] == 0) || (strcmp(vg.atompath,vg.curatompath) == 0)) {
+		if (vg.print_atom)
+			vg.printatom = true;
+		if (vg.print_sample)
+			vg.printsample = true;
+	}
+	atomprint("<%s",cstr); vg.tabcnt++;
+		atomerr = CallValidateAtomTypeProc(validateProc, entry, 
+									entry->refconOverride?((void*) (entry->refconOverride)):refcon);
+	--vg.tabcnt; atomprint("</%s>\n",cstr); 
+	vg.printatom = curatomprint;
+	vg.printsample = cursampleprint;
+	restoreAtomPath( vg.curatompath, curatompath );
+	
+	return atomerr;
+}
+
 //==========================================================================================
 
 OSErr ValidateAtomOfType( OSType theType, long flags, ValidateAtomTypeProcPtr validateProc, 
@@ -853,9 +1014,6 @@ OSErr ValidateAtomOfType( OSType theType, long flags, ValidateAtomTypeProcPtr va
 	long typeCnt = 0;
 	atomOffsetEntry *entry;
 	OSErr atomerr;
-	atompathType curatompath;
-	Boolean curatomprint;
-	Boolean cursampleprint;
 	
 	cstr[0] = (theType >> 24) & 0xff;
 	cstr[1] = (theType >> 16) & 0xff;
@@ -876,25 +1034,7 @@ OSErr ValidateAtomOfType( OSType theType, long flags, ValidateAtomTypeProcPtr va
 				else errprint("Atom %s must be first and is actually at position %d\n",ostypetostr(theType),i+1);
 			}			
 			typeCnt++;
-			addAtomToPath( vg.curatompath, theType, typeCnt, curatompath );
-			if (vg.print_atompath) {
-				fprintf(stdout,"%s\n", vg.curatompath);
-			}
-			curatomprint = vg.printatom;
-			cursampleprint = vg.printsample;
-			if ((vg.atompath[0] == 0) || (strcmp(vg.atompath,vg.curatompath) == 0)) {
-				if (vg.print_atom)
-					vg.printatom = true;
-				if (vg.print_sample)
-					vg.printsample = true;
-			}
-			atomprint("<%s",cstr); vg.tabcnt++;
-				atomerr = CallValidateAtomTypeProc(validateProc, entry, 
-											entry->refconOverride?((void*) (entry->refconOverride)):refcon);
-			--vg.tabcnt; atomprint("</%s>\n",cstr); 
-			vg.printatom = curatomprint;
-			vg.printsample = cursampleprint;
-			restoreAtomPath( vg.curatompath, curatompath );
+			atomerr = ValidateAtomEntry( entry, typeCnt, validateProc, refcon );
 			if (!err) err = atomerr;
 		}
 	}
@@ -987,23 +1127,20 @@ bail:
 	return noErr;
 }
 
-typedef struct track_track {
-	UInt32 chunk_num;
-	UInt32 chunk_cnt;
-} track_track;
 
 OSErr Validate_moov_Atom( atomOffsetEntry *aoe, void *refcon )
 {
 #pragma unused(refcon)
 	OSErr err = noErr;
 	long cnt;
-	atomOffsetEntry *list;
+	atomOffsetEntry *list = nil;
 	long i;
 	OSErr atomerr = noErr;
 	long mvhdCnt = 0;
 	long trakCnt = 0;
 	long thisTrakIndex = 0;
 	long iodsCnt = 0;
+	Boolean hasMovieExtends = false;
 	atomOffsetEntry *entry;
 	UInt64 minOffset, maxOffset;
 	MovieInfoRec		*mir = NULL;
@@ -1021,6 +1158,8 @@ OSErr Validate_moov_Atom( atomOffsetEntry *aoe, void *refcon )
 		entry = &list[i];
 		if (entry->type == 'trak') {
 			++trakCnt;
+		} else if (entry->type == 'mvex') {
+			hasMovieExtends = true;
 		}
 	}
 	
@@ -1033,6 +1172,7 @@ OSErr Validate_moov_Atom( atomOffsetEntry *aoe, void *refcon )
 	BAILIFNIL( vg.mir = calloc(1, sizeof(MovieInfoRec) + i), allocFailedErr );
 	mir = vg.mir;
 	mir->maxTIRs = trakCnt;
+	mir->hasMovieExtends = hasMovieExtends;		// so the tracks know their samples may be in fragments
 
 
 	atomerr = ValidateAtomOfType( 'mvhd', kTypeAtomFlagMustHaveOne | kTypeAtomFlagCanHaveAtMostOne, 
@@ -1093,6 +1233,11 @@ OSErr Validate_moov_Atom( atomOffsetEntry *aoe, void *refcon )
 	// Process hint 'trak' atoms
 	atomerr = ValidateAtomOfType( 'trak', 0, Validate_trak_Atom, cnt, list, nil );
 	if (!err) err = atomerr;
+
+	// Process 'mvex' atoms; after the tracks, since 'trex' refers to them
+	atomerr = ValidateAtomOfType( 'mvex', kTypeAtomFlagCanHaveAtMostOne, 
+		Validate_mvex_Atom, cnt, list, mir );
+	if (!err) err = atomerr;
 	
 	// Process 'iods' atoms
 	atomerr = ValidateAtomOfType( 'iods', kTypeAtomFlagMustHaveOne | kTypeAtomFlagCanHaveAtMostOne, 
@@ -1148,7 +1293,10 @@ OSErr Validate_moov_Atom( atomOffsetEntry *aoe, void *refcon )
 			
 			if (tir->chunkOffsetEntryCnt > 1) {
 				for (j=1; j<=tir->sampleToChunkEntryCnt; j++) {
-					if (tir->sampleToChunk[j].samplesPerChunk > 1) 
+					SampleToChunk stsc;
+					
+					GetSampleToChunk( tir, j, &stsc );
+					if (stsc.samplesPerChunk > 1) 
 						{ all_single = 0; break; }
 				}
 				if (all_single == 1) warnprint("Warning: track %d has %d chunks all containing 1 sample only\n",
@@ -1157,172 +1305,13 @@ OSErr Validate_moov_Atom( atomOffsetEntry *aoe, void *refcon )
 		}
 		
 	// Check for overlapped sample chunks [dws]
-	//  this re-write relies on the fact that most tracks are in offset order and most files behave;
-	//  we pick the track with the lowest unprocessed chunk offset;
-	//  if that is beyond the highest chunk end we have seen, we append it;  otherwise (the rare case)
-	//   we insert it into the sorted list.  this gives us a rapid check and an output sorted list without
-	//   an n-squared overlap check and without a post-sort
-	if (mir->numTIRs > 0)
-	{
-		UInt32 totalChunks = 0;
-		TrackInfoRec *tir;
-		UInt64 highwatermark;
-		UInt32 trk_cnt, topslot = 0;
-		track_track *trk;
-		
-		chunkOverlapRec *corp;
-		
-		UInt8 done = 0;
-		
-		trk_cnt = mir->numTIRs;
-		
-		BAILIFNULL( trk = calloc(trk_cnt,sizeof(track_track)), allocFailedErr );
-
-		for (i=0; i<trk_cnt; ++i) {
-			// find the chunk counts for each track and setup structures
-			tir = &(mir->tirList[i]);
-			totalChunks += tir->chunkOffsetEntryCnt;
-			
-			trk[i].chunk_cnt = tir->chunkOffsetEntryCnt;
-			trk[i].chunk_num = 1;	// the next chunk to work on for each track
-			
-		}
-		BAILIFNULL( corp = calloc(totalChunks,sizeof(chunkOverlapRec)), allocFailedErr );
-				
-		highwatermark = 0;		// the highest chunk end seen
-
-		do { // until we have processed all chunks of all tracks
-			UInt32 lowest;
-			UInt64 low_offset;
-			UInt64 chunkOffset, chunkStop;
-			UInt32 chunkSize;
-			UInt32 slot;
-	
-			// find the next lowest chunk start
-			lowest = -1;		// next chunk not identified
-			for (i=0; i<trk_cnt; i++) {
-				UInt64 offset;
-				tir = &(mir->tirList[i]);
-				if (trk[i].chunk_num <= trk[i].chunk_cnt) {		// track has chunks to process
-					offset = tir->chunkOffset[ trk[i].chunk_num ].chunkOffset;
-					if ((lowest == -1)  || ((lowest != -1) && (offset<low_offset)))
-					{
-						low_offset = offset;
-						lowest = i;
-					}
-				}
-			}
-			
-			if (lowest == -1) {
-				errprint("aargh: program error!!!\n");
-				BAILIFERR( programErr );
-			}
-						
-			tir = &(mir->tirList[lowest]);
-			BAILIFERR( GetChunkOffsetSize(tir, trk[lowest].chunk_num, &chunkOffset, &chunkSize, nil) );
-			if (chunkSize == 0) {
-				errprint("Tracks with zero length chunks\n");
-				err = badPublicMovieAtom;
-				goto bail;
-			}
-			chunkStop = chunkOffset + chunkSize -1;
-			
-			if (chunkOffset != low_offset) {
-				errprint("Aargh! program error\n");
-				BAILIFERR( programErr );
-			}
-			
-			if (chunkOffset >= vg.inMaxOffset) 
-			{
-				errprint("Chunk offset %s is at or beyond file size  0x%lx\n", int64toxstr(chunkOffset), vg.inMaxOffset);
-			} else if (chunkStop > vg.inMaxOffset) 
-			{
-				errprint("Chunk end %s is beyond file size  0x%lx\n", int64toxstr(chunkStop), vg.inMaxOffset);
-			}
-			
-			if (chunkOffset >= highwatermark)
-			{	// easy, it starts after all other chunks end
-				slot = topslot;
-			} 
-			else 
-			{
-				// have to insert the chunk into the list somewhere; it might overlap
-				UInt32 k, priorslot, nextslot;
-				
-				// find the first chunk we already have that is starts after the candidate starts (if any)
-				slot = topslot;
-				for (k=0; k<topslot; k++) {
-					// this could be done with binary chop, but it happens rarely
-					if (corp[k].chunkStart > chunkOffset) { 
-						slot = k; 
-						break; 
-					}
-				}
-				
-				// Note we only warn if hint track chunks share data with other chunks, of if
-				//  two tracks of the same type share data
-				
-				// do we overlap the prior slots (if any)?
-				//   we might overlap slots before that, but if so, they must also overlap the slot
-				//   prior to us, and we would have already reported that error
-				if (slot > 0) {
-					priorslot = slot-1;
-					if ((chunkOffset >= corp[priorslot].chunkStart) && (chunkOffset <= corp[priorslot].chunkStop)) {
-						if ((tir->mediaType == corp[priorslot].mediaType) || 
-						    (tir->mediaType == 'hint') || 
-							(corp[priorslot].mediaType == 'hint')) 
-						warnprint("Warning: chunk %d of track ID %d at %s overlaps chunk from track ID %d at %s\n",
-							trk[lowest].chunk_num, tir->trackID, int64todstr_r( chunkOffset, tempStr1 ), 
-							corp[priorslot].trackID, int64todstr_r( corp[priorslot].chunkStart, tempStr2 ));
-						else errprint("Error: chunk %d of track ID %d at %s overlaps chunk from track ID %d at %s\n",
-							trk[lowest].chunk_num, tir->trackID, int64todstr_r( chunkOffset, tempStr1 ), 
-							corp[priorslot].trackID, int64todstr_r( corp[priorslot].chunkStart, tempStr2 ));
-					}
-				}
-
-				// do we overlap the next slots (if any)?
-				//   again, we might overlap slots after that, but if so, we also overlap the next slot
-				//   and one report is enough
-				if (slot < topslot) {
-					if ((chunkStop >= corp[slot].chunkStart) && (chunkStop <= corp[slot].chunkStop)) {
-						if ((tir->mediaType == corp[slot].mediaType) || 
-						    (tir->mediaType == 'hint') || 
-							(corp[slot].mediaType == 'hint')) 
-						warnprint("Warning: chunk %d of track ID %d at %s overlaps chunk from track ID %d at %s\n",
-							trk[lowest].chunk_num, tir->trackID, int64todstr_r( chunkOffset, tempStr1 ), 
-							corp[slot].trackID, int64todstr_r( corp[slot].chunkStart, tempStr2 ));
-						else errprint("Error: chunk %d of track ID %d at %s overlaps chunk from track ID %d at %s\n",
-							trk[lowest].chunk_num, tir->trackID, int64todstr_r( chunkOffset, tempStr1 ), 
-							corp[slot].trackID, int64todstr_r( corp[slot].chunkStart, tempStr2 ));
-					}
-				}
-					
-				// now shuffle the array up prior to inserting this record into the sorted list
-				for (nextslot = topslot; nextslot>slot; nextslot-- ) 
-					corp[nextslot] = corp[ nextslot-1 ];
-			}
-			corp[ slot ].chunkStart = chunkOffset;
-			corp[ slot ].chunkStop  = chunkStop;
-			corp[ slot ].trackID 	= tir->trackID;
-			corp[ slot ].mediaType  = tir->mediaType;  
-			
-				
-			if (chunkStop > highwatermark) highwatermark = chunkStop;
-			topslot++;
-
-			trk[lowest].chunk_num += 1;		// done that chunk
-			
-			// see whether we have eaten all chunks for all tracks			
-			done = 1;
-			for (i=0; i<trk_cnt; i++) {
-				if (trk[i].chunk_num <= trk[i].chunk_cnt) { done = 0; break; }
-			}
-		} while (done != 1);
-		// until we have processed all chunks of all tracks
+	if (mir->numTIRs > 0) {
+		BAILIFERR( CheckChunkOverlaps( mir ) );
 	}
 			
 	aoe->aoeflags |= kAtomValidated;
 bail:
+	if (list) free( list );
 //	if (mir != NULL) {
 //		dispose_mir(mir);
 //	}
@@ -1332,8 +1321,14 @@ bail:
 void dispose_mir( MovieInfoRec *mir )
 {
 	// for each track, get rid of the stuff in it
+	long i;
 
-
+	for (i = 0; i < mir->numTIRs; i++) {
+		DisposeTrackTimeline( &mir->tirList[i] );
+		DisposeTrackTables( &mir->tirList[i] );
+		if (mir->tirList[i].syncSample) free( mir->tirList[i].syncSample );
+	}
+	if (mir->chunkList) free( mir->chunkList );
 	free( mir );
 }
 
@@ -1345,7 +1340,7 @@ OSErr Validate_tref_Atom( atomOffsetEntry *aoe, void *refcon )
 {
 	OSErr err = noErr;
 	long cnt;
-	atomOffsetEntry *list;
+	atomOffsetEntry *list = nil;
 	long i;
 	OSErr atomerr = noErr;
 	long mvhdCnt = 0;
@@ -1403,6 +1398,7 @@ OSErr Validate_tref_Atom( atomOffsetEntry *aoe, void *refcon )
 	
 	aoe->aoeflags |= kAtomValidated;
 bail:
+	if (list) free( list );
 	return err;
 }
 
@@ -1413,7 +1409,7 @@ OSErr Validate_udta_Atom( atomOffsetEntry *aoe, void *refcon )
 #pragma unused(refcon)
 	OSErr err = noErr;
 	long cnt;
-	atomOffsetEntry *list;
+	atomOffsetEntry *list = nil;
 	long i;
 	OSErr atomerr = noErr;
 	atomOffsetEntry *entry;
@@ -1459,6 +1455,7 @@ OSErr Validate_udta_Atom( atomOffsetEntry *aoe, void *refcon )
 	
 	aoe->aoeflags |= kAtomValidated;
 bail:
+	if (list) free( list );
 	return err;
 }
 
@@ -1512,7 +1509,7 @@ OSErr Validate_moovhnti_Atom( atomOffsetEntry *aoe, void *refcon )
 {
 	OSErr err = noErr;
 	long cnt;
-	atomOffsetEntry *list;
+	atomOffsetEntry *list = nil;
 	long i;
 	OSErr atomerr = noErr;
 	atomOffsetEntry *entry;
@@ -1546,6 +1543,7 @@ OSErr Validate_moovhnti_Atom( atomOffsetEntry *aoe, void *refcon )
 	
 	aoe->aoeflags |= kAtomValidated;
 bail:
+	if (list) free( list );
 	return err;
 }
 
@@ -1556,7 +1554,7 @@ OSErr Validate_sinf_Atom( atomOffsetEntry *aoe, void *refcon, UInt32 flags )
 #pragma unused(refcon)
 	OSErr err = noErr;
 	long cnt;
-	atomOffsetEntry *list;
+	atomOffsetEntry *list = nil;
 	long i;
 	OSErr atomerr = noErr;
 	atomOffsetEntry *entry;
@@ -1600,6 +1598,7 @@ OSErr Validate_sinf_Atom( atomOffsetEntry *aoe, void *refcon, UInt32 flags )
 	
 	aoe->aoeflags |= kAtomValidated;
 bail:
+	if (list) free( list );
 	return err;
 }
 
@@ -1610,7 +1609,7 @@ OSErr Validate_meta_Atom( atomOffsetEntry *aoe, void *refcon )
 #pragma unused(refcon)
 	OSErr err = noErr;
 	long cnt;
-	atomOffsetEntry *list;
+	atomOffsetEntry *list = nil;
 	long i;
 	OSErr atomerr = noErr;
 	atomOffsetEntry *entry;
@@ -1688,6 +1687,7 @@ OSErr Validate_meta_Atom( atomOffsetEntry *aoe, void *refcon )
 	
 	aoe->aoeflags |= kAtomValidated;
 bail:
+	if (list) free( list );
 	return err;
 }
 
@@ -20,7 +20,7 @@ limitations under the License.
 #include "ValidateMP4.h"
 
 
-extern ValidateGlobals vg;
+extern THREAD_LOCAL ValidateGlobals vg;
 
 //===============================================
 
@@ -318,7 +318,7 @@ OSErr Validate_tkhd_Atom( atomOffsetEntry *aoe, void *refcon )
 	// else FieldMustBe( flags, 1, "'tkhd' flags must be 1" );
 	if ((flags & 7) != flags) errprint("Tkhd flags 0x%X other than 1,2 or 4 set\n", flags);
 	if (flags == 0) warnprint( "WARNING: 'tkhd' flags == 0 (OK in a hint track)\n", flags );
-	if (tkhdHead.duration == 0) warnprint( "WARNING: 'tkhd' duration == 0, track may be considered empty\n", flags );
+	if ((tkhdHead.duration == 0) && !vg.mir->hasMovieExtends) warnprint( "WARNING: 'tkhd' duration == 0, track may be considered empty\n", flags );
 
 
 	FieldMustBe( tkhdHeadCommon.movieTimeOffset, 0, "'tkhd' movieTimeOffset must be %d not %d" );
@@ -433,7 +433,9 @@ OSErr Validate_mdhd_Atom( atomOffsetEntry *aoe, void *refcon )
 	// Check required field values
 	FieldMustBe( flags, 0, "'mdvd' flags must be %d not %d" );
 	FieldMustBe( mdhdHeadCommon.quality, 0, "'mdhd' quality (reserved in mp4) must be %d not %d" );
-	FieldCheck( (mdhdHead.duration > 0), "'mdhd' duration must be > 0" );
+	if (!vg.mir->hasMovieExtends) {		// a fragmented movie may have all its samples in fragments
+		FieldCheck( (mdhdHead.duration > 0), "'mdhd' duration must be > 0" );
+	}
 
 	// All done
 	aoe->aoeflags |= kAtomValidated;
@@ -477,7 +479,7 @@ OSErr Validate_mdia_hdlr_Atom( atomOffsetEntry *aoe, void *refcon )
 	UInt32 flags;
 	UInt64 offset;
 	HandlerInfoRecord	hdlrInfo;
-	char *nameP;
+	char *nameP = nil;
 
 	// Get version/flags
 	BAILIFERR( GetFullAtomVersionFlags( aoe, &version, &flags, &offset ) );
@@ -496,7 +498,7 @@ OSErr Validate_mdia_hdlr_Atom( atomOffsetEntry *aoe, void *refcon )
 
 	// Remember info in the refcon
 	if (vg.print_atompath) {
-		fprintf(stdout,"\t\tHandler subtype = '%s'\n", ostypetostr(hdlrInfo.componentSubType));
+		fprintf(_stdout,"\t\tHandler subtype = '%s'\n", ostypetostr(hdlrInfo.componentSubType));
 	}
 	tir->mediaType = hdlrInfo.componentSubType;
 	atomprint("handler_type=\"%s\"\n", ostypetostr(hdlrInfo.componentSubType));
@@ -521,6 +523,7 @@ OSErr Validate_mdia_hdlr_Atom( atomOffsetEntry *aoe, void *refcon )
 	aoe->aoeflags |= kAtomValidated;
 
 bail:
+	if (nameP) free( nameP );
 	return err;
 }
 
@@ -531,7 +534,7 @@ OSErr Validate_hdlr_Atom( atomOffsetEntry *aoe, void *refcon )
 	UInt32 flags;
 	UInt64 offset;
 	HandlerInfoRecord	hdlrInfo;
-	char *nameP;
+	char *nameP = nil;
 
 	// Get version/flags
 	BAILIFERR( GetFullAtomVersionFlags( aoe, &version, &flags, &offset ) );
@@ -550,7 +553,7 @@ OSErr Validate_hdlr_Atom( atomOffsetEntry *aoe, void *refcon )
 
 	// Remember info in the refcon
 	if (vg.print_atompath) {
-		fprintf(stdout,"\t\tHandler subtype = '%s'\n", ostypetostr(hdlrInfo.componentSubType));
+		fprintf(_stdout,"\t\tHandler subtype = '%s'\n", ostypetostr(hdlrInfo.componentSubType));
 	}
 	atomprint("handler_type=\"%s\"\n", ostypetostr(hdlrInfo.componentSubType));
 	
@@ -569,6 +572,7 @@ OSErr Validate_hdlr_Atom( atomOffsetEntry *aoe, void *refcon )
 	aoe->aoeflags |= kAtomValidated;
 
 bail:
+	if (nameP) free( nameP );
 	return err;
 }
 
@@ -673,7 +677,7 @@ typedef struct HintMediaInfoHeader {
 
 OSErr Validate_hmhd_Atom( atomOffsetEntry *aoe, void *refcon )
 {
-#pragma unused(refcon)
+	TrackInfoRec *tir = (TrackInfoRec *)refcon;
 	OSErr err = noErr;
 	UInt32 version;
 	UInt32 flags;
@@ -703,6 +707,8 @@ OSErr Validate_hmhd_Atom( atomOffsetEntry *aoe, void *refcon )
 	// Check required field values
 	FieldMustBe( flags, 0, "'hmdh' flags must be %d not 0x%lx" );
 
+	tir->hintMaxBitrate = hmhdInfo.maxbitrate;
+
 	// All done
 	aoe->aoeflags |= kAtomValidated;
 
@@ -775,9 +781,10 @@ bail:
 
 //==========================================================================================
 
+//   refcon is the track's TrackInfoRec, or nil for a 'dref' outside a track
 OSErr Validate_url_Entry( atomOffsetEntry *aoe, void *refcon )
 {
-#pragma unused(refcon)
+	TrackInfoRec *tir = (TrackInfoRec *)refcon;
 	OSErr err = noErr;
 	UInt32 version;
 	UInt32 flags;
@@ -791,6 +798,7 @@ OSErr Validate_url_Entry( atomOffsetEntry *aoe, void *refcon )
 	if (flags & 1) {
 		// no more data
 	} else {
+		if (tir) tir->externalDataRefCnt++;
 		BAILIFERR( GetFileCString( aoe, &locationP, offset, aoe->maxOffset - offset, &offset ) );
 	}
 	
@@ -810,6 +818,7 @@ OSErr Validate_url_Entry( atomOffsetEntry *aoe, void *refcon )
 	aoe->aoeflags |= kAtomValidated;
 
 bail:
+	if (locationP) free( locationP );
 	return err;
 }
 
@@ -817,7 +826,7 @@ bail:
 
 OSErr Validate_urn_Entry( atomOffsetEntry *aoe, void *refcon )
 {
-#pragma unused(refcon)
+	TrackInfoRec *tir = (TrackInfoRec *)refcon;
 	OSErr err = noErr;
 	UInt32 version;
 	UInt32 flags;
@@ -829,6 +838,7 @@ OSErr Validate_urn_Entry( atomOffsetEntry *aoe, void *refcon )
 	BAILIFERR( GetFullAtomVersionFlags( aoe, &version, &flags, &offset ) );
 
 	// Get data 
+	if (tir && !(flags & 1)) tir->externalDataRefCnt++;
 	// name is required
 	BAILIFERR( GetFileCString( aoe, &nameP, offset, aoe->maxOffset - offset, &offset ) );
 	if (offset >= (aoe->offset + aoe->size)) {
@@ -851,6 +861,8 @@ OSErr Validate_urn_Entry( atomOffsetEntry *aoe, void *refcon )
 	aoe->aoeflags |= kAtomValidated;
 
 bail:
+	if (nameP) free( nameP );
+	if (locationP) free( locationP );
 	return err;
 }
 
@@ -860,8 +872,8 @@ bail:
 
 OSErr Validate_dref_Atom( atomOffsetEntry *aoe, void *refcon )
 {
-#pragma unused(refcon)
 	OSErr err = noErr;
+	atomOffsetEntry *list = nil;
 	UInt32 version;
 	UInt32 flags;
 	UInt64 offset;
@@ -886,7 +898,6 @@ OSErr Validate_dref_Atom( atomOffsetEntry *aoe, void *refcon )
 		UInt64 minOffset, maxOffset;
 		atomOffsetEntry *entry;
 		long cnt;
-		atomOffsetEntry *list;
 		int i;
 		
 		minOffset = offset;
@@ -926,6 +937,7 @@ OSErr Validate_dref_Atom( atomOffsetEntry *aoe, void *refcon )
 	aoe->aoeflags |= kAtomValidated;
 
 bail:
+	if (list) free( list );
 	return err;
 }
 
@@ -955,13 +967,14 @@ OSErr Validate_stts_Atom( atomOffsetEntry *aoe, void *refcon )
 	BAILIFERR( GetFileDataN32( aoe, &entryCount, offset, &offset ) );
 		//  adding 1 to entryCount to make this 1 based array
 	listSize = entryCount * sizeof(TimeToSampleNum);
-	BAILIFNULL( listP = malloc(listSize + sizeof(TimeToSampleNum)), allocFailedErr );
-	BAILIFERR( GetFileData( aoe, &listP[1], offset, listSize, &offset ) );
-	listP[0].sampleCount = 0; listP[0].sampleDuration = 0;
-	for ( i = 1; i <= entryCount; i++ ) {
-		listP[i].sampleCount = EndianS32_BtoN(listP[i].sampleCount);
-		listP[i].sampleDuration = EndianS32_BtoN(listP[i].sampleDuration);
+	if (!(tir->timeToSampleView = GetMappedTable( offset, listSize ))) {
+		BAILIFNULL( listP = malloc(listSize + sizeof(TimeToSampleNum)), allocFailedErr );
+		BAILIFERR( GetFileData( aoe, &listP[1], offset, listSize, &offset ) );
+		listP[0].sampleCount = 0; listP[0].sampleDuration = 0;
+		SwapBigEndian32( &listP[1].sampleCount, entryCount * 2 );
 	}
+	tir->timeToSample = listP;
+	tir->timeToSampleEntryCnt = entryCount;
 
 	// Print atom contents non-required fields
 	atomprintnotab("\tversion=\"%d\" flags=\"%d\"\n", version, flags);
@@ -970,16 +983,19 @@ OSErr Validate_stts_Atom( atomOffsetEntry *aoe, void *refcon )
 	vg.tabcnt++;
 		//  changes to i stuff where needed to make it 1 based
 	for ( i = 1; i <= entryCount; i++ ) {
-		atomprintdetailed("<sttsEntry sampleCount=\"%d\" sampleDelta/duration=\"%d\" />\n", listP[i].sampleCount, listP[i].sampleDuration);
-		if (!listP[i].sampleDuration) {
+		TimeToSampleNum entry;
+		
+		GetTimeToSample( tir, i, &entry );
+		atomprintdetailed("<sttsEntry sampleCount=\"%d\" sampleDelta/duration=\"%d\" />\n", entry.sampleCount, entry.sampleDuration);
+		if (!entry.sampleDuration) {
 			if (i == (entryCount)) {
 				lastSampleDurationIsZero = true;
 			} else {
 				errprint("You can't have a zero duration other than last in the stts TimeToSample table\n");
 			}
 		}
-		numSamples += listP[i].sampleCount;
-		totalDuration += listP[i].sampleCount * listP[i].sampleDuration;
+		numSamples += entry.sampleCount;
+		totalDuration += entry.sampleCount * entry.sampleDuration;
 	}
 	--vg.tabcnt;
 
@@ -1015,14 +1031,9 @@ bail:
 //==========================================================================================
 
 
-typedef struct CompositionTimeToSampleNum {
-    long             sampleCount;
-    TimeValue        sampleOffset;
-} CompositionTimeToSampleNum;
-
 OSErr Validate_ctts_Atom( atomOffsetEntry *aoe, void *refcon )
 {
-#pragma unused(refcon)
+	TrackInfoRec *tir = (TrackInfoRec *)refcon;
 	OSErr err = noErr;
 	UInt32 version;
 	UInt32 flags;
@@ -1030,7 +1041,7 @@ OSErr Validate_ctts_Atom( atomOffsetEntry *aoe, void *refcon )
 	UInt32 entryCount;
 	UInt32 totalcount;
 	UInt32 allzero;
-	CompositionTimeToSampleNum *listP;
+	CompositionTimeToSampleNum *listP = nil;
 	UInt32 listSize;
 	UInt32 i;
 	
@@ -1039,13 +1050,16 @@ OSErr Validate_ctts_Atom( atomOffsetEntry *aoe, void *refcon )
 
 	// Get data 
 	BAILIFERR( GetFileDataN32( aoe, &entryCount, offset, &offset ) );
-	listSize = entryCount * sizeof(TimeToSampleNum);
-	BAILIFNIL( listP = malloc(listSize), allocFailedErr );
-	BAILIFERR( GetFileData( aoe, listP, offset, listSize, &offset ) );
-	for ( i = 0; i < entryCount; i++ ) {
-		listP[i].sampleCount = EndianS32_BtoN(listP[i].sampleCount);
-		listP[i].sampleOffset = EndianS32_BtoN(listP[i].sampleOffset);
+	listSize = entryCount * sizeof(CompositionTimeToSampleNum);
+	if (!(tir->compositionTimeToSampleView = GetMappedTable( offset, listSize ))) {
+			// 1 based array
+		BAILIFNIL( listP = malloc(listSize + sizeof(CompositionTimeToSampleNum)), allocFailedErr );
+		BAILIFERR( GetFileData( aoe, &listP[1], offset, listSize, &offset ) );
+		listP[0].sampleCount = 0; listP[0].sampleOffset = 0;
+		SwapBigEndian32( &listP[1].sampleCount, entryCount * 2 );
 	}
+	tir->compositionTimeToSample = listP;
+	tir->compositionTimeToSampleEntryCnt = entryCount;
 	
 	// Print atom contents non-required fields
 	atomprintnotab("\tversion=\"%d\" flags=\"%d\"\n", version, flags);
@@ -1055,13 +1069,16 @@ OSErr Validate_ctts_Atom( atomOffsetEntry *aoe, void *refcon )
 	
 	totalcount = 0;  allzero = 1;
 	
-	for ( i = 0; i < entryCount; i++ ) {
-		atomprintdetailed("<cttsEntry sampleCount=\"%d\" sampleDelta/duration=\"%d\" />\n", listP[i].sampleCount, listP[i].sampleOffset);
-		if (listP[i].sampleOffset < 0) {
+	for ( i = 1; i <= entryCount; i++ ) {
+		CompositionTimeToSampleNum entry;
+		
+		GetCompositionTimeToSample( tir, i, &entry );
+		atomprintdetailed("<cttsEntry sampleCount=\"%d\" sampleDelta/duration=\"%d\" />\n", entry.sampleCount, entry.sampleOffset);
+		if (entry.sampleOffset < 0) {
 			errprint("You can't have a negative offset in the ctts table\n");
 		}
-		totalcount += listP[i].sampleCount;
-		if (listP[i].sampleOffset != 0) allzero = 0;
+		totalcount += entry.sampleCount;
+		if (entry.sampleOffset != 0) allzero = 0;
 	}
 	
 	if (totalcount == 0) warnprint("WARNING: CTTS atom has no entries so is un-needed\n");
@@ -1090,7 +1107,8 @@ OSErr Validate_stsz_Atom( atomOffsetEntry *aoe, void *refcon )
 	UInt64 offset;
 	UInt32 entryCount;
 	UInt32 sampleSize;
-	SampleSizeRecord *listP;
+	SampleSizeRecord *listP = nil;
+	const UInt8 *viewP = nil;
 	UInt32 listSize;
 	UInt32 i;
 	
@@ -1102,13 +1120,19 @@ OSErr Validate_stsz_Atom( atomOffsetEntry *aoe, void *refcon )
 	BAILIFERR( GetFileDataN32( aoe, &entryCount, offset, &offset ) );
 	if ((sampleSize == 0) && entryCount) {
 		listSize = entryCount * sizeof(SampleSizeRecord);
-			// 1 based array
-		BAILIFNIL( listP = malloc(listSize + sizeof(SampleSizeRecord)), allocFailedErr );
-		BAILIFERR( GetFileData( aoe, &listP[1], offset, listSize, &offset ) );
-		for ( i = 1; i <= entryCount; i++ ) {
-			listP[i].sampleSize = EndianS32_BtoN(listP[i].sampleSize);
+		if (!(viewP = GetMappedTable( offset, listSize ))) {
+				// 1 based array
+			BAILIFNIL( listP = malloc(listSize + sizeof(SampleSizeRecord)), allocFailedErr );
+			BAILIFERR( GetFileData( aoe, &listP[1], offset, listSize, &offset ) );
+			SwapBigEndian32( &listP[1].sampleSize, entryCount );
+			listP[0].sampleSize = 0;
 		}
 	}
+	tir->sampleSizeEntryCnt = entryCount;
+	tir->singleSampleSize = sampleSize;
+	BAILIFERR( SetSampleSizeTable( tir, listP, entryCount ) );
+	tir->sampleSizeView = viewP;
+	tir->sampleSizeViewBits = 32;
 	
 	// Print atom contents non-required fields
 	atomprintnotab("\tversion=\"%d\" flags=\"%d\"\n", version, flags);
@@ -1117,10 +1141,11 @@ OSErr Validate_stsz_Atom( atomOffsetEntry *aoe, void *refcon )
 	atomprint("/>\n");
 	if ((sampleSize == 0) && entryCount) {
 		vg.tabcnt++;
-		listP[0].sampleSize = 0;
 		for ( i = 1; i <= entryCount; i++ ) {
-			atomprintdetailed("<stszEntry sampleSize=\"%d\" />\n", listP[i].sampleSize);
-			if (listP[i].sampleSize == 0) {
+			UInt32 entrySize = GetSampleSize( tir, i );
+			
+			atomprintdetailed("<stszEntry sampleSize=\"%d\" />\n", entrySize);
+			if (entrySize == 0) {
 				errprint("You can't have a zero sample size in stsz\n");
 			}
 		}
@@ -1132,9 +1157,6 @@ OSErr Validate_stsz_Atom( atomOffsetEntry *aoe, void *refcon )
 
 	// All done
 	aoe->aoeflags |= kAtomValidated;
-	tir->sampleSizeEntryCnt = entryCount;
-	tir->singleSampleSize = sampleSize;
-	tir->sampleSize = listP;
 	
 bail:
 	return err;
@@ -1150,8 +1172,11 @@ OSErr Validate_stz2_Atom( atomOffsetEntry *aoe, void *refcon )
 	UInt32 entryCount;
 	UInt32 temp;
 	UInt8 fieldSize;
-	SampleSizeRecord *listP;
+	SampleSizeRecord *listP = nil;
 	UInt32 listSize;
+	UInt8 *tableP = nil;
+	const UInt8 *viewP = nil;
+	UInt32 tableSize = 0;
 	UInt32 i;
 	
 	// Get version/flags
@@ -1162,34 +1187,31 @@ OSErr Validate_stz2_Atom( atomOffsetEntry *aoe, void *refcon )
 	BAILIFERR( GetFileData( aoe, &fieldSize, offset, 1, &offset ) );
 	BAILIFERR( GetFileDataN32( aoe, &entryCount, offset, &offset ) );
 	listSize = entryCount * sizeof(SampleSizeRecord);
-		// 1 based array + room for one over for the 4-bit case loop
-	BAILIFNIL( listP = malloc(listSize + sizeof(SampleSizeRecord) + sizeof(SampleSizeRecord)), allocFailedErr );
 	
 	if (entryCount) switch (fieldSize) {
-		case 4:
-			for (i=0; i<((entryCount+1)/2); i++) {
-				UInt8 theSize;
-				BAILIFERR( GetFileData( aoe, &theSize, offset, 1, &offset ) );
-				listP[i*2 + 1].sampleSize = theSize >> 4;
-				listP[i*2 + 2].sampleSize = theSize & 0x0F;
-			}
-			break;
-		case 8:
-			for (i=1; i<=entryCount; i++) {
-				UInt8 theSize;
-				BAILIFERR( GetFileData( aoe, &theSize, offset, 1, &offset ) );
-				listP[i].sampleSize = theSize;
-			}
-			break;
-		case 16:
-			for (i=1; i<=entryCount; i++) {
-				UInt16 theSize;
-				BAILIFERR( GetFileDataN16( aoe, &theSize, offset, &offset ) );
-				listP[i].sampleSize = theSize;
-			}
-			break;
+		case 4:		tableSize = (entryCount + 1) / 2;	break;
+		case 8:		tableSize = entryCount;				break;
+		case 16:	tableSize = entryCount * 2;			break;
 		default: errprint("You can't have a field size of %d in stz2\n", fieldSize);
 	}
+	if (tableSize && !(viewP = GetMappedTable( offset, tableSize ))) {
+			// 1 based array + room for one over for the 4-bit case loop
+		BAILIFNIL( listP = calloc(1, listSize + sizeof(SampleSizeRecord) + sizeof(SampleSizeRecord)), allocFailedErr );
+
+		// read the whole packed table in one go and widen it in memory
+		BAILIFNIL( tableP = malloc(tableSize), allocFailedErr );
+		BAILIFERR( GetFileData( aoe, tableP, offset, tableSize, &offset ) );
+		switch (fieldSize) {
+			case 4:		UnpackSampleSizes4( tableP, &listP[1].sampleSize, entryCount );	break;
+			case 8:		UnpackSampleSizes8( tableP, &listP[1].sampleSize, entryCount );	break;
+			case 16:	UnpackSampleSizes16( tableP, &listP[1].sampleSize, entryCount );	break;
+		}
+	}
+	tir->sampleSizeEntryCnt = entryCount;
+	tir->singleSampleSize = 0;
+	BAILIFERR( SetSampleSizeTable( tir, listP, entryCount ) );
+	tir->sampleSizeView = viewP;
+	tir->sampleSizeViewBits = fieldSize;
 	
 	// Print atom contents non-required fields
 	atomprintnotab("\tversion=\"%d\" flags=\"%d\"\n", version, flags);
@@ -1198,10 +1220,11 @@ OSErr Validate_stz2_Atom( atomOffsetEntry *aoe, void *refcon )
 	atomprint("/>\n");
 	if (entryCount) {
 		vg.tabcnt++;
-		listP[0].sampleSize = 0;
 		for ( i = 1; i <= entryCount; i++ ) {
-			atomprintdetailed("<stz2Entry sampleSize=\"%d\" />\n", listP[i].sampleSize);
-			if (listP[i].sampleSize == 0) {
+			UInt32 entrySize = GetSampleSize( tir, i );
+			
+			atomprintdetailed("<stz2Entry sampleSize=\"%d\" />\n", entrySize);
+			if (entrySize == 0) {
 				errprint("You can't have a zero sample size in stz2\n");
 			}
 		}
@@ -1213,11 +1236,9 @@ OSErr Validate_stz2_Atom( atomOffsetEntry *aoe, void *refcon )
 
 	// All done
 	aoe->aoeflags |= kAtomValidated;
-	tir->sampleSizeEntryCnt = entryCount;
-	tir->singleSampleSize = 0;
-	tir->sampleSize = listP;
 	
 bail:
+	if (tableP) free(tableP);
 	return err;
 }
 
@@ -1231,10 +1252,11 @@ OSErr Validate_stsc_Atom( atomOffsetEntry *aoe, void *refcon )
 	UInt32 flags;
 	UInt64 offset;
 	UInt32 entryCount;
-	SampleToChunk *listP;
+	SampleToChunk *listP = nil;
 	UInt32 listSize;
 	UInt32 i;
 	UInt32 sampleToChunkSampleSubTotal = 0;		// total accounted for all but last entry
+	SampleToChunk entry, prevEntry;
 	
 	// Get version/flags
 	BAILIFERR( GetFullAtomVersionFlags( aoe, &version, &flags, &offset ) );
@@ -1242,18 +1264,23 @@ OSErr Validate_stsc_Atom( atomOffsetEntry *aoe, void *refcon )
 	// Get data 
 	BAILIFERR( GetFileDataN32( aoe, &entryCount, offset, &offset ) );
 	listSize = entryCount * sizeof(SampleToChunk);
-			// 1 based array
-	BAILIFNIL( listP = malloc(listSize + sizeof(SampleToChunk)), allocFailedErr );
-	BAILIFERR( GetFileData( aoe, &listP[1], offset, listSize, &offset ) );
-	for ( i = 1; i <= entryCount; i++ ) {
-		listP[i].firstChunk = EndianU32_BtoN(listP[i].firstChunk);
-		listP[i].samplesPerChunk = EndianU32_BtoN(listP[i].samplesPerChunk);
-		listP[i].sampleDescriptionIndex = EndianU32_BtoN(listP[i].sampleDescriptionIndex);
-		if (i > 1) {
-			sampleToChunkSampleSubTotal += 
-				( listP[i].firstChunk - listP[i-1].firstChunk )
-					* ( listP[i-1].samplesPerChunk );
-		}
+	if (!(tir->sampleToChunkView = GetMappedTable( offset, listSize ))) {
+				// 1 based array
+		BAILIFNIL( listP = malloc(listSize + sizeof(SampleToChunk)), allocFailedErr );
+		BAILIFERR( GetFileData( aoe, &listP[1], offset, listSize, &offset ) );
+		SwapBigEndian32( &listP[1].firstChunk, entryCount * 3 );
+		listP[0].firstChunk = listP[0].samplesPerChunk = listP[0].sampleDescriptionIndex = 0;
+	}
+	tir->sampleToChunk = listP;
+	tir->sampleToChunkEntryCnt = entryCount;
+	
+	GetSampleToChunk( tir, 1, &prevEntry );
+	for ( i = 2; i <= entryCount; i++ ) {
+		GetSampleToChunk( tir, i, &entry );
+		sampleToChunkSampleSubTotal += 
+			( entry.firstChunk - prevEntry.firstChunk )
+				* ( prevEntry.samplesPerChunk );
+		prevEntry = entry;
 	}
 
 	// Print atom contents non-required fields
@@ -1261,10 +1288,10 @@ OSErr Validate_stsc_Atom( atomOffsetEntry *aoe, void *refcon )
 	atomprint("entryCount=\"%ld\"\n", entryCount);
 	atomprint("/>\n");
 	vg.tabcnt++;
-	listP[0].firstChunk = listP[0].samplesPerChunk = listP[0].sampleDescriptionIndex = 0;
 	for ( i = 1; i <= entryCount; i++ ) {
+		GetSampleToChunk( tir, i, &entry );
 		atomprintdetailed("<stscEntry firstChunk=\"%d\" samplesPerChunk=\"%d\" sampleDescriptionIndex=\"%d\" />\n", 
-			listP[i].firstChunk, listP[i].samplesPerChunk, listP[i].sampleDescriptionIndex);
+			entry.firstChunk, entry.samplesPerChunk, entry.sampleDescriptionIndex);
 		
 	}
 	--vg.tabcnt;
@@ -1275,8 +1302,6 @@ OSErr Validate_stsc_Atom( atomOffsetEntry *aoe, void *refcon )
 	// All done
 	aoe->aoeflags |= kAtomValidated;
 	
-	tir->sampleToChunkEntryCnt = entryCount;
-	tir->sampleToChunk = listP;
 	tir->sampleToChunkSampleSubTotal = sampleToChunkSampleSubTotal;		// total accounted for all but last entry
 	
 bail:
@@ -1293,8 +1318,9 @@ OSErr Validate_stco_Atom( atomOffsetEntry *aoe, void *refcon )
 	UInt32 flags;
 	UInt64 offset;
 	UInt32 entryCount;
-	ChunkOffsetRecord *listP;
-	ChunkOffset64Record *list64P;
+	ChunkOffsetRecord *listP = nil;
+	ChunkOffset64Record *list64P = nil;
+	const UInt8 *viewP;
 	UInt32 listSize;
 	UInt32 i;
 
@@ -1305,14 +1331,20 @@ OSErr Validate_stco_Atom( atomOffsetEntry *aoe, void *refcon )
 	// Get data 
 	BAILIFERR( GetFileDataN32( aoe, &entryCount, offset, &offset ) );
 	listSize = entryCount * sizeof(ChunkOffsetRecord);
-			// 1 based array
-	BAILIFNIL( listP = malloc(listSize + sizeof(ChunkOffsetRecord)), allocFailedErr );
-			// 1 based array
-	BAILIFNIL( list64P = malloc((entryCount + 1) * sizeof(ChunkOffset64Record)), allocFailedErr );
-	BAILIFERR( GetFileData( aoe, &listP[1], offset, listSize, &offset ) );
-	for ( i = 1; i <= entryCount; i++ ) {
-		listP[i].chunkOffset = EndianU32_BtoN(listP[i].chunkOffset);
+	if (!(viewP = GetMappedTable( offset, listSize ))) {
+				// 1 based array
+		BAILIFNIL( listP = malloc(listSize + sizeof(ChunkOffsetRecord)), allocFailedErr );
+				// 1 based array
+		BAILIFNIL( list64P = malloc((entryCount + 1) * sizeof(ChunkOffset64Record)), allocFailedErr );
+		BAILIFERR( GetFileData( aoe, &listP[1], offset, listSize, &offset ) );
+		WidenBigEndian32To64( &listP[1].chunkOffset, &list64P[1].chunkOffset, entryCount );
+		list64P[0].chunkOffset = 0;
+		free(listP);
 	}
+	tir->chunkOffsetEntryCnt = entryCount;
+	BAILIFERR( SetChunkOffsetTable( tir, list64P, entryCount ) );
+	tir->chunkOffsetView = viewP;
+	tir->chunkOffsetViewBits = 32;
 
 	
 	// Print atom contents non-required fields
@@ -1324,13 +1356,13 @@ OSErr Validate_stco_Atom( atomOffsetEntry *aoe, void *refcon )
 
 	atomprint("/>\n");
 	vg.tabcnt++;
-	list64P[0].chunkOffset = listP[0].chunkOffset = 0;
 	for ( i = 1; i <= entryCount; i++ ) {
-		atomprintdetailed("<stcoEntry chunkOffset=\"%ld\" />\n", listP[i].chunkOffset);
-		if (listP[i].chunkOffset == 0) {
+		UInt64 chunkOffset = GetChunkOffset( tir, i );
+		
+		atomprintdetailed("<stcoEntry chunkOffset=\"%ld\" />\n", (UInt32)chunkOffset);
+		if (chunkOffset == 0) {
 			errprint("You can't have a zero sample size in stco\n");
 		}
-		list64P[i].chunkOffset = listP[i].chunkOffset;
 	}
 	--vg.tabcnt;
 
@@ -1339,9 +1371,6 @@ OSErr Validate_stco_Atom( atomOffsetEntry *aoe, void *refcon )
 
 	// All done
 	aoe->aoeflags |= kAtomValidated;
-	tir->chunkOffsetEntryCnt = entryCount;
-	tir->chunkOffset = list64P;
-	free(listP);
 	
 bail:
 	return err;
@@ -1357,7 +1386,8 @@ OSErr Validate_co64_Atom( atomOffsetEntry *aoe, void *refcon )
 	UInt32 flags;
 	UInt64 offset;
 	UInt32 entryCount;
-	ChunkOffset64Record *listP;
+	ChunkOffset64Record *listP = nil;
+	const UInt8 *viewP;
 	UInt32 listSize;
 	UInt32 i;
 	
@@ -1367,22 +1397,28 @@ OSErr Validate_co64_Atom( atomOffsetEntry *aoe, void *refcon )
 	// Get data 
 	BAILIFERR( GetFileDataN32( aoe, &entryCount, offset, &offset ) );
 	listSize = entryCount * sizeof(ChunkOffset64Record);
-		// 1 based table
-	BAILIFNIL( listP = malloc(listSize + sizeof(ChunkOffset64Record)), allocFailedErr );
-	BAILIFERR( GetFileData( aoe, &listP[1], offset, listSize, &offset ) );
-	for ( i = 1; i <= entryCount; i++ ) {
-		listP[i].chunkOffset = EndianU64_BtoN(listP[i].chunkOffset);
+	if (!(viewP = GetMappedTable( offset, listSize ))) {
+			// 1 based table
+		BAILIFNIL( listP = malloc(listSize + sizeof(ChunkOffset64Record)), allocFailedErr );
+		BAILIFERR( GetFileData( aoe, &listP[1], offset, listSize, &offset ) );
+		SwapBigEndian64( &listP[1].chunkOffset, entryCount );
+		listP[0].chunkOffset = 0;
 	}
+	tir->chunkOffsetEntryCnt = entryCount;
+	BAILIFERR( SetChunkOffsetTable( tir, listP, entryCount ) );
+	tir->chunkOffsetView = viewP;
+	tir->chunkOffsetViewBits = 64;
 	
 	// Print atom contents non-required fields
 	atomprintnotab("\tversion=\"%d\" flags=\"%d\"\n", version, flags);
 	atomprint("entryCount=\"%ld\"\n", entryCount);
 	atomprint("/>\n");
 	vg.tabcnt++;
-	listP[0].chunkOffset = 0;
 	for ( i = 1; i <= entryCount; i++ ) {
-		atomprintdetailed("<stcoEntry chunkOffset=\"%s\" />\n", int64todstr(listP[i].chunkOffset));
-		if (listP[i].chunkOffset == 0) {
+		UInt64 chunkOffset = GetChunkOffset( tir, i );
+		
+		atomprintdetailed("<stcoEntry chunkOffset=\"%s\" />\n", int64todstr(chunkOffset));
+		if (chunkOffset == 0) {
 			errprint("You can't have a zero sample size in stsz\n");
 		}
 	}
@@ -1393,8 +1429,6 @@ OSErr Validate_co64_Atom( atomOffsetEntry *aoe, void *refcon )
 
 	// All done
 	aoe->aoeflags |= kAtomValidated;
-	tir->chunkOffsetEntryCnt = entryCount;
-	tir->chunkOffset = listP;
 	
 bail:
 	return err;
@@ -1409,15 +1443,16 @@ typedef struct SyncSampleRecord {
 
 OSErr Validate_stss_Atom( atomOffsetEntry *aoe, void *refcon )
 {
-#pragma unused(refcon)
+	TrackInfoRec *tir = (TrackInfoRec *)refcon;
 	OSErr err = noErr;
 	UInt32 version;
 	UInt32 flags;
 	UInt64 offset;
 	UInt32 entryCount;
-	SyncSampleRecord *listP;
+	SyncSampleRecord *listP = nil;
 	UInt32 listSize;
 	UInt32 i;
+	Boolean ordered = true;
 	
 	// Get version/flags
 	BAILIFERR( GetFullAtomVersionFlags( aoe, &version, &flags, &offset ) );
@@ -1425,11 +1460,9 @@ OSErr Validate_stss_Atom( atomOffsetEntry *aoe, void *refcon )
 	// Get data 
 	BAILIFERR( GetFileDataN32( aoe, &entryCount, offset, &offset ) );
 	listSize = entryCount * sizeof(SyncSampleRecord);
-	BAILIFNIL( listP = malloc(listSize), allocFailedErr );
+	BAILIFNIL( listP = malloc(listSize + sizeof(SyncSampleRecord)), allocFailedErr );
 	BAILIFERR( GetFileData( aoe, listP, offset, listSize, &offset ) );
-	for ( i = 0; i < entryCount; i++ ) {
-		listP[i].sampleNum = EndianU32_BtoN(listP[i].sampleNum);
-	}
+	SwapBigEndian32( &listP[0].sampleNum, entryCount );
 	
 	// Print atom contents non-required fields
 	atomprintnotab("\tversion=\"%d\" flags=\"%d\"\n", version, flags);
@@ -1441,16 +1474,26 @@ OSErr Validate_stss_Atom( atomOffsetEntry *aoe, void *refcon )
 		if (listP[i].sampleNum == 0) {
 			errprint("You can't have a zero sample number in stss\n");
 		}
+		if ((i > 0) && (listP[i].sampleNum <= listP[i-1].sampleNum)) {
+			ordered = false;
+		}
 	}
 	--vg.tabcnt;
 
 	// Check required field values
 	FieldMustBe( flags, 0, "'stss' flags must be %d not 0x%lx" );
+	if (!ordered) {
+		errprint("Sync sample table ('stss') entries must be in strictly increasing order\n");
+	}
+
+	BAILIFERR( SetSyncSampleTable( tir, &listP[0].sampleNum, entryCount ) );
+	listP = nil;
 
 	// All done
 	aoe->aoeflags |= kAtomValidated;
 
 bail:
+	if (listP) free( listP );
 	return err;
 }
 
@@ -1481,10 +1524,7 @@ OSErr Validate_stsh_Atom( atomOffsetEntry *aoe, void *refcon )
 	listSize = entryCount * sizeof(ShadowSyncEntry);
 	BAILIFNIL( listP = malloc(listSize), allocFailedErr );
 	BAILIFERR( GetFileData( aoe, listP, offset, listSize, &offset ) );
-	for ( i = 0; i < entryCount; i++ ) {
-		listP[i].shadowSyncNumber = EndianU32_BtoN(listP[i].shadowSyncNumber);
-		listP[i].syncSampleNumber = EndianU32_BtoN(listP[i].syncSampleNumber);
-	}
+	SwapBigEndian32( &listP[0].shadowSyncNumber, entryCount * 2 );
 	
 	// Print atom contents non-required fields
 	atomprintnotab("\tversion=\"%d\" flags=\"%d\"\n", version, flags);
@@ -1911,6 +1951,7 @@ OSErr Validate_tref_sync_Atom( atomOffsetEntry *aoe, void *refcon )
 OSErr Validate_stsd_Atom( atomOffsetEntry *aoe, void *refcon )
 {
 	TrackInfoRec *tir = (TrackInfoRec *)refcon;
+	atomOffsetEntry *list = nil;
 	OSErr err = noErr;
 	UInt32 version;
 	UInt32 flags;
@@ -1943,7 +1984,6 @@ OSErr Validate_stsd_Atom( atomOffsetEntry *aoe, void *refcon )
 		UInt64 minOffset, maxOffset;
 		atomOffsetEntry *entry;
 		long cnt;
-		atomOffsetEntry *list;
 		int i;
 		
 		minOffset = offset;
@@ -2007,6 +2047,7 @@ OSErr Validate_stsd_Atom( atomOffsetEntry *aoe, void *refcon )
 	// All done
 	aoe->aoeflags |= kAtomValidated;
 bail:
+	if (list) free( list );
 	return err;
 
 
@@ -2018,6 +2059,7 @@ bail:
 OSErr Validate_vide_SD_Entry( atomOffsetEntry *aoe, void *refcon )
 {
 	TrackInfoRec *tir = (TrackInfoRec *)refcon;
+	atomOffsetEntry *list = nil;
 	OSErr err = noErr;
 	UInt64 offset;
 	SampleDescriptionHead sdh;
@@ -2107,7 +2149,6 @@ OSErr Validate_vide_SD_Entry( atomOffsetEntry *aoe, void *refcon )
 			UInt64 minOffset, maxOffset;
 			atomOffsetEntry *entry;
 			long cnt;
-			atomOffsetEntry *list;
 			int i;
 			int is_protected = 0;
 			
@@ -2187,6 +2228,7 @@ OSErr Validate_vide_SD_Entry( atomOffsetEntry *aoe, void *refcon )
 	aoe->aoeflags |= kAtomValidated;
 
 bail:
+	if (list) free( list );
 	return err;
 }
 
@@ -2206,6 +2248,7 @@ typedef struct SoundSampleDescriptionInfo {
 OSErr Validate_soun_SD_Entry( atomOffsetEntry *aoe, void *refcon )
 {
 	TrackInfoRec *tir = (TrackInfoRec *)refcon;
+	atomOffsetEntry *list = nil;
 	OSErr err = noErr;
 	Boolean fileTypeKnown = false;
 	UInt64 offset;
@@ -2272,7 +2315,6 @@ OSErr Validate_soun_SD_Entry( atomOffsetEntry *aoe, void *refcon )
 		UInt64 maxOffset;
 		atomOffsetEntry *entry;
 		long cnt;
-		atomOffsetEntry *list;
 		int i;
 		
 		minOffset = offset;
@@ -2309,6 +2351,7 @@ OSErr Validate_soun_SD_Entry( atomOffsetEntry *aoe, void *refcon )
 	aoe->aoeflags |= kAtomValidated;
 
 bail:
+	if (list) free( list );
 	return err;
 }
 
@@ -2353,6 +2396,7 @@ bail:
 OSErr Validate_mp4_SD_Entry( atomOffsetEntry *aoe, void *refcon, ValidateBitstreamProcPtr validateBitstreamProc, char *esname )
 {
 	TrackInfoRec *tir = (TrackInfoRec *)refcon;
+	atomOffsetEntry *list = nil;
 	OSErr err = noErr;
 	UInt64 offset;
 	SampleDescriptionHead sdh;
@@ -2380,7 +2424,6 @@ OSErr Validate_mp4_SD_Entry( atomOffsetEntry *aoe, void *refcon, ValidateBitstre
 		UInt64 minOffset, maxOffset;
 		atomOffsetEntry *entry;
 		long cnt;
-		atomOffsetEntry *list;
 		int i;
 		
 		minOffset = offset;
@@ -2408,6 +2451,7 @@ OSErr Validate_mp4_SD_Entry( atomOffsetEntry *aoe, void *refcon, ValidateBitstre
 	aoe->aoeflags |= kAtomValidated;
 
 bail:
+	if (list) free( list );
 	return err;
 }
 
@@ -2911,6 +2955,7 @@ OSErr Validate_schm_Atom( atomOffsetEntry *aoe, void *refcon )
 	aoe->aoeflags |= kAtomValidated;
 	
 bail:
+	if (locationP) free( locationP );
 	return err;
 }
 
@@ -2918,7 +2963,7 @@ OSErr Validate_schi_Atom( atomOffsetEntry *aoe, void *refcon )
 {
 	OSErr err = noErr;
 	long cnt;
-	atomOffsetEntry *list;
+	atomOffsetEntry *list = nil;
 	long i;
 	OSErr atomerr = noErr;
 	atomOffsetEntry *entry;
@@ -2951,6 +2996,7 @@ OSErr Validate_schi_Atom( atomOffsetEntry *aoe, void *refcon )
 	aoe->aoeflags |= kAtomValidated;
 	
 bail:
+	if (list) free( list );
 	return err;
 }
 
@@ -2987,6 +3033,7 @@ OSErr Validate_xml_Atom( atomOffsetEntry *aoe, void *refcon )
 	aoe->aoeflags |= kAtomValidated;
 	
 bail:
+	if (xmlP) free( xmlP );
 	return err;
 }
 
@@ -3132,6 +3179,7 @@ bail:
 OSErr Validate_ipro_Atom( atomOffsetEntry *aoe, void *refcon )
 {
 #pragma unused(refcon)
+	atomOffsetEntry *list = nil;
 	OSErr err = noErr;
 	UInt64 offset;
 	AtomSizeType ahdr;
@@ -3157,7 +3205,6 @@ OSErr Validate_ipro_Atom( atomOffsetEntry *aoe, void *refcon )
 		UInt64 maxOffset;
 		atomOffsetEntry *entry;
 		long cnt;
-		atomOffsetEntry *list;
 		int i;
 		
 		minOffset = offset;
@@ -3189,6 +3236,7 @@ OSErr Validate_ipro_Atom( atomOffsetEntry *aoe, void *refcon )
 	aoe->aoeflags |= kAtomValidated;
 	
 bail:
+	if (list) free( list );
 	return err;
 }
 
@@ -3232,12 +3280,16 @@ OSErr Validate_infe_Atom( atomOffsetEntry *aoe, void *refcon )
 	aoe->aoeflags |= kAtomValidated;
 	
 bail:
+	if (nameP) free( nameP );
+	if (typeP) free( typeP );
+	if (encodP) free( encodP );
 	return err;
 }
 
 OSErr Validate_iinf_Atom( atomOffsetEntry *aoe, void *refcon )
 {
 #pragma unused(refcon)
+	atomOffsetEntry *list = nil;
 	OSErr err = noErr;
 	UInt64 offset;
 	AtomSizeType ahdr;
@@ -3263,7 +3315,6 @@ OSErr Validate_iinf_Atom( atomOffsetEntry *aoe, void *refcon )
 		UInt64 maxOffset;
 		atomOffsetEntry *entry;
 		long cnt;
-		atomOffsetEntry *list;
 		int i;
 		
 		minOffset = offset;
@@ -3295,6 +3346,7 @@ OSErr Validate_iinf_Atom( atomOffsetEntry *aoe, void *refcon )
 	aoe->aoeflags |= kAtomValidated;
 	
 bail:
+	if (list) free( list );
 	return err;
 }
 
@@ -0,0 +1,696 @@
+/*
+
+This file contains Original Code and/or Modifications of Original Code
+as defined in and that are subject to the Apple Public Source License
+Version 2.0 (the 'License'). You may not use this file except in
+compliance with the License. Please obtain a copy of the License at
+http://www.opensource.apple.com/apsl/ and read it before using this
+file.
+
+The Original Code and all software distributed under the License are
+distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+Please see the License for the specific language governing rights and
+limitations under the License.
+
+*/
+
+// Microbenchmarks for the parsing primitives that dominate profiles.
+//   Built by "make bench" and linked against the validator objects (without main).
+//   All input data comes from a fixed-seed generator so runs are comparable.
+
+#include "ValidateMP4.h"
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define kBenchDefaultSeed	0x4D503456		// 'MP4V'
+#define kBenchBufferSize	(64*1024)
+
+typedef void (*BenchProcPtr)( UInt32 iterations );
+
+typedef struct BenchCase {
+	const char		*name;
+	BenchProcPtr	proc;
+	UInt32			iterations;		// default iteration count, scaled by -scale
+} BenchCase;
+
+static UInt32 gSeed = kBenchDefaultSeed;
+static UInt32 gRandState;
+static volatile UInt32 gSink;		// results go here so the timed loops can't be optimized away
+static struct timespec gStartTime;
+
+//==========================================================================================
+
+static void BenchSeed( UInt32 salt )
+{
+	// every benchmark reseeds, so its input does not depend on which others ran first
+	gRandState = gSeed ^ (salt * 0x9E3779B9);
+	if (gRandState == 0) gRandState = 1;
+}
+
+static UInt32 BenchRandom( void )
+{
+	// xorshift32
+	gRandState ^= gRandState << 13;
+	gRandState ^= gRandState >> 17;
+	gRandState ^= gRandState << 5;
+	return gRandState;
+}
+
+static void BenchFillRandom( UInt8 *p, UInt32 size )
+{
+	while (size--) *p++ = (UInt8)BenchRandom();
+}
+
+static void BenchStart( void )
+{
+	clock_gettime( CLOCK_MONOTONIC, &gStartTime );
+}
+
+static void BenchStop( const char *name, UInt64 ops )
+{
+	struct timespec stopTime;
+	double ns;
+
+	clock_gettime( CLOCK_MONOTONIC, &stopTime );
+	ns = (double)(stopTime.tv_sec - gStartTime.tv_sec) * 1e9 + (double)(stopTime.tv_nsec - gStartTime.tv_nsec);
+
+	fprintf( stdout, "%-36s %12llu ops %12.2f ns/op\n", name, (unsigned long long)ops, ops ? ns / ops : 0.0 );
+	fflush( stdout );
+}
+
+// the hex dump printers write to stdout; send it to /dev/null while they run
+static int BenchMuteStdout( void )
+{
+	int savedfd;
+	int nullfd;
+
+	fflush( stdout );
+	savedfd = dup( fileno(stdout) );
+	nullfd = open( "/dev/null", O_WRONLY );
+	if (nullfd >= 0) {
+		dup2( nullfd, fileno(stdout) );
+		close( nullfd );
+	}
+	return savedfd;
+}
+
+static void BenchRestoreStdout( int savedfd )
+{
+	fflush( stdout );
+	if (savedfd >= 0) {
+		dup2( savedfd, fileno(stdout) );
+		close( savedfd );
+	}
+}
+
+//==========================================================================================
+// simple MSB-first bit writer, used to build exp-Golomb streams
+
+typedef struct BenchBitWriter {
+	UInt8	*ptr;
+	UInt32	size;
+	UInt32	bitpos;
+} BenchBitWriter;
+
+static Boolean BenchPutBits( BenchBitWriter *bw, UInt32 value, UInt32 nBits )
+{
+	while (nBits--) {
+		UInt32 bytepos = bw->bitpos >> 3;
+		if (bytepos >= bw->size) return false;
+		if ((value >> nBits) & 1)
+			bw->ptr[bytepos] |= (0x80 >> (bw->bitpos & 7));
+		bw->bitpos++;
+	}
+	return true;
+}
+
+static Boolean BenchPutGolomb( BenchBitWriter *bw, UInt32 value )
+{
+	UInt32 codeNum = value + 1;
+	UInt32 nbits = 0;
+
+	while ((codeNum >> nbits) > 1) nbits++;
+	return BenchPutBits( bw, 0, nbits ) && BenchPutBits( bw, codeNum, nbits + 1 );
+}
+
+//==========================================================================================
+
+static void Bench_GetBits( UInt32 iterations )
+{
+	UInt8 *buf;
+	UInt8 widths[256];
+	UInt32 i, w;
+	UInt64 ops = 0;
+	UInt32 sum = 0;
+	OSErr err;
+	BitBuffer bb;
+
+	BenchSeed( 1 );
+	buf = calloc( kBenchBufferSize + bitParsingSlop, 1 );
+	BenchFillRandom( buf, kBenchBufferSize );
+	for (i = 0; i < 256; i++) widths[i] = 1 + (BenchRandom() % 32);
+
+	BenchStart();
+	for (i = 0; i < iterations; i++) {
+		BitBuffer_Init( &bb, buf, kBenchBufferSize );
+		w = 0;
+		while (bb.bits_left >= 32) {
+			sum += GetBits( &bb, widths[w++ & 0xff], &err );
+			ops++;
+		}
+	}
+	BenchStop( "GetBits (1..32 bits)", ops );
+	gSink = sum;
+	free( buf );
+}
+
+static void Bench_PeekBits( UInt32 iterations )
+{
+	UInt8 *buf;
+	UInt8 widths[256];
+	UInt32 i, w;
+	UInt64 ops = 0;
+	UInt32 sum = 0;
+	OSErr err;
+	BitBuffer bb;
+
+	BenchSeed( 2 );
+	buf = calloc( kBenchBufferSize + bitParsingSlop, 1 );
+	BenchFillRandom( buf, kBenchBufferSize );
+	for (i = 0; i < 256; i++) widths[i] = 1 + (BenchRandom() % 32);
+
+	BenchStart();
+	for (i = 0; i < iterations; i++) {
+		BitBuffer_Init( &bb, buf, kBenchBufferSize );
+		w = 0;
+		while (bb.bits_left >= 40) {
+			// peek, then step a byte so successive peeks see fresh data
+			sum += PeekBits( &bb, widths[w++ & 0xff], &err );
+			GetBits( &bb, 8, &err );
+			ops++;
+		}
+	}
+	BenchStop( "PeekBits (1..32 bits) + GetBits(8)", ops );
+	gSink = sum;
+	free( buf );
+}
+
+static UInt8 *BenchMakeGolombStream( UInt32 salt, UInt32 *countOut, UInt32 *sizeOut )
+{
+	BenchBitWriter bw;
+	UInt32 count = 0;
+	UInt32 value;
+
+	BenchSeed( salt );
+	bw.size = kBenchBufferSize;
+	bw.ptr = calloc( bw.size + bitParsingSlop, 1 );
+	bw.bitpos = 0;
+
+	// mostly small values, like slice header fields, with an occasional large one
+	for (;;) {
+		value = BenchRandom();
+		if (value & 0x100) value &= 0x0f; else value &= 0xfff;
+		if (!BenchPutGolomb( &bw, value )) break;
+		count++;
+	}
+	*countOut = count - 1;		// the last one may be truncated
+	*sizeOut = bw.size;
+	return bw.ptr;
+}
+
+static void Bench_read_golomb_uev( UInt32 iterations )
+{
+	UInt8 *buf;
+	UInt32 count, size, i, j;
+	UInt32 sum = 0;
+	OSErr err;
+	BitBuffer bb;
+
+	buf = BenchMakeGolombStream( 3, &count, &size );
+
+	BenchStart();
+	for (i = 0; i < iterations; i++) {
+		BitBuffer_Init( &bb, buf, size );
+		for (j = 0; j < count; j++) {
+			sum += read_golomb_uev( &bb, &err );
+		}
+	}
+	BenchStop( "read_golomb_uev", (UInt64)iterations * count );
+	gSink = sum;
+	free( buf );
+}
+
+static void Bench_read_golomb_sev( UInt32 iterations )
+{
+	UInt8 *buf;
+	UInt32 count, size, i, j;
+	SInt32 sum = 0;
+	OSErr err;
+	BitBuffer bb;
+
+	buf = BenchMakeGolombStream( 4, &count, &size );
+
+	BenchStart();
+	for (i = 0; i < iterations; i++) {
+		BitBuffer_Init( &bb, buf, size );
+		for (j = 0; j < count; j++) {
+			sum += read_golomb_sev( &bb, &err );
+		}
+	}
+	BenchStop( "read_golomb_sev", (UInt64)iterations * count );
+	gSink = sum;
+	free( buf );
+}
+
+static void Bench_strip_trailing_zero_bits( UInt32 iterations )
+{
+	enum { kPayloadSize = 1500, kTrailingZeroBytes = 16 };
+	UInt8 *buf;
+	UInt32 i;
+	UInt32 sum = 0;
+	OSErr err;
+	BitBuffer bb;
+
+	BenchSeed( 5 );
+	buf = calloc( kPayloadSize + kTrailingZeroBytes + bitParsingSlop, 1 );
+	BenchFillRandom( buf, kPayloadSize );
+	buf[kPayloadSize - 1] = 0x80;	// rbsp stop bit followed by 7 + 8*kTrailingZeroBytes zero bits
+
+	BenchStart();
+	for (i = 0; i < iterations; i++) {
+		BitBuffer_Init( &bb, buf, kPayloadSize + kTrailingZeroBytes );
+		sum += strip_trailing_zero_bits( &bb, &err );
+	}
+	BenchStop( "strip_trailing_zero_bits (135 bits)", iterations );
+	gSink = sum;
+	free( buf );
+}
+
+//==========================================================================================
+// synthetic sample tables shaped like a long interleaved audio track
+
+enum {
+	kBenchTrackSamples = 200000,
+	kBenchTrackSTSCEntries = 64
+};
+
+static void BenchMakeTrack( TrackInfoRec *tir )
+{
+	UInt32 i, chunk, sample;
+	UInt64 offset;
+
+	memset( tir, 0, sizeof(*tir) );
+	tir->sampleSizeEntryCnt = kBenchTrackSamples;
+	tir->sampleSize = calloc( kBenchTrackSamples + 1, sizeof(SampleSizeRecord) );
+	for (i = 1; i <= kBenchTrackSamples; i++)
+		tir->sampleSize[i].sampleSize = 200 + (BenchRandom() % 400);
+
+	// a varying number of samples per chunk, so the stsc walk has real work to do
+	tir->sampleToChunkEntryCnt = kBenchTrackSTSCEntries;
+	tir->sampleToChunk = calloc( kBenchTrackSTSCEntries + 2, sizeof(SampleToChunk) );
+	chunk = 1;
+	sample = 0;
+	for (i = 1; i <= kBenchTrackSTSCEntries; i++) {
+		UInt32 perChunk = 5 + (BenchRandom() % 40);
+		UInt32 chunks = (i < kBenchTrackSTSCEntries) ? 50 : 0;
+
+		tir->sampleToChunk[i].firstChunk = chunk;
+		tir->sampleToChunk[i].samplesPerChunk = perChunk;
+		tir->sampleToChunk[i].sampleDescriptionIndex = 1;
+		if (i == kBenchTrackSTSCEntries) {
+			// last entry runs to the end of the track; make it divide evenly
+			tir->sampleToChunk[i].samplesPerChunk = perChunk = 10;
+			chunks = (kBenchTrackSamples - sample) / perChunk;
+		}
+		chunk += chunks;
+		sample += chunks * perChunk;
+	}
+	tir->sampleSizeEntryCnt = sample;
+
+	tir->chunkOffsetEntryCnt = chunk - 1;
+	tir->chunkOffset = calloc( chunk + 1, sizeof(ChunkOffset64Record) );
+	offset = 4096;
+	sample = 1;
+	for (i = 1; i < chunk; i++) {
+		UInt32 k, n, stsc;
+
+		for (stsc = kBenchTrackSTSCEntries; tir->sampleToChunk[stsc].firstChunk > i; stsc--) ;
+		n = tir->sampleToChunk[stsc].samplesPerChunk;
+		tir->chunkOffset[i].chunkOffset = offset;
+		for (k = 0; k < n; k++) offset += tir->sampleSize[sample++].sampleSize;
+		offset += 1000;		// interleaved data from another track
+	}
+}
+
+static void BenchDisposeTrack( TrackInfoRec *tir )
+{
+	free( tir->sampleSize );
+	free( tir->sampleToChunk );
+	free( tir->chunkOffset );
+}
+
+static void Bench_GetSampleOffsetSize( UInt32 iterations )
+{
+	TrackInfoRec tir;
+	UInt32 *queries;
+	UInt32 i;
+	UInt64 offset, sum = 0;
+	UInt32 size, sdi;
+
+	BenchSeed( 6 );
+	BenchMakeTrack( &tir );
+	queries = malloc( iterations * sizeof(UInt32) );
+	for (i = 0; i < iterations; i++) queries[i] = 1 + (BenchRandom() % tir.sampleSizeEntryCnt);
+
+	BenchStart();
+	for (i = 0; i < iterations; i++) {
+		GetSampleOffsetSize( &tir, queries[i], &offset, &size, &sdi );
+		sum += offset + size;
+	}
+	BenchStop( "GetSampleOffsetSize (random)", iterations );
+
+	BenchStart();
+	for (i = 0; i < iterations; i++) {
+		GetSampleOffsetSize( &tir, 1 + (i % tir.sampleSizeEntryCnt), &offset, &size, &sdi );
+		sum += offset + size;
+	}
+	BenchStop( "GetSampleOffsetSize (sequential)", iterations );
+
+	gSink = (UInt32)sum;
+	free( queries );
+	BenchDisposeTrack( &tir );
+}
+
+static void Bench_GetChunkOffsetSize( UInt32 iterations )
+{
+	TrackInfoRec tir;
+	UInt32 *queries;
+	UInt32 i;
+	UInt64 offset, sum = 0;
+	UInt32 size, sdi;
+
+	BenchSeed( 7 );
+	BenchMakeTrack( &tir );
+	queries = malloc( iterations * sizeof(UInt32) );
+	for (i = 0; i < iterations; i++) queries[i] = 1 + (BenchRandom() % tir.chunkOffsetEntryCnt);
+
+	BenchStart();
+	for (i = 0; i < iterations; i++) {
+		GetChunkOffsetSize( &tir, queries[i], &offset, &size, &sdi );
+		sum += offset + size;
+	}
+	BenchStop( "GetChunkOffsetSize (random)", iterations );
+
+	gSink = (UInt32)sum;
+	free( queries );
+	BenchDisposeTrack( &tir );
+}
+
+//==========================================================================================
+
+static void Bench_UnpackSampleSizes( UInt32 iterations )
+{
+	enum { kEntries = 100000 };
+	UInt8 *packed;
+	UInt32 *sizes;
+	UInt32 i;
+	UInt32 sum = 0;
+
+	BenchSeed( 11 );
+	packed = malloc( kEntries * 2 );
+	sizes = malloc( kEntries * sizeof(UInt32) );
+	BenchFillRandom( packed, kEntries * 2 );
+
+	BenchStart();
+	for (i = 0; i < iterations; i++) {
+		UnpackSampleSizes4( packed, sizes, kEntries );
+		sum += sizes[i % kEntries];
+	}
+	BenchStop( "UnpackSampleSizes4 (per entry)", (UInt64)iterations * kEntries );
+
+	BenchStart();
+	for (i = 0; i < iterations; i++) {
+		UnpackSampleSizes8( packed, sizes, kEntries );
+		sum += sizes[i % kEntries];
+	}
+	BenchStop( "UnpackSampleSizes8 (per entry)", (UInt64)iterations * kEntries );
+
+	BenchStart();
+	for (i = 0; i < iterations; i++) {
+		UnpackSampleSizes16( packed, sizes, kEntries );
+		sum += sizes[i % kEntries];
+	}
+	BenchStop( "UnpackSampleSizes16 (per entry)", (UInt64)iterations * kEntries );
+
+	gSink = sum;
+	free( packed );
+	free( sizes );
+}
+
+//==========================================================================================
+
+static void Bench_SwapBigEndian( UInt32 iterations )
+{
+	enum { kEntries = 100000 };
+	UInt32 *table32;
+	UInt64 *table64;
+	UInt32 i;
+	UInt64 sum = 0;
+
+	BenchSeed( 12 );
+	table32 = malloc( kEntries * sizeof(UInt32) );
+	table64 = malloc( kEntries * sizeof(UInt64) );
+	BenchFillRandom( (UInt8 *)table32, kEntries * sizeof(UInt32) );
+	BenchFillRandom( (UInt8 *)table64, kEntries * sizeof(UInt64) );
+
+	BenchStart();
+	for (i = 0; i < iterations; i++) {
+		SwapBigEndian32( table32, kEntries );
+		sum += table32[i % kEntries];
+	}
+	BenchStop( "SwapBigEndian32 (per entry)", (UInt64)iterations * kEntries );
+
+	BenchStart();
+	for (i = 0; i < iterations; i++) {
+		SwapBigEndian64( table64, kEntries );
+		sum += table64[i % kEntries];
+	}
+	BenchStop( "SwapBigEndian64 (per entry)", (UInt64)iterations * kEntries );
+
+	BenchStart();
+	for (i = 0; i < iterations; i++) {
+		WidenBigEndian32To64( table32, table64, kEntries );
+		sum += table64[i % kEntries];
+	}
+	BenchStop( "WidenBigEndian32To64 (per entry)", (UInt64)iterations * kEntries );
+
+	gSink = (UInt32)sum;
+	free( table32 );
+	free( table64 );
+}
+
+//==========================================================================================
+
+static void Bench_FindAtomOffsets( UInt32 iterations )
+{
+	enum { kAtomCount = 1000 };
+	FILE *f;
+	atomOffsetEntry aoe = {0};
+	atomOffsetEntry *list;
+	long cnt;
+	UInt32 i;
+	UInt64 fileSize;
+	UInt64 sum = 0;
+	FILE *savedFile = vg.inFile;
+
+	BenchSeed( 8 );
+	f = tmpfile();
+	if (!f) {
+		fprintf( stderr, "FindAtomOffsets: could not create temporary file\n" );
+		return;
+	}
+
+	// a flat run of small atoms, with the occasional 64-bit size and uuid atom
+	for (i = 0; i < kAtomCount; i++) {
+		UInt8 header[32];
+		UInt32 headerSize = 8;
+		UInt32 payload = 8 + (BenchRandom() % 64);
+		UInt32 type = 'free';
+		UInt32 size;
+
+		memset( header, 0, sizeof(header) );
+		if ((i % 97) == 0) {
+			type = 'uuid';
+			headerSize += 16;
+		}
+		if ((i % 89) == 0) {
+			UInt64 large = headerSize + 8 + payload;
+			size = 1;
+			*(UInt64*)&header[8] = EndianU64_NtoB(large);
+			headerSize += 8;
+		} else {
+			size = headerSize + payload;
+		}
+		*(UInt32*)&header[0] = EndianU32_NtoB(size);
+		*(UInt32*)&header[4] = EndianU32_NtoB(type);
+		fwrite( header, 1, headerSize, f );
+		while (payload--) fputc( 0, f );
+	}
+	fflush( f );
+	fseek( f, 0, SEEK_END );
+	fileSize = ftell( f );
+
+	vg.inFile = f;
+	aoe.type = 'file';
+	aoe.size = fileSize;
+	aoe.maxOffset = fileSize;
+
+	BenchStart();
+	for (i = 0; i < iterations; i++) {
+		FindAtomOffsets( &aoe, 0, fileSize, &cnt, &list );
+		sum += cnt;
+		free( list );
+	}
+	BenchStop( "FindAtomOffsets (1000 atoms)", iterations );
+
+	gSink = (UInt32)sum;
+	vg.inFile = savedFile;
+	fclose( f );
+}
+
+//==========================================================================================
+
+static void Bench_Base64DecodeToBuffer( UInt32 iterations )
+{
+	enum { kDecodedSize = 3 * 1024, kLineLength = 76 };
+	static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	UInt8 raw[kDecodedSize];
+	char *encoded;
+	char decoded[kDecodedSize];
+	UInt32 encodedLength = 0;
+	UInt32 i, inLength, outLength;
+	UInt32 sum = 0;
+
+	BenchSeed( 9 );
+	BenchFillRandom( raw, kDecodedSize );
+
+	// encode with line breaks, as SDP 'sprop-parameter-sets' and friends can have
+	encoded = malloc( (kDecodedSize / 3) * 4 + (kDecodedSize / 3) * 4 / kLineLength + 4 );
+	for (i = 0; i < kDecodedSize; i += 3) {
+		UInt32 group = (raw[i] << 16) | (raw[i+1] << 8) | raw[i+2];
+		encoded[encodedLength++] = alphabet[(group >> 18) & 0x3f];
+		encoded[encodedLength++] = alphabet[(group >> 12) & 0x3f];
+		encoded[encodedLength++] = alphabet[(group >>  6) & 0x3f];
+		encoded[encodedLength++] = alphabet[(group      ) & 0x3f];
+		if (((i / 3 + 1) * 4) % kLineLength == 0) encoded[encodedLength++] = '\n';
+	}
+
+	BenchStart();
+	for (i = 0; i < iterations; i++) {
+		inLength = encodedLength;
+		outLength = sizeof(decoded);
+		Base64DecodeToBuffer( encoded, &inLength, decoded, &outLength );
+		sum += outLength + (UInt8)decoded[i % kDecodedSize];
+	}
+	BenchStop( "Base64DecodeToBuffer (3 KB)", iterations );
+
+	gSink = sum;
+	free( encoded );
+}
+
+//==========================================================================================
+
+static void Bench_HexPrinters( UInt32 iterations )
+{
+	enum { kDumpSize = 4096 };
+	char data[kDumpSize];
+	UInt32 i;
+	int savedfd;
+	Boolean savedprintatom = vg.printatom;
+	Boolean savedprintsample = vg.printsample;
+
+	BenchSeed( 10 );
+	BenchFillRandom( (UInt8*)data, kDumpSize );
+
+	vg.printatom = true;
+	vg.printsample = true;
+
+	savedfd = BenchMuteStdout();
+	BenchStart();
+	for (i = 0; i < iterations; i++) atomprinthexdata( data, kDumpSize );
+	BenchRestoreStdout( savedfd );
+	BenchStop( "atomprinthexdata (4 KB)", iterations );
+
+	savedfd = BenchMuteStdout();
+	BenchStart();
+	for (i = 0; i < iterations; i++) sampleprinthexdata( data, kDumpSize );
+	BenchRestoreStdout( savedfd );
+	BenchStop( "sampleprinthexdata (4 KB)", iterations );
+
+	savedfd = BenchMuteStdout();
+	BenchStart();
+	for (i = 0; i < iterations; i++) sampleprinthexandasciidata( data, kDumpSize );
+	BenchRestoreStdout( savedfd );
+	BenchStop( "sampleprinthexandasciidata (4 KB)", iterations );
+
+	vg.printatom = savedprintatom;
+	vg.printsample = savedprintsample;
+}
+
+//==========================================================================================
+
+static BenchCase gBenchCases[] = {
+	{ "getbits",		Bench_GetBits,					200 },
+	{ "peekbits",		Bench_PeekBits,					200 },
+	{ "golomb_uev",		Bench_read_golomb_uev,			200 },
+	{ "golomb_sev",		Bench_read_golomb_sev,			200 },
+	{ "strip",			Bench_strip_trailing_zero_bits,	2000000 },
+	{ "sampleoffset",	Bench_GetSampleOffsetSize,		20000 },
+	{ "chunkoffset",	Bench_GetChunkOffsetSize,		20000 },
+	{ "stz2unpack",		Bench_UnpackSampleSizes,		200 },
+	{ "byteswap",		Bench_SwapBigEndian,			200 },
+	{ "findatoms",		Bench_FindAtomOffsets,			200 },
+	{ "base64",			Bench_Base64DecodeToBuffer,		20000 },
+	{ "hexprint",		Bench_HexPrinters,				200 }
+};
+
+int main(int argc, char *argv[])
+{
+	int argn;
+	const char *filter = nil;
+	double scale = 1.0;
+	UInt32 i;
+
+	for (argn = 1; argn < argc; argn++) {
+		if ((strcmp(argv[argn], "-scale") == 0) && (argn + 1 < argc)) {
+			scale = atof( argv[++argn] );
+		} else if ((strcmp(argv[argn], "-seed") == 0) && (argn + 1 < argc)) {
+			gSeed = strtoul( argv[++argn], nil, 0 );
+		} else if (argv[argn][0] != '-') {
+			filter = argv[argn];
+		} else {
+			fprintf( stderr, "Usage: %s [-scale <factor>] [-seed <n>] [benchmark]\n", "ValidateBench" );
+			fprintf( stderr, "    benchmarks:" );
+			for (i = 0; i < sizeof(gBenchCases)/sizeof(BenchCase); i++)
+				fprintf( stderr, " %s", gBenchCases[i].name );
+			fprintf( stderr, "\n" );
+			return -1;
+		}
+	}
+
+	fprintf( stdout, "<!-- ValidateBench seed=0x%08lx scale=%g -->\n", (unsigned long)gSeed, scale );
+	for (i = 0; i < sizeof(gBenchCases)/sizeof(BenchCase); i++) {
+		UInt32 iterations;
+
+		if (filter && strcmp(filter, gBenchCases[i].name) != 0) continue;
+		iterations = (UInt32)(gBenchCases[i].iterations * scale);
+		if (iterations == 0) iterations = 1;
+		(*gBenchCases[i].proc)( iterations );
+	}
+
+	return 0;
+}
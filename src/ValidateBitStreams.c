@@ -20,7 +20,7 @@ limitations under the License.
 #include "ValidateMP4.h"
 
 	// JRM
-extern ValidateGlobals vg;
+extern THREAD_LOCAL ValidateGlobals vg;
 
 OSErr Validate_ES_INC_Descriptor(BitBuffer *bb);
 OSErr Validate_ES_REF_Descriptor(BitBuffer *bb);
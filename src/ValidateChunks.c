@@ -0,0 +1,527 @@
+/*
+
+This file contains Original Code and/or Modifications of Original Code
+as defined in and that are subject to the Apple Public Source License
+Version 2.0 (the 'License'). You may not use this file except in
+compliance with the License. Please obtain a copy of the License at
+http://www.opensource.apple.com/apsl/ and read it before using this
+file.
+
+The Original Code and all software distributed under the License are
+distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+Please see the License for the specific language governing rights and
+limitations under the License.
+
+*/
+
+#include "ValidateMP4.h"
+
+//==========================================================================================
+// Chunk heap
+//
+//   one entry per track that still has chunks, keyed by the offset of its next chunk;
+//   ties go to the lower track index so chunks come out in the same order as a scan of
+//   the tracks would give
+
+typedef struct ChunkHeapEntry {
+	UInt64	offset;
+	UInt32	track;
+} ChunkHeapEntry;
+
+static Boolean ChunkHeapLess( const ChunkHeapEntry *a, const ChunkHeapEntry *b )
+{
+	if (a->offset != b->offset) return (a->offset < b->offset);
+	return (a->track < b->track);
+}
+
+static void ChunkHeapSiftDown( ChunkHeapEntry *heap, UInt32 cnt, UInt32 i )
+{
+	ChunkHeapEntry e = heap[i];
+
+	for (;;) {
+		UInt32 child = 2*i + 1;
+
+		if (child >= cnt) break;
+		if ((child + 1 < cnt) && ChunkHeapLess( &heap[child + 1], &heap[child] )) child++;
+		if (!ChunkHeapLess( &heap[child], &e )) break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = e;
+}
+
+//==========================================================================================
+// Chunk tree
+//
+//   chunks that start before the end of some earlier chunk (the rare case) go in a treap,
+//   ordered by start and then by arrival; everything else is simply appended to a sorted
+//   array.  Nodes live in one growable array and refer to each other by index.
+
+enum {
+	kNoNode = -1
+};
+
+typedef struct ChunkTreeNode {
+	chunkOverlapRec	rec;
+	UInt32	seq;				// arrival order; breaks ties between equal starts
+	UInt32	priority;
+	SInt32	left, right;
+} ChunkTreeNode;
+
+typedef struct ChunkTree {
+	ChunkTreeNode *nodes;
+	SInt32	cnt;
+	SInt32	max;
+	SInt32	root;
+} ChunkTree;
+
+static UInt32 ChunkTreePriority( UInt32 seq )
+{
+	// any well mixed function of seq will do; it just has to look random
+	seq ^= seq >> 16;
+	seq *= 0x7FEB352DUL;
+	seq ^= seq >> 15;
+	seq *= 0x846CA68BUL;
+	seq ^= seq >> 16;
+	return seq;
+}
+
+static SInt32 ChunkTreeInsertAt( ChunkTree *t, SInt32 root, SInt32 n )
+{
+	ChunkTreeNode *nodes = t->nodes;
+
+	if (root == kNoNode) return n;
+
+	// new nodes always arrive last, so among equal starts they go right
+	if (nodes[n].rec.chunkStart < nodes[root].rec.chunkStart) {
+		SInt32 l = ChunkTreeInsertAt( t, nodes[root].left, n );
+		nodes[root].left = l;
+		if (nodes[l].priority > nodes[root].priority) {
+			nodes[root].left = nodes[l].right;
+			nodes[l].right = root;
+			return l;
+		}
+	} else {
+		SInt32 r = ChunkTreeInsertAt( t, nodes[root].right, n );
+		nodes[root].right = r;
+		if (nodes[r].priority > nodes[root].priority) {
+			nodes[root].right = nodes[r].left;
+			nodes[r].left = root;
+			return r;
+		}
+	}
+	return root;
+}
+
+static OSErr ChunkTreeInsert( ChunkTree *t, const chunkOverlapRec *rec, UInt32 seq )
+{
+	OSErr err = noErr;
+	ChunkTreeNode *n;
+
+	if (t->cnt == t->max) {
+		SInt32 newMax = t->max ? 2*t->max : 64;
+		ChunkTreeNode *newNodes;
+
+		BAILIFNIL( newNodes = realloc(t->nodes, newMax * sizeof(ChunkTreeNode)), allocFailedErr );
+		t->nodes = newNodes;
+		t->max = newMax;
+	}
+	n = &t->nodes[t->cnt];
+	n->rec = *rec;
+	n->seq = seq;
+	n->priority = ChunkTreePriority( seq );
+	n->left = n->right = kNoNode;
+	t->root = ChunkTreeInsertAt( t, t->root, t->cnt++ );
+
+bail:
+	return err;
+}
+
+//   the last node starting at or before start, and the first node starting after it
+static void ChunkTreeNeighbours( ChunkTree *t, UInt64 start, SInt32 *prior, SInt32 *next )
+{
+	SInt32 i = t->root;
+
+	*prior = *next = kNoNode;
+	while (i != kNoNode) {
+		if (t->nodes[i].rec.chunkStart <= start) {
+			*prior = i;
+			i = t->nodes[i].right;
+		} else {
+			*next = i;
+			i = t->nodes[i].left;
+		}
+	}
+}
+
+//   appends the tree's records, in order, to recs/seqs
+static void ChunkTreeFlatten( ChunkTree *t, SInt32 i, chunkOverlapRec *recs, UInt32 *seqs, UInt32 *cnt )
+{
+	while (i != kNoNode) {
+		ChunkTreeFlatten( t, t->nodes[i].left, recs, seqs, cnt );
+		recs[*cnt] = t->nodes[i].rec;
+		seqs[*cnt] = t->nodes[i].seq;
+		(*cnt)++;
+		i = t->nodes[i].right;
+	}
+}
+
+//==========================================================================================
+// Media data index
+//
+//   the top level atoms come back from FindAtomOffsets in file order, so the 'mdat' payload
+//   extents are already sorted and can't overlap; a chunk is good if it lies inside one of them
+
+OSErr BuildMediaDataIndex( long cnt, atomOffsetEntry *list )
+{
+	OSErr err = noErr;
+	long i;
+
+	DisposeMediaDataIndex();
+	if (cnt <= 0) goto bail;
+	BAILIFNIL( vg.mdatList = calloc(cnt, sizeof(MediaDataExtent)), allocFailedErr );
+	for (i = 0; i < cnt; i++) {
+		if ((list[i].type == 'mdat') && (list[i].size > list[i].atomStartSize)) {
+			vg.mdatList[vg.mdatCnt].dataStart = list[i].offset + list[i].atomStartSize;
+			vg.mdatList[vg.mdatCnt].dataStop = list[i].offset + list[i].size - 1;
+			vg.mdatCnt++;
+		}
+	}
+
+bail:
+	return err;
+}
+
+//   a stream adds the 'mdat' atoms as they arrive, which is also in file order
+OSErr AddMediaDataExtent( atomOffsetEntry *aoe )
+{
+	OSErr err = noErr;
+	MediaDataExtent *newList;
+
+	if (aoe->size <= aoe->atomStartSize) goto bail;
+	if ((vg.mdatCnt == 0) || ((vg.mdatCnt >= 16) && ((vg.mdatCnt & (vg.mdatCnt - 1)) == 0))) {
+		UInt32 newMax = (vg.mdatCnt < 16) ? 16 : 2 * vg.mdatCnt;
+
+		BAILIFNIL( newList = realloc( vg.mdatList, newMax * sizeof(MediaDataExtent) ), allocFailedErr );
+		vg.mdatList = newList;
+	}
+	vg.mdatList[vg.mdatCnt].dataStart = aoe->offset + aoe->atomStartSize;
+	vg.mdatList[vg.mdatCnt].dataStop = aoe->offset + aoe->size - 1;
+	vg.mdatCnt++;
+
+bail:
+	return err;
+}
+
+void DisposeMediaDataIndex( void )
+{
+	if (vg.mdatList) free( vg.mdatList );
+	vg.mdatList = nil;
+	vg.mdatCnt = 0;
+}
+
+Boolean RangeIsInMediaData( UInt64 chunkStart, UInt64 chunkStop )
+{
+	UInt32 lo = 0, hi = vg.mdatCnt;
+
+	// find the last 'mdat' whose payload starts at or before the chunk
+	while (lo < hi) {
+		UInt32 mid = lo + (hi - lo)/2;
+		if (vg.mdatList[mid].dataStart <= chunkStart) lo = mid + 1;
+		else hi = mid;
+	}
+	return (lo > 0) && (chunkStop <= vg.mdatList[lo - 1].dataStop);
+}
+
+//   one pass over the sorted chunk list and the 'mdat' extents, printing the payload ranges that
+//   no chunk covers
+void ReportMediaDataCoverage( MovieInfoRec *mir )
+{
+	const chunkOverlapRec *chunks = mir->chunkList;
+	UInt32 chunkCnt = mir->chunkListCnt;
+	UInt32 c = 0;
+	UInt32 m;
+	UInt64 mdatBytes = 0;
+	UInt64 unreferencedBytes = 0;
+	UInt32 rangeCnt = 0;
+	char 	tempStr1[32];
+	char 	tempStr2[32];
+
+	if (!chunks && mir->numTIRs) {
+		long i;
+		for (i = 0; i < mir->numTIRs; i++) {
+			if (mir->tirList[i].chunkOffsetEntryCnt) {
+				reportprint("<!-- 'mdat' coverage not reported: the chunk layout could not be checked -->\n");
+				return;
+			}
+		}
+	}
+
+	if (mir->fragmentCnt) {
+		reportprint("<!-- samples in movie fragments are not counted as references to 'mdat' bytes -->\n");
+	}
+	reportprint("<mdatCoverage>\n");
+	vg.tabcnt++;
+	for (m = 0; m < vg.mdatCnt; m++) {
+		const MediaDataExtent *mdat = &vg.mdatList[m];
+		UInt64 next = mdat->dataStart;		// first byte not yet known to be referenced
+		UInt32 j;
+
+		mdatBytes += mdat->dataStop - mdat->dataStart + 1;
+
+		// chunks ending before this 'mdat' can't matter to it or to any later one
+		while ((c < chunkCnt) && (chunks[c].chunkStop < mdat->dataStart)) c++;
+
+		for (j = c; (j < chunkCnt) && (chunks[j].chunkStart <= mdat->dataStop); j++) {
+			if (chunks[j].chunkStop < next) continue;
+			if (chunks[j].chunkStart > next) {
+				reportprint("<unreferenced offset=\"%s\" size=\"%s\" />\n",
+					int64toxstr_r( next, tempStr1 ), int64todstr_r( chunks[j].chunkStart - next, tempStr2 ));
+				unreferencedBytes += chunks[j].chunkStart - next;
+				rangeCnt++;
+			}
+			next = chunks[j].chunkStop + 1;
+			if (next > mdat->dataStop) break;
+		}
+		if (next <= mdat->dataStop) {
+			reportprint("<unreferenced offset=\"%s\" size=\"%s\" />\n",
+				int64toxstr_r( next, tempStr1 ), int64todstr_r( mdat->dataStop - next + 1, tempStr2 ));
+			unreferencedBytes += mdat->dataStop - next + 1;
+			rangeCnt++;
+		}
+	}
+	--vg.tabcnt;
+	reportprint("</mdatCoverage>\n");
+	reportprint("<!-- 'mdat' payload %s bytes, unreferenced %s bytes in %ld ranges (%.2f%%) -->\n",
+		int64todstr_r( mdatBytes, tempStr1 ), int64todstr_r( unreferencedBytes, tempStr2 ), rangeCnt,
+		mdatBytes ? (100.0 * (double)unreferencedBytes / (double)mdatBytes) : 0.0);
+}
+
+//==========================================================================================
+
+static void ReportChunkOverlap( TrackInfoRec *tir, UInt32 chunkNum, UInt64 chunkOffset, const chunkOverlapRec *other )
+{
+	char 	tempStr1[32];
+	char 	tempStr2[32];
+
+	// Note we only warn if hint track chunks share data with other chunks, of if
+	//  two tracks of the same type share data
+	if ((tir->mediaType == other->mediaType) ||
+	    (tir->mediaType == 'hint') ||
+		(other->mediaType == 'hint'))
+	warnprint("Warning: chunk %d of track ID %d at %s overlaps chunk from track ID %d at %s\n",
+		chunkNum, tir->trackID, int64todstr_r( chunkOffset, tempStr1 ),
+		other->trackID, int64todstr_r( other->chunkStart, tempStr2 ));
+	else errprint("Error: chunk %d of track ID %d at %s overlaps chunk from track ID %d at %s\n",
+		chunkNum, tir->trackID, int64todstr_r( chunkOffset, tempStr1 ),
+		other->trackID, int64todstr_r( other->chunkStart, tempStr2 ));
+}
+
+//   last index in the (sorted) appended list starting at or before start, or -1
+static SInt32 FindPriorChunk( const chunkOverlapRec *list, UInt32 cnt, UInt64 start )
+{
+	UInt32 lo = 0, hi = cnt;
+
+	while (lo < hi) {
+		UInt32 mid = lo + (hi - lo)/2;
+		if (list[mid].chunkStart <= start) lo = mid + 1;
+		else hi = mid;
+	}
+	return (SInt32)lo - 1;
+}
+
+// Check for overlapped sample chunks [dws]
+//  most tracks are in offset order and most files behave, so we merge the tracks' chunk lists
+//  with a heap on the next unprocessed chunk of each track;
+//  if that chunk starts beyond the highest chunk end we have seen, we append it;  otherwise (the rare
+//   case) it goes into a balanced tree and is checked against its neighbours there and in the
+//   appended list.  this gives us a rapid check and a sorted list of every chunk in mir->chunkList
+//   without an n-squared overlap check and without a post-sort
+
+OSErr CheckChunkOverlaps( MovieInfoRec *mir )
+{
+	OSErr err = noErr;
+	UInt32 totalChunks = 0;
+	UInt32 trk_cnt = mir->numTIRs;
+	UInt32 *chunk_num = nil;		// the next chunk to work on for each track
+	ChunkHeapEntry *heap = nil;
+	UInt32 heapCnt = 0;
+	chunkOverlapRec *corp = nil;	// chunks in offset order, appended
+	UInt32 *corpSeq = nil;
+	UInt32 topslot = 0;
+	ChunkTree tree = { nil, 0, 0, kNoNode };
+	UInt64 highwatermark = 0;		// the highest chunk end seen
+	UInt32 seq = 0;
+	UInt32 i;
+
+	BAILIFNULL( chunk_num = calloc(trk_cnt, sizeof(UInt32)), allocFailedErr );
+	BAILIFNULL( heap = calloc(trk_cnt, sizeof(ChunkHeapEntry)), allocFailedErr );
+
+	for (i = 0; i < trk_cnt; ++i) {
+		TrackInfoRec *tir = &(mir->tirList[i]);
+
+		totalChunks += tir->chunkOffsetEntryCnt;
+		chunk_num[i] = 1;
+		if (tir->chunkOffsetEntryCnt) {
+			heap[heapCnt].offset = GetChunkOffset( tir, 1 );
+			heap[heapCnt].track = i;
+			heapCnt++;
+		}
+	}
+	for (i = heapCnt/2; i-- > 0; ) {
+		ChunkHeapSiftDown( heap, heapCnt, i );
+	}
+
+	BAILIFNULL( corp = calloc(totalChunks + 1, sizeof(chunkOverlapRec)), allocFailedErr );
+	BAILIFNULL( corpSeq = calloc(totalChunks + 1, sizeof(UInt32)), allocFailedErr );
+
+	while (heapCnt) {	// until we have processed all chunks of all tracks
+		UInt32 lowest = heap[0].track;
+		UInt64 low_offset = heap[0].offset;
+		TrackInfoRec *tir = &(mir->tirList[lowest]);
+		UInt64 chunkOffset, chunkStop;
+		UInt32 chunkSize;
+		chunkOverlapRec rec;
+
+		BAILIFERR( GetChunkOffsetSize(tir, chunk_num[lowest], &chunkOffset, &chunkSize, nil) );
+		if (chunkSize == 0) {
+			errprint("Tracks with zero length chunks\n");
+			err = badPublicMovieAtom;
+			goto bail;
+		}
+		chunkStop = chunkOffset + chunkSize -1;
+
+		if (chunkOffset != low_offset) {
+			errprint("Aargh! program error\n");
+			BAILIFERR( programErr );
+		}
+
+		if (chunkOffset >= vg.inMaxOffset)
+		{
+			errprint("Chunk offset %s is at or beyond file size  0x%lx\n", int64toxstr(chunkOffset), vg.inMaxOffset);
+		} else if (chunkStop > vg.inMaxOffset)
+		{
+			errprint("Chunk end %s is beyond file size  0x%lx\n", int64toxstr(chunkStop), vg.inMaxOffset);
+		} else if (vg.mdatList && !tir->externalDataRefCnt && !RangeIsInMediaData( chunkOffset, chunkStop ))
+		{
+			errprint("Chunk %d of track ID %d at %s is not inside a media data ('mdat') atom\n",
+				chunk_num[lowest], tir->trackID, int64toxstr(chunkOffset));
+		}
+
+		rec.chunkStart = chunkOffset;
+		rec.chunkStop  = chunkStop;
+		rec.trackID    = tir->trackID;
+		rec.mediaType  = tir->mediaType;
+
+		if (chunkOffset >= highwatermark)
+		{	// easy, it starts after all other chunks end
+			corp[ topslot ] = rec;
+			corpSeq[ topslot ] = seq;
+			topslot++;
+		}
+		else
+		{
+			// it might overlap; find its neighbours among the appended chunks and in the tree
+			const chunkOverlapRec *prior = nil, *next = nil;
+			UInt32 priorSeq = 0, nextSeq = 0;
+			SInt32 k, treePrior, treeNext;
+
+			k = FindPriorChunk( corp, topslot, chunkOffset );
+			if (k >= 0) {
+				prior = &corp[k];  priorSeq = corpSeq[k];
+			}
+			if (k + 1 < (SInt32)topslot) {
+				next = &corp[k + 1];  nextSeq = corpSeq[k + 1];
+			}
+			ChunkTreeNeighbours( &tree, chunkOffset, &treePrior, &treeNext );
+			if ((treePrior != kNoNode) && (!prior ||
+					(tree.nodes[treePrior].rec.chunkStart > prior->chunkStart) ||
+					((tree.nodes[treePrior].rec.chunkStart == prior->chunkStart) && (tree.nodes[treePrior].seq > priorSeq)))) {
+				prior = &tree.nodes[treePrior].rec;
+			}
+			if ((treeNext != kNoNode) && (!next ||
+					(tree.nodes[treeNext].rec.chunkStart < next->chunkStart) ||
+					((tree.nodes[treeNext].rec.chunkStart == next->chunkStart) && (tree.nodes[treeNext].seq < nextSeq)))) {
+				next = &tree.nodes[treeNext].rec;
+			}
+
+			// do we overlap the prior chunk (if any)?
+			//   we might overlap chunks before that, but if so, they must also overlap the chunk
+			//   prior to us, and we would have already reported that error
+			if (prior && (chunkOffset >= prior->chunkStart) && (chunkOffset <= prior->chunkStop)) {
+				ReportChunkOverlap( tir, chunk_num[lowest], chunkOffset, prior );
+			}
+
+			// do we overlap the next chunk (if any)?
+			//   again, we might overlap chunks after that, but if so, we also overlap the next chunk
+			//   and one report is enough
+			if (next && (chunkStop >= next->chunkStart) && (chunkStop <= next->chunkStop)) {
+				ReportChunkOverlap( tir, chunk_num[lowest], chunkOffset, next );
+			}
+
+			BAILIFERR( ChunkTreeInsert( &tree, &rec, seq ) );
+		}
+		seq++;
+
+		if (chunkStop > highwatermark) highwatermark = chunkStop;
+
+		// done that chunk; move the track on to its next one or drop it from the heap
+		chunk_num[lowest] += 1;
+		if (chunk_num[lowest] <= tir->chunkOffsetEntryCnt) {
+			heap[0].offset = GetChunkOffset( tir, chunk_num[lowest] );
+		} else {
+			heap[0] = heap[--heapCnt];
+		}
+		if (heapCnt) ChunkHeapSiftDown( heap, heapCnt, 0 );
+	}
+
+	// fold the out-of-order chunks back into the sorted list
+	if (tree.cnt) {
+		chunkOverlapRec *treeRecs = nil;
+		UInt32 *treeSeqs = nil;
+		chunkOverlapRec *merged = nil;
+		UInt32 treeCnt = 0, a = 0, b = 0, m = 0;
+
+		treeRecs = malloc(tree.cnt * sizeof(chunkOverlapRec));
+		treeSeqs = malloc(tree.cnt * sizeof(UInt32));
+		merged = malloc((topslot + tree.cnt) * sizeof(chunkOverlapRec));
+		if (!treeRecs || !treeSeqs || !merged) {
+			err = allocFailedErr;
+		} else {
+			ChunkTreeFlatten( &tree, tree.root, treeRecs, treeSeqs, &treeCnt );
+			while ((a < topslot) || (b < treeCnt)) {
+				if ((b >= treeCnt) || ((a < topslot) &&
+						((corp[a].chunkStart < treeRecs[b].chunkStart) ||
+						 ((corp[a].chunkStart == treeRecs[b].chunkStart) && (corpSeq[a] < treeSeqs[b]))))) {
+					merged[m++] = corp[a++];
+				} else {
+					merged[m++] = treeRecs[b++];
+				}
+			}
+			free( corp );
+			corp = merged;
+			merged = nil;
+			topslot = m;
+		}
+		if (treeRecs) free( treeRecs );
+		if (treeSeqs) free( treeSeqs );
+		if (merged) free( merged );
+		if (err) goto bail;
+	}
+
+	if (mir->chunkList) free( mir->chunkList );
+	mir->chunkList = corp;
+	mir->chunkListCnt = topslot;
+	corp = nil;
+
+bail:
+	if (chunk_num) free( chunk_num );
+	if (heap) free( heap );
+	if (corp) free( corp );
+	if (corpSeq) free( corpSeq );
+	if (tree.nodes) free( tree.nodes );
+	return err;
+}
@@ -0,0 +1,597 @@
+/*
+
+This file contains Original Code and/or Modifications of Original Code
+as defined in and that are subject to the Apple Public Source License
+Version 2.0 (the 'License'). You may not use this file except in
+compliance with the License. Please obtain a copy of the License at
+http://www.opensource.apple.com/apsl/ and read it before using this
+file.
+
+The Original Code and all software distributed under the License are
+distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+Please see the License for the specific language governing rights and
+limitations under the License.
+
+*/
+
+#include "ValidateMP4.h"
+
+//==========================================================================================
+// Content digests (-digest, -verifydigest)
+//
+//   While the samples are read for checking, each one gets a 64-bit XXH64 hash and goes
+//   into a SHA-256 of its track.  Each top level 'mdat' payload gets a SHA-256 of its own,
+//   fed by GetFileData as long as the reads go through the payload in order; what's left
+//   when they don't (the chunks of the other tracks of an interleaved file, samples that
+//   weren't checked, a payload no track uses) is read at the end, by then mostly from the
+//   page cache.  The manifest is text:
+//		# ValidateMP4 content digests 1
+//		mdat <number> <payload offset> <payload size> <sha256>
+//		track <track ID> <samples> <samples hashed> <sha256>
+//		sample <track ID> <sample number> <size> <xxh64>
+//   Checking against an earlier manifest compares the samples both hashed, the sample counts,
+//   the track digests when both hashed every sample, and the 'mdat' digests; tracks, samples
+//   and 'mdat' atoms the manifest has and the file doesn't are reported too.
+
+enum {
+	kDigestReadSize = 1024 * 1024,
+	kSHA256Size = 32
+};
+
+typedef struct SHA256Context {
+	UInt32	state[8];
+	UInt64	length;					// bytes so far
+	UInt8	block[64];
+	UInt32	blockUsed;
+} SHA256Context;
+
+typedef struct SampleDigest {
+	UInt32	trackID;
+	UInt32	sampleNum;
+	UInt32	size;
+	UInt64	hash;
+} SampleDigest;
+
+typedef struct TrackDigest {
+	SHA256Context sha;
+	SampleDigest *samples;			// in the order they were hashed
+	UInt32	sampleCnt;
+	UInt32	sampleSpace;
+} TrackDigest;
+
+typedef struct MediaDataDigest {
+	SHA256Context sha;
+	UInt64	hashedTo;				// the next payload byte the SHA-256 needs
+} MediaDataDigest;
+
+typedef struct MediaDataDigests {
+	FILE	*file;					// the reads of threads with a file of their own don't count
+	UInt32	mdatCnt;
+	UInt32	lastMdat;				// where the last read was
+	MediaDataDigest mdats[1];
+} MediaDataDigests;
+
+typedef struct DigestManifest {
+	SampleDigest *samples;			// sorted by track ID, then sample number
+	UInt32	sampleCnt;
+	struct {
+		UInt32	trackID;
+		UInt32	sampleCnt;
+		UInt32	hashedCnt;
+		char	sha[2*kSHA256Size + 1];
+	} *tracks;
+	UInt32	trackCnt;
+	struct {
+		UInt64	offset;
+		UInt64	size;
+		char	sha[2*kSHA256Size + 1];
+	} *mdats;
+	UInt32	mdatCnt;
+} DigestManifest;
+
+//==========================================================================================
+// XXH64
+
+#define kXXH64Prime1	11400714785074694791ULL
+#define kXXH64Prime2	14029467366897019727ULL
+#define kXXH64Prime3	1609587929392839161ULL
+#define kXXH64Prime4	9650029242287828579ULL
+#define kXXH64Prime5	2870177450012600261ULL
+
+static UInt64 XXH64Rotate( UInt64 x, int r )
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static UInt64 XXH64Read64( const UInt8 *p )
+{
+	return (UInt64)p[0] | ((UInt64)p[1] << 8) | ((UInt64)p[2] << 16) | ((UInt64)p[3] << 24) |
+		((UInt64)p[4] << 32) | ((UInt64)p[5] << 40) | ((UInt64)p[6] << 48) | ((UInt64)p[7] << 56);
+}
+
+static UInt64 XXH64Round( UInt64 acc, UInt64 input )
+{
+	acc += input * kXXH64Prime2;
+	return XXH64Rotate( acc, 31 ) * kXXH64Prime1;
+}
+
+static UInt64 XXH64Merge( UInt64 acc, UInt64 v )
+{
+	acc ^= XXH64Round( 0, v );
+	return acc * kXXH64Prime1 + kXXH64Prime4;
+}
+
+static UInt64 XXH64( const UInt8 *p, size_t length )
+{
+	const UInt8 *end = p + length;
+	UInt64 h;
+
+	if (length >= 32) {
+		UInt64 v1 = kXXH64Prime1 + kXXH64Prime2, v2 = kXXH64Prime2, v3 = 0, v4 = 0 - kXXH64Prime1;
+
+		do {
+			v1 = XXH64Round( v1, XXH64Read64( p ) );
+			v2 = XXH64Round( v2, XXH64Read64( p + 8 ) );
+			v3 = XXH64Round( v3, XXH64Read64( p + 16 ) );
+			v4 = XXH64Round( v4, XXH64Read64( p + 24 ) );
+			p += 32;
+		} while (end - p >= 32);
+		h = XXH64Rotate( v1, 1 ) + XXH64Rotate( v2, 7 ) + XXH64Rotate( v3, 12 ) + XXH64Rotate( v4, 18 );
+		h = XXH64Merge( XXH64Merge( XXH64Merge( XXH64Merge( h, v1 ), v2 ), v3 ), v4 );
+	} else {
+		h = kXXH64Prime5;
+	}
+	h += length;
+
+	for ( ; end - p >= 8; p += 8) {
+		h ^= XXH64Round( 0, XXH64Read64( p ) );
+		h = XXH64Rotate( h, 27 ) * kXXH64Prime1 + kXXH64Prime4;
+	}
+	if (end - p >= 4) {
+		h ^= ((UInt64)p[0] | ((UInt64)p[1] << 8) | ((UInt64)p[2] << 16) | ((UInt64)p[3] << 24)) * kXXH64Prime1;
+		h = XXH64Rotate( h, 23 ) * kXXH64Prime2 + kXXH64Prime3;
+		p += 4;
+	}
+	for ( ; p < end; p++) {
+		h ^= *p * kXXH64Prime5;
+		h = XXH64Rotate( h, 11 ) * kXXH64Prime1;
+	}
+
+	h ^= h >> 33;
+	h *= kXXH64Prime2;
+	h ^= h >> 29;
+	h *= kXXH64Prime3;
+	h ^= h >> 32;
+	return h;
+}
+
+//==========================================================================================
+// SHA-256
+
+static const UInt32 kSHA256Rounds[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define SHA256Rotate( x, r )	(((x) >> (r)) | ((x) << (32 - (r))))
+
+static void SHA256Init( SHA256Context *ctx )
+{
+	static const UInt32 initial[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+
+	memcpy( ctx->state, initial, sizeof(initial) );
+	ctx->length = 0;
+	ctx->blockUsed = 0;
+}
+
+static void SHA256Block( SHA256Context *ctx, const UInt8 *p )
+{
+	UInt32 w[64], a, b, c, d, e, f, g, h, t1, t2;
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		w[i] = ((UInt32)p[4*i] << 24) | ((UInt32)p[4*i + 1] << 16) | ((UInt32)p[4*i + 2] << 8) | p[4*i + 3];
+	}
+	for ( ; i < 64; i++) {
+		UInt32 s0 = SHA256Rotate( w[i-15], 7 ) ^ SHA256Rotate( w[i-15], 18 ) ^ (w[i-15] >> 3);
+		UInt32 s1 = SHA256Rotate( w[i-2], 17 ) ^ SHA256Rotate( w[i-2], 19 ) ^ (w[i-2] >> 10);
+		w[i] = w[i-16] + s0 + w[i-7] + s1;
+	}
+
+	a = ctx->state[0]; b = ctx->state[1]; c = ctx->state[2]; d = ctx->state[3];
+	e = ctx->state[4]; f = ctx->state[5]; g = ctx->state[6]; h = ctx->state[7];
+	for (i = 0; i < 64; i++) {
+		t1 = h + (SHA256Rotate( e, 6 ) ^ SHA256Rotate( e, 11 ) ^ SHA256Rotate( e, 25 )) + ((e & f) ^ (~e & g)) + kSHA256Rounds[i] + w[i];
+		t2 = (SHA256Rotate( a, 2 ) ^ SHA256Rotate( a, 13 ) ^ SHA256Rotate( a, 22 )) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+	ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c; ctx->state[3] += d;
+	ctx->state[4] += e; ctx->state[5] += f; ctx->state[6] += g; ctx->state[7] += h;
+}
+
+static void SHA256Update( SHA256Context *ctx, const UInt8 *p, size_t length )
+{
+	ctx->length += length;
+	if (ctx->blockUsed) {
+		size_t n = 64 - ctx->blockUsed;
+
+		if (n > length) n = length;
+		memcpy( ctx->block + ctx->blockUsed, p, n );
+		ctx->blockUsed += n;
+		p += n;
+		length -= n;
+		if (ctx->blockUsed < 64) return;
+		SHA256Block( ctx, ctx->block );
+		ctx->blockUsed = 0;
+	}
+	for ( ; length >= 64; p += 64, length -= 64) {
+		SHA256Block( ctx, p );
+	}
+	memcpy( ctx->block, p, length );
+	ctx->blockUsed = length;
+}
+
+//   as lower case hex
+static void SHA256Final( SHA256Context *ctx, char *hex )
+{
+	UInt64 bits = ctx->length * 8;
+	UInt8 pad[72] = { 0x80 };
+	size_t padLength = ((ctx->blockUsed < 56) ? 56 : 120) - ctx->blockUsed;
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		pad[padLength + i] = (UInt8)(bits >> (56 - 8*i));
+	}
+	SHA256Update( ctx, pad, padLength + 8 );
+	for (i = 0; i < 8; i++) {
+		sprintf( hex + 8*i, "%08x", (unsigned)ctx->state[i] );
+	}
+}
+
+//==========================================================================================
+
+void DigestSample( TrackInfoRec *tir, UInt32 sampleNum, const void *data, UInt32 size )
+{
+	TrackDigest *td = tir->digest;
+	SampleDigest *sd;
+
+	if (!vg.digest) return;
+	if (!td) {
+		if (!(td = tir->digest = calloc( 1, sizeof(TrackDigest) ))) return;
+		SHA256Init( &td->sha );
+	}
+	if (td->sampleCnt == td->sampleSpace) {
+		UInt32 space = td->sampleSpace ? 2 * td->sampleSpace : 1024;
+		SampleDigest *samples = realloc( td->samples, space * sizeof(SampleDigest) );
+
+		if (!samples) return;
+		td->samples = samples;
+		td->sampleSpace = space;
+	}
+	sd = &td->samples[td->sampleCnt++];
+	sd->trackID = tir->trackID;
+	sd->sampleNum = sampleNum;
+	sd->size = size;
+	sd->hash = XXH64( data, size );
+	SHA256Update( &td->sha, data, size );
+}
+
+void DisposeTrackDigest( TrackInfoRec *tir )
+{
+	if (tir->digest) {
+		if (tir->digest->samples) free( tir->digest->samples );
+		free( tir->digest );
+		tir->digest = nil;
+	}
+}
+
+OSErr StartMediaDataDigests( void )
+{
+	MediaDataDigests *d;
+	UInt32 m;
+
+	DisposeMediaDataDigests();
+	if (!vg.digest || !vg.mdatCnt) return noErr;
+	if (!(d = calloc( 1, sizeof(MediaDataDigests) + (vg.mdatCnt - 1) * sizeof(MediaDataDigest) ))) return allocFailedErr;
+	d->file = vg.inFile;
+	d->mdatCnt = vg.mdatCnt;
+	for (m = 0; m < vg.mdatCnt; m++) {
+		SHA256Init( &d->mdats[m].sha );
+		d->mdats[m].hashedTo = vg.mdatList[m].dataStart;
+	}
+	vg.mdatDigests = d;
+	return noErr;
+}
+
+void DisposeMediaDataDigests( void )
+{
+	if (vg.mdatDigests) free( vg.mdatDigests );
+	vg.mdatDigests = nil;
+}
+
+//   called by GetFileData with what it read; the bytes go into the SHA-256 of each 'mdat'
+//   payload whose next byte they have
+void DigestFileData( UInt64 offset, const void *data, UInt64 size )
+{
+	MediaDataDigests *d = vg.mdatDigests;
+	UInt64 end = offset + size;
+	UInt32 m = d->lastMdat;
+
+	if (d->file != vg.inFile) return;
+
+	// usually the read is in the same 'mdat' as the last one
+	if ((offset < vg.mdatList[m].dataStart) || (offset > vg.mdatList[m].dataStop)) {
+		UInt32 lo = 0, hi = d->mdatCnt;
+
+		// the first 'mdat' whose payload doesn't end before the read
+		while (lo < hi) {
+			UInt32 mid = lo + (hi - lo)/2;
+			if (vg.mdatList[mid].dataStop < offset) lo = mid + 1;
+			else hi = mid;
+		}
+		m = lo;
+	}
+	for ( ; (m < d->mdatCnt) && (vg.mdatList[m].dataStart < end); m++) {
+		MediaDataDigest *md = &d->mdats[m];
+		UInt64 stop = (end <= vg.mdatList[m].dataStop) ? end : vg.mdatList[m].dataStop + 1;
+
+		d->lastMdat = m;
+		if ((md->hashedTo < offset) || (md->hashedTo >= stop)) continue;
+		SHA256Update( &md->sha, (const UInt8 *)data + (md->hashedTo - offset), (size_t)(stop - md->hashedTo) );
+		md->hashedTo = stop;
+	}
+}
+
+//   reads what the checks didn't of an 'mdat' payload; GetFileData puts it into the SHA-256
+static OSErr DigestMediaData( UInt32 m, char *hex )
+{
+	OSErr err = noErr;
+	MediaDataDigest *md = &vg.mdatDigests->mdats[m];
+	UInt8 *buf = nil;
+
+	BAILIFNIL( buf = malloc( kDigestReadSize ), allocFailedErr );
+	while (md->hashedTo <= vg.mdatList[m].dataStop) {
+		UInt64 left = vg.mdatList[m].dataStop - md->hashedTo + 1;
+		UInt64 hashedTo = md->hashedTo;
+
+		BAILIFERR( GetFileData( nil, buf, hashedTo, (left < kDigestReadSize) ? left : kDigestReadSize, nil ) );
+		BAILIF( md->hashedTo == hashedTo, paramErr );
+	}
+	SHA256Final( &md->sha, hex );
+
+bail:
+	if (buf) free( buf );
+	return err;
+}
+
+//==========================================================================================
+
+static int CompareSampleDigests( const void *a, const void *b )
+{
+	const SampleDigest *x = a, *y = b;
+
+	if (x->trackID != y->trackID) return (x->trackID < y->trackID) ? -1 : 1;
+	if (x->sampleNum != y->sampleNum) return (x->sampleNum < y->sampleNum) ? -1 : 1;
+	return 0;
+}
+
+static void DisposeDigestManifest( DigestManifest *dm )
+{
+	if (dm->samples) free( dm->samples );
+	if (dm->tracks) free( dm->tracks );
+	if (dm->mdats) free( dm->mdats );
+}
+
+static OSErr ReadDigestManifest( const char *path, DigestManifest *dm )
+{
+	OSErr err = noErr;
+	FILE *f;
+	char line[256];
+	UInt32 sampleSpace = 0, trackSpace = 0, mdatSpace = 0;
+	unsigned long long a, b;
+	unsigned int id, n, size;
+	void *more;
+
+	if (!(f = fopen( path, "r" ))) {
+		fprintf( _stderr, "Could not open digest manifest \"%s\"\n", path );
+		return ioErr;
+	}
+	while (fgets( line, sizeof(line), f )) {
+		char sha[2*kSHA256Size + 2];
+
+		if (line[0] == '#') continue;
+		if (sscanf( line, "sample %u %u %u %llx", &id, &n, &size, &a ) == 4) {
+			if (dm->sampleCnt == sampleSpace) {
+				sampleSpace = sampleSpace ? 2 * sampleSpace : 1024;
+				BAILIFNIL( more = realloc( dm->samples, sampleSpace * sizeof(*dm->samples) ), allocFailedErr );
+				dm->samples = more;
+			}
+			dm->samples[dm->sampleCnt].trackID = id;
+			dm->samples[dm->sampleCnt].sampleNum = n;
+			dm->samples[dm->sampleCnt].size = size;
+			dm->samples[dm->sampleCnt].hash = a;
+			dm->sampleCnt++;
+		} else if (sscanf( line, "track %u %u %u %65s", &id, &n, &size, sha ) == 4) {
+			if (dm->trackCnt == trackSpace) {
+				trackSpace = trackSpace ? 2 * trackSpace : 16;
+				BAILIFNIL( more = realloc( dm->tracks, trackSpace * sizeof(*dm->tracks) ), allocFailedErr );
+				dm->tracks = more;
+			}
+			dm->tracks[dm->trackCnt].trackID = id;
+			dm->tracks[dm->trackCnt].sampleCnt = n;
+			dm->tracks[dm->trackCnt].hashedCnt = size;
+			strncpy( dm->tracks[dm->trackCnt].sha, sha, 2*kSHA256Size );
+			dm->tracks[dm->trackCnt].sha[2*kSHA256Size] = 0;
+			dm->trackCnt++;
+		} else if (sscanf( line, "mdat %u %llu %llu %65s", &n, &a, &b, sha ) == 4) {
+			if (dm->mdatCnt == mdatSpace) {
+				mdatSpace = mdatSpace ? 2 * mdatSpace : 16;
+				BAILIFNIL( more = realloc( dm->mdats, mdatSpace * sizeof(*dm->mdats) ), allocFailedErr );
+				dm->mdats = more;
+			}
+			dm->mdats[dm->mdatCnt].offset = a;
+			dm->mdats[dm->mdatCnt].size = b;
+			strncpy( dm->mdats[dm->mdatCnt].sha, sha, 2*kSHA256Size );
+			dm->mdats[dm->mdatCnt].sha[2*kSHA256Size] = 0;
+			dm->mdatCnt++;
+		} else {
+			fprintf( _stderr, "\"%s\" is not a digest manifest\n", path );
+			err = paramErr;
+			goto bail;
+		}
+	}
+	if (dm->sampleCnt) qsort( dm->samples, dm->sampleCnt, sizeof(*dm->samples), CompareSampleDigests );
+
+bail:
+	fclose( f );
+	return err;
+}
+
+//   compares what this run hashed with the manifest; differences are errors
+static void VerifyTrackDigest( DigestManifest *dm, TrackInfoRec *tir, const char *sha, UInt32 *comparedCnt, UInt32 *differCnt )
+{
+	TrackDigest *td = tir->digest;
+	UInt32 hashedCnt = td ? td->sampleCnt : 0;
+	UInt32 sampleCnt = tir->sampleSizeEntryCnt + tir->fragmentSampleCnt;
+	UInt32 i, matched = 0, missingCnt = 0, firstMissing = 0;
+
+	for (i = 0; i < hashedCnt; i++) {
+		SampleDigest *now = &td->samples[i];
+		SampleDigest *was = bsearch( now, dm->samples, dm->sampleCnt, sizeof(*dm->samples), CompareSampleDigests );
+
+		if (!was) continue;
+		matched++;
+		(*comparedCnt)++;
+		if ((was->size != now->size) || (was->hash != now->hash)) {
+			errprint( "Sample %u of track ID %u differs from the digest manifest (size %u, was %u)\n",
+						(unsigned)now->sampleNum, (unsigned)tir->trackID, (unsigned)now->size, (unsigned)was->size );
+			(*differCnt)++;
+		}
+	}
+
+	// samples the manifest hashed past the end of the track
+	for (i = 0; i < dm->sampleCnt; i++) {
+		SampleDigest *was = &dm->samples[i];
+
+		if ((was->trackID != tir->trackID) || (was->sampleNum <= sampleCnt)) continue;
+		if (!missingCnt++) firstMissing = was->sampleNum;
+	}
+	if (missingCnt) {
+		errprint( "%u samples of track ID %u in the digest manifest are not in the file (the first is sample %u)\n",
+					(unsigned)missingCnt, (unsigned)tir->trackID, (unsigned)firstMissing );
+		(*differCnt) += missingCnt;
+	}
+
+	for (i = 0; i < dm->trackCnt; i++) {
+		if (dm->tracks[i].trackID != tir->trackID) continue;
+		if (dm->tracks[i].sampleCnt != sampleCnt) {
+			errprint( "Track ID %u has %u samples, the digest manifest has %u\n",
+						(unsigned)tir->trackID, (unsigned)sampleCnt, (unsigned)dm->tracks[i].sampleCnt );
+			(*differCnt)++;
+		} else if (td && (dm->tracks[i].hashedCnt == sampleCnt) && (hashedCnt == sampleCnt) && (matched == hashedCnt) &&
+					strcmp( dm->tracks[i].sha, sha )) {
+			errprint( "Track ID %u differs from the digest manifest\n", (unsigned)tir->trackID );
+			(*differCnt)++;
+		}
+		return;
+	}
+	if (td) {
+		errprint( "Track ID %u is not in the digest manifest\n", (unsigned)tir->trackID );
+		(*differCnt)++;
+	}
+}
+
+OSErr FinishContentDigests( MovieInfoRec *mir )
+{
+	OSErr err = noErr;
+	DigestManifest dm = {0};
+	FILE *f = nil;
+	char (*trackSHA)[2*kSHA256Size + 1] = nil;
+	char sha[2*kSHA256Size + 1];
+	UInt32 comparedCnt = 0, differCnt = 0, sampleCnt = 0;
+	UInt32 m, s;
+	long i;
+
+	if (vg.verifydigeststr[0]) {
+		BAILIFERR( ReadDigestManifest( vg.verifydigeststr, &dm ) );
+	}
+	if (vg.digeststr[0] && !(f = fopen( vg.digeststr, "w" ))) {
+		fprintf( _stderr, "Could not create digest manifest \"%s\"\n", vg.digeststr );
+		err = ioErr;
+		goto bail;
+	}
+	if (f) fprintf( f, "# ValidateMP4 content digests 1\n" );
+
+	for (m = 0; m < vg.mdatCnt; m++) {
+		const MediaDataExtent *mdat = &vg.mdatList[m];
+
+		BAILIFNIL( vg.mdatDigests, allocFailedErr );
+		BAILIFERR( DigestMediaData( m, sha ) );
+		if (f) fprintf( f, "mdat %u %llu %llu %s\n", (unsigned)(m + 1), (unsigned long long)mdat->dataStart,
+							(unsigned long long)(mdat->dataStop - mdat->dataStart + 1), sha );
+		if (!vg.verifydigeststr[0]) continue;
+		if ((m >= dm.mdatCnt) || (dm.mdats[m].offset != mdat->dataStart) ||
+				(dm.mdats[m].size != mdat->dataStop - mdat->dataStart + 1) || strcmp( dm.mdats[m].sha, sha )) {
+			errprint( "'mdat' %u differs from the digest manifest\n", (unsigned)(m + 1) );
+			differCnt++;
+		}
+	}
+	for (m = vg.mdatCnt; m < dm.mdatCnt; m++) {
+		errprint( "'mdat' %u of the digest manifest is not in the file\n", (unsigned)(m + 1) );
+		differCnt++;
+	}
+
+	BAILIFNIL( trackSHA = calloc( mir->numTIRs + 1, sizeof(*trackSHA) ), allocFailedErr );
+	for (i = 0; i < mir->numTIRs; i++) {
+		TrackInfoRec *tir = &mir->tirList[i];
+
+		if (tir->digest) {
+			SHA256Final( &tir->digest->sha, trackSHA[i] );
+			sampleCnt += tir->digest->sampleCnt;
+		}
+		if (vg.verifydigeststr[0]) VerifyTrackDigest( &dm, tir, trackSHA[i], &comparedCnt, &differCnt );
+		if (!f || !tir->digest) continue;
+		fprintf( f, "track %u %u %u %s\n", (unsigned)tir->trackID, (unsigned)(tir->sampleSizeEntryCnt + tir->fragmentSampleCnt),
+					(unsigned)tir->digest->sampleCnt, trackSHA[i] );
+		for (s = 0; s < tir->digest->sampleCnt; s++) {
+			SampleDigest *sd = &tir->digest->samples[s];
+
+			fprintf( f, "sample %u %u %u %016llx\n", (unsigned)sd->trackID, (unsigned)sd->sampleNum,
+						(unsigned)sd->size, (unsigned long long)sd->hash );
+		}
+	}
+
+	for (s = 0; s < dm.trackCnt; s++) {
+		for (i = 0; (i < mir->numTIRs) && (mir->tirList[i].trackID != dm.tracks[s].trackID); i++) {}
+		if (i < mir->numTIRs) continue;
+		errprint( "Track ID %u of the digest manifest is not in the file\n", (unsigned)dm.tracks[s].trackID );
+		differCnt++;
+	}
+
+	if (vg.verifydigeststr[0]) {
+		reportprint( "<!-- Digests checked against \"%s\": %u of %u samples and %u 'mdat' atoms compared, %u differ -->\n",
+						vg.verifydigeststr, (unsigned)comparedCnt, (unsigned)sampleCnt, (unsigned)vg.mdatCnt, (unsigned)differCnt );
+	}
+
+bail:
+	if (f && fclose( f ) && !err) err = ioErr;
+	if (err && f) {
+		fprintf( _stderr, "Could not write digest manifest \"%s\" (err %d)\n", vg.digeststr, err );
+		remove( vg.digeststr );
+	}
+	if (trackSHA) free( trackSHA );
+	DisposeDigestManifest( &dm );
+	return err;
+}
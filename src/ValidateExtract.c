@@ -0,0 +1,441 @@
+/*
+
+This file contains Original Code and/or Modifications of Original Code
+as defined in and that are subject to the Apple Public Source License
+Version 2.0 (the 'License'). You may not use this file except in
+compliance with the License. Please obtain a copy of the License at
+http://www.opensource.apple.com/apsl/ and read it before using this
+file.
+
+The Original Code and all software distributed under the License are
+distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+Please see the License for the specific language governing rights and
+limitations under the License.
+
+*/
+
+#include "ValidateMP4.h"
+
+//==========================================================================================
+// Elementary stream extraction (-extract <trackID>:<file>)
+//
+//   Writes the samples of one track as a stream a decoder can read without the file
+//   format:  H.264 in Annex B form with the 'avcC' parameter sets ahead of the first sample
+//   (and, for 'avc1', every sync sample), AAC with an ADTS header on each frame, and MPEG-4
+//   Visual with its decoder specific info (the VOS/VOL headers) in front.  Only those
+//   headers are built here; the payload goes from file to file with CopyFileData, and
+//   payload that is contiguous in the input is copied in one go.
+
+enum {
+	kAVCSampleEntrySize = 86,		// the fixed part of a VisualSampleEntry
+	kAudioSampleEntrySize = 36,		// and of an AudioSampleEntry
+	kADTSHeaderSize = 7,
+	kADTSMaxFrameSize = 0x1FFF
+};
+
+typedef struct ExtractStream {
+	FILE	*out;
+	UInt64	outOffset;
+	UInt32	trackID;
+	OSType	format;					// of the current sample description
+	UInt32	sampleDescriptionIndex;
+
+	UInt8	*header;				// Annex B parameter sets, or the MPEG-4 Visual config
+	UInt32	headerSize;
+	Boolean	needsHeader;
+
+	UInt32	nalLengthSize;			// 'avc1'/'avc3'
+	UInt8	adtsHeader[kADTSHeaderSize];	// 'mp4a', without the frame length
+
+	UInt64	pendingOffset;			// input bytes not copied yet
+	UInt64	pendingSize;
+} ExtractStream;
+
+static const UInt8 kAnnexBStartCode[4] = { 0, 0, 0, 1 };
+
+//==========================================================================================
+
+static UInt32 Extract16( const UInt8 *p )
+{
+	return ((UInt32)p[0] << 8) | p[1];
+}
+
+static UInt32 Extract32( const UInt8 *p )
+{
+	return ((UInt32)p[0] << 24) | ((UInt32)p[1] << 16) | ((UInt32)p[2] << 8) | p[3];
+}
+
+static OSErr FlushExtractData( ExtractStream *es )
+{
+	OSErr err = noErr;
+
+	if (es->pendingSize) {
+		err = CopyFileData( vg.inFile, es->pendingOffset, es->pendingSize, es->out, es->outOffset );
+		es->outOffset += es->pendingSize;
+		es->pendingSize = 0;
+	}
+	return err;
+}
+
+//   queues input bytes for the kernel to copy, joining them to the last range when they follow it
+static OSErr CopyExtractData( ExtractStream *es, UInt64 offset, UInt64 size )
+{
+	OSErr err = noErr;
+
+	if (es->pendingSize && (es->pendingOffset + es->pendingSize == offset)) {
+		es->pendingSize += size;
+		return noErr;
+	}
+	BAILIFERR( FlushExtractData( es ) );
+	es->pendingOffset = offset;
+	es->pendingSize = size;
+
+bail:
+	return err;
+}
+
+static OSErr WriteExtractBytes( ExtractStream *es, const UInt8 *p, UInt32 size )
+{
+	OSErr err = noErr;
+
+	BAILIFERR( FlushExtractData( es ) );
+	BAILIF( fwrite( p, 1, size, es->out ) != size, ioErr );
+	es->outOffset += size;
+
+bail:
+	return err;
+}
+
+//==========================================================================================
+
+//   the payload of the first child atom of a sample entry with this type
+static OSErr FindSampleEntryAtom( SampleDescriptionPtr sd, UInt32 fixedSize, OSType type, UInt8 **pOut, UInt32 *sizeOut )
+{
+	UInt8 *p = (UInt8 *)sd;
+	UInt32 entrySize = Extract32( p );
+	UInt32 offset = fixedSize;
+
+	while (offset + 8 <= entrySize) {
+		UInt32 atomSize = Extract32( p + offset );
+
+		if ((atomSize < 8) || (atomSize > entrySize - offset)) break;
+		if (Extract32( p + offset + 4 ) == type) {
+			*pOut = p + offset + 8;
+			*sizeOut = atomSize - 8;
+			return noErr;
+		}
+		offset += atomSize;
+	}
+	return badAtomErr;
+}
+
+//   the DecSpecificInfo in an 'esds'
+static OSErr GetDecoderSpecificInfo( UInt8 *esds, UInt32 esdsSize, UInt8 **pOut, UInt32 *sizeOut )
+{
+	OSErr err = noErr;
+	BitBuffer bb;
+	UInt32 tag, size, flags;
+
+	BAILIF( esdsSize < 4, badAtomErr );
+	BAILIFERR( BitBuffer_Init( &bb, esds + 4, esdsSize - 4 ) );		// after version and flags
+
+	BAILIFERR( GetDescriptorTagAndSize( &bb, &tag, &size ) );
+	BAILIF( tag != Class_ES_DescrTag, badAtomErr );
+	BAILIFERR( SkipBytes( &bb, 2 ) );			// ES_ID
+	flags = GetBits( &bb, 8, &err ); if (err) goto bail;
+	if (flags & 0x80) BAILIFERR( SkipBytes( &bb, 2 ) );						// dependsOn_ES_ID
+	if (flags & 0x40) BAILIFERR( SkipBytes( &bb, GetBits( &bb, 8, &err ) ) );	// URL
+	if (flags & 0x20) BAILIFERR( SkipBytes( &bb, 2 ) );						// OCR_ES_Id
+
+	BAILIFERR( GetDescriptorTagAndSize( &bb, &tag, &size ) );
+	BAILIF( tag != Class_DecoderConfigDescTag, badAtomErr );
+	BAILIFERR( SkipBytes( &bb, 13 ) );
+	BAILIFERR( GetDescriptorTagAndSize( &bb, &tag, &size ) );
+	BAILIF( (tag != Class_DecSpecificInfoTag) || (size > NumBytesLeft( &bb )), badAtomErr );
+
+	*pOut = esds + 4 + (bb.length - NumBytesLeft( &bb ));
+	*sizeOut = size;
+
+bail:
+	return err;
+}
+
+//   Annex B SPS and PPS from an 'avcC'
+static OSErr SetUpAVCStream( ExtractStream *es, UInt8 *avcC, UInt32 size )
+{
+	OSErr err = noErr;
+	UInt32 offset, pass, i, setCnt, setSize, headerSize = 0;
+
+	BAILIF( size < 7, badAtomErr );
+	es->nalLengthSize = (avcC[4] & 3) + 1;
+	BAILIF( es->nalLengthSize == 3, badAtomErr );
+
+	// measure, then copy
+	for (pass = 0; pass < 2; pass++) {
+		offset = 5;
+		headerSize = 0;
+		for (i = 0; i < 2; i++) {			// SPS, then PPS
+			BAILIF( offset >= size, badAtomErr );
+			setCnt = (i == 0) ? (avcC[offset] & 0x1F) : avcC[offset];
+			offset++;
+			while (setCnt--) {
+				BAILIF( size - offset < 2, badAtomErr );
+				setSize = Extract16( avcC + offset );
+				offset += 2;
+				BAILIF( size - offset < setSize, badAtomErr );
+				if (es->header) {
+					memcpy( es->header + headerSize, kAnnexBStartCode, 4 );
+					memcpy( es->header + headerSize + 4, avcC + offset, setSize );
+				}
+				headerSize += 4 + setSize;
+				offset += setSize;
+			}
+		}
+		if (pass == 0) BAILIFNIL( es->header = malloc( headerSize + 1 ), allocFailedErr );
+	}
+	es->headerSize = headerSize;
+
+bail:
+	return err;
+}
+
+//   the fixed part of the ADTS header from the AudioSpecificConfig
+static OSErr SetUpADTSStream( ExtractStream *es, UInt8 *config, UInt32 size )
+{
+	OSErr err = noErr;
+	BitBuffer bb;
+	UInt32 objectType, frequencyIndex, channels;
+
+	BAILIFERR( BitBuffer_Init( &bb, config, size ) );
+	objectType = GetBits( &bb, 5, &err ); if (err) goto bail;
+	if (objectType == 31) objectType = 32 + GetBits( &bb, 6, &err );
+	frequencyIndex = GetBits( &bb, 4, &err ); if (err) goto bail;
+	if (frequencyIndex == 15) {
+		fprintf( _stderr, "-extract: track %u has a sampling rate ADTS can't signal\n", (unsigned)es->trackID );
+		err = noCanDoErr;
+		goto bail;
+	}
+	channels = GetBits( &bb, 4, &err ); if (err) goto bail;
+	if ((objectType == 5) || (objectType == 29)) {		// SBR/PS; ADTS carries the core and the decoder finds the rest
+		if (GetBits( &bb, 4, &err ) == 15) GetBits( &bb, 24, &err );
+		objectType = GetBits( &bb, 5, &err ); if (err) goto bail;
+	}
+	if ((objectType < 1) || (objectType > 4) || (channels == 0) || (channels > 7)) {
+		fprintf( _stderr, "-extract: track %u is AAC object type %u with channel configuration %u, which ADTS can't carry\n",
+					(unsigned)es->trackID, (unsigned)objectType, (unsigned)channels );
+		err = noCanDoErr;
+		goto bail;
+	}
+
+	es->adtsHeader[0] = 0xFF;
+	es->adtsHeader[1] = 0xF1;			// MPEG-4, no CRC
+	es->adtsHeader[2] = (UInt8)(((objectType - 1) << 6) | (frequencyIndex << 2) | (channels >> 2));
+	es->adtsHeader[3] = (UInt8)((channels & 3) << 6);
+	es->adtsHeader[4] = 0;
+	es->adtsHeader[5] = 0x1F;			// buffer fullness 0x7FF (variable rate)
+	es->adtsHeader[6] = 0xFC;
+
+bail:
+	return err;
+}
+
+static OSErr SetUpExtractStream( ExtractStream *es, TrackInfoRec *tir, UInt32 sampleDescriptionIndex )
+{
+	OSErr err = noErr;
+	SampleDescriptionPtr sd;
+	UInt8 *p, *config;
+	UInt32 size, configSize;
+
+	if (es->header) free( es->header );
+	es->header = nil;
+	es->headerSize = 0;
+	es->needsHeader = true;
+	es->sampleDescriptionIndex = sampleDescriptionIndex;
+
+	if ((sampleDescriptionIndex < 1) || (sampleDescriptionIndex > tir->sampleDescriptionCnt) ||
+			!(sd = tir->sampleDescriptions[sampleDescriptionIndex])) {
+		fprintf( _stderr, "-extract: track %u has no sample description %u\n", (unsigned)es->trackID, (unsigned)sampleDescriptionIndex );
+		err = badAtomErr;
+		goto bail;
+	}
+	es->format = Extract32( (UInt8 *)sd + 4 );
+
+	switch (es->format) {
+		case 'avc1':
+		case 'avc3':
+			BAILIFERR( FindSampleEntryAtom( sd, kAVCSampleEntrySize, 'avcC', &p, &size ) );
+			BAILIFERR( SetUpAVCStream( es, p, size ) );
+			break;
+
+		case 'mp4a':
+			BAILIFERR( FindSampleEntryAtom( sd, kAudioSampleEntrySize, 'esds', &p, &size ) );
+			BAILIFERR( GetDecoderSpecificInfo( p, size, &config, &configSize ) );
+			BAILIFERR( SetUpADTSStream( es, config, configSize ) );
+			break;
+
+		case 'mp4v':
+			BAILIFERR( FindSampleEntryAtom( sd, kAVCSampleEntrySize, 'esds', &p, &size ) );
+			BAILIFERR( GetDecoderSpecificInfo( p, size, &config, &configSize ) );
+			BAILIFNIL( es->header = malloc( configSize + 1 ), allocFailedErr );
+			memcpy( es->header, config, configSize );
+			es->headerSize = configSize;
+			break;
+
+		default:
+			fprintf( _stderr, "-extract: track %u is '%s', which can't be written as an elementary stream\n",
+						(unsigned)es->trackID, ostypetostr( es->format ) );
+			err = noCanDoErr;
+			break;
+	}
+
+bail:
+	if (err == badAtomErr) {
+		fprintf( _stderr, "-extract: can't read the decoder configuration of track %u\n", (unsigned)es->trackID );
+	}
+	return err;
+}
+
+//==========================================================================================
+
+static OSErr ExtractSample( ExtractStream *es, TrackInfoRec *tir, UInt32 sampleNum, UInt64 offset, UInt32 size )
+{
+	OSErr err = noErr;
+	UInt64 end = offset + size;
+	UInt8 buf[kADTSHeaderSize];
+	UInt32 nalSize, frameSize, i;
+
+	if (end > (UInt64)vg.inMaxOffset) {
+		fprintf( _stderr, "-extract: sample %u of track %u is past the end of the file\n", (unsigned)sampleNum, (unsigned)es->trackID );
+		return badAtomErr;
+	}
+	if ((es->format == 'avc1') && IsSyncSample( tir, sampleNum )) es->needsHeader = true;
+	if (es->needsHeader && es->headerSize) {
+		BAILIFERR( WriteExtractBytes( es, es->header, es->headerSize ) );
+	}
+	es->needsHeader = false;
+
+	switch (es->format) {
+		case 'avc1':
+		case 'avc3':
+			// length prefixes become start codes
+			while (offset < end) {
+				BAILIF( end - offset < es->nalLengthSize, badAtomErr );
+				BAILIFERR( GetFileData( nil, buf, offset, es->nalLengthSize, &offset ) );
+				for (i = 0, nalSize = 0; i < es->nalLengthSize; i++) {
+					nalSize = (nalSize << 8) | buf[i];
+				}
+				BAILIF( nalSize > end - offset, badAtomErr );
+				BAILIFERR( WriteExtractBytes( es, kAnnexBStartCode, sizeof(kAnnexBStartCode) ) );
+				BAILIFERR( CopyExtractData( es, offset, nalSize ) );
+				offset += nalSize;
+			}
+			break;
+
+		case 'mp4a':
+			frameSize = kADTSHeaderSize + size;
+			BAILIF( frameSize > kADTSMaxFrameSize, noCanDoErr );
+			memcpy( buf, es->adtsHeader, kADTSHeaderSize );
+			buf[3] |= (UInt8)(frameSize >> 11);
+			buf[4] = (UInt8)(frameSize >> 3);
+			buf[5] |= (UInt8)(frameSize << 5);
+			BAILIFERR( WriteExtractBytes( es, buf, kADTSHeaderSize ) );
+			BAILIFERR( CopyExtractData( es, offset, size ) );
+			break;
+
+		default:
+			BAILIFERR( CopyExtractData( es, offset, size ) );
+			break;
+	}
+
+bail:
+	if (err == badAtomErr) {
+		fprintf( _stderr, "-extract: the NAL unit lengths in sample %u of track %u don't add up\n", (unsigned)sampleNum, (unsigned)es->trackID );
+	} else if (err == noCanDoErr) {
+		fprintf( _stderr, "-extract: sample %u of track %u is too big for an ADTS frame\n", (unsigned)sampleNum, (unsigned)es->trackID );
+	}
+	return err;
+}
+
+//   walks 'stsc' forward once, so samples come out in decode order
+static OSErr ExtractTrack( ExtractStream *es, TrackInfoRec *tir )
+{
+	OSErr err = noErr;
+	UInt32 runEntry, chunkNum, lastChunk, sampleNum = 1, s;
+	SampleToChunk run, nextRun;
+
+	for (runEntry = 1; runEntry <= tir->sampleToChunkEntryCnt; runEntry++) {
+		GetSampleToChunk( tir, runEntry, &run );
+		lastChunk = tir->chunkOffsetEntryCnt;
+		if (runEntry < tir->sampleToChunkEntryCnt) {
+			GetSampleToChunk( tir, runEntry + 1, &nextRun );
+			if (nextRun.firstChunk - 1 < lastChunk) lastChunk = nextRun.firstChunk - 1;
+		}
+		if (run.sampleDescriptionIndex != es->sampleDescriptionIndex) {
+			BAILIFERR( SetUpExtractStream( es, tir, run.sampleDescriptionIndex ) );
+		}
+		for (chunkNum = run.firstChunk; chunkNum <= lastChunk; chunkNum++) {
+			UInt64 offset = GetChunkOffset( tir, chunkNum );
+
+			for (s = 0; (s < run.samplesPerChunk) && (sampleNum <= tir->sampleSizeEntryCnt); s++, sampleNum++) {
+				UInt32 size = GetSampleSize( tir, sampleNum );
+
+				BAILIFERR( ExtractSample( es, tir, sampleNum, offset, size ) );
+				offset += size;
+			}
+		}
+	}
+	BAILIFERR( FlushExtractData( es ) );
+
+bail:
+	return err;
+}
+
+OSErr WriteElementaryStream( MovieInfoRec *mir, const char *spec )
+{
+	OSErr err = noErr;
+	ExtractStream es = {0};
+	TrackInfoRec *tir = nil;
+	const char *path;
+	char *end;
+	long i;
+
+	es.trackID = (UInt32)strtoul( spec, &end, 10 );
+	if ((end == spec) || (*end != ':') || !end[1]) {
+		fprintf( _stderr, "-extract wants <trackID>:<file>, not \"%s\"\n", spec );
+		return paramErr;
+	}
+	path = end + 1;
+
+	if (!mir || !vg.inFilePath) {
+		fprintf( _stderr, "-extract needs a 'moov' in a file that can be read again\n" );
+		return paramErr;
+	}
+	for (i = 0; i < mir->numTIRs; i++) {
+		if (mir->tirList[i].trackID == es.trackID) tir = &mir->tirList[i];
+	}
+	if (!tir) {
+		fprintf( _stderr, "-extract: there is no track %u\n", (unsigned)es.trackID );
+		return paramErr;
+	}
+	if (tir->externalDataRefCnt || tir->hasTrackExtends) {
+		fprintf( _stderr, "-extract: track %u has data in other files or in movie fragments\n", (unsigned)es.trackID );
+		return noCanDoErr;
+	}
+
+	if (!(es.out = fopen( path, "wb" ))) {
+		fprintf( _stderr, "Could not create elementary stream file \"%s\"\n", path );
+		return ioErr;
+	}
+	err = ExtractTrack( &es, tir );
+
+	if (fclose( es.out ) && !err) err = ioErr;
+	if (err) {
+		fprintf( _stderr, "Could not write elementary stream file \"%s\" (err %d)\n", path, err );
+		remove( path );
+	}
+	if (es.header) free( es.header );
+	return err;
+}
@@ -19,6 +19,25 @@ limitations under the License.
 
 #include "ValidateMP4.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+	#define USE_SSE2 1
+	#include <emmintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+	#define USE_MMAP 1
+	#include <sys/mman.h>
+	#define USE_PTHREADS 1
+	#include <pthread.h>
+#endif
+
+// AVX2 kernels are compiled with a per-function target attribute and picked at run time
+#if USE_SSE2 && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define USE_AVX2 1
+	#include <immintrin.h>
+	#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
 
 //==========================================================================================
 
@@ -29,8 +48,17 @@ int GetFileData( atomOffsetEntry *aoe, void *dataP, UInt64 offset64, UInt64 size
 	long amtRead = 0;
 	long size = size64;
 	
+	if (vg.inStream) {
+		err = GetStreamData( dataP, offset64, size64 );
+		if (!err && newoffset64) *newoffset64 = offset64 + size64;
+		return err;
+	}
+	if (vg.cancelled && *vg.cancelled) {
+		return userCanceledErr;
+	}
+	
 	if (offset64 > 0x7FFFFFFFL) {
-		fprintf(stderr,"sorry - can't handle file offsets > 31-bits\n");
+		fprintf(_stderr,"sorry - can't handle file offsets > 31-bits\n");
 		err = noCanDoErr;
 		goto bail;
 	}
@@ -43,12 +71,58 @@ int GetFileData( atomOffsetEntry *aoe, void *dataP, UInt64 offset64, UInt64 size
 		err = outOfDataErr;
 		goto bail;
 	}
+	if (vg.mdatDigests) DigestFileData( offset64, dataP, size );
 
 	if (newoffset64) *newoffset64 = offset64 + size;
 bail:
 	return err;
 }
 
+//==========================================================================================
+
+//   with -tablemode mapped the sample tables are used where they sit in the file
+OSErr MapInputFile( void )
+{
+	OSErr err = noErr;
+#if USE_MMAP
+	void *p;
+	
+	if (vg.inMaxOffset <= 0) goto bail;
+	p = mmap( nil, vg.inMaxOffset, PROT_READ, MAP_PRIVATE, fileno(vg.inFile), 0 );
+	if (p == MAP_FAILED) {
+		err = noCanDoErr;
+		goto bail;
+	}
+	vg.inMap = p;
+bail:
+#else
+	err = noCanDoErr;
+#endif
+	return err;
+}
+
+void UnmapInputFile( void )
+{
+#if USE_MMAP
+	if (vg.inMap) {
+		munmap( (void *)vg.inMap, vg.inMaxOffset );
+	}
+#endif
+	vg.inMap = nil;
+}
+
+//   nil unless the file is mapped and the whole table is inside it; callers then read the table instead
+const UInt8 *GetMappedTable( UInt64 offset64, UInt64 size64 )
+{
+	if ((vg.tablemode != tablemode_mapped) || !vg.inMap) {
+		return nil;
+	}
+	if ((offset64 > (UInt64)vg.inMaxOffset) || (size64 > (UInt64)vg.inMaxOffset - offset64)) {
+		return nil;
+	}
+	return vg.inMap + offset64;
+}
+
 
 int GetFileDataN64( atomOffsetEntry *aoe, void *dataP, UInt64 offset64, UInt64 *newoffset64 )
 {
@@ -206,43 +280,51 @@ int GetSampleOffsetSize( TrackInfoRec *tir, UInt32 sampleNum, UInt64 *offsetOut,
 	UInt32 size = 0;
 	UInt32 chunkNum;
 	UInt32 sampleDelta;
-	UInt64 offset;
+	UInt64 offset = 0;
 	UInt32 sampleDescriptionIndex = 0;
+	SampleToChunk stsc, nextStsc;
 	
 	if (sampleNum > tir->sampleSizeEntryCnt) {
 		err = paramErr;
 		goto bail;
 	}
 	 
+	GetSampleToChunk( tir, 1, &stsc );
 	for (stsCnt = 1; stsCnt < tir->sampleToChunkEntryCnt; stsCnt++) {
 		int numChunks;
 		int numSamples;
 		
-		numChunks = (tir->sampleToChunk[stsCnt + 1].firstChunk - tir->sampleToChunk[stsCnt].firstChunk);
-		numSamples = numChunks * tir->sampleToChunk[stsCnt].samplesPerChunk;
+		GetSampleToChunk( tir, stsCnt + 1, &nextStsc );
+		numChunks = (nextStsc.firstChunk - stsc.firstChunk);
+		numSamples = numChunks * stsc.samplesPerChunk;
 		if (sampleNum < (sampleCnt + numSamples)) {
 			break;
 		}
 		sampleCnt += numSamples;
+		stsc = nextStsc;
 	}
 	
 	sampleDelta = sampleNum - sampleCnt;
-	samplesPerChunk = tir->sampleToChunk[stsCnt].samplesPerChunk;
-	chunkNum = tir->sampleToChunk[stsCnt].firstChunk + (sampleDelta / samplesPerChunk);
+	samplesPerChunk = stsc.samplesPerChunk;
+	if (samplesPerChunk == 0) {
+		err = paramErr;
+		goto bail;
+	}
+	chunkNum = stsc.firstChunk + (sampleDelta / samplesPerChunk);
 	sampleDelta %= samplesPerChunk;
 	
-	sampleCnt += samplesPerChunk * (chunkNum - tir->sampleToChunk[stsCnt].firstChunk);
+	sampleCnt += samplesPerChunk * (chunkNum - stsc.firstChunk);
 
-	offset = tir->chunkOffset[chunkNum].chunkOffset;
-	sampleDescriptionIndex = tir->sampleToChunk[stsCnt].sampleDescriptionIndex;
+	offset = GetChunkOffset( tir, chunkNum );
+	sampleDescriptionIndex = stsc.sampleDescriptionIndex;
 	if (tir->singleSampleSize) {
 		size = tir->singleSampleSize;
 		offset += sampleDelta * size; 
 	} else {
 		for (i = sampleCnt; i < sampleCnt + sampleDelta; i++) {
-			offset += tir->sampleSize[i].sampleSize;
+			offset += GetSampleSize( tir, i );
 		}
-		size = tir->sampleSize[sampleNum].sampleSize;
+		size = GetSampleSize( tir, sampleNum );
 	}
 	
 bail:
@@ -260,32 +342,35 @@ int GetChunkOffsetSize( TrackInfoRec *tir, UInt32 chunkNum, UInt64 *offsetOut, U
 	UInt32 sampleCnt = 1;
 	UInt32 samplesPerChunk;
 	UInt32 size = 0;
-	UInt64 offset;
+	UInt64 offset = 0;
 	UInt32 sampleDescriptionIndex = 0;
+	SampleToChunk stsc, nextStsc;
 	
 	if (chunkNum > tir->chunkOffsetEntryCnt) {
 		err = paramErr;
 		goto bail;
 	}
 	
+	GetSampleToChunk( tir, 1, &stsc );
 	for (stsCnt = 1; stsCnt < tir->sampleToChunkEntryCnt; stsCnt++) {
-		if (tir->sampleToChunk[stsCnt + 1].firstChunk > chunkNum) {
+		GetSampleToChunk( tir, stsCnt + 1, &nextStsc );
+		if (nextStsc.firstChunk > chunkNum) {
 			break;
 		}
-		sampleCnt += (tir->sampleToChunk[stsCnt].samplesPerChunk * 
-					(tir->sampleToChunk[stsCnt + 1].firstChunk - tir->sampleToChunk[stsCnt].firstChunk));
+		sampleCnt += (stsc.samplesPerChunk * (nextStsc.firstChunk - stsc.firstChunk));
+		stsc = nextStsc;
 	}
 	
-	samplesPerChunk = tir->sampleToChunk[stsCnt].samplesPerChunk;
-	sampleCnt += samplesPerChunk * (chunkNum - tir->sampleToChunk[stsCnt].firstChunk);
-	sampleDescriptionIndex = tir->sampleToChunk[stsCnt].sampleDescriptionIndex;
+	samplesPerChunk = stsc.samplesPerChunk;
+	sampleCnt += samplesPerChunk * (chunkNum - stsc.firstChunk);
+	sampleDescriptionIndex = stsc.sampleDescriptionIndex;
 	
-	offset = tir->chunkOffset[chunkNum].chunkOffset;
+	offset = GetChunkOffset( tir, chunkNum );
 	if (tir->singleSampleSize) {
 		size = samplesPerChunk * tir->singleSampleSize;
 	} else {
 		for (i = sampleCnt; i < sampleCnt + samplesPerChunk; i++) {
-			size += tir->sampleSize[i].sampleSize;
+			size += GetSampleSize( tir, i );
 		}
 	}
 			
@@ -307,7 +392,7 @@ int GetFileStartCode( atomOffsetEntry *aoe, UInt32 *startCode, UInt64 offset64,
 	UInt32 bits = 0;
 	
 	if (offset64 > 0x7FFFFFFFL) {
-		fprintf(stderr,"sorry - can't handle file offsets > 31-bits\n");
+		fprintf(_stderr,"sorry - can't handle file offsets > 31-bits\n");
 		err = noCanDoErr;
 		goto bail;
 	}
@@ -356,6 +441,243 @@ UInt64 Endian64_Swap(UInt64 value)
 }
 #endif
 
+//=========  Bulk table byte swapping =========
+//   sample tables are read as big-endian arrays and converted in place (or widened for 'stco');
+//   on big-endian targets these are plain copies or nothing at all
+
+#if USE_AVX2
+static int gUseAVX2 = -1;		// -1 until we've asked the CPU
+
+static void AskCPUForAVX2( void )
+{
+	__builtin_cpu_init();
+	gUseAVX2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+}
+
+//   the tables are swapped on worker threads too (-jobs, -server), so the CPU is asked once
+static Boolean UseAVX2( void )
+{
+#if USE_PTHREADS
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+	pthread_once( &once, AskCPUForAVX2 );
+#else
+	if (gUseAVX2 < 0) AskCPUForAVX2();
+#endif
+	return gUseAVX2;
+}
+
+AVX2_TARGET static UInt32 SwapBigEndian32_AVX2( UInt32 *p, UInt32 count )
+{
+	const __m256i mask = _mm256_setr_epi8( 3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12,
+										   3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12 );
+	UInt32 i = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)&p[i]);
+		_mm256_storeu_si256((__m256i *)&p[i], _mm256_shuffle_epi8(v, mask));
+	}
+	return i;
+}
+
+AVX2_TARGET static UInt32 SwapBigEndian64_AVX2( UInt64 *p, UInt32 count )
+{
+	const __m256i mask = _mm256_setr_epi8( 7,6,5,4,3,2,1,0, 15,14,13,12,11,10,9,8,
+										   7,6,5,4,3,2,1,0, 15,14,13,12,11,10,9,8 );
+	UInt32 i = 0;
+
+	for (; i + 4 <= count; i += 4) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)&p[i]);
+		_mm256_storeu_si256((__m256i *)&p[i], _mm256_shuffle_epi8(v, mask));
+	}
+	return i;
+}
+
+AVX2_TARGET static UInt32 WidenBigEndian32To64_AVX2( const UInt32 *src, UInt64 *dst, UInt32 count )
+{
+	const __m128i mask = _mm_setr_epi8( 3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12 );
+	UInt32 i = 0;
+
+	for (; i + 4 <= count; i += 4) {
+		__m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&src[i]), mask);
+		_mm256_storeu_si256((__m256i *)&dst[i], _mm256_cvtepu32_epi64(v));
+	}
+	return i;
+}
+#endif
+
+#if USE_SSE2 && TARGET_RT_LITTLE_ENDIAN
+static __m128i Swap16Lanes_SSE2( __m128i v )
+{
+	return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+static __m128i Swap32Lanes_SSE2( __m128i v )
+{
+	v = Swap16Lanes_SSE2(v);
+	v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2,3,0,1));
+	return _mm_shufflehi_epi16(v, _MM_SHUFFLE(2,3,0,1));
+}
+
+static __m128i Swap64Lanes_SSE2( __m128i v )
+{
+	v = Swap16Lanes_SSE2(v);
+	v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0,1,2,3));
+	return _mm_shufflehi_epi16(v, _MM_SHUFFLE(0,1,2,3));
+}
+#endif
+
+void SwapBigEndian32( UInt32 *p, UInt32 count )
+{
+#if TARGET_RT_LITTLE_ENDIAN
+	UInt32 i = 0;
+
+  #if USE_AVX2
+	if (UseAVX2()) i = SwapBigEndian32_AVX2( p, count );
+  #endif
+  #if USE_SSE2
+	for (; i + 4 <= count; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)&p[i]);
+		_mm_storeu_si128((__m128i *)&p[i], Swap32Lanes_SSE2(v));
+	}
+  #endif
+	for (; i < count; i++)
+		p[i] = EndianU32_BtoN(p[i]);
+#else
+  #pragma unused(p,count)
+#endif
+}
+
+void SwapBigEndian64( UInt64 *p, UInt32 count )
+{
+#if TARGET_RT_LITTLE_ENDIAN
+	UInt32 i = 0;
+
+  #if USE_AVX2
+	if (UseAVX2()) i = SwapBigEndian64_AVX2( p, count );
+  #endif
+  #if USE_SSE2
+	for (; i + 2 <= count; i += 2) {
+		__m128i v = _mm_loadu_si128((const __m128i *)&p[i]);
+		_mm_storeu_si128((__m128i *)&p[i], Swap64Lanes_SSE2(v));
+	}
+  #endif
+	for (; i < count; i++)
+		p[i] = EndianU64_BtoN(p[i]);
+#else
+  #pragma unused(p,count)
+#endif
+}
+
+//   src and dst must not overlap
+void WidenBigEndian32To64( const UInt32 *src, UInt64 *dst, UInt32 count )
+{
+	UInt32 i = 0;
+
+#if TARGET_RT_LITTLE_ENDIAN
+  #if USE_AVX2
+	if (UseAVX2()) i = WidenBigEndian32To64_AVX2( src, dst, count );
+  #endif
+  #if USE_SSE2
+	{
+		const __m128i zero = _mm_setzero_si128();
+
+		for (; i + 4 <= count; i += 4) {
+			__m128i v = Swap32Lanes_SSE2(_mm_loadu_si128((const __m128i *)&src[i]));
+			_mm_storeu_si128((__m128i *)&dst[i + 0], _mm_unpacklo_epi32(v, zero));
+			_mm_storeu_si128((__m128i *)&dst[i + 2], _mm_unpackhi_epi32(v, zero));
+		}
+	}
+  #endif
+#endif
+	for (; i < count; i++)
+		dst[i] = EndianU32_BtoN(src[i]);
+}
+
+//=========  Sample size table unpacking =========
+//   widen the packed big-endian 'stz2' fields into 32-bit native sizes;  dst gets count entries
+
+void UnpackSampleSizes4( const UInt8 *src, UInt32 *dst, UInt32 count )
+{
+	UInt32 i = 0;
+
+#if USE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i nibbleMask = _mm_set1_epi8(0x0F);
+
+	// 16 bytes in, 32 sizes out; high nibble comes first
+	for (; i + 32 <= count; i += 32, src += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)src);
+		__m128i hiN = _mm_and_si128(_mm_srli_epi16(v, 4), nibbleMask);
+		__m128i loN = _mm_and_si128(v, nibbleMask);
+		__m128i b0 = _mm_unpacklo_epi8(hiN, loN);
+		__m128i b1 = _mm_unpackhi_epi8(hiN, loN);
+		__m128i w;
+
+		w = _mm_unpacklo_epi8(b0, zero);
+		_mm_storeu_si128((__m128i *)&dst[i +  0], _mm_unpacklo_epi16(w, zero));
+		_mm_storeu_si128((__m128i *)&dst[i +  4], _mm_unpackhi_epi16(w, zero));
+		w = _mm_unpackhi_epi8(b0, zero);
+		_mm_storeu_si128((__m128i *)&dst[i +  8], _mm_unpacklo_epi16(w, zero));
+		_mm_storeu_si128((__m128i *)&dst[i + 12], _mm_unpackhi_epi16(w, zero));
+		w = _mm_unpacklo_epi8(b1, zero);
+		_mm_storeu_si128((__m128i *)&dst[i + 16], _mm_unpacklo_epi16(w, zero));
+		_mm_storeu_si128((__m128i *)&dst[i + 20], _mm_unpackhi_epi16(w, zero));
+		w = _mm_unpackhi_epi8(b1, zero);
+		_mm_storeu_si128((__m128i *)&dst[i + 24], _mm_unpacklo_epi16(w, zero));
+		_mm_storeu_si128((__m128i *)&dst[i + 28], _mm_unpackhi_epi16(w, zero));
+	}
+#endif
+	for (; i + 2 <= count; i += 2, src++) {
+		dst[i]     = *src >> 4;
+		dst[i + 1] = *src & 0x0F;
+	}
+	if (i < count)
+		dst[i] = *src >> 4;		// odd count, the last low nibble is padding
+}
+
+void UnpackSampleSizes8( const UInt8 *src, UInt32 *dst, UInt32 count )
+{
+	UInt32 i = 0;
+
+#if USE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; i + 16 <= count; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)&src[i]);
+		__m128i w;
+
+		w = _mm_unpacklo_epi8(v, zero);
+		_mm_storeu_si128((__m128i *)&dst[i +  0], _mm_unpacklo_epi16(w, zero));
+		_mm_storeu_si128((__m128i *)&dst[i +  4], _mm_unpackhi_epi16(w, zero));
+		w = _mm_unpackhi_epi8(v, zero);
+		_mm_storeu_si128((__m128i *)&dst[i +  8], _mm_unpacklo_epi16(w, zero));
+		_mm_storeu_si128((__m128i *)&dst[i + 12], _mm_unpackhi_epi16(w, zero));
+	}
+#endif
+	for (; i < count; i++)
+		dst[i] = src[i];
+}
+
+void UnpackSampleSizes16( const UInt8 *src, UInt32 *dst, UInt32 count )
+{
+	UInt32 i = 0;
+
+#if USE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; i + 8 <= count; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)&src[i * 2]);
+
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));		// big-endian shorts
+		_mm_storeu_si128((__m128i *)&dst[i + 0], _mm_unpacklo_epi16(v, zero));
+		_mm_storeu_si128((__m128i *)&dst[i + 4], _mm_unpackhi_epi16(v, zero));
+	}
+#endif
+	for (; i < count; i++)
+		dst[i] = (src[i * 2] << 8) | src[i * 2 + 1];
+}
+
 void EndianMatrix_BtoN( MatrixRecord *matrix )
 {
 	int i,j;
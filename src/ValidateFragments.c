@@ -0,0 +1,1500 @@
+/*
+
+This file contains Original Code and/or Modifications of Original Code
+as defined in and that are subject to the Apple Public Source License
+Version 2.0 (the 'License'). You may not use this file except in
+compliance with the License. Please obtain a copy of the License at
+http://www.opensource.apple.com/apsl/ and read it before using this
+file.
+
+The Original Code and all software distributed under the License are
+distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+Please see the License for the specific language governing rights and
+limitations under the License.
+
+*/
+
+#include "ValidateMP4.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+	#define USE_PTHREADS 1
+	#include <pthread.h>
+	#include <unistd.h>
+#endif
+
+//==========================================================================================
+// Movie fragments
+//
+//   'moof' atoms are validated in file order, one at a time, after the 'moov'.  Nothing
+//   read from a fragment outlives it except a few running totals per track (sample count,
+//   next decode time) and the last sequence number, so memory follows the size of the
+//   largest fragment rather than the length of the file.
+//
+//   With -jobs the fragments are checked on worker threads instead; see ValidateMovieFragments.
+
+enum {
+	// 'tfhd' flags
+	kTrackFragmentBaseDataOffsetPresent = 0x000001,
+	kTrackFragmentSampleDescriptionIndexPresent = 0x000002,
+	kTrackFragmentDefaultSampleDurationPresent = 0x000008,
+	kTrackFragmentDefaultSampleSizePresent = 0x000010,
+	kTrackFragmentDefaultSampleFlagsPresent = 0x000020,
+	kTrackFragmentDurationIsEmpty = 0x010000,
+	kTrackFragmentDefaultBaseIsMoof = 0x020000,
+
+	// 'trun' flags
+	kTrackRunDataOffsetPresent = 0x000001,
+	kTrackRunFirstSampleFlagsPresent = 0x000004,
+	kTrackRunSampleDurationPresent = 0x000100,
+	kTrackRunSampleSizePresent = 0x000200,
+	kTrackRunSampleFlagsPresent = 0x000400,
+	kTrackRunSampleCompositionTimeOffsetPresent = 0x000800,
+
+	kSampleIsNonSyncSample = 0x00010000,
+	kSampleFlagsReservedMask = 0xF0000000
+};
+
+typedef struct MovieFragmentInfo {
+	UInt64	moofOffset;
+	UInt64	nextDataOffset;			// end of the previous track fragment's data
+	Boolean	firstTrackFragment;
+} MovieFragmentInfo;
+
+typedef struct TrackFragmentInfo {
+	MovieFragmentInfo *mfi;
+	TrackInfoRec *tir;				// nil if the 'tfhd' was unusable
+	UInt32	tfhdFlags;
+	UInt64	baseDataOffset;
+	UInt64	nextDataOffset;			// where a 'trun' without a data offset starts
+	UInt32	sampleDescriptionIndex;
+	UInt32	defaultSampleDuration;
+	UInt32	defaultSampleSize;
+	UInt32	defaultSampleFlags;
+	UInt32	trunCnt;
+} TrackFragmentInfo;
+
+static TrackInfoRec *FindTrackByID( MovieInfoRec *mir, UInt32 trackID )
+{
+	long i;
+
+	for (i = 0; i < mir->numTIRs; i++) {
+		if (mir->tirList[i].trackID == trackID) {
+			return &mir->tirList[i];
+		}
+	}
+	return nil;
+}
+
+//==========================================================================================
+
+OSErr Validate_mvex_Atom( atomOffsetEntry *aoe, void *refcon )
+{
+	MovieInfoRec *mir = (MovieInfoRec *)refcon;
+	OSErr err = noErr;
+	long cnt;
+	atomOffsetEntry *list = nil;
+	long i;
+	OSErr atomerr = noErr;
+	atomOffsetEntry *entry;
+	UInt64 minOffset, maxOffset;
+
+	atomprintnotab(">\n");
+
+	minOffset = aoe->offset + aoe->atomStartSize;
+	maxOffset = aoe->offset + aoe->size - aoe->atomStartSize;
+
+	BAILIFERR( FindAtomOffsets( aoe, minOffset, maxOffset, &cnt, &list ) );
+
+	mir->hasMovieExtends = true;
+
+	// Process 'mehd' atoms
+	atomerr = ValidateAtomOfType( 'mehd', kTypeAtomFlagCanHaveAtMostOne,
+		Validate_mehd_Atom, cnt, list, mir );
+	if (!err) err = atomerr;
+
+	// Process 'trex' atoms
+	atomerr = ValidateAtomOfType( 'trex', kTypeAtomFlagMustHaveOne,
+		Validate_trex_Atom, cnt, list, mir );
+	if (!err) err = atomerr;
+
+	//
+	for (i = 0; i < cnt; i++) {
+		entry = &list[i];
+
+		if (entry->aoeflags & kAtomValidated) continue;
+
+		switch (entry->type) {
+			default:
+				warnprint("WARNING: unknown movie extends atom '%s'\n",ostypetostr(entry->type));
+				break;
+		}
+	}
+
+	for (i = 0; i < mir->numTIRs; i++) {
+		TrackInfoRec *tir = &mir->tirList[i];
+
+		if (!tir->hasTrackExtends && (tir->mediaType != 'hint')) {
+			errprint("No 'trex' for track ID %d\n", tir->trackID);
+			err = badAtomErr;
+		}
+	}
+
+	aoe->aoeflags |= kAtomValidated;
+bail:
+	if (list) free( list );
+	return err;
+}
+
+//==========================================================================================
+
+OSErr Validate_mehd_Atom( atomOffsetEntry *aoe, void *refcon )
+{
+#pragma unused(refcon)
+	OSErr err = noErr;
+	UInt32 version;
+	UInt32 flags;
+	UInt64 offset;
+	UInt64 fragmentDuration;
+
+	// Get version/flags
+	BAILIFERR( GetFullAtomVersionFlags( aoe, &version, &flags, &offset ) );
+
+	if (version == 0) {
+		UInt32 duration32;
+		BAILIFERR( GetFileDataN32( aoe, &duration32, offset, &offset ) );
+		fragmentDuration = duration32;
+	} else if (version == 1) {
+		BAILIFERR( GetFileDataN64( aoe, &fragmentDuration, offset, &offset ) );
+	} else {
+		errprint("Movie extends header is version other than 0 or 1\n");
+		err = badAtomErr;
+		goto bail;
+	}
+
+	// Print atom contents non-required fields
+	atomprintnotab("\tversion=\"%d\" flags=\"%d\"\n", version, flags);
+	atomprint("fragmentDuration=\"%s\"\n", int64todstr(fragmentDuration));
+	atomprint("/>\n");
+
+	// Check required field values
+	FieldMustBe( flags, 0, "'mehd' flags must be %d not 0x%lx" );
+
+	// All done
+	aoe->aoeflags |= kAtomValidated;
+
+bail:
+	return err;
+}
+
+//==========================================================================================
+
+typedef struct TrackExtendsRecord {
+	UInt32	trackID;
+	UInt32	defaultSampleDescriptionIndex;
+	UInt32	defaultSampleDuration;
+	UInt32	defaultSampleSize;
+	UInt32	defaultSampleFlags;
+} TrackExtendsRecord;
+
+OSErr Validate_trex_Atom( atomOffsetEntry *aoe, void *refcon )
+{
+	MovieInfoRec *mir = (MovieInfoRec *)refcon;
+	OSErr err = noErr;
+	UInt32 version;
+	UInt32 flags;
+	UInt64 offset;
+	TrackExtendsRecord trex;
+	TrackInfoRec *tir;
+
+	// Get version/flags
+	BAILIFERR( GetFullAtomVersionFlags( aoe, &version, &flags, &offset ) );
+
+	// Get data
+	BAILIFERR( GetFileData( aoe, &trex, offset, sizeof(trex), &offset ) );
+	SwapBigEndian32( &trex.trackID, sizeof(trex) / sizeof(UInt32) );
+
+	// Print atom contents non-required fields
+	atomprintnotab("\tversion=\"%d\" flags=\"%d\"\n", version, flags);
+	atomprint("trackID=\"%ld\"\n", trex.trackID);
+	atomprint("defaultSampleDescriptionIndex=\"%ld\"\n", trex.defaultSampleDescriptionIndex);
+	atomprint("defaultSampleDuration=\"%ld\"\n", trex.defaultSampleDuration);
+	atomprint("defaultSampleSize=\"%ld\"\n", trex.defaultSampleSize);
+	atomprint("defaultSampleFlags=\"0x%lx\"\n", trex.defaultSampleFlags);
+	atomprint("/>\n");
+
+	// Check required field values
+	FieldMustBe( version, 0, "'trex' version must be %d not %d" );
+	FieldMustBe( flags, 0, "'trex' flags must be %d not 0x%lx" );
+
+	if (!(tir = FindTrackByID( mir, trex.trackID ))) {
+		errprint("'trex' refers to track ID %d, which is not in the movie\n", trex.trackID);
+		err = badAtomErr;
+		goto bail;
+	}
+	if (tir->hasTrackExtends) {
+		errprint("Multiple 'trex' atoms for track ID %d\n", trex.trackID);
+	}
+	if ((trex.defaultSampleDescriptionIndex == 0) || (trex.defaultSampleDescriptionIndex > tir->sampleDescriptionCnt)) {
+		errprint("'trex' default sample description index %d of track ID %d is not between 1 and the number of sample descriptions (%d)\n",
+			trex.defaultSampleDescriptionIndex, trex.trackID, tir->sampleDescriptionCnt);
+	}
+	if (trex.defaultSampleFlags & kSampleFlagsReservedMask) {
+		errprint("'trex' default sample flags 0x%lx of track ID %d has reserved bits set\n", trex.defaultSampleFlags, trex.trackID);
+	}
+
+	tir->hasTrackExtends = true;
+	tir->defaultSampleDescriptionIndex = trex.defaultSampleDescriptionIndex;
+	tir->defaultSampleDuration = trex.defaultSampleDuration;
+	tir->defaultSampleSize = trex.defaultSampleSize;
+	tir->defaultSampleFlags = trex.defaultSampleFlags;
+	tir->fragmentSampleCnt = 0;
+	tir->fragmentDecodeTime = tir->timeToSampleDuration;
+
+	// All done
+	aoe->aoeflags |= kAtomValidated;
+
+bail:
+	return err;
+}
+
+//==========================================================================================
+
+OSErr Validate_moof_Atom( atomOffsetEntry *aoe, void *refcon )
+{
+#pragma unused(refcon)
+	OSErr err = noErr;
+	long cnt;
+	atomOffsetEntry *list = nil;
+	long i;
+	OSErr atomerr = noErr;
+	atomOffsetEntry *entry;
+	UInt64 minOffset, maxOffset;
+	MovieInfoRec *mir = vg.mir;
+	MovieFragmentInfo mfi;
+
+	atomprintnotab(">\n");
+
+	if (!mir) {
+		errprint("Movie fragment ('moof') without a movie ('moov') atom\n");
+		err = badAtomErr;
+		goto bail;
+	}
+	if (!mir->hasMovieExtends) {
+		errprint("Movie fragment ('moof') found but the 'moov' has no 'mvex' atom\n");
+		err = badAtomErr;
+	}
+	mir->fragmentCnt++;
+
+	minOffset = aoe->offset + aoe->atomStartSize;
+	maxOffset = aoe->offset + aoe->size - aoe->atomStartSize;
+
+	BAILIFERR( FindAtomOffsets( aoe, minOffset, maxOffset, &cnt, &list ) );
+
+	// Process 'mfhd' atoms
+	atomerr = ValidateAtomOfType( 'mfhd', kTypeAtomFlagMustHaveOne | kTypeAtomFlagCanHaveAtMostOne | kTypeAtomFlagMustBeFirst,
+		Validate_mfhd_Atom, cnt, list, mir );
+	if (!err) err = atomerr;
+
+	// Process 'traf' atoms
+	mfi.moofOffset = aoe->offset;
+	mfi.nextDataOffset = aoe->offset;
+	mfi.firstTrackFragment = true;
+	atomerr = ValidateAtomOfType( 'traf', 0,
+		Validate_traf_Atom, cnt, list, &mfi );
+	if (!err) err = atomerr;
+
+	//
+	for (i = 0; i < cnt; i++) {
+		entry = &list[i];
+
+		if (entry->aoeflags & kAtomValidated) continue;
+
+		switch (entry->type) {
+			case 'pssh':		// protection system data, not checked here
+			case 'skip':
+			case 'free':
+				break;
+
+			default:
+				warnprint("WARNING: unknown movie fragment atom '%s'\n",ostypetostr(entry->type));
+				break;
+		}
+	}
+
+	aoe->aoeflags |= kAtomValidated;
+bail:
+	if (list) free( list );
+	return err;
+}
+
+//==========================================================================================
+
+OSErr Validate_mfhd_Atom( atomOffsetEntry *aoe, void *refcon )
+{
+	MovieInfoRec *mir = (MovieInfoRec *)refcon;
+	OSErr err = noErr;
+	UInt32 version;
+	UInt32 flags;
+	UInt64 offset;
+	UInt32 sequenceNumber;
+
+	// Get version/flags
+	BAILIFERR( GetFullAtomVersionFlags( aoe, &version, &flags, &offset ) );
+
+	// Get data
+	BAILIFERR( GetFileDataN32( aoe, &sequenceNumber, offset, &offset ) );
+
+	// Print atom contents non-required fields
+	atomprintnotab("\tversion=\"%d\" flags=\"%d\"\n", version, flags);
+	atomprint("sequenceNumber=\"%ld\"\n", sequenceNumber);
+	atomprint("/>\n");
+
+	// Check required field values
+	FieldMustBe( version, 0, "'mfhd' version must be %d not %d" );
+	FieldMustBe( flags, 0, "'mfhd' flags must be %d not 0x%lx" );
+
+	if (mir->hasFragmentSequenceNumber && (sequenceNumber <= mir->fragmentSequenceNumber)) {
+		errprint("Movie fragment sequence number %ld does not increase (previous fragment was %ld)\n",
+			sequenceNumber, mir->fragmentSequenceNumber);
+	}
+	mir->fragmentSequenceNumber = sequenceNumber;
+	mir->hasFragmentSequenceNumber = true;
+
+	// All done
+	aoe->aoeflags |= kAtomValidated;
+
+bail:
+	return err;
+}
+
+//==========================================================================================
+
+OSErr Validate_traf_Atom( atomOffsetEntry *aoe, void *refcon )
+{
+	MovieFragmentInfo *mfi = (MovieFragmentInfo *)refcon;
+	OSErr err = noErr;
+	long cnt;
+	atomOffsetEntry *list = nil;
+	long i;
+	OSErr atomerr = noErr;
+	atomOffsetEntry *entry;
+	UInt64 minOffset, maxOffset;
+	TrackFragmentInfo tfi = {0};
+
+	atomprintnotab(">\n");
+
+	minOffset = aoe->offset + aoe->atomStartSize;
+	maxOffset = aoe->offset + aoe->size - aoe->atomStartSize;
+
+	BAILIFERR( FindAtomOffsets( aoe, minOffset, maxOffset, &cnt, &list ) );
+
+	tfi.mfi = mfi;
+
+	// Process 'tfhd' atoms
+	atomerr = ValidateAtomOfType( 'tfhd', kTypeAtomFlagMustHaveOne | kTypeAtomFlagCanHaveAtMostOne | kTypeAtomFlagMustBeFirst,
+		Validate_tfhd_Atom, cnt, list, &tfi );
+	if (!err) err = atomerr;
+
+	if (tfi.tir) {
+		// Process 'tfdt' atoms
+		atomerr = ValidateAtomOfType( 'tfdt', kTypeAtomFlagCanHaveAtMostOne,
+			Validate_tfdt_Atom, cnt, list, &tfi );
+		if (!err) err = atomerr;
+
+		// Process 'trun' atoms
+		atomerr = ValidateAtomOfType( 'trun', 0,
+			Validate_trun_Atom, cnt, list, &tfi );
+		if (!err) err = atomerr;
+
+		if ((tfi.tfhdFlags & kTrackFragmentDurationIsEmpty) && tfi.trunCnt) {
+			errprint("Track fragment of track ID %d has duration-is-empty set but has 'trun' atoms\n", tfi.tir->trackID);
+		}
+	}
+
+	//
+	for (i = 0; i < cnt; i++) {
+		entry = &list[i];
+
+		if (entry->aoeflags & kAtomValidated) continue;
+
+		switch (entry->type) {
+			case 'tfdt':		// skipped above when the 'tfhd' was unusable
+			case 'trun':
+
+			case 'sdtp':		// not checked in track fragments yet
+			case 'sbgp':
+			case 'sgpd':
+			case 'subs':
+			case 'saiz':
+			case 'saio':
+			case 'senc':
+				break;
+
+			default:
+				warnprint("WARNING: unknown track fragment atom '%s'\n",ostypetostr(entry->type));
+				break;
+		}
+	}
+
+	mfi->nextDataOffset = tfi.nextDataOffset;
+	mfi->firstTrackFragment = false;
+
+	aoe->aoeflags |= kAtomValidated;
+bail:
+	if (list) free( list );
+	return err;
+}
+
+//==========================================================================================
+
+OSErr Validate_tfhd_Atom( atomOffsetEntry *aoe, void *refcon )
+{
+	TrackFragmentInfo *tfi = (TrackFragmentInfo *)refcon;
+	OSErr err = noErr;
+	UInt32 version;
+	UInt32 flags;
+	UInt64 offset;
+	UInt32 trackID;
+	UInt64 baseDataOffset = 0;
+	UInt32 sampleDescriptionIndex = 0;
+	UInt32 defaultSampleDuration = 0;
+	UInt32 defaultSampleSize = 0;
+	UInt32 defaultSampleFlags = 0;
+	TrackInfoRec *tir;
+
+	// Get version/flags
+	BAILIFERR( GetFullAtomVersionFlags( aoe, &version, &flags, &offset ) );
+
+	// Get data
+	BAILIFERR( GetFileDataN32( aoe, &trackID, offset, &offset ) );
+	if (flags & kTrackFragmentBaseDataOffsetPresent) {
+		BAILIFERR( GetFileDataN64( aoe, &baseDataOffset, offset, &offset ) );
+	}
+	if (flags & kTrackFragmentSampleDescriptionIndexPresent) {
+		BAILIFERR( GetFileDataN32( aoe, &sampleDescriptionIndex, offset, &offset ) );
+	}
+	if (flags & kTrackFragmentDefaultSampleDurationPresent) {
+		BAILIFERR( GetFileDataN32( aoe, &defaultSampleDuration, offset, &offset ) );
+	}
+	if (flags & kTrackFragmentDefaultSampleSizePresent) {
+		BAILIFERR( GetFileDataN32( aoe, &defaultSampleSize, offset, &offset ) );
+	}
+	if (flags & kTrackFragmentDefaultSampleFlagsPresent) {
+		BAILIFERR( GetFileDataN32( aoe, &defaultSampleFlags, offset, &offset ) );
+	}
+
+	// Print atom contents non-required fields
+	atomprintnotab("\tversion=\"%d\" flags=\"0x%lx\"\n", version, flags);
+	atomprint("trackID=\"%ld\"\n", trackID);
+	if (flags & kTrackFragmentBaseDataOffsetPresent)
+		atomprint("baseDataOffset=\"%s\"\n", int64toxstr(baseDataOffset));
+	if (flags & kTrackFragmentSampleDescriptionIndexPresent)
+		atomprint("sampleDescriptionIndex=\"%ld\"\n", sampleDescriptionIndex);
+	if (flags & kTrackFragmentDefaultSampleDurationPresent)
+		atomprint("defaultSampleDuration=\"%ld\"\n", defaultSampleDuration);
+	if (flags & kTrackFragmentDefaultSampleSizePresent)
+		atomprint("defaultSampleSize=\"%ld\"\n", defaultSampleSize);
+	if (flags & kTrackFragmentDefaultSampleFlagsPresent)
+		atomprint("defaultSampleFlags=\"0x%lx\"\n", defaultSampleFlags);
+	atomprint("/>\n");
+
+	// Check required field values
+	FieldMustBe( version, 0, "'tfhd' version must be %d not %d" );
+
+	if (!(tir = FindTrackByID( vg.mir, trackID ))) {
+		errprint("Track fragment refers to track ID %d, which is not in the movie\n", trackID);
+		err = badAtomErr;
+		goto bail;
+	}
+	if (!tir->hasTrackExtends) {
+		errprint("Track fragment for track ID %d, which has no 'trex'\n", trackID);
+		err = badAtomErr;
+		goto bail;
+	}
+
+	if (!(flags & kTrackFragmentSampleDescriptionIndexPresent)) {
+		sampleDescriptionIndex = tir->defaultSampleDescriptionIndex;
+	} else if ((sampleDescriptionIndex == 0) || (sampleDescriptionIndex > tir->sampleDescriptionCnt)) {
+		errprint("'tfhd' sample description index %d of track ID %d is not between 1 and the number of sample descriptions (%d)\n",
+			sampleDescriptionIndex, trackID, tir->sampleDescriptionCnt);
+	}
+	if (!(flags & kTrackFragmentDefaultSampleDurationPresent)) defaultSampleDuration = tir->defaultSampleDuration;
+	if (!(flags & kTrackFragmentDefaultSampleSizePresent)) defaultSampleSize = tir->defaultSampleSize;
+	if (!(flags & kTrackFragmentDefaultSampleFlagsPresent)) {
+		defaultSampleFlags = tir->defaultSampleFlags;
+	} else if (defaultSampleFlags & kSampleFlagsReservedMask) {
+		errprint("'tfhd' default sample flags 0x%lx of track ID %d has reserved bits set\n", defaultSampleFlags, trackID);
+	}
+
+	// the data of the first track fragment is relative to the 'moof'; later ones follow on
+	// from the one before, unless they say otherwise
+	if (!(flags & kTrackFragmentBaseDataOffsetPresent)) {
+		if ((flags & kTrackFragmentDefaultBaseIsMoof) || tfi->mfi->firstTrackFragment) {
+			baseDataOffset = tfi->mfi->moofOffset;
+		} else {
+			baseDataOffset = tfi->mfi->nextDataOffset;
+		}
+	}
+
+	tfi->tir = tir;
+	tfi->tfhdFlags = flags;
+	tfi->baseDataOffset = baseDataOffset;
+	tfi->nextDataOffset = baseDataOffset;
+	tfi->sampleDescriptionIndex = sampleDescriptionIndex;
+	tfi->defaultSampleDuration = defaultSampleDuration;
+	tfi->defaultSampleSize = defaultSampleSize;
+	tfi->defaultSampleFlags = defaultSampleFlags;
+
+	// All done
+	aoe->aoeflags |= kAtomValidated;
+
+bail:
+	return err;
+}
+
+//==========================================================================================
+
+OSErr Validate_tfdt_Atom( atomOffsetEntry *aoe, void *refcon )
+{
+	TrackFragmentInfo *tfi = (TrackFragmentInfo *)refcon;
+	TrackInfoRec *tir = tfi->tir;
+	OSErr err = noErr;
+	UInt32 version;
+	UInt32 flags;
+	UInt64 offset;
+	UInt64 baseMediaDecodeTime;
+
+	// Get version/flags
+	BAILIFERR( GetFullAtomVersionFlags( aoe, &version, &flags, &offset ) );
+
+	if (version == 0) {
+		UInt32 decodeTime32;
+		BAILIFERR( GetFileDataN32( aoe, &decodeTime32, offset, &offset ) );
+		baseMediaDecodeTime = decodeTime32;
+	} else if (version == 1) {
+		BAILIFERR( GetFileDataN64( aoe, &baseMediaDecodeTime, offset, &offset ) );
+	} else {
+		errprint("Track fragment decode time is version other than 0 or 1\n");
+		err = badAtomErr;
+		goto bail;
+	}
+
+	// Print atom contents non-required fields
+	atomprintnotab("\tversion=\"%d\" flags=\"%d\"\n", version, flags);
+	atomprint("baseMediaDecodeTime=\"%s\"\n", int64todstr(baseMediaDecodeTime));
+	atomprint("/>\n");
+
+	// Check required field values
+	FieldMustBe( flags, 0, "'tfdt' flags must be %d not 0x%lx" );
+
+	if (baseMediaDecodeTime != tir->fragmentDecodeTime) {
+		char 	tempStr1[32];
+		char 	tempStr2[32];
+
+		warnprint("WARNING: 'tfdt' base media decode time (%s) of track ID %d is not the sum of the durations"
+				  " of the samples before it (%s)\n",
+				  int64todstr_r( baseMediaDecodeTime, tempStr1 ), tir->trackID,
+				  int64todstr_r( tir->fragmentDecodeTime, tempStr2 ));
+	}
+	tir->fragmentDecodeTime = baseMediaDecodeTime;
+	tir->hasFragmentDecodeTime = true;
+
+	// All done
+	aoe->aoeflags |= kAtomValidated;
+
+bail:
+	return err;
+}
+
+//==========================================================================================
+
+//   returns userCanceledErr once the server has stopped the job, noErr otherwise
+static OSErr ValidateFragmentSample( TrackInfoRec *tir, UInt32 sampleNum, UInt64 sampleOffset, UInt32 sampleSize,
+	UInt32 sampleDescriptionIndex )
+{
+	OSErr (*validator)( BitBuffer *bb, void *refcon );
+	UInt32 savedSampleDescriptionIndex = tir->currentSampleDescriptionIndex;
+	Ptr dataP = nil;
+	BitBuffer bb;
+	OSErr err = noErr;
+
+	switch (tir->mediaType) {
+		case 'vide':	validator = Validate_vide_sample_Bitstream;	break;
+		case 'soun':	validator = Validate_soun_sample_Bitstream;	break;
+		case 'odsm':	validator = Validate_odsm_sample_Bitstream;	break;
+		case 'sdsm':	validator = Validate_sdsm_sample_Bitstream;	break;
+		default:		return noErr;
+	}
+
+	sampleprint("<sample num=\"%d\" offset=\"%s\" size=\"%d\" />\n",sampleNum,int64toxstr(sampleOffset),sampleSize); vg.tabcnt++;
+	if ((dataP = malloc(sampleSize)) == nil) {
+		errprint("couldn't allocate %ld bytes for sample %ld\n", sampleSize, sampleNum);
+	} else if ((err = GetFileData( vg.fileaoe, dataP, sampleOffset, sampleSize, nil )) != noErr) {
+		if (err != userCanceledErr) {
+			errprint("couldn't read sample %ld\n", sampleNum);
+			err = noErr;
+		}
+	} else {
+		if ((sampleDescriptionIndex > 0) && (sampleDescriptionIndex <= tir->sampleDescriptionCnt)) {
+			tir->currentSampleDescriptionIndex = sampleDescriptionIndex;
+		}
+		DigestSample( tir, sampleNum, dataP, sampleSize );
+		BitBuffer_Init(&bb, (void *)dataP, sampleSize);
+		validator( &bb, tir );
+		tir->currentSampleDescriptionIndex = savedSampleDescriptionIndex;
+	}
+	if (dataP) free( dataP );
+	--vg.tabcnt; sampleprint("</sample>\n");
+	return err;
+}
+
+typedef struct TrackRunEntry {
+	UInt32	duration;
+	UInt32	size;
+	UInt32	flags;
+	SInt64	compositionOffset;
+} TrackRunEntry;
+
+static UInt8 *GetTrackRunEntry( UInt8 *p, UInt32 i, UInt32 version, UInt32 trunFlags, UInt32 firstSampleFlags,
+	TrackFragmentInfo *tfi, TrackRunEntry *entry )
+{
+	entry->duration = tfi->defaultSampleDuration;
+	entry->size = tfi->defaultSampleSize;
+	entry->flags = ((i == 0) && (trunFlags & kTrackRunFirstSampleFlagsPresent)) ? firstSampleFlags : tfi->defaultSampleFlags;
+	entry->compositionOffset = 0;
+
+	if (trunFlags & kTrackRunSampleDurationPresent) { entry->duration = EndianU32_BtoN(*(UInt32 *)p); p += 4; }
+	if (trunFlags & kTrackRunSampleSizePresent) { entry->size = EndianU32_BtoN(*(UInt32 *)p); p += 4; }
+	if (trunFlags & kTrackRunSampleFlagsPresent) { entry->flags = EndianU32_BtoN(*(UInt32 *)p); p += 4; }
+	if (trunFlags & kTrackRunSampleCompositionTimeOffsetPresent) {
+		UInt32 compositionOffset = EndianU32_BtoN(*(UInt32 *)p);
+		entry->compositionOffset = (version == 0) ? (SInt64)compositionOffset : (SInt64)(SInt32)compositionOffset;
+		p += 4;
+	}
+	return p;
+}
+
+OSErr Validate_trun_Atom( atomOffsetEntry *aoe, void *refcon )
+{
+	TrackFragmentInfo *tfi = (TrackFragmentInfo *)refcon;
+	TrackInfoRec *tir = tfi->tir;
+	OSErr err = noErr;
+	UInt32 version;
+	UInt32 flags;
+	UInt64 offset;
+	UInt32 sampleCount;
+	SInt32 dataOffset = 0;
+	UInt32 firstSampleFlags = 0;
+	UInt32 entrySize;
+	UInt8 *entries = nil;
+	UInt8 *p;
+	TrackRunEntry entry;
+	UInt64 firstSampleOffset, sampleOffset;
+	UInt64 firstDecodeTime;
+	UInt32 firstSampleNum;
+	UInt32 i;
+	Boolean reportedReservedFlags = false;
+	Boolean dataOutsideFile = false;
+	Boolean hasNonSyncSamples = false;
+
+	// Get version/flags
+	BAILIFERR( GetFullAtomVersionFlags( aoe, &version, &flags, &offset ) );
+
+	// Get data
+	BAILIFERR( GetFileDataN32( aoe, &sampleCount, offset, &offset ) );
+	if (flags & kTrackRunDataOffsetPresent) {
+		BAILIFERR( GetFileDataN32( aoe, &dataOffset, offset, &offset ) );
+	}
+	if (flags & kTrackRunFirstSampleFlagsPresent) {
+		BAILIFERR( GetFileDataN32( aoe, &firstSampleFlags, offset, &offset ) );
+	}
+
+	entrySize = 4 * (((flags & kTrackRunSampleDurationPresent) != 0) + ((flags & kTrackRunSampleSizePresent) != 0) +
+					 ((flags & kTrackRunSampleFlagsPresent) != 0) + ((flags & kTrackRunSampleCompositionTimeOffsetPresent) != 0));
+	if ((UInt64)sampleCount * entrySize > aoe->offset + aoe->size - offset) {
+		errprint("'trun' sample count %ld does not fit in the atom\n", sampleCount);
+		err = badAtomSize;
+		goto bail;
+	}
+	if (sampleCount && entrySize) {
+		BAILIFNIL( entries = malloc(sampleCount * entrySize), allocFailedErr );
+		BAILIFERR( GetFileData( aoe, entries, offset, sampleCount * entrySize, &offset ) );
+	}
+
+	// Print atom contents non-required fields
+	atomprintnotab("\tversion=\"%d\" flags=\"0x%lx\"\n", version, flags);
+	atomprint("sampleCount=\"%ld\"\n", sampleCount);
+	if (flags & kTrackRunDataOffsetPresent)
+		atomprint("dataOffset=\"%ld\"\n", dataOffset);
+	if (flags & kTrackRunFirstSampleFlagsPresent)
+		atomprint("firstSampleFlags=\"0x%lx\"\n", firstSampleFlags);
+	atomprint("/>\n");
+
+	// Check required field values
+	if (version > 1) {
+		errprint("'trun' version must be 0 or 1 not %d\n", version);
+	}
+	if ((flags & kTrackRunFirstSampleFlagsPresent) && (flags & kTrackRunSampleFlagsPresent)) {
+		errprint("'trun' must not have both first-sample-flags and sample-flags\n");
+	}
+
+	if (flags & kTrackRunDataOffsetPresent) {
+		firstSampleOffset = tfi->baseDataOffset + (SInt64)dataOffset;
+	} else {
+		firstSampleOffset = tfi->nextDataOffset;
+	}
+	firstSampleNum = tir->sampleSizeEntryCnt + tir->fragmentSampleCnt + 1;
+	firstDecodeTime = tir->fragmentDecodeTime;
+	tfi->trunCnt++;
+
+	vg.tabcnt++;
+	sampleOffset = firstSampleOffset;
+	for (i = 0, p = entries; i < sampleCount; i++) {
+		UInt32 sampleNum = firstSampleNum + i;
+
+		p = GetTrackRunEntry( p, i, version, flags, firstSampleFlags, tfi, &entry );
+		atomprintdetailed("<trunEntry duration=\"%ld\" size=\"%ld\" flags=\"0x%lx\" compositionTimeOffset=\"%ld\" />\n",
+			entry.duration, entry.size, entry.flags, (long)entry.compositionOffset);
+
+		if ((entry.flags & kSampleFlagsReservedMask) && !reportedReservedFlags) {
+			errprint("Sample flags 0x%lx of sample %ld of track ID %d have reserved bits set\n", entry.flags, sampleNum, tir->trackID);
+			reportedReservedFlags = true;
+		}
+		if (entry.flags & kSampleIsNonSyncSample) {
+			hasNonSyncSamples = true;
+		}
+		if (entry.size && !dataOutsideFile) {
+			if (sampleOffset + entry.size > (UInt64)vg.inMaxOffset) {
+				errprint("Sample %ld of track ID %d at %s runs beyond the end of the file\n",
+					sampleNum, tir->trackID, int64toxstr(sampleOffset));
+				dataOutsideFile = true;
+			} else if (vg.mdatList && !tir->externalDataRefCnt && !RangeIsInMediaData( sampleOffset, sampleOffset + entry.size - 1 )) {
+				errprint("Sample %ld of track ID %d at %s is not inside a media data ('mdat') atom\n",
+					sampleNum, tir->trackID, int64toxstr(sampleOffset));
+			}
+		}
+		sampleOffset += entry.size;
+		tir->fragmentDecodeTime += entry.duration;
+	}
+	--vg.tabcnt;
+	tir->fragmentSampleCnt += sampleCount;
+	tfi->nextDataOffset = sampleOffset;
+
+	if ((vg.checklevel >= checklevel_samples) && !dataOutsideFile) {
+		char *tag = (tir->mediaType == 'soun') ? "audi" : ostypetostr(tir->mediaType);
+		UInt64 decodeTime = firstDecodeTime;
+
+		sampleprint("<%s_SAMPLE_DATA>\n", tag); vg.tabcnt++;
+		sampleOffset = firstSampleOffset;
+		for (i = 0, p = entries; i < sampleCount; i++) {
+			UInt32 sampleNum = firstSampleNum + i;
+			SInt64 presentationTime;
+
+			p = GetTrackRunEntry( p, i, version, flags, firstSampleFlags, tfi, &entry );
+			presentationTime = (SInt64)decodeTime + entry.compositionOffset;
+			if (SampleNumberIsSelected( tir, sampleNum, hasNonSyncSamples && !(entry.flags & kSampleIsNonSyncSample) ) &&
+					SampleTimeIsSelected( tir, (presentationTime > 0) ? (UInt64)presentationTime : 0, entry.duration, 0 )) {
+				if (ValidateFragmentSample( tir, sampleNum, sampleOffset, entry.size, tfi->sampleDescriptionIndex ) == userCanceledErr) {
+					err = userCanceledErr;		// the server stopped the job
+					break;
+				}
+			}
+			sampleOffset += entry.size;
+			decodeTime += entry.duration;
+		}
+		--vg.tabcnt; sampleprint("</%s_SAMPLE_DATA>\n", tag);
+	}
+
+	// All done
+	aoe->aoeflags |= kAtomValidated;
+
+bail:
+	if (entries) free( entries );
+	return err;
+}
+
+//==========================================================================================
+// Fragment indexes
+//
+//   The top level atom list already says where every 'moof' is, so 'sidx' and 'tfra' are
+//   checked against it rather than trusted to find the fragments.
+
+static atomOffsetEntry *FindFileAtom( FileAtomList *fileAtoms, UInt64 offset, long *indexOut )
+{
+	long lo = 0, hi = fileAtoms->cnt;
+
+	while (lo < hi) {
+		long mid = lo + (hi - lo) / 2;
+		if (fileAtoms->list[mid].offset < offset) lo = mid + 1;
+		else hi = mid;
+	}
+	if (indexOut) *indexOut = lo;
+	if ((lo < fileAtoms->cnt) && (fileAtoms->list[lo].offset == offset)) {
+		return &fileAtoms->list[lo];
+	}
+	return nil;
+}
+
+static Boolean RangeHasFileAtom( FileAtomList *fileAtoms, UInt64 start, UInt64 stop, OSType type )
+{
+	long i;
+
+	FindFileAtom( fileAtoms, start, &i );
+	for ( ; (i < fileAtoms->cnt) && (fileAtoms->list[i].offset < stop); i++) {
+		if (fileAtoms->list[i].type == type) return true;
+	}
+	return false;
+}
+
+OSErr Validate_sidx_Atom( atomOffsetEntry *aoe, void *refcon )
+{
+	FileAtomList *fileAtoms = (FileAtomList *)refcon;
+	OSErr err = noErr;
+	UInt32 version;
+	UInt32 flags;
+	UInt64 offset;
+	UInt32 referenceID;
+	UInt32 timescale;
+	UInt64 earliestPresentationTime;
+	UInt64 firstOffset;
+	UInt16 reserved;
+	UInt16 referenceCount;
+	UInt32 *references = nil;
+	UInt64 referenceOffset;
+	TrackInfoRec *tir;
+	UInt32 i;
+	char 	tempStr1[32];
+	char 	tempStr2[32];
+
+	// Get version/flags
+	BAILIFERR( GetFullAtomVersionFlags( aoe, &version, &flags, &offset ) );
+
+	// Get data
+	BAILIFERR( GetFileDataN32( aoe, &referenceID, offset, &offset ) );
+	BAILIFERR( GetFileDataN32( aoe, &timescale, offset, &offset ) );
+	if (version == 0) {
+		UInt32 time32, offset32;
+		BAILIFERR( GetFileDataN32( aoe, &time32, offset, &offset ) );
+		BAILIFERR( GetFileDataN32( aoe, &offset32, offset, &offset ) );
+		earliestPresentationTime = time32;
+		firstOffset = offset32;
+	} else if (version == 1) {
+		BAILIFERR( GetFileDataN64( aoe, &earliestPresentationTime, offset, &offset ) );
+		BAILIFERR( GetFileDataN64( aoe, &firstOffset, offset, &offset ) );
+	} else {
+		errprint("Segment index is version other than 0 or 1\n");
+		err = badAtomErr;
+		goto bail;
+	}
+	BAILIFERR( GetFileDataN16( aoe, &reserved, offset, &offset ) );
+	BAILIFERR( GetFileDataN16( aoe, &referenceCount, offset, &offset ) );
+
+	if ((UInt64)referenceCount * 12 > aoe->offset + aoe->size - offset) {
+		errprint("'sidx' reference count %d does not fit in the atom\n", referenceCount);
+		err = badAtomSize;
+		goto bail;
+	}
+	if (referenceCount) {
+		BAILIFNIL( references = malloc(referenceCount * 12), allocFailedErr );
+		BAILIFERR( GetFileData( aoe, references, offset, referenceCount * 12, &offset ) );
+		SwapBigEndian32( references, referenceCount * 3 );
+	}
+
+	// Print atom contents non-required fields
+	atomprintnotab("\tversion=\"%d\" flags=\"%d\"\n", version, flags);
+	atomprint("referenceID=\"%ld\"\n", referenceID);
+	atomprint("timescale=\"%ld\"\n", timescale);
+	atomprint("earliestPresentationTime=\"%s\"\n", int64todstr(earliestPresentationTime));
+	atomprint("firstOffset=\"%s\"\n", int64todstr(firstOffset));
+	atomprint("referenceCount=\"%d\"\n", referenceCount);
+	atomprint("/>\n");
+
+	// Check required field values
+	FieldMustBe( flags, 0, "'sidx' flags must be %d not 0x%lx" );
+	FieldMustBe( reserved, 0, "'sidx' reserved must be %d not %d" );
+
+	if (vg.mir) {
+		if (!(tir = FindTrackByID( vg.mir, referenceID ))) {
+			errprint("'sidx' reference ID %d is not a track in the movie\n", referenceID);
+		} else if (timescale != tir->mediaTimeScale) {
+			warnprint("WARNING: 'sidx' timescale %ld is not the media timescale of track ID %d (%ld)\n",
+				timescale, referenceID, tir->mediaTimeScale);
+		}
+	}
+
+	// references are contiguous, starting firstOffset bytes after the 'sidx'
+	referenceOffset = aoe->offset + aoe->size + firstOffset;
+	vg.tabcnt++;
+	for (i = 0; i < referenceCount; i++) {
+		UInt32 referenceType = references[3*i] >> 31;
+		UInt32 referencedSize = references[3*i] & 0x7FFFFFFF;
+		UInt32 subsegmentDuration = references[3*i + 1];
+		UInt32 startsWithSAP = references[3*i + 2] >> 31;
+		UInt32 SAPType = (references[3*i + 2] >> 28) & 7;
+		UInt32 SAPDeltaTime = references[3*i + 2] & 0x0FFFFFFF;
+		atomOffsetEntry *target;
+
+		atomprintdetailed("<sidxEntry referenceType=\"%ld\" offset=\"%s\" size=\"%ld\" duration=\"%ld\" startsWithSAP=\"%ld\" SAPType=\"%ld\" SAPDeltaTime=\"%ld\" />\n",
+			referenceType, int64toxstr(referenceOffset), referencedSize, subsegmentDuration, startsWithSAP, SAPType, SAPDeltaTime);
+
+		if (SAPType > 6) {
+			errprint("'sidx' reference %ld has reserved SAP type %ld\n", i + 1, SAPType);
+		}
+		if (referenceOffset + referencedSize > (UInt64)vg.inMaxOffset) {
+			errprint("'sidx' reference %ld at %s (%s bytes) runs beyond the end of the file\n", i + 1,
+				int64toxstr_r( referenceOffset, tempStr1 ), int64todstr_r( referencedSize, tempStr2 ));
+			break;
+		}
+		if (!(target = FindFileAtom( fileAtoms, referenceOffset, nil ))) {
+			errprint("'sidx' reference %ld at %s does not start at a top level atom\n", i + 1, int64toxstr(referenceOffset));
+		} else if (referenceType == 1) {
+			if (target->type != 'sidx') {
+				errprint("'sidx' reference %ld at %s should be a segment index ('sidx') but is a '%s' atom\n", i + 1,
+					int64toxstr_r( referenceOffset, tempStr1 ), ostypetostr(target->type));
+			}
+		} else if (!RangeHasFileAtom( fileAtoms, referenceOffset, referenceOffset + referencedSize, 'moof' )) {
+			errprint("'sidx' reference %ld at %s does not contain a movie fragment ('moof')\n", i + 1, int64toxstr(referenceOffset));
+		}
+		referenceOffset += referencedSize;
+	}
+	--vg.tabcnt;
+
+	// All done
+	aoe->aoeflags |= kAtomValidated;
+
+bail:
+	if (references) free( references );
+	return err;
+}
+
+//==========================================================================================
+
+OSErr Validate_mfra_Atom( atomOffsetEntry *aoe, void *refcon )
+{
+	OSErr err = noErr;
+	long cnt;
+	atomOffsetEntry *list = nil;
+	long i;
+	OSErr atomerr = noErr;
+	atomOffsetEntry *entry;
+	UInt64 minOffset, maxOffset;
+
+	atomprintnotab(">\n");
+
+	minOffset = aoe->offset + aoe->atomStartSize;
+	maxOffset = aoe->offset + aoe->size - aoe->atomStartSize;
+
+	BAILIFERR( FindAtomOffsets( aoe, minOffset, maxOffset, &cnt, &list ) );
+
+	// Process 'tfra' atoms
+	atomerr = ValidateAtomOfType( 'tfra', 0,
+		Validate_tfra_Atom, cnt, list, refcon );
+	if (!err) err = atomerr;
+
+	// Process 'mfro' atoms
+	atomerr = ValidateAtomOfType( 'mfro', kTypeAtomFlagMustHaveOne | kTypeAtomFlagCanHaveAtMostOne,
+		Validate_mfro_Atom, cnt, list, aoe );
+	if (!err) err = atomerr;
+
+	if (cnt && (list[cnt - 1].type != 'mfro')) {
+		errprint("The 'mfro' must be the last atom in the 'mfra'\n");
+	}
+	if (aoe->offset + aoe->size != (UInt64)vg.inMaxOffset) {
+		warnprint("WARNING: the movie fragment random access ('mfra') atom is not at the end of the file\n");
+	}
+
+	//
+	for (i = 0; i < cnt; i++) {
+		entry = &list[i];
+
+		if (entry->aoeflags & kAtomValidated) continue;
+
+		switch (entry->type) {
+			default:
+				warnprint("WARNING: unknown movie fragment random access atom '%s'\n",ostypetostr(entry->type));
+				break;
+		}
+	}
+
+	aoe->aoeflags |= kAtomValidated;
+bail:
+	if (list) free( list );
+	return err;
+}
+
+//==========================================================================================
+
+static UInt64 GetBigEndianField( UInt8 **pp, UInt32 size )
+{
+	UInt64 value = 0;
+	UInt8 *p = *pp;
+
+	while (size--) {
+		value = (value << 8) | *p++;
+	}
+	*pp = p;
+	return value;
+}
+
+OSErr Validate_tfra_Atom( atomOffsetEntry *aoe, void *refcon )
+{
+	FileAtomList *fileAtoms = (FileAtomList *)refcon;
+	OSErr err = noErr;
+	UInt32 version;
+	UInt32 flags;
+	UInt64 offset;
+	UInt32 trackID;
+	UInt32 fieldSizes;
+	UInt32 trafNumberSize, trunNumberSize, sampleNumberSize;
+	UInt32 entryCount;
+	UInt32 entrySize;
+	UInt8 *entries = nil;
+	UInt8 *p;
+	UInt64 previousTime = 0;
+	Boolean reportedOrder = false;
+	UInt32 i;
+
+	// Get version/flags
+	BAILIFERR( GetFullAtomVersionFlags( aoe, &version, &flags, &offset ) );
+
+	if (version > 1) {
+		errprint("Track fragment random access is version other than 0 or 1\n");
+		err = badAtomErr;
+		goto bail;
+	}
+
+	// Get data
+	BAILIFERR( GetFileDataN32( aoe, &trackID, offset, &offset ) );
+	BAILIFERR( GetFileDataN32( aoe, &fieldSizes, offset, &offset ) );
+	BAILIFERR( GetFileDataN32( aoe, &entryCount, offset, &offset ) );
+
+	trafNumberSize = ((fieldSizes >> 4) & 3) + 1;
+	trunNumberSize = ((fieldSizes >> 2) & 3) + 1;
+	sampleNumberSize = (fieldSizes & 3) + 1;
+	entrySize = ((version == 1) ? 16 : 8) + trafNumberSize + trunNumberSize + sampleNumberSize;
+	if ((UInt64)entryCount * entrySize > aoe->offset + aoe->size - offset) {
+		errprint("'tfra' entry count %ld does not fit in the atom\n", entryCount);
+		err = badAtomSize;
+		goto bail;
+	}
+	if (entryCount) {
+		BAILIFNIL( entries = malloc(entryCount * entrySize), allocFailedErr );
+		BAILIFERR( GetFileData( aoe, entries, offset, entryCount * entrySize, &offset ) );
+	}
+
+	// Print atom contents non-required fields
+	atomprintnotab("\tversion=\"%d\" flags=\"%d\"\n", version, flags);
+	atomprint("trackID=\"%ld\"\n", trackID);
+	atomprint("lengthSizeOfTrafNum=\"%ld\"\n", trafNumberSize - 1);
+	atomprint("lengthSizeOfTrunNum=\"%ld\"\n", trunNumberSize - 1);
+	atomprint("lengthSizeOfSampleNum=\"%ld\"\n", sampleNumberSize - 1);
+	atomprint("numberOfEntry=\"%ld\"\n", entryCount);
+	atomprint("/>\n");
+
+	// Check required field values
+	FieldMustBe( flags, 0, "'tfra' flags must be %d not 0x%lx" );
+	FieldMustBe( fieldSizes & 0xFFFFFFC0, 0, "'tfra' reserved bits must be %d not 0x%lx" );
+
+	if (vg.mir && !FindTrackByID( vg.mir, trackID )) {
+		errprint("'tfra' refers to track ID %d, which is not in the movie\n", trackID);
+	}
+
+	vg.tabcnt++;
+	for (i = 0, p = entries; i < entryCount; i++) {
+		UInt64 time = GetBigEndianField( &p, (version == 1) ? 8 : 4 );
+		UInt64 moofOffset = GetBigEndianField( &p, (version == 1) ? 8 : 4 );
+		UInt32 trafNumber = GetBigEndianField( &p, trafNumberSize );
+		UInt32 trunNumber = GetBigEndianField( &p, trunNumberSize );
+		UInt32 sampleNumber = GetBigEndianField( &p, sampleNumberSize );
+		atomOffsetEntry *target;
+		char 	tempStr1[32];
+
+		atomprintdetailed("<tfraEntry time=\"%s\" moofOffset=\"%s\" trafNumber=\"%ld\" trunNumber=\"%ld\" sampleNumber=\"%ld\" />\n",
+			int64todstr_r( time, tempStr1 ), int64toxstr(moofOffset), trafNumber, trunNumber, sampleNumber);
+
+		if ((i > 0) && (time < previousTime) && !reportedOrder) {
+			errprint("'tfra' times of track ID %d decrease at entry %ld\n", trackID, i + 1);
+			reportedOrder = true;
+		}
+		previousTime = time;
+
+		target = FindFileAtom( fileAtoms, moofOffset, nil );
+		if (!target || (target->type != 'moof')) {
+			errprint("'tfra' entry %ld of track ID %d points at %s, which is not a movie fragment ('moof')\n",
+				i + 1, trackID, int64toxstr(moofOffset));
+		}
+		if ((trafNumber == 0) || (trunNumber == 0) || (sampleNumber == 0)) {
+			errprint("'tfra' entry %ld of track ID %d has a zero traf, trun or sample number (they start at 1)\n", i + 1, trackID);
+		}
+	}
+	--vg.tabcnt;
+
+	// All done
+	aoe->aoeflags |= kAtomValidated;
+
+bail:
+	if (entries) free( entries );
+	return err;
+}
+
+//==========================================================================================
+
+OSErr Validate_mfro_Atom( atomOffsetEntry *aoe, void *refcon )
+{
+	atomOffsetEntry *mfra = (atomOffsetEntry *)refcon;
+	OSErr err = noErr;
+	UInt32 version;
+	UInt32 flags;
+	UInt64 offset;
+	UInt32 size;
+
+	// Get version/flags
+	BAILIFERR( GetFullAtomVersionFlags( aoe, &version, &flags, &offset ) );
+
+	// Get data
+	BAILIFERR( GetFileDataN32( aoe, &size, offset, &offset ) );
+
+	// Print atom contents non-required fields
+	atomprintnotab("\tversion=\"%d\" flags=\"%d\"\n", version, flags);
+	atomprint("size=\"%ld\"\n", size);
+	atomprint("/>\n");
+
+	// Check required field values
+	FieldMustBe( version, 0, "'mfro' version must be %d not %d" );
+	FieldMustBe( flags, 0, "'mfro' flags must be %d not 0x%lx" );
+
+	if (size != mfra->size) {
+		errprint("'mfro' size %ld is not the size of its 'mfra' (%s)\n", size, int64todstr(mfra->size));
+	}
+
+	// All done
+	aoe->aoeflags |= kAtomValidated;
+
+bail:
+	return err;
+}
+
+//==========================================================================================
+// Parallel fragment validation (-jobs)
+//
+//   A fragment's report depends on what the fragments before it left behind: the sample
+//   count and decode time of each track, and the last sequence number.  So each fragment
+//   is checked twice.  The first pass runs quietly at check level 1 and only notes what
+//   the fragment did to that state.  A running sum over the notes, in file order, gives
+//   every fragment the state it starts from; the second pass then checks the fragments
+//   for real, sequence number and 'tfdt' continuity included.  Both passes run on the
+//   workers.  Second pass reports are buffered per fragment and written in file order, so
+//   the output is the same as with -jobs 1.
+
+#if USE_PTHREADS
+
+typedef struct FragmentTrackState {
+	UInt32	sampleCnt;
+	UInt64	decodeTime;
+	Boolean	hasDecodeTime;
+} FragmentTrackState;
+
+typedef struct FragmentJob {
+	atomOffsetEntry *entry;
+	long	moofNum;					// 1 based, for the atom path
+	Boolean	hasSequenceNumber;			// the state the fragment starts from (second pass)
+	UInt32	sequenceNumber;				//   or what it did to it (first pass)
+	FragmentTrackState *tracks;
+	char	*out;
+	size_t	outSize;
+	char	*errOut;
+	size_t	errOutSize;
+	OSErr	err;
+	Boolean	done;
+} FragmentJob;
+
+typedef struct FragmentPool {
+	ValidateGlobals *globals;			// the main thread's
+	MovieInfoRec *mir;
+	size_t	mirSize;
+	FragmentJob *jobs;
+	long	jobCnt;
+	Boolean	quiet;						// first pass
+	long	nextJob;
+	long	nextMerge;					// workers stay within window jobs of the merge
+	long	window;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} FragmentPool;
+
+typedef struct FragmentWorker {
+	FragmentPool *pool;
+	pthread_t thread;
+	FILE	*inFile;
+	FILE	*nullFile;
+	MovieInfoRec *mir;					// private copy; the sample tables are shared
+} FragmentWorker;
+
+static void *FragmentWorkerMain( void *arg )
+{
+	FragmentWorker *worker = (FragmentWorker *)arg;
+	FragmentPool *pool = worker->pool;
+	MovieInfoRec *mir = worker->mir;
+	FragmentJob *job;
+	long t;
+
+	if (pool->globals != &vg) vg = *pool->globals;
+	vg.inFile = worker->inFile;
+	vg.mir = mir;
+	if (pool->quiet) {
+		vg.outFile = vg.errFile = worker->nullFile;
+		vg.checklevel = 1;
+		vg.print_atompath = vg.print_atom = vg.print_sample = false;
+		vg.printatom = vg.printsample = false;
+	}
+
+	for (;;) {
+		pthread_mutex_lock( &pool->lock );
+		while ((pool->nextJob < pool->jobCnt) && (pool->nextJob >= pool->nextMerge + pool->window)) {
+			pthread_cond_wait( &pool->cond, &pool->lock );
+		}
+		job = (pool->nextJob < pool->jobCnt) ? &pool->jobs[pool->nextJob++] : nil;
+		pthread_mutex_unlock( &pool->lock );
+		if (!job) break;
+
+		memcpy( mir, pool->mir, pool->mirSize );
+		mir->fragmentCnt = job->moofNum - 1;
+		mir->hasFragmentSequenceNumber = job->hasSequenceNumber;
+		mir->fragmentSequenceNumber = job->sequenceNumber;
+		for (t = 0; t < mir->numTIRs; t++) {
+			mir->tirList[t].fragmentSampleCnt = job->tracks[t].sampleCnt;
+			mir->tirList[t].fragmentDecodeTime = job->tracks[t].decodeTime;
+			mir->tirList[t].hasFragmentDecodeTime = job->tracks[t].hasDecodeTime;
+		}
+		if (!pool->quiet) {
+			vg.outFile = open_memstream( &job->out, &job->outSize );
+			vg.errFile = open_memstream( &job->errOut, &job->errOutSize );
+		}
+
+		job->err = ValidateAtomEntry( job->entry, job->moofNum, Validate_moof_Atom, nil );
+
+		if (!pool->quiet) {
+			if (vg.outFile) fclose( vg.outFile );
+			if (vg.errFile) fclose( vg.errFile );
+			vg.outFile = vg.errFile = nil;
+		}
+		job->hasSequenceNumber = mir->hasFragmentSequenceNumber;
+		job->sequenceNumber = mir->fragmentSequenceNumber;
+		for (t = 0; t < mir->numTIRs; t++) {
+			job->tracks[t].sampleCnt = mir->tirList[t].fragmentSampleCnt;
+			job->tracks[t].decodeTime = mir->tirList[t].fragmentDecodeTime;
+			job->tracks[t].hasDecodeTime = mir->tirList[t].hasFragmentDecodeTime;
+		}
+
+		pthread_mutex_lock( &pool->lock );
+		job->done = true;
+		pthread_cond_broadcast( &pool->cond );
+		pthread_mutex_unlock( &pool->lock );
+	}
+	return nil;
+}
+
+static OSErr RunFragmentPass( FragmentPool *pool, FragmentWorker *workers, long workerCnt, Boolean quiet )
+{
+	OSErr err = noErr;
+	long started = 0;
+	long i;
+
+	pool->quiet = quiet;
+	pool->nextJob = 0;
+	pool->nextMerge = 0;
+	pool->window = quiet ? pool->jobCnt : 4 * workerCnt;
+	for (i = 0; i < pool->jobCnt; i++) {
+		pool->jobs[i].done = false;
+	}
+
+	for (started = 0; started < workerCnt; started++) {
+		if (pthread_create( &workers[started].thread, nil, FragmentWorkerMain, &workers[started] ) != 0) break;
+	}
+	if (started == 0) {
+		// no threads at all; do the work here
+		ValidateGlobals savedGlobals = vg;
+
+		pool->window = pool->jobCnt;
+		FragmentWorkerMain( &workers[0] );
+		vg = savedGlobals;
+	}
+
+	if (!quiet) {
+		for (i = 0; i < pool->jobCnt; i++) {
+			FragmentJob *job = &pool->jobs[i];
+
+			pthread_mutex_lock( &pool->lock );
+			while (!job->done) {
+				pthread_cond_wait( &pool->cond, &pool->lock );
+			}
+			pthread_mutex_unlock( &pool->lock );
+
+			if (job->out) {
+				fwrite( job->out, 1, job->outSize, _stdout );
+				free( job->out );
+				job->out = nil;
+			}
+			if (job->errOut) {
+				fwrite( job->errOut, 1, job->errOutSize, _stderr );
+				free( job->errOut );
+				job->errOut = nil;
+			}
+			if (!err) err = job->err;
+
+			pthread_mutex_lock( &pool->lock );
+			pool->nextMerge = i + 1;
+			pthread_cond_broadcast( &pool->cond );
+			pthread_mutex_unlock( &pool->lock );
+		}
+	}
+
+	for (i = 0; i < started; i++) {
+		pthread_join( workers[i].thread, nil );
+	}
+	return err;
+}
+
+static OSErr ValidateMovieFragmentsInParallel( long cnt, atomOffsetEntry *list, long moofCnt, Boolean *handledOut )
+{
+	OSErr err = noErr;
+	MovieInfoRec *mir = vg.mir;
+	FragmentPool pool = {0};
+	FragmentWorker *workers = nil;
+	FragmentTrackState *trackStates = nil;
+	FragmentTrackState *stateTracks = nil;
+	FragmentJob state = {0};
+	FragmentJob *last;
+	long workerCnt = (vg.jobs < moofCnt) ? vg.jobs : moofCnt;
+	long numTIRs = mir->numTIRs;
+	long i, t;
+	Boolean haveLock = false;
+
+	*handledOut = false;
+
+	pool.globals = &vg;
+	pool.mir = mir;
+	pool.mirSize = sizeof(MovieInfoRec) + ((numTIRs > 1) ? (numTIRs - 1) * sizeof(TrackInfoRec) : 0);
+	pool.jobCnt = moofCnt;
+	BAILIFNIL( pool.jobs = calloc( moofCnt, sizeof(FragmentJob) ), allocFailedErr );
+	BAILIFNIL( trackStates = calloc( moofCnt * (numTIRs ? numTIRs : 1), sizeof(FragmentTrackState) ), allocFailedErr );
+	BAILIFNIL( stateTracks = calloc( numTIRs ? numTIRs : 1, sizeof(FragmentTrackState) ), allocFailedErr );
+	BAILIFNIL( workers = calloc( workerCnt, sizeof(FragmentWorker) ), allocFailedErr );
+
+	for (i = 0; i < workerCnt; i++) {
+		workers[i].pool = &pool;
+		BAILIFNIL( workers[i].inFile = fopen( vg.inFilePath, "rb" ), ioErr );
+		BAILIFNIL( workers[i].nullFile = fopen( "/dev/null", "w" ), ioErr );
+		BAILIFNIL( workers[i].mir = malloc( pool.mirSize ), allocFailedErr );
+	}
+	if (pthread_mutex_init( &pool.lock, nil ) != 0) { err = allocFailedErr; goto bail; }
+	if (pthread_cond_init( &pool.cond, nil ) != 0) { pthread_mutex_destroy( &pool.lock ); err = allocFailedErr; goto bail; }
+	haveLock = true;
+
+	for (i = 0, t = 0; i < cnt; i++) {
+		if ((list[i].type == 'moof') && !(list[i].aoeflags & (kAtomValidated | kAtomSkipThisAtom))) {
+			pool.jobs[t].entry = &list[i];
+			pool.jobs[t].moofNum = t + 1;
+			pool.jobs[t].tracks = &trackStates[t * numTIRs];
+			t++;
+		}
+	}
+
+	// from here on the fragments are ours to report on
+	*handledOut = true;
+
+	// first pass: what each fragment does to the running state, starting from nothing
+	RunFragmentPass( &pool, workers, workerCnt, true );
+
+	// the running sum gives each fragment its starting state
+	for (t = 0; t < numTIRs; t++) {
+		stateTracks[t].sampleCnt = mir->tirList[t].fragmentSampleCnt;
+		stateTracks[t].decodeTime = mir->tirList[t].fragmentDecodeTime;
+		stateTracks[t].hasDecodeTime = mir->tirList[t].hasFragmentDecodeTime;
+	}
+	state.hasSequenceNumber = mir->hasFragmentSequenceNumber;
+	state.sequenceNumber = mir->fragmentSequenceNumber;
+
+	for (i = 0; i < moofCnt; i++) {
+		FragmentJob *job = &pool.jobs[i];
+		Boolean hasSequenceNumber = job->hasSequenceNumber;
+		UInt32 sequenceNumber = job->sequenceNumber;
+
+		for (t = 0; t < numTIRs; t++) {
+			FragmentTrackState change = job->tracks[t];
+
+			job->tracks[t] = stateTracks[t];
+			stateTracks[t].sampleCnt += change.sampleCnt;
+			if (change.hasDecodeTime) {
+				stateTracks[t].decodeTime = change.decodeTime;
+				stateTracks[t].hasDecodeTime = true;
+			} else {
+				stateTracks[t].decodeTime += change.decodeTime;
+			}
+		}
+		job->hasSequenceNumber = state.hasSequenceNumber;
+		job->sequenceNumber = state.sequenceNumber;
+		if (hasSequenceNumber) {
+			state.hasSequenceNumber = true;
+			state.sequenceNumber = sequenceNumber;
+		}
+	}
+
+	// second pass: the real thing
+	err = RunFragmentPass( &pool, workers, workerCnt, false );
+
+	// leave the movie as a sequential run would have
+	last = &pool.jobs[moofCnt - 1];
+	mir->fragmentCnt += moofCnt;
+	mir->hasFragmentSequenceNumber = last->hasSequenceNumber;
+	mir->fragmentSequenceNumber = last->sequenceNumber;
+	for (t = 0; t < numTIRs; t++) {
+		mir->tirList[t].fragmentSampleCnt = last->tracks[t].sampleCnt;
+		mir->tirList[t].fragmentDecodeTime = last->tracks[t].decodeTime;
+		mir->tirList[t].hasFragmentDecodeTime = last->tracks[t].hasDecodeTime;
+	}
+
+bail:
+	if (haveLock) {
+		pthread_cond_destroy( &pool.cond );
+		pthread_mutex_destroy( &pool.lock );
+	}
+	if (workers) {
+		for (i = 0; i < workerCnt; i++) {
+			if (workers[i].inFile) fclose( workers[i].inFile );
+			if (workers[i].nullFile) fclose( workers[i].nullFile );
+			if (workers[i].mir) free( workers[i].mir );
+		}
+		free( workers );
+	}
+	if (stateTracks) free( stateTracks );
+	if (trackStates) free( trackStates );
+	if (pool.jobs) free( pool.jobs );
+	return err;
+}
+
+#endif	// USE_PTHREADS
+
+OSErr ValidateMovieFragments( long cnt, atomOffsetEntry *list )
+{
+#if USE_PTHREADS
+	long moofCnt = 0;
+	long i;
+
+	for (i = 0; i < cnt; i++) {
+		if ((list[i].type == 'moof') && !(list[i].aoeflags & (kAtomValidated | kAtomSkipThisAtom))) moofCnt++;
+	}
+	// the track digests need the samples in order
+	if ((vg.jobs > 1) && (moofCnt > 1) && vg.mir && vg.inFilePath && !vg.digest) {
+		Boolean handled;
+		OSErr err = ValidateMovieFragmentsInParallel( cnt, list, moofCnt, &handled );
+
+		if (handled) return err;
+	}
+#endif
+	return ValidateAtomOfType( 'moof', 0,
+		Validate_moof_Atom, cnt, list, nil );
+}
@@ -50,6 +50,11 @@ limitations under the License.
 
 #include "ValidateMP4.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+	#define USE_PTHREADS 1
+	#include <pthread.h>
+#endif
+
 // ---------------------------------------------------------------------------
 //		D E F I N I T I O N S
 // ---------------------------------------------------------------------------
@@ -63,6 +68,15 @@ limitations under the License.
 #define kSpaceChar					' '
 
 
+#define kHintSampleCacheEntries		8
+#define kHintSampleCacheMaxBytes	(8*1024*1024)
+
+#define kHintSamplesPerJob			64
+
+#define kHintBitrateMaxSeconds		(24*60*60)
+
+#define kRTPHeaderSize				12
+
 #define kMaxSDPPayloadNameLength	255
 #define kMaxSDPModeNameLength		31
 
@@ -81,6 +95,56 @@ typedef struct {
 } SDPInfoRec;
 
 
+// media samples referenced by the packets; many packets in a row use the same one
+typedef struct {
+	UInt32		trackID;
+	UInt32		sampleNum;
+	Ptr			data;				// nil if the entry is unused
+	UInt32		size;
+	UInt32		lastUse;
+} HintSampleCacheEntry;
+
+typedef struct {
+	HintSampleCacheEntry	entries[kHintSampleCacheEntries];
+	UInt32		useCount;
+	UInt32		bytes;
+} HintSampleCache;
+
+
+// one per packet, for the checks that need the packets in order (see Check_Hint_Packet_Order)
+typedef struct {
+	UInt32		hintSampleNum;
+	UInt32		mediaSampleNum;			// the first media sample the packet has data from, or 0
+	SInt32		relativeTransmissionTime;
+	SInt32		rtpTimeOffset;			// from an 'rtpo' TLV
+	UInt32		size;					// RTP header and payload
+	UInt16		sequenceNumber;
+	Boolean		repeatPacket;
+} HintPacketRecord;
+
+// carried from packet to packet across the whole track
+typedef struct {
+	TrackInfoRec	*tir;				// the hint track
+	TrackInfoRec	*mediaTIR;
+	UInt32		hintSampleNum;
+	UInt32		packetNum;
+	UInt64		hintSampleTime;
+	Boolean		hasSequenceNumber;
+	UInt16		sequenceNumber;
+	Boolean		hasPreviousPacket;		// false at the start and after samples that weren't checked
+	SInt64		transmissionTime;
+	SInt64		rtpTime;
+	UInt32		packetCnt;
+	UInt32		timelineMismatchCnt;
+	UInt32		rtpTimeBackwardsCnt;
+	UInt32		transmissionBackwardsCnt;
+	UInt64		*bytesPerSecond;		// the transmission bitrate curve, from firstSecond on
+	UInt32		secondCnt;
+	UInt64		firstSecond;
+	Boolean		bitrateStopped;			// the packets span more than kHintBitrateMaxSeconds
+} HintOrderState;
+
+
 typedef struct {
 	atomOffsetEntry	*aoe;
 	TrackInfoRec	*tir;
@@ -111,6 +175,13 @@ typedef struct {
 	Ptr				packetData;
 	char			*packetDataCurrent;
 	UInt32			packetDataMaxLength;
+
+	HintSampleCache	sampleCache;
+
+	HintPacketRecord	*packets;		// since the last Check_Hint_Packet_Order
+	UInt32			packetCnt;
+	UInt32			packetMax;
+	UInt32			packetMediaSampleNum;
 	
 	// ----- params for audio payload
 	Boolean			genericPayloadParamsOK;
@@ -135,6 +206,18 @@ typedef struct {
 #define H_ATOM_PRINT_HEXDATA(_x, _l)	{ if (doPrinting) {atomprinthexdata((_x), (_l)) ;}}
 
 
+struct HintJob;
+
+static OSErr Validate_Hint_Sample_Num( HintInfoRec *hir, UInt32 inSampleNum );
+static OSErr Validate_Hint_Sample_Range( HintInfoRec *hir, UInt32 startSampleNum, UInt32 endSampleNum, struct HintJob *job, HintOrderState *order );
+static void Check_Hint_Packet_Order( HintOrderState *order, HintPacketRecord *packets, UInt32 packetCnt );
+static void Finish_Hint_Packet_Order( HintInfoRec *hir, HintOrderState *order );
+static void Add_Hint_Bitrate_Bytes( HintOrderState *order, UInt64 second, UInt32 size );
+static OSErr record_hint_packet( HintInfoRec *hir, HintPacketRecord *inPacket );
+#if USE_PTHREADS
+static void Mark_Hint_Job_Sample( HintInfoRec *hir, struct HintJob *job );
+static OSErr Validate_Hint_Samples_In_Parallel( HintInfoRec *hir, UInt32 startSampleNum, UInt32 endSampleNum, HintOrderState *order, Boolean *handledOut );
+#endif
 static OSErr Validate_Hint_Sample( HintInfoRec *hir, char *inSampleData, UInt32 inLength );
 static OSErr Validate_Packet_Entry( HintInfoRec *hir, char *inPacketEntry, UInt32 inMaxLength, char **outNextEntryPtr );
 static OSErr Validate_Data_Entry( HintInfoRec *hir, char *inEntry );
@@ -172,6 +255,8 @@ static Boolean get_next_fmtp_param(char **inLine, char **outTagString, char **ou
 
 static OSErr get_original_track_info(UInt32 inRefTrackID, TrackInfoRec **outTIR);
 static OSErr get_track_sample(TrackInfoRec *tir, UInt32 inSampleNum, Ptr *dataOut, UInt32 *sizeOut, UInt32 *sampleDescriptionIndexOut);
+static OSErr get_cached_track_sample(HintSampleCache *cache, TrackInfoRec *tir, UInt32 inSampleNum, Ptr *dataOut, UInt32 *sizeOut);
+static void dispose_sample_cache(HintSampleCache *cache);
 
 
 // use hex equivalents instead of '\r' and '\n' since some compilers (MPW) are different
@@ -259,19 +344,16 @@ enum  {
 OSErr Validate_Hint_Track( atomOffsetEntry *aoe, TrackInfoRec *tir )
 {
 	OSErr		err = noErr;
-	UInt64		sampleOffset;
-	UInt32		sampleSize;
-	UInt32		sampleDescriptionIndex;
-	Ptr			dataP = nil;
-	UInt32		i;
 	UInt32		startSampleNum;
 	UInt32		endSampleNum;
 	Boolean		doPrinting = false;
+	Boolean		handled;
 	HintInfoRec	hir = {0};
+	HintOrderState	order = {0};
 	
 	UInt64 minOffset, maxOffset;
 	long cnt;
-	atomOffsetEntry *list;
+	atomOffsetEntry *list = nil;
 	OSErr		tempErr;
 
 	// -------------------------------------------------------
@@ -355,42 +437,552 @@ OSErr Validate_Hint_Track( atomOffsetEntry *aoe, TrackInfoRec *tir )
 	} else {
 		endSampleNum = tir->sampleSizeEntryCnt;
 	}
+	{
+		UInt32 firstSelected, lastSelected;
+		
+		GetSelectedSampleRange( tir, &firstSelected, &lastSelected );
+		if (startSampleNum < firstSelected) startSampleNum = firstSelected;
+		if (endSampleNum > lastSelected) endSampleNum = lastSelected;
+	}
+
+	order.tir = tir;
+	order.mediaTIR = hir.originalMediaTIR;
 
 	H_ATOM_PRINT_INCR(("<hint_SAMPLE_DATA>\n"));
-		for (i = startSampleNum; i <= endSampleNum; i++) {
-			if ((vg.samplenumber==0) || (vg.samplenumber==i)) {
-				err = GetSampleOffsetSize( tir, i, &sampleOffset, &sampleSize, &sampleDescriptionIndex );
-				if (err != noErr) {
-					errprint("couldn't GetSampleOffsetSize for sample %ld (err %ld)\n", i, err);
-					continue;
-				}
-				H_ATOM_PRINT_INCR(( "<sample num=\"%d\" offset=\"%s\" size=\"%d\"\n",i,int64toxstr(sampleOffset),sampleSize));
-					BAILIFNIL( dataP = malloc(sampleSize), allocFailedErr );
-					err = GetFileData( vg.fileaoe, dataP, sampleOffset, sampleSize, nil );
-					if (err != noErr) {
-						errprint("couldn't GetFileData for sample %ld (err %ld)\n", i, err);
-						continue;
-					}
-									
-					hir.hintSampleNum = i;
-					hir.hintSampleData = dataP;
-					hir.hintSampleLength = sampleSize;
-					Validate_Hint_Sample(&hir, dataP, sampleSize);
-
-					free( dataP );
-					hir.hintSampleData = NULL;
-				H_ATOM_PRINT_DECR(("</sample>\n"))
-			}
+		handled = false;
+#if USE_PTHREADS
+		if ((vg.jobs > 1) && vg.inFilePath && !vg.inStream && (endSampleNum >= startSampleNum + kHintSamplesPerJob)) {
+			err = Validate_Hint_Samples_In_Parallel( &hir, startSampleNum, endSampleNum, &order, &handled );
+		}
+#endif
+		if (!handled) {
+			err = Validate_Hint_Sample_Range( &hir, startSampleNum, endSampleNum, nil, &order );
 		}
 	H_ATOM_PRINT_DECR(("</hint_SAMPLE_DATA>\n"));
+	Finish_Hint_Packet_Order( &hir, &order );
 
 bail:
+	if (list) free( list );
 	if (hir.packetData != NULL) {
 		free(hir.packetData);
 	}
+	if (hir.packets != NULL) {
+		free(hir.packets);
+	}
+	dispose_sample_cache(&hir.sampleCache);
+	return err;
+}
+
+//==========================================================================================
+static OSErr Validate_Hint_Sample_Num( HintInfoRec *hir, UInt32 inSampleNum )
+{
+	OSErr		err = noErr;
+	UInt64		sampleOffset;
+	UInt32		sampleSize;
+	UInt32		sampleDescriptionIndex;
+	Ptr			dataP = nil;
+	Boolean		doPrinting = hir->printSamples;
+
+	err = GetSampleOffsetSize( hir->tir, inSampleNum, &sampleOffset, &sampleSize, &sampleDescriptionIndex );
+	if (err != noErr) {
+		errprint("couldn't GetSampleOffsetSize for sample %ld (err %ld)\n", inSampleNum, err);
+		goto bail;
+	}
+	H_ATOM_PRINT_INCR(( "<sample num=\"%d\" offset=\"%s\" size=\"%d\"\n",inSampleNum,int64toxstr(sampleOffset),sampleSize));
+		BAILIFNIL( dataP = malloc(sampleSize), allocFailedErr );
+		err = GetFileData( vg.fileaoe, dataP, sampleOffset, sampleSize, nil );
+		if (err != noErr) {
+			if (err != userCanceledErr) errprint("couldn't GetFileData for sample %ld (err %ld)\n", inSampleNum, err);
+			goto bail;
+		}
+						
+		hir->hintSampleNum = inSampleNum;
+		hir->hintSampleData = dataP;
+		hir->hintSampleLength = sampleSize;
+		Validate_Hint_Sample(hir, dataP, sampleSize);
+
+		hir->hintSampleData = NULL;
+	H_ATOM_PRINT_DECR(("</sample>\n"))
+
+bail:
+	if (dataP != nil) free( dataP );
 	return err;
 }
 
+//==========================================================================================
+//   with a job (a worker thread) the packets are kept for the merge to check; otherwise
+//   they are checked as soon as each sample is done
+static OSErr Validate_Hint_Sample_Range( HintInfoRec *hir, UInt32 startSampleNum, UInt32 endSampleNum, struct HintJob *job, HintOrderState *order )
+{
+	TrackInfoRec	*tir = hir->tir;
+	UInt32		i;
+
+	for (i = GetNextSelectedSample( tir, startSampleNum, endSampleNum ); i <= endSampleNum; i = GetNextSelectedSample( tir, i + 1, endSampleNum )) {
+		if (SampleIsSelected( tir, i )) {
+			// the server stopped the job
+			if (Validate_Hint_Sample_Num( hir, i ) == userCanceledErr) return userCanceledErr;
+#if USE_PTHREADS
+			if (job) {
+				Mark_Hint_Job_Sample( hir, job );
+				continue;
+			}
+#endif
+			Check_Hint_Packet_Order( order, hir->packets, hir->packetCnt );
+			hir->packetCnt = 0;
+		}
+	}
+	return noErr;
+}
+
+//==========================================================================================
+//   RTP times are in the hint track's time scale; the transmission bitrate curve has one
+//   entry per second of transmission time
+static void Check_Hint_Packet_Order( HintOrderState *order, HintPacketRecord *packets, UInt32 packetCnt )
+{
+	TrackInfoRec	*mediaTIR = order->mediaTIR;
+	UInt32		timeScale = order->tir->mediaTimeScale;
+	UInt32		i;
+	UInt16		expected;
+	SInt64		transmissionTime;
+	SInt64		rtpTime;
+
+	for (i = 0; i < packetCnt; i++) {
+		HintPacketRecord *packet = &packets[i];
+
+		if (packet->hintSampleNum != order->hintSampleNum) {
+			// nothing can be said across samples that weren't checked
+			if (packet->hintSampleNum != order->hintSampleNum + 1) {
+				order->hasSequenceNumber = false;
+				order->hasPreviousPacket = false;
+			}
+			order->hintSampleNum = packet->hintSampleNum;
+			order->hintSampleTime = GetSampleDecodeTime( order->tir, packet->hintSampleNum, nil );
+			order->packetNum = 0;
+		}
+		order->packetCnt++;
+		
+		// a repeated packet carries the sequence number of the one it repeats
+		if (!packet->repeatPacket) {
+			expected = (UInt16)(order->sequenceNumber + 1);
+			if (order->hasSequenceNumber && (packet->sequenceNumber != expected)) {
+				errprint("hint sample %ld packet %ld: RTP sequence number %ld should be %ld\n",
+					order->hintSampleNum, order->packetNum, packet->sequenceNumber, expected);
+			}
+			order->hasSequenceNumber = true;
+			order->sequenceNumber = packet->sequenceNumber;
+		}
+
+		transmissionTime = (SInt64)order->hintSampleTime + packet->relativeTransmissionTime;
+		rtpTime = (SInt64)order->hintSampleTime + packet->rtpTimeOffset;
+
+		if (order->hasPreviousPacket) {
+			if (transmissionTime < order->transmissionTime) {
+				if ((order->transmissionBackwardsCnt++ == 0) && timeScale) {
+					warnprint("WARNING - hint sample %ld packet %ld is to be sent %.3f seconds before the packet ahead of it\n",
+						order->hintSampleNum, order->packetNum, (double)(order->transmissionTime - transmissionTime) / timeScale);
+				}
+			} else if (timeScale && (transmissionTime - order->transmissionTime > timeScale)) {
+				warnprint("WARNING - nothing is sent for %.2f seconds before hint sample %ld packet %ld\n",
+					(double)(transmissionTime - order->transmissionTime) / timeScale, order->hintSampleNum, order->packetNum);
+			}
+			
+			// with composition offsets the media isn't presented in decode order
+			if (mediaTIR && !mediaTIR->compositionRunFirstSample && (rtpTime < order->rtpTime)) {
+				if ((order->rtpTimeBackwardsCnt++ == 0) && timeScale) {
+					warnprint("WARNING - hint sample %ld packet %ld: RTP time goes back by %.3f seconds\n",
+						order->hintSampleNum, order->packetNum, (double)(order->rtpTime - rtpTime) / timeScale);
+				}
+			}
+		}
+		order->hasPreviousPacket = true;
+		order->transmissionTime = transmissionTime;
+		order->rtpTime = rtpTime;
+
+		// the packet should be stamped with the time its media is presented at, give or take
+		// a tick of the hint track's clock
+		if (mediaTIR && mediaTIR->timeline && mediaTIR->mediaTimeScale && (packet->mediaSampleNum != 0)) {
+			UInt64 mediaTime = GetSampleDecodeTime( mediaTIR, packet->mediaSampleNum, nil ) 
+								+ GetSampleCompositionOffset( mediaTIR, packet->mediaSampleNum );
+			SInt64 difference = rtpTime * (SInt64)mediaTIR->mediaTimeScale - (SInt64)(mediaTime * timeScale);
+
+			if ((difference > (SInt64)mediaTIR->mediaTimeScale) || (difference < -(SInt64)mediaTIR->mediaTimeScale)) {
+				if (order->timelineMismatchCnt++ == 0) {
+					char tempStr1[32], tempStr2[32];
+
+					warnprint("WARNING - hint sample %ld packet %ld: RTP time %s is not the time of media sample %ld (%s)\n",
+						order->hintSampleNum, order->packetNum, int64todstr_r(rtpTime, tempStr1), packet->mediaSampleNum,
+						int64todstr_r((mediaTime * timeScale) / mediaTIR->mediaTimeScale, tempStr2));
+				}
+			}
+		}
+
+		if (timeScale && (packet->size > 0) && !order->bitrateStopped) {
+			Add_Hint_Bitrate_Bytes( order, (transmissionTime > 0) ? (UInt64)transmissionTime / timeScale : 0, packet->size );
+		}
+		order->packetNum++;
+	}
+}
+
+//==========================================================================================
+//   the curve starts at the first packet's second; times come from the file, so a curve that
+//   would have to span more than kHintBitrateMaxSeconds stops growing rather than allocate
+static void Add_Hint_Bitrate_Bytes( HintOrderState *order, UInt64 second, UInt32 size )
+{
+	UInt64		firstSecond = order->bytesPerSecond ? order->firstSecond : second;
+	UInt64		endSecond = firstSecond + order->secondCnt;
+	UInt64		*bytesPerSecond;
+	UInt32		newCnt, shift;
+
+	if ((second >= firstSecond) && (second < endSecond)) {
+		order->bytesPerSecond[second - firstSecond] += size;
+		return;
+	}
+
+	if (second < firstSecond) firstSecond = second;
+	if (second >= endSecond) endSecond = second + 1;
+	if (endSecond - firstSecond > kHintBitrateMaxSeconds) {
+		warnprint("WARNING - hint packets are sent over more than %ld seconds; the transmission bitrate curve stops at hint sample %ld packet %ld\n",
+			kHintBitrateMaxSeconds, order->hintSampleNum, order->packetNum);
+		order->bitrateStopped = true;
+		return;
+	}
+	newCnt = (UInt32)(endSecond - firstSecond);
+	if (newCnt < 2 * order->secondCnt) newCnt = 2 * order->secondCnt;
+	if (newCnt > kHintBitrateMaxSeconds) newCnt = kHintBitrateMaxSeconds;
+	shift = order->bytesPerSecond ? (UInt32)(order->firstSecond - firstSecond) : 0;
+
+	if ((bytesPerSecond = realloc( order->bytesPerSecond, newCnt * sizeof(UInt64) )) == nil) {
+		order->bitrateStopped = true;
+		return;
+	}
+	// when the curve now starts earlier, what it has moves up
+	memmove( bytesPerSecond + shift, bytesPerSecond, order->secondCnt * sizeof(UInt64) );
+	memset( bytesPerSecond, 0, shift * sizeof(UInt64) );
+	memset( bytesPerSecond + shift + order->secondCnt, 0, (newCnt - shift - order->secondCnt) * sizeof(UInt64) );
+	order->bytesPerSecond = bytesPerSecond;
+	order->secondCnt = newCnt;
+	order->firstSecond = firstSecond;
+	order->bytesPerSecond[second - firstSecond] += size;
+}
+
+//==========================================================================================
+static void Finish_Hint_Packet_Order( HintInfoRec *hir, HintOrderState *order )
+{
+	UInt32		lastSecond = 0;
+	UInt32		peakSecond = 0;
+	UInt64		firstSecond = order->firstSecond;
+	UInt64		totalBytes = 0;
+	UInt32		overCnt = 0;
+	UInt32		s;
+	char		tempStr1[32], tempStr2[32];
+	Boolean		doPrinting = hir->printSamples;
+
+	if (order->transmissionBackwardsCnt > 1) {
+		warnprint("WARNING - %ld of %ld hint packets are to be sent before the packet ahead of them\n",
+			order->transmissionBackwardsCnt, order->packetCnt);
+	}
+	if (order->rtpTimeBackwardsCnt > 1) {
+		warnprint("WARNING - the RTP time goes back at %ld of %ld hint packets\n",
+			order->rtpTimeBackwardsCnt, order->packetCnt);
+	}
+	if (order->timelineMismatchCnt > 1) {
+		warnprint("WARNING - %ld of %ld hint packets have an RTP time that is not their media's\n",
+			order->timelineMismatchCnt, order->packetCnt);
+	}
+	
+	if (!order->bytesPerSecond) goto bail;
+
+	for (s = 0; s < order->secondCnt; s++) {
+		if (order->bytesPerSecond[s] == 0) continue;
+		lastSecond = s;
+		totalBytes += order->bytesPerSecond[s];
+		if (order->bytesPerSecond[s] > order->bytesPerSecond[peakSecond]) peakSecond = s;
+		if (order->tir->hintMaxBitrate && (order->bytesPerSecond[s] * kBitsPerByte > order->tir->hintMaxBitrate)) {
+			overCnt++;
+		}
+	}
+	if (overCnt) {
+		warnprint("WARNING - more than the 'hmhd' maxbitrate (%ld) is sent in %ld seconds, up to %s bits in second %s\n",
+			order->tir->hintMaxBitrate, overCnt, int64todstr_r(order->bytesPerSecond[peakSecond] * kBitsPerByte, tempStr1),
+			int64todstr_r(firstSecond + peakSecond, tempStr2));
+	}
+
+	H_ATOM_PRINT_INCR(("<transmissionBitrate seconds=\"%ld\" averageBitrate=\"%s\" peakBitrate=\"%s\" peakSecond=\"%s\">\n",
+		lastSecond + 1, int64todstr_r(totalBytes * kBitsPerByte / (lastSecond + 1), tempStr1),
+		int64todstr_r(order->bytesPerSecond[peakSecond] * kBitsPerByte, tempStr2), int64todstr(firstSecond + peakSecond)));
+		for (s = 0; s <= lastSecond; s++) {
+			H_ATOM_PRINT(("<second num=\"%s\" bitrate=\"%s\" />\n", int64todstr_r(firstSecond + s, tempStr1),
+				int64todstr_r(order->bytesPerSecond[s] * kBitsPerByte, tempStr2)));
+		}
+	H_ATOM_PRINT_DECR(("</transmissionBitrate>\n"));
+
+bail:
+	if (order->bytesPerSecond) free( order->bytesPerSecond );
+	order->bytesPerSecond = nil;
+	order->secondCnt = 0;
+	order->bitrateStopped = false;
+}
+
+//==========================================================================================
+static OSErr record_hint_packet( HintInfoRec *hir, HintPacketRecord *inPacket )
+{
+	OSErr		err = noErr;
+	HintPacketRecord	*packets;
+	UInt32		newMax;
+
+	if (hir->packetCnt == hir->packetMax) {
+		newMax = hir->packetMax ? 2 * hir->packetMax : 64;
+		BAILIFNIL( packets = realloc( hir->packets, newMax * sizeof(HintPacketRecord) ), allocFailedErr );
+		hir->packets = packets;
+		hir->packetMax = newMax;
+	}
+	hir->packets[hir->packetCnt++] = *inPacket;
+
+bail:
+	return err;
+}
+
+#if USE_PTHREADS
+
+//==========================================================================================
+// Parallel hint sample validation (-jobs)
+//
+//   Apart from the RTP sequence numbers, a hint sample can be checked knowing only the
+//   SDP, so the samples are split into runs of kHintSamplesPerJob and handed to worker
+//   threads, each with its own HintInfoRec (packet buffer and sample cache) and input
+//   file.  A job keeps its report, where each sample's part of it ends, and the packets
+//   it saw.  The main thread writes the reports in sample order and checks the packets
+//   as it goes, so the output is the same as with -jobs 1.
+
+typedef struct HintJobSample {
+	size_t	outEnd;
+	size_t	errOutEnd;
+	UInt32	packetEnd;
+} HintJobSample;
+
+typedef struct HintJob {
+	UInt32	firstSample;
+	UInt32	lastSample;
+	HintJobSample *samples;
+	UInt32	sampleCnt;
+	HintPacketRecord *packets;
+	UInt32	packetCnt;
+	char	*out;
+	size_t	outSize;
+	char	*errOut;
+	size_t	errOutSize;
+	OSErr	err;
+	Boolean	done;
+} HintJob;
+
+typedef struct HintPool {
+	ValidateGlobals *globals;			// the main thread's
+	HintInfoRec *hir;					// after the SDP; copied by each worker
+	HintJob *jobs;
+	long	jobCnt;
+	long	nextJob;
+	long	nextMerge;					// workers stay within window jobs of the merge
+	long	window;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} HintPool;
+
+typedef struct HintWorker {
+	HintPool *pool;
+	pthread_t thread;
+	FILE	*inFile;
+	OSErr	err;
+} HintWorker;
+
+static void Mark_Hint_Job_Sample( HintInfoRec *hir, HintJob *job )
+{
+	HintJobSample *sample = &job->samples[job->sampleCnt++];
+
+	fflush( vg.outFile );
+	fflush( vg.errFile );
+	sample->outEnd = job->outSize;
+	sample->errOutEnd = job->errOutSize;
+	sample->packetEnd = hir->packetCnt;
+}
+
+static void *HintWorkerMain( void *arg )
+{
+	HintWorker *worker = (HintWorker *)arg;
+	HintPool *pool = worker->pool;
+	HintInfoRec hir;
+	HintJob *job;
+
+	if (pool->globals != &vg) vg = *pool->globals;
+	vg.inFile = worker->inFile;
+
+	hir = *pool->hir;
+	hir.packets = nil;
+	hir.packetCnt = hir.packetMax = 0;
+	memset( &hir.sampleCache, 0, sizeof(hir.sampleCache) );
+	if (hir.packetData) {
+		if ((hir.packetData = malloc( hir.packetDataMaxLength )) == nil) {
+			worker->err = allocFailedErr;
+		}
+	}
+
+	for (;;) {
+		pthread_mutex_lock( &pool->lock );
+		while ((pool->nextJob < pool->jobCnt) && (pool->nextJob >= pool->nextMerge + pool->window)) {
+			pthread_cond_wait( &pool->cond, &pool->lock );
+		}
+		job = (pool->nextJob < pool->jobCnt) ? &pool->jobs[pool->nextJob++] : nil;
+		pthread_mutex_unlock( &pool->lock );
+		if (!job) break;
+
+		job->err = worker->err;
+		job->samples = calloc( job->lastSample - job->firstSample + 1, sizeof(HintJobSample) );
+		vg.outFile = open_memstream( &job->out, &job->outSize );
+		vg.errFile = open_memstream( &job->errOut, &job->errOutSize );
+		if (!job->samples || !vg.outFile || !vg.errFile) {
+			job->err = allocFailedErr;
+		}
+
+		if (!job->err) {
+			job->err = Validate_Hint_Sample_Range( &hir, job->firstSample, job->lastSample, job, nil );
+		}
+
+		if (vg.outFile) fclose( vg.outFile );
+		if (vg.errFile) fclose( vg.errFile );
+		vg.outFile = vg.errFile = nil;
+
+		// the job takes the packets; the next one starts a new list
+		job->packets = hir.packets;
+		job->packetCnt = hir.packetCnt;
+		hir.packets = nil;
+		hir.packetCnt = hir.packetMax = 0;
+
+		pthread_mutex_lock( &pool->lock );
+		job->done = true;
+		pthread_cond_broadcast( &pool->cond );
+		pthread_mutex_unlock( &pool->lock );
+	}
+
+	if (hir.packetData) free( hir.packetData );
+	dispose_sample_cache( &hir.sampleCache );
+	return nil;
+}
+
+static void Merge_Hint_Job( HintJob *job, HintOrderState *order )
+{
+	size_t	outStart = 0;
+	size_t	errOutStart = 0;
+	UInt32	packetStart = 0;
+	UInt32	i;
+
+	for (i = 0; i < job->sampleCnt; i++) {
+		HintJobSample *sample = &job->samples[i];
+
+		if (sample->outEnd > outStart) {
+			fwrite( job->out + outStart, 1, sample->outEnd - outStart, _stdout );
+		}
+		if (sample->errOutEnd > errOutStart) {
+			fwrite( job->errOut + errOutStart, 1, sample->errOutEnd - errOutStart, _stderr );
+		}
+		Check_Hint_Packet_Order( order, job->packets + packetStart, sample->packetEnd - packetStart );
+		outStart = sample->outEnd;
+		errOutStart = sample->errOutEnd;
+		packetStart = sample->packetEnd;
+	}
+	// anything after the last sample (there is nothing unless the job failed)
+	if (job->outSize > outStart) {
+		fwrite( job->out + outStart, 1, job->outSize - outStart, _stdout );
+	}
+	if (job->errOutSize > errOutStart) {
+		fwrite( job->errOut + errOutStart, 1, job->errOutSize - errOutStart, _stderr );
+	}
+}
+
+static OSErr Validate_Hint_Samples_In_Parallel( HintInfoRec *hir, UInt32 startSampleNum, UInt32 endSampleNum, HintOrderState *order, Boolean *handledOut )
+{
+	OSErr err = noErr;
+	HintPool pool = {0};
+	HintWorker *workers = nil;
+	long workerCnt;
+	long started = 0;
+	long i;
+	Boolean haveLock = false;
+
+	*handledOut = false;
+
+	pool.globals = &vg;
+	pool.hir = hir;
+	pool.jobCnt = (endSampleNum - startSampleNum) / kHintSamplesPerJob + 1;
+	workerCnt = (vg.jobs < pool.jobCnt) ? vg.jobs : pool.jobCnt;
+	pool.window = 4 * workerCnt;
+	BAILIFNIL( pool.jobs = calloc( pool.jobCnt, sizeof(HintJob) ), allocFailedErr );
+	BAILIFNIL( workers = calloc( workerCnt, sizeof(HintWorker) ), allocFailedErr );
+
+	for (i = 0; i < workerCnt; i++) {
+		workers[i].pool = &pool;
+		BAILIFNIL( workers[i].inFile = fopen( vg.inFilePath, "rb" ), ioErr );
+	}
+	if (pthread_mutex_init( &pool.lock, nil ) != 0) { err = allocFailedErr; goto bail; }
+	if (pthread_cond_init( &pool.cond, nil ) != 0) { pthread_mutex_destroy( &pool.lock ); err = allocFailedErr; goto bail; }
+	haveLock = true;
+
+	for (i = 0; i < pool.jobCnt; i++) {
+		pool.jobs[i].firstSample = startSampleNum + i * kHintSamplesPerJob;
+		pool.jobs[i].lastSample = pool.jobs[i].firstSample + kHintSamplesPerJob - 1;
+		if (pool.jobs[i].lastSample > endSampleNum) pool.jobs[i].lastSample = endSampleNum;
+	}
+
+	for (started = 0; started < workerCnt; started++) {
+		if (pthread_create( &workers[started].thread, nil, HintWorkerMain, &workers[started] ) != 0) break;
+	}
+	if (started == 0) goto bail;		// no threads at all; the caller does the work
+	*handledOut = true;
+
+	for (i = 0; i < pool.jobCnt; i++) {
+		HintJob *job = &pool.jobs[i];
+
+		pthread_mutex_lock( &pool.lock );
+		while (!job->done) {
+			pthread_cond_wait( &pool.cond, &pool.lock );
+		}
+		pthread_mutex_unlock( &pool.lock );
+
+		Merge_Hint_Job( job, order );
+		if (!err) err = job->err;
+		if (job->out) free( job->out );
+		if (job->errOut) free( job->errOut );
+		if (job->samples) free( job->samples );
+		if (job->packets) free( job->packets );
+		job->out = job->errOut = nil;
+		job->samples = nil;
+		job->packets = nil;
+
+		pthread_mutex_lock( &pool.lock );
+		pool.nextMerge = i + 1;
+		pthread_cond_broadcast( &pool.cond );
+		pthread_mutex_unlock( &pool.lock );
+	}
+
+	for (i = 0; i < started; i++) {
+		pthread_join( workers[i].thread, nil );
+	}
+
+bail:
+	if (haveLock) {
+		pthread_cond_destroy( &pool.cond );
+		pthread_mutex_destroy( &pool.lock );
+	}
+	if (workers) {
+		for (i = 0; i < workerCnt; i++) {
+			if (workers[i].inFile) fclose( workers[i].inFile );
+		}
+		free( workers );
+	}
+	if (pool.jobs) free( pool.jobs );
+	return err;
+}
+
+#endif	// USE_PTHREADS
+
 //==========================================================================================
 static OSErr Validate_Hint_Sample( HintInfoRec *hir, char *inSampleData, UInt32 inLength )
 {
@@ -451,6 +1043,7 @@ static OSErr Validate_Packet_Entry( HintInfoRec *hir, char *inPacketEntry, UInt3
 	UInt16		entryCount;
 	UInt16		i;
 	OSErr		tempErr;
+	HintPacketRecord	packet = {0};
 	Boolean		doPrinting = hir->printSamples;
 
 	/*
@@ -470,6 +1063,7 @@ static OSErr Validate_Packet_Entry( HintInfoRec *hir, char *inPacketEntry, UInt3
 	temp32 = EndianU32_BtoN(*((UInt32*)current));
 	current += sizeof(temp32);
 	H_ATOM_PRINT(("relativeTransmissionTime=\"%ld\"\n", temp32));
+	packet.relativeTransmissionTime = (SInt32)temp32;
 	temp16 = EndianU16_BtoN(*((UInt16*)current));
 	current += sizeof(temp16);
 	H_ATOM_PRINT_INCR(("<rtpHeader>\n"));
@@ -482,6 +1076,8 @@ static OSErr Validate_Packet_Entry( HintInfoRec *hir, char *inPacketEntry, UInt3
 	temp16 = EndianU16_BtoN(*((UInt16*)current));
 	current += sizeof(temp16);
 	H_ATOM_PRINT(("sequenceNumber=\"%ld\"\n", temp16))
+	packet.hintSampleNum = hir->hintSampleNum;
+	packet.sequenceNumber = temp16;
 
 #define kPacketEntry_XBit		0x0004
 #define kPacketEntry_BBit		0x0002
@@ -495,6 +1091,7 @@ static OSErr Validate_Packet_Entry( HintInfoRec *hir, char *inPacketEntry, UInt3
 	hasExtraInfoTLVs = ((temp16 & kPacketEntry_XBit) != 0);
 	H_ATOM_PRINT(("BFrame=\"%d\"\n", ((temp16 & kPacketEntry_BBit) != 0)));
 	H_ATOM_PRINT(("repeatPacket=\"%d\"\n", ((temp16 & kPacketEntry_RBit) != 0)));
+	packet.repeatPacket = ((temp16 & kPacketEntry_RBit) != 0);
 
 	entryCount = EndianU16_BtoN(*((UInt16*)current));
 	current += sizeof(temp16);
@@ -514,6 +1111,7 @@ static OSErr Validate_Packet_Entry( HintInfoRec *hir, char *inPacketEntry, UInt3
 			if (boxtype == 'rtpo') {
 				temp32 = EndianU32_BtoN(*((UInt32*)tlvdata));
 				H_ATOM_PRINT(("RTP timestamp offset=\"%ld\"\n", temp32));
+				packet.rtpTimeOffset = (SInt32)temp32;
 			}
 			else warnprint("Unknown packet extra info TLV %s\n",ostypetostr(boxtype));
 			tlv += (boxlen + 3) & (0xFFFFFFFc);		// rounded up to a 4-byte boundary
@@ -529,6 +1127,7 @@ static OSErr Validate_Packet_Entry( HintInfoRec *hir, char *inPacketEntry, UInt3
 
 	hir->packetConstructedOK = true;
 	hir->packetDataCurrent = hir->packetData;
+	hir->packetMediaSampleNum = 0;
 	for (i=0; i<entryCount; ++i) {
 		H_ATOM_PRINT_INCR(("<dataEntry=\"%ld\">\n", i));
 			tempErr = Validate_Data_Entry(hir, current);
@@ -536,6 +1135,8 @@ static OSErr Validate_Packet_Entry( HintInfoRec *hir, char *inPacketEntry, UInt3
 		H_ATOM_PRINT_DECR(("</dataEntry>\n"));
 	}
 	*outNextEntryPtr = current;
+	packet.mediaSampleNum = hir->packetMediaSampleNum;
+	packet.size = kRTPHeaderSize + (UInt32)(hir->packetDataCurrent - hir->packetData);
 	
 	
 	if (hir->constructPacket && hir->validatePayload && hir->packetData && hir->packetConstructedOK) {
@@ -547,6 +1148,9 @@ static OSErr Validate_Packet_Entry( HintInfoRec *hir, char *inPacketEntry, UInt3
 
 
 bail:
+	// even a packet whose data table is broken takes a sequence number
+	tempErr = record_hint_packet(hir, &packet);
+	if (!err) err = tempErr;
 	return err;
 }
 
@@ -664,7 +1268,12 @@ static OSErr Validate_Data_Entry( HintInfoRec *hir, char *inEntry )
 					goto bail;
 				}
 
-				BAILIFERR( get_track_sample(thisTIR, sampleNum, &sampleData, &sampleDataLength, NULL) );
+				if ((thisTIR == hir->originalMediaTIR) && (hir->packetMediaSampleNum == 0)) {
+					hir->packetMediaSampleNum = sampleNum;
+				}
+
+				// the cache owns sampleData
+				BAILIFERR( get_cached_track_sample(&hir->sampleCache, thisTIR, sampleNum, &sampleData, &sampleDataLength) );
 				if (offset+length >sampleDataLength) {
 					errprint("[2] data entry - offset(%d) + length(%d) > samplelength (%d)\n", offset, length, sampleDataLength);
 					err = paramErr;
@@ -713,9 +1322,6 @@ static OSErr Validate_Data_Entry( HintInfoRec *hir, char *inEntry )
 	}
 
 bail:
-	if (sampleData != NULL) {
-		free( sampleData );
-	}
 	if (err != noErr) {
 		hir->packetConstructedOK = false;
 	}
@@ -1090,7 +1696,7 @@ static OSErr Validate_hint_udta_Atom( atomOffsetEntry *aoe, void *refcon )
 	OSErr atomerr = noErr;
 	UInt64 minOffset, maxOffset;
 	long cnt;
-	atomOffsetEntry *list;
+	atomOffsetEntry *list = nil;
 	
 	minOffset = aoe->offset + aoe->atomStartSize;
 	maxOffset = aoe->offset + aoe->size - aoe->atomStartSize;
@@ -1108,6 +1714,7 @@ static OSErr Validate_hint_udta_Atom( atomOffsetEntry *aoe, void *refcon )
 	if (!err) err = atomerr;
 
 bail:
+	if (list) free( list );
 	return err;
 }
 
@@ -2240,4 +2847,75 @@ bail:
 	return err;
 }
 
+//==========================================================================================
+//   the least recently used samples go first, once there are too many or they are too big
+static OSErr get_cached_track_sample(HintSampleCache *cache, TrackInfoRec *tir, UInt32 inSampleNum, Ptr *dataOut, UInt32 *sizeOut)
+{
+	OSErr		err = noErr;
+	HintSampleCacheEntry	*entry, *freeEntry, *lru;
+	Ptr			data = NULL;
+	UInt32		size = 0;
+	UInt32		i;
+
+	*dataOut = NULL;
+	*sizeOut = 0;
+	if (tir == NULL) goto bail;
+
+	for (i = 0; i < kHintSampleCacheEntries; ++i) {
+		entry = &cache->entries[i];
+		if (entry->data && (entry->trackID == tir->trackID) && (entry->sampleNum == inSampleNum)) {
+			entry->lastUse = ++cache->useCount;
+			*dataOut = entry->data;
+			*sizeOut = entry->size;
+			goto bail;
+		}
+	}
+
+	BAILIFERR( get_track_sample(tir, inSampleNum, &data, &size, NULL) );
+
+	// a sample bigger than the whole budget is still kept, on its own
+	for (;;) {
+		freeEntry = lru = NULL;
+		for (i = 0; i < kHintSampleCacheEntries; ++i) {
+			entry = &cache->entries[i];
+			if (!entry->data) {
+				if (!freeEntry) freeEntry = entry;
+			} else if (!lru || (entry->lastUse < lru->lastUse)) {
+				lru = entry;
+			}
+		}
+		if (freeEntry && (!lru || (cache->bytes + size <= kHintSampleCacheMaxBytes))) break;
+		cache->bytes -= lru->size;
+		free(lru->data);
+		lru->data = NULL;
+	}
+
+	freeEntry->trackID = tir->trackID;
+	freeEntry->sampleNum = inSampleNum;
+	freeEntry->data = data;
+	freeEntry->size = size;
+	freeEntry->lastUse = ++cache->useCount;
+	cache->bytes += size;
+	*dataOut = data;
+	*sizeOut = size;
+	data = NULL;
+
+bail:
+	if (data != NULL) free(data);
+	return err;
+}
+
+static void dispose_sample_cache(HintSampleCache *cache)
+{
+	UInt32		i;
+
+	for (i = 0; i < kHintSampleCacheEntries; ++i) {
+		if (cache->entries[i].data != NULL) {
+			free(cache->entries[i].data);
+			cache->entries[i].data = NULL;
+		}
+	}
+	cache->bytes = 0;
+}
+
 
@@ -0,0 +1,454 @@
+/*
+
+This file contains Original Code and/or Modifications of Original Code
+as defined in and that are subject to the Apple Public Source License
+Version 2.0 (the 'License'). You may not use this file except in
+compliance with the License. Please obtain a copy of the License at
+http://www.opensource.apple.com/apsl/ and read it before using this
+file.
+
+The Original Code and all software distributed under the License are
+distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+Please see the License for the specific language governing rights and
+limitations under the License.
+
+*/
+
+#include "ValidateMP4.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+	#define USE_MMAP 1
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+
+//==========================================================================================
+// libvalidatemp4 (see ValidateMP4Lib.h)
+//
+//   A call turns its options into a command line and runs it through ValidateMP4Command,
+//   the way a server job does, so the library checks exactly what ValidateMP4 checks.
+//   errprint and warnprint hand their messages to LibraryMessage; the report and anything
+//   else printed go to memory streams and are passed on before each message and at the end.
+
+enum {
+	kLibraryMaxArgs = 32,
+	kLibraryMessageSize = 4096
+};
+
+typedef struct LibraryText {
+	FILE	*file;
+	char	*text;
+	size_t	size;
+	size_t	sent;
+} LibraryText;
+
+typedef struct LibraryRun {
+	validatemp4_options options;
+	LibraryText report;					// vg.outFile
+	LibraryText notices;				// vg.errFile
+	long	errorCnt;
+	struct validatemp4_movie *movie;	// validatemp4_open: indexed from the 'moov' (see KeepLibraryMovie)
+} LibraryRun;
+
+typedef struct LibrarySample {
+	UInt64	offset;
+	UInt64	decodeTime;
+	UInt32	size;
+	UInt32	duration;
+	SInt32	compositionOffset;
+	UInt32	descriptionIndex;			// the high bit is set for a sync sample
+} LibrarySample;
+
+enum {
+	kLibrarySyncSample = 0x80000000
+};
+
+typedef struct LibraryTrack {
+	validatemp4_track info;
+	LibrarySample *samples;				// 0 based
+} LibraryTrack;
+
+struct validatemp4_movie {
+	long	trackCnt;
+	LibraryTrack *tracks;
+	const UInt8 *map;					// the whole file
+	UInt64	mapSize;
+};
+
+//==========================================================================================
+
+static void SendLibraryText( LibraryRun *run, LibraryText *t, validatemp4_kind kind )
+{
+	fflush( t->file );
+	if (t->size > t->sent) {
+		// the stream keeps its text nul terminated
+		if (run->options.callback && ((kind != validatemp4_report) || run->options.printtype)) {
+			run->options.callback( run->options.context, kind, "", t->text + t->sent );
+		}
+		t->sent = t->size;
+	}
+}
+
+static void SendLibraryTexts( LibraryRun *run )
+{
+	SendLibraryText( run, &run->report, validatemp4_report );
+	SendLibraryText( run, &run->notices, validatemp4_notice );
+}
+
+void LibraryMessage( validatemp4_kind kind, const char *formatStr, va_list ap )
+{
+	LibraryRun *run = vg.library;
+	char message[kLibraryMessageSize];
+
+	SendLibraryTexts( run );
+	if (kind == validatemp4_error) {
+		run->errorCnt++;
+	}
+	if (run->options.callback) {
+		vsnprintf( message, sizeof(message), formatStr, ap );
+		run->options.callback( run->options.context, kind, vg.curatompath, message );
+	}
+}
+
+void validatemp4_init_options( validatemp4_options *options )
+{
+	memset( options, 0, sizeof(*options) );
+	options->size = sizeof(*options);
+}
+
+static long RunLibraryValidation( const char *inputName, FILE *inData, const validatemp4_options *options, validatemp4_movie *movie )
+{
+	LibraryRun run;
+	char *argv[kLibraryMaxArgs];
+	int argc = 0;
+	char checklevel[32], samplefraction[32], sampleevery[32], sampleseed[32];
+	char inputArg[1024];
+	long result;
+
+	memset( &run, 0, sizeof(run) );
+	run.movie = movie;
+	validatemp4_init_options( &run.options );
+	if (options) {
+		// a program built against an older header has fewer options
+		memcpy( &run.options, options, (options->size < sizeof(run.options)) ? options->size : sizeof(run.options) );
+		run.options.size = sizeof(run.options);
+	}
+
+	#define addOption( _name_, _value_ ) \
+			{ argv[argc++] = (_name_); argv[argc++] = (char *)(_value_); }
+	#define addFlag( _name_ ) \
+			{ argv[argc++] = (_name_); }
+
+	argv[argc++] = "ValidateMP4";
+	if (run.options.filetype) addOption( "-filetype", run.options.filetype );
+	if (run.options.checklevel) {
+		snprintf( checklevel, sizeof(checklevel), "%d", run.options.checklevel );
+		addOption( "-checklevel", checklevel );
+	}
+	if (run.options.printtype) addOption( "-printtype", run.options.printtype );
+	if (run.options.atompath) addOption( "-atompath", run.options.atompath );
+	if (run.options.tablemode) addOption( "-tablemode", run.options.tablemode );
+	if (run.options.timerange) addOption( "-timerange", run.options.timerange );
+	if (run.options.samplerange) addOption( "-samplerange", run.options.samplerange );
+	if (run.options.samplefraction) {
+		snprintf( samplefraction, sizeof(samplefraction), "%.17g", run.options.samplefraction );
+		addOption( "-samplefraction", samplefraction );
+	}
+	if (run.options.sampleevery) {
+		snprintf( sampleevery, sizeof(sampleevery), "%lu", run.options.sampleevery );
+		addOption( "-sampleevery", sampleevery );
+	}
+	if (run.options.sampleseed) {
+		snprintf( sampleseed, sizeof(sampleseed), "%lu", run.options.sampleseed );
+		addOption( "-sampleseed", sampleseed );
+	}
+	if (run.options.coverage) addFlag( "-coverage" );
+	// a path that starts with - would be taken for an option (or standard input); the command
+	// keeps the path in a buffer the size of inputArg, so a longer one is refused, not cut short
+	if (snprintf( inputArg, sizeof(inputArg), "%s%s", (inputName[0] == '-') ? "./" : "", inputName ) >= (int)sizeof(inputArg)) {
+		result = paramErr;
+		goto bail;
+	}
+	argv[argc++] = inputArg;
+	argv[argc] = nil;
+
+	#undef addOption
+	#undef addFlag
+
+	memset( &vg, 0, sizeof(vg) );
+	run.report.file = open_memstream( &run.report.text, &run.report.size );
+	run.notices.file = open_memstream( &run.notices.text, &run.notices.size );
+	if (!run.report.file || !run.notices.file) {
+		result = allocFailedErr;
+		goto bail;
+	}
+	vg.outFile = run.report.file;
+	vg.errFile = run.notices.file;
+	vg.library = &run;
+	vg.inData = inData;
+
+	result = ValidateMP4Command( argc, argv );
+
+	SendLibraryTexts( &run );
+	memset( &vg, 0, sizeof(vg) );
+	if (result == noErr) {
+		result = run.errorCnt;
+	} else if (result > 0) {
+		result = -result;
+	}
+
+bail:
+	if (run.report.file) fclose( run.report.file );
+	if (run.notices.file) fclose( run.notices.file );
+	if (run.report.text) free( run.report.text );
+	if (run.notices.text) free( run.notices.text );
+	return result;
+}
+
+long validate_file( const char *path, const validatemp4_options *options )
+{
+	if (!path || !path[0]) {
+		return paramErr;
+	}
+	return RunLibraryValidation( path, nil, options, nil );
+}
+
+long validate_buffer( const void *data, size_t size, const validatemp4_options *options )
+{
+	FILE *inData;
+	long result;
+
+	if (!data || (size == 0)) {
+		return paramErr;
+	}
+	if (!(inData = fmemopen( (void *)data, size, "rb" ))) {
+		return allocFailedErr;
+	}
+	result = RunLibraryValidation( "buffer", inData, options, nil );
+	fclose( inData );
+	return result;
+}
+
+//==========================================================================================
+// Sample access
+//
+//   The index is built in one pass over each track's tables while the validator still has
+//   them, and holds everything validatemp4_get_sample returns, so a lookup doesn't touch the
+//   tables (or anything else that changes) again.
+
+static OSErr BuildLibraryTrack( LibraryTrack *track, TrackInfoRec *tir )
+{
+	OSErr err = noErr;
+	UInt32 sampleCnt = tir->sampleSizeEntryCnt;
+	UInt32 sampleNum, entryNum, chunkNum, i;
+	UInt64 decodeTime = 0;
+
+	track->info.trackID = tir->trackID;
+	track->info.mediaType = tir->mediaType;
+	track->info.timescale = tir->mediaTimeScale;
+	track->info.duration = tir->mediaDuration;
+	track->info.sampleCount = sampleCnt;
+	if (sampleCnt == 0) goto bail;
+	BAILIFNIL( track->samples = calloc( sampleCnt, sizeof(LibrarySample) ), allocFailedErr );
+
+	// where each sample is, chunk by chunk
+	sampleNum = 1;
+	for (entryNum = 1; (entryNum <= tir->sampleToChunkEntryCnt) && (sampleNum <= sampleCnt); entryNum++) {
+		SampleToChunk entry, nextEntry;
+		UInt32 lastChunk = tir->chunkOffsetEntryCnt;
+
+		GetSampleToChunk( tir, entryNum, &entry );
+		if (entryNum < tir->sampleToChunkEntryCnt) {
+			GetSampleToChunk( tir, entryNum + 1, &nextEntry );
+			if (nextEntry.firstChunk - 1 < lastChunk) lastChunk = nextEntry.firstChunk - 1;
+		}
+		for (chunkNum = entry.firstChunk; (chunkNum <= lastChunk) && (sampleNum <= sampleCnt); chunkNum++) {
+			UInt64 offset = GetChunkOffset( tir, chunkNum );
+
+			for (i = 0; (i < entry.samplesPerChunk) && (sampleNum <= sampleCnt); i++, sampleNum++) {
+				LibrarySample *sample = &track->samples[sampleNum - 1];
+
+				sample->offset = offset;
+				sample->size = GetSampleSize( tir, sampleNum );
+				sample->descriptionIndex = entry.sampleDescriptionIndex & ~kLibrarySyncSample;
+				offset += sample->size;
+			}
+		}
+	}
+
+	// when
+	sampleNum = 1;
+	for (entryNum = 1; (entryNum <= tir->timeToSampleEntryCnt) && (sampleNum <= sampleCnt); entryNum++) {
+		TimeToSampleNum entry;
+
+		GetTimeToSample( tir, entryNum, &entry );
+		for (i = 0; (i < entry.sampleCount) && (sampleNum <= sampleCnt); i++, sampleNum++) {
+			track->samples[sampleNum - 1].decodeTime = decodeTime;
+			track->samples[sampleNum - 1].duration = entry.sampleDuration;
+			decodeTime += entry.sampleDuration;
+		}
+	}
+	for (; sampleNum <= sampleCnt; sampleNum++) {
+		track->samples[sampleNum - 1].decodeTime = decodeTime;
+	}
+	sampleNum = 1;
+	for (entryNum = 1; (entryNum <= tir->compositionTimeToSampleEntryCnt) && (sampleNum <= sampleCnt); entryNum++) {
+		CompositionTimeToSampleNum entry;
+
+		GetCompositionTimeToSample( tir, entryNum, &entry );
+		for (i = 0; (i < entry.sampleCount) && (sampleNum <= sampleCnt); i++, sampleNum++) {
+			track->samples[sampleNum - 1].compositionOffset = (SInt32)entry.sampleOffset;
+		}
+	}
+
+	// and which can be decoded on their own
+	if (!tir->hasSyncSampleTable) {
+		for (i = 0; i < sampleCnt; i++) {
+			track->samples[i].descriptionIndex |= kLibrarySyncSample;
+		}
+	} else {
+		for (i = 0; i < tir->syncSampleEntryCnt; i++) {
+			if (tir->syncSample[i] <= sampleCnt) {
+				track->samples[tir->syncSample[i] - 1].descriptionIndex |= kLibrarySyncSample;
+			}
+		}
+	}
+
+bail:
+	return err;
+}
+
+//   called with the validator's tables once the file has been checked
+OSErr KeepLibraryMovie( MovieInfoRec *mir )
+{
+	OSErr err = noErr;
+	validatemp4_movie *movie = vg.library->movie;
+	long t;
+
+	if (!movie || movie->tracks) goto bail;
+	BAILIFNIL( movie->tracks = calloc( mir->numTIRs ? mir->numTIRs : 1, sizeof(LibraryTrack) ), allocFailedErr );
+	movie->trackCnt = mir->numTIRs;
+	for (t = 0; t < mir->numTIRs; t++) {
+		BAILIFERR( BuildLibraryTrack( &movie->tracks[t], &mir->tirList[t] ) );
+	}
+
+bail:
+	if (err && movie && movie->tracks) {
+		for (t = 0; t < movie->trackCnt; t++) {
+			if (movie->tracks[t].samples) free( movie->tracks[t].samples );
+		}
+		free( movie->tracks );
+		movie->tracks = nil;
+	}
+	return err;
+}
+
+static void MapLibraryMovie( validatemp4_movie *movie, const char *path )
+{
+#if USE_MMAP
+	struct stat info;
+	void *p;
+	int fd = open( path, O_RDONLY );
+
+	if (fd < 0) return;
+	if ((fstat( fd, &info ) == 0) && (info.st_size > 0)) {
+		p = mmap( nil, info.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+		if (p != MAP_FAILED) {
+			movie->map = p;
+			movie->mapSize = info.st_size;
+		}
+	}
+	close( fd );
+#endif
+}
+
+validatemp4_movie *validatemp4_open( const char *path, const validatemp4_options *options, long *result )
+{
+	validatemp4_movie *movie;
+	long err;
+
+	if (!path || !path[0]) {
+		err = paramErr;
+		goto bail;
+	}
+	if (!(movie = calloc( 1, sizeof(validatemp4_movie) ))) {
+		err = allocFailedErr;
+		goto bail;
+	}
+	err = RunLibraryValidation( path, nil, options, movie );
+	if (!movie->tracks) {
+		validatemp4_close( movie );
+		if (err >= 0) err = noCanDoErr;
+		goto bail;
+	}
+	MapLibraryMovie( movie, path );
+	if (result) *result = err;
+	return movie;
+
+bail:
+	if (result) *result = err;
+	return nil;
+}
+
+void validatemp4_close( validatemp4_movie *movie )
+{
+	long t;
+
+	if (!movie) return;
+	if (movie->tracks) {
+		for (t = 0; t < movie->trackCnt; t++) {
+			if (movie->tracks[t].samples) free( movie->tracks[t].samples );
+		}
+		free( movie->tracks );
+	}
+#if USE_MMAP
+	if (movie->map) munmap( (void *)movie->map, movie->mapSize );
+#endif
+	free( movie );
+}
+
+long validatemp4_track_count( const validatemp4_movie *movie )
+{
+	return movie ? movie->trackCnt : 0;
+}
+
+int validatemp4_get_track( const validatemp4_movie *movie, long trackIndex, validatemp4_track *track )
+{
+	if (!movie || (trackIndex < 0) || (trackIndex >= movie->trackCnt)) {
+		return paramErr;
+	}
+	*track = movie->tracks[trackIndex].info;
+	return noErr;
+}
+
+int validatemp4_get_sample( const validatemp4_movie *movie, long trackIndex, unsigned long sampleNumber, validatemp4_sample *sample )
+{
+	const LibraryTrack *track;
+	const LibrarySample *s;
+
+	if (!movie || (trackIndex < 0) || (trackIndex >= movie->trackCnt)) {
+		return paramErr;
+	}
+	track = &movie->tracks[trackIndex];
+	if ((sampleNumber == 0) || (sampleNumber > track->info.sampleCount)) {
+		return paramErr;
+	}
+	s = &track->samples[sampleNumber - 1];
+	sample->offset = s->offset;
+	sample->size = s->size;
+	sample->decodeTime = s->decodeTime;
+	sample->duration = s->duration;
+	sample->compositionOffset = s->compositionOffset;
+	sample->descriptionIndex = s->descriptionIndex & ~kLibrarySyncSample;
+	sample->sync = (s->descriptionIndex & kLibrarySyncSample) != 0;
+	sample->data = nil;
+	if (movie->map && (s->offset <= movie->mapSize) && (s->size <= movie->mapSize - s->offset)) {
+		sample->data = movie->map + s->offset;
+	}
+	return noErr;
+}
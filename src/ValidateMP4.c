@@ -30,8 +30,7 @@ limitations under the License.
 #define myTAB "\t"
 #endif
 
-ValidateGlobals vg = {0};
-
+THREAD_LOCAL ValidateGlobals vg = {0};
 
 static int keymatch (const char * arg, const char * keyword, int minchars);
 
@@ -74,23 +73,27 @@ static int keymatch (const char * arg, const char * keyword, int minchars)
 		arg = argv[argn]; \
 		if( nil == arg ) \
 		{ \
-			fprintf( stderr, "Expected " _str_err_str_ " got end of args\n" ); \
+			fprintf( _stderr, "Expected " _str_err_str_ " got end of args\n" ); \
 			err = -1; \
 			goto usageError; \
 		} \
 		if( arg[0] == '-' ) \
 		{ \
-			fprintf( stderr, "Expected " _str_err_str_ " next arg\n" ); \
+			fprintf( _stderr, "Expected " _str_err_str_ " next arg\n" ); \
 			err = -1; \
 			goto usageError; \
 		} \
-		strcpy(*(_str_), arg); 
+		snprintf( *(_str_), sizeof(*(_str_)), "%s", arg );
 		
 
+// VALIDATEMP4_NO_MAIN leaves out main() so the validator objects can be linked into other tools (e.g. ValidateBench)
+#if !VALIDATEMP4_NO_MAIN
 #if !STAND_ALONE_APP
 int main(int argc, char *argv[]);
 int main(int argc, char *argv[])
 {
+	return ValidateMP4Command( argc, argv );
+}
 #else
 int main(void);
 int main(void)
@@ -100,12 +103,24 @@ int main(void)
 		"<mpeg4-file-path>"
 		};
 	int argc = sizeof(argv)/sizeof(char*);
+
+	return ValidateMP4Command( argc, argv );
+}
 #endif
+#endif	// !VALIDATEMP4_NO_MAIN
+
+//   the whole command line; server jobs (see ValidateServer.c) come through here too, on
+//   worker threads and with their report going to vg.outFile and vg.errFile
+int ValidateMP4Command( int argc, char *argv[] )
+{
 	int argn;
+	int clientArgn = 0;
+	int inputArgn = 0;
 	int gotInputFile = false;
 	int err;
 	char gInputFileFullPath[1024];
 	int usedefaultfiletype = true;
+	Boolean isStream;
 	
 	FILE *infile = nil;
 	atomOffsetEntry aoe = {0};
@@ -132,17 +147,18 @@ int main(void)
 	{
 		const char *arg = argv[argn];
 		
-		if( '-' != arg[0] )
+		if( ('-' != arg[0]) || (0 == arg[1]) )		// a lone - is standard input
 		{
 			char *extensionstartp = nil;
 			
 			if (gotInputFile) {
-				fprintf( stderr, "Unexpected argument \"%s\"\n", arg );
+				fprintf( _stderr, "Unexpected argument \"%s\"\n", arg );
 				err = -1;
 				goto usageError;
 			}
-			strcpy(gInputFileFullPath, arg);
+			snprintf( gInputFileFullPath, sizeof(gInputFileFullPath), "%s", arg );
 			gotInputFile = true;
+			inputArgn = argn;
 			
 #ifdef USE_STRCASECMP
 	#define rStrCaseCmp(a,b)		strcasecmp(a,b)
@@ -176,17 +192,103 @@ int main(void)
 			getNextArgStr( &vg.printtypestr, "printtype" );
 		} else if ( keymatch( arg, "samplenumber", 1 ) ) {
 			getNextArgStr( &vg.samplenumberstr, "samplenumber" );
+		} else if ( keymatch( arg, "samplerange", 7 ) ) {
+			getNextArgStr( &vg.samplerangestr, "samplerange" );
+		} else if ( keymatch( arg, "samplefraction", 7 ) ) {
+			getNextArgStr( &vg.samplefractionstr, "samplefraction" );
+		} else if ( keymatch( arg, "sampleevery", 7 ) ) {
+			getNextArgStr( &vg.sampleeverystr, "sampleevery" );
+		} else if ( keymatch( arg, "sampleseed", 7 ) ) {
+			getNextArgStr( &vg.sampleseedstr, "sampleseed" );
+		} else if ( keymatch( arg, "tablemode", 2 ) ) {
+			getNextArgStr( &vg.tablemodestr, "tablemode" );
+		} else if ( keymatch( arg, "coverage", 2 ) ) {
+			vg.coverage = true;
+		} else if ( keymatch( arg, "timerange", 2 ) ) {
+			getNextArgStr( &vg.timerangestr, "timerange" );
+		} else if ( keymatch( arg, "keyframeindex", 1 ) ) {
+			getNextArgStr( &vg.keyframeindexstr, "keyframeindex" );
+		} else if ( keymatch( arg, "faststart", 2 ) ) {
+			getNextArgStr( &vg.faststartstr, "faststart" );
+		} else if ( keymatch( arg, "optimize", 2 ) ) {
+			getNextArgStr( &vg.optimizestr, "optimize" );
+		} else if ( keymatch( arg, "extract", 2 ) ) {
+			getNextArgStr( &vg.extractstr, "extract" );
+		} else if ( keymatch( arg, "digest", 2 ) ) {
+			getNextArgStr( &vg.digeststr, "digest" );
+		} else if ( keymatch( arg, "verifydigest", 7 ) ) {
+			getNextArgStr( &vg.verifydigeststr, "verifydigest" );
+		} else if ( keymatch( arg, "jobs", 1 ) ) {
+			getNextArgStr( &vg.jobsstr, "jobs" );
+		} else if ( keymatch( arg, "spool", 2 ) ) {
+			getNextArgStr( &vg.spoolstr, "spool" );
+		} else if ( keymatch( arg, "follow", 2 ) ) {
+			getNextArgStr( &vg.followstr, "follow" );
+		} else if ( keymatch( arg, "server", 2 ) ) {
+			getNextArgStr( &vg.serverstr, "server" );
+		} else if ( keymatch( arg, "client", 2 ) ) {
+			clientArgn = argn;
+			getNextArgStr( &vg.clientstr, "client" );
+		} else if ( keymatch( arg, "workers", 2 ) ) {
+			getNextArgStr( &vg.workersstr, "workers" );
+		} else if ( keymatch( arg, "timeout", 5 ) ) {
+			getNextArgStr( &vg.timeoutstr, "timeout" );
 
 
 
 		} else {
-			fprintf( stderr, "Unexpected option \"%s\"\n", arg );
+			fprintf( _stderr, "Unexpected option \"%s\"\n", arg );
 			err = -1;
 			goto usageError;
 		}
 	}
 	
 
+	//=====================
+	// Server and client (see ValidateServer.c)
+
+	if (vg.serverstr[0] || vg.clientstr[0]) {
+		long workers = 4;
+		long timeout = 0;
+
+		if (vg.cancelled) {
+			fprintf( _stderr, "-server and -client can't be used by a server job\n" );
+			err = -1;
+			goto usageError;
+		}
+		if (vg.serverstr[0] && vg.clientstr[0]) {
+			fprintf( _stderr, "Use only one of -server and -client\n" );
+			err = -1;
+			goto usageError;
+		}
+		if (vg.workersstr[0] != 0) {
+			workers = atoi(vg.workersstr);
+			if (workers < 1) {
+				fprintf( _stderr, "Invalid number of workers\n" );
+				err = -1;
+				goto usageError;
+			}
+		}
+		if (vg.timeoutstr[0] != 0) {
+			timeout = atoi(vg.timeoutstr);
+			if (timeout < 1) {
+				fprintf( _stderr, "Invalid timeout\n" );
+				err = -1;
+				goto usageError;
+			}
+		}
+		if (vg.serverstr[0]) {
+			err = RunValidateServer( vg.serverstr, workers, timeout );
+		} else if (!gotInputFile) {
+			err = -1;
+			fprintf( _stderr, "No input file specified\n" );
+			goto usageError;
+		} else {
+			err = RunValidateClient( vg.clientstr, argc, argv, clientArgn, inputArgn, timeout );
+		}
+		goto bail;
+	}
+
 	//=====================
 	// Process input parameters
 	
@@ -196,7 +298,7 @@ int main(void)
 	} else if (strcmp(vg.filetypestr, "mp4v") == 0) {
 		vg.filetype = filetype_mp4v;
 	} else if (vg.filetype == 0) {
-		fprintf( stderr, "Invalid filetype\n" );
+		fprintf( _stderr, "Invalid filetype\n" );
 		err = -1;
 		goto usageError;
 	}
@@ -206,10 +308,14 @@ int main(void)
 	} else {
 		vg.checklevel = atoi(vg.checklevelstr);
 		if (vg.checklevel < 1) {
-			fprintf( stderr, "Invalid check level\n" );
+			fprintf( _stderr, "Invalid check level\n" );
 			goto usageError;
 		}
 	}
+	if (vg.digeststr[0] || vg.verifydigeststr[0]) {
+		vg.digest = true;
+		if (vg.checklevel < checklevel_samples) vg.checklevel = checklevel_samples;		// the samples have to be read
+	}
 
 	if (vg.printtypestr[0] == 0) {
 		// default is not to print anything
@@ -233,7 +339,7 @@ int main(void)
 			} else if (keymatch(tokstr, "hintpayload", 1)) {
 				vg.print_hintpayload = true;
 			} else {
-				fprintf( stderr, "Invalid print type option\n" );
+				fprintf( _stderr, "Invalid print type option\n" );
 				goto usageError;
 			}
 			tokstr = strtok(nil,"+");
@@ -247,31 +353,162 @@ int main(void)
 		if (vg.samplenumber < 1) goto usageError;
 	}
 
+	if ((vg.tablemodestr[0] == 0) || (strcmp(vg.tablemodestr, "auto") == 0)) {
+		vg.tablemode = tablemode_auto;
+	} else if (strcmp(vg.tablemodestr, "flat") == 0) {
+		vg.tablemode = tablemode_flat;
+	} else if (strcmp(vg.tablemodestr, "compact") == 0) {
+		vg.tablemode = tablemode_compact;
+	} else if (strcmp(vg.tablemodestr, "mapped") == 0) {
+		vg.tablemode = tablemode_mapped;
+	} else {
+		fprintf( _stderr, "Invalid table mode\n" );
+		goto usageError;
+	}
+
+	if (vg.timerangestr[0] != 0) {
+		char extra;
+		
+		if ((sscanf(vg.timerangestr, "%lf-%lf%c", &vg.timerangeStart, &vg.timerangeEnd, &extra) != 2) ||
+				(vg.timerangeStart < 0) || (vg.timerangeEnd <= vg.timerangeStart)) {
+			fprintf( _stderr, "Invalid time range\n" );
+			goto usageError;
+		}
+		vg.timerange = true;
+	}
+
+	if (vg.samplerangestr[0] != 0) {
+		unsigned long first, last;
+		char extra;
+
+		if ((sscanf(vg.samplerangestr, "%lu-%lu%c", &first, &last, &extra) != 2) ||
+				(first < 1) || (last < first) || (last > 0xFFFFFFFEUL)) {
+			fprintf( _stderr, "Invalid sample range\n" );
+			goto usageError;
+		}
+		vg.samplerangeFirst = first;
+		vg.samplerangeLast = last;
+	}
+
+	if ((vg.samplefractionstr[0] != 0) && (vg.sampleeverystr[0] != 0)) {
+		fprintf( _stderr, "Use only one of -samplefraction and -sampleevery\n" );
+		goto usageError;
+	} else if (vg.samplefractionstr[0] != 0) {
+		char extra;
+
+		if ((sscanf(vg.samplefractionstr, "%lf%c", &vg.sampleFraction, &extra) != 1) ||
+				!(vg.sampleFraction > 0) || (vg.sampleFraction > 1)) {
+			fprintf( _stderr, "Invalid sample fraction\n" );
+			goto usageError;
+		}
+	} else if (vg.sampleeverystr[0] != 0) {
+		long every = atoi(vg.sampleeverystr);
+		if (every < 1) {
+			fprintf( _stderr, "Invalid sample interval\n" );
+			goto usageError;
+		}
+		vg.sampleEvery = every;
+	}
+	vg.sampleSeed = strtoul(vg.sampleseedstr, nil, 0);
+
+	if (vg.jobsstr[0] == 0) {
+		vg.jobs = 1;
+	} else {
+		vg.jobs = atoi(vg.jobsstr);
+		if (vg.jobs < 1) {
+			fprintf( _stderr, "Invalid number of jobs\n" );
+			goto usageError;
+		}
+	}
+
+	if (vg.spoolstr[0] == 0) {
+		vg.spoolLimit = 64 * 1024 * 1024;	// default
+	} else {
+		long megabytes = atoi(vg.spoolstr);
+		if (megabytes < 0) {
+			fprintf( _stderr, "Invalid spool size\n" );
+			goto usageError;
+		}
+		vg.spoolLimit = (UInt64)megabytes * 1024 * 1024;
+	}
+
+	if (vg.followstr[0] != 0) {
+		vg.follow = atoi(vg.followstr);
+		if (vg.follow < 1) {
+			fprintf( _stderr, "Invalid follow time\n" );
+			goto usageError;
+		}
+	}
+
 	//=====================
 
 	if (!gotInputFile) {
 		err = -1;
-		fprintf( stderr, "No input file specified\n" );
+		fprintf( _stderr, "No input file specified\n" );
 		goto usageError;
 	}
 
-    infile = fopen(gInputFileFullPath, "rb");
+	if (vg.cancelled && ((strcmp(gInputFileFullPath, "-") == 0) || vg.follow)) {
+		err = -1;
+		fprintf( _stderr, "A server job can't read standard input or follow a file\n" );
+		goto bail;
+	}
+
+	if (vg.inData) {
+		infile = vg.inData;
+	} else if (strcmp(gInputFileFullPath, "-") == 0) {
+		infile = stdin;
+	} else {
+		infile = fopen(gInputFileFullPath, "rb");
+	}
 	if (!infile) {
 		err = -1;
-		fprintf( stderr, "Could not open input file \"%s\"\n", gInputFileFullPath );
+		fprintf( _stderr, "Could not open input file \"%s\"\n", gInputFileFullPath );
 		goto usageError;
 	}
 	
-	fprintf(stdout,"\n\n\n<!-- Source file is '%s' -->\n", gInputFileFullPath);
+	fprintf(_stdout,"\n\n\n<!-- Source file is '%s' -->\n", gInputFileFullPath);
 
 	vg.inFile = infile;
 	vg.inOffset = 0;
-	err = fseek(infile, 0, SEEK_END);
-	if (err) goto bail;
-	vg.inMaxOffset = ftell( infile );
-	if (vg.inMaxOffset < 0) {
-		err = vg.inMaxOffset;
-		goto bail;
+	
+	// a pipe, or a file that is still being written, can only be read front to back
+	//   (see ValidateStream.c)
+	isStream = (fseek(infile, 0, SEEK_END) != 0);
+	if (vg.follow && !isStream) {
+		rewind( infile );
+		isStream = true;
+	}
+	if (isStream) {
+		if (vg.filetype == filetype_mp4v) {
+			err = -1;
+			fprintf( _stderr, "Elementary streams can't be read from a pipe or followed\n" );
+			goto bail;
+		}
+		if (vg.faststartstr[0] || vg.optimizestr[0] || vg.extractstr[0]) {
+			err = -1;
+			fprintf( _stderr, "-faststart, -optimize and -extract need a file, not a pipe or a followed file\n" );
+			goto bail;
+		}
+		if (vg.digest) {
+			err = -1;
+			fprintf( _stderr, "-digest and -verifydigest need a file, not a pipe or a followed file\n" );
+			goto bail;
+		}
+	} else {
+		if ((infile != stdin) && (infile != vg.inData)) vg.inFilePath = gInputFileFullPath;
+		vg.inMaxOffset = ftell( infile );
+		if (vg.inMaxOffset < 0) {
+			err = vg.inMaxOffset;
+			goto bail;
+		}
+	}
+
+	if ((vg.tablemode == tablemode_mapped) && !isStream) {
+		if (MapInputFile() != noErr) {
+			fprintf( _stderr, "Could not map input file; reading tables instead\n" );
+			vg.tablemode = tablemode_auto;
+		}
 	}
 
 	aoe.type = 'file';
@@ -285,8 +522,8 @@ int main(void)
 	if (vg.filetype == filetype_mp4v) {
 		err = ValidateElementaryVideoStream( &aoe, nil );
 	} else {
-		err = ValidateFileAtoms( &aoe, nil );
-		fprintf(stdout,"<!#- Finished testing file '%s' -->\n", gInputFileFullPath);
+		err = isStream ? ValidateStream( &aoe ) : ValidateFileAtoms( &aoe, nil );
+		fprintf(_stdout,"<!#- Finished testing file '%s' -->\n", gInputFileFullPath);
 	}
 	
 	goto bail;
@@ -294,33 +531,84 @@ int main(void)
 	//=====================
 
 usageError:
-	fprintf( stderr, "Usage: %s [-filetype <type>] "
+	if (vg.library) goto bail;		// the options came from a validatemp4_options
+	fprintf( _stderr, "Usage: %s [-filetype <type>] "
 								"[-printtype <options>] [-checklevel <level>]\n", "ValidateMP4" );
-	fprintf( stderr, "            [-samplenumber <number>] [-verbose <options> [-help] inputfile\n" );
-	fprintf( stderr, "    -a[tompath] <atompath> - limit certain operations to <atompath> (e.g. moov-1:trak-2)\n" );
-	fprintf( stderr, "                     this effects -checklevel and -printtype (default is everything) \n" );
-	fprintf( stderr, "    -p[rinttype] <options> - controls output (combine options with +) \n" );
-	fprintf( stderr, "                     atompath - output the atompath for each atom \n" );
-	fprintf( stderr, "                     atom - output the contents of each atom \n" );
-	fprintf( stderr, "                     fulltable - output those long tables (e.g. samplesize tables)  \n" );
-	fprintf( stderr, "                     sample - output the samples as well \n" );
-	fprintf( stderr, "                                 (depending on the track type, this is the same as sampleraw) \n" );
-	fprintf( stderr, "                     sampleraw - output the samples in raw form \n" );
-	fprintf( stderr, "                     hintpayload - output payload for hint tracks \n" );
-	fprintf( stderr, "    -c[hecklevel] <level> - increase the amount of checking performed \n" );
-	fprintf( stderr, "                     1: check the moov container (default -atompath is ignored) \n" );
-	fprintf( stderr, "                     2: check the samples \n" );
-	fprintf( stderr, "                     3: check the payload of hint track samples \n" );
-	fprintf( stderr, "    -s[amplenumber] <number> - limit sample checking or printing operations to sample <number> \n" );
-	fprintf( stderr, "                     most effective in combination with -atompath (default is all samples) \n" );
-
-	fprintf( stderr, "    -h[elp] - print this usage message \n" );
+	fprintf( _stderr, "            [-samplenumber <number>] [-samplerange <first>-<last>] \n" );
+	fprintf( _stderr, "            [-samplefraction <fraction> | -sampleevery <n>] [-sampleseed <seed>] \n" );
+	fprintf( _stderr, "            [-tablemode <mode>] [-timerange <start>-<end>]\n" );
+	fprintf( _stderr, "            [-coverage] [-keyframeindex <file>] [-faststart <file>] \n" );
+	fprintf( _stderr, "            [-optimize <file>] [-extract <trackID>:<file>] \n" );
+	fprintf( _stderr, "            [-digest <file>] [-verifydigest <file>] \n" );
+	fprintf( _stderr, "            [-jobs <n>] [-spool <megabytes>]\n" );
+	fprintf( _stderr, "            [-follow <seconds>] [-server <socket> [-workers <n>] | -client <socket>] \n" );
+	fprintf( _stderr, "            [-timeout <seconds>] [-verbose <options> [-help] inputfile\n" );
+	fprintf( _stderr, "    inputfile - the file to check, or - to read a stream from standard input \n" );
+	fprintf( _stderr, "    -a[tompath] <atompath> - limit certain operations to <atompath> (e.g. moov-1:trak-2)\n" );
+	fprintf( _stderr, "                     this effects -checklevel and -printtype (default is everything) \n" );
+	fprintf( _stderr, "    -p[rinttype] <options> - controls output (combine options with +) \n" );
+	fprintf( _stderr, "                     atompath - output the atompath for each atom \n" );
+	fprintf( _stderr, "                     atom - output the contents of each atom \n" );
+	fprintf( _stderr, "                     fulltable - output those long tables (e.g. samplesize tables)  \n" );
+	fprintf( _stderr, "                     sample - output the samples as well \n" );
+	fprintf( _stderr, "                                 (depending on the track type, this is the same as sampleraw) \n" );
+	fprintf( _stderr, "                     sampleraw - output the samples in raw form \n" );
+	fprintf( _stderr, "                     hintpayload - output payload for hint tracks \n" );
+	fprintf( _stderr, "    -c[hecklevel] <level> - increase the amount of checking performed \n" );
+	fprintf( _stderr, "                     1: check the moov container (default -atompath is ignored) \n" );
+	fprintf( _stderr, "                     2: check the samples \n" );
+	fprintf( _stderr, "                     3: check the payload of hint track samples \n" );
+	fprintf( _stderr, "    -s[amplenumber] <number> - limit sample checking or printing operations to sample <number> \n" );
+	fprintf( _stderr, "                     most effective in combination with -atompath (default is all samples) \n" );
+	fprintf( _stderr, "    -sampler[ange] <first>-<last> - limit sample checking or printing operations to samples \n" );
+	fprintf( _stderr, "                     <first> through <last> (e.g. 1000-1999) \n" );
+	fprintf( _stderr, "    -samplef[raction] <fraction> - check only about <fraction> of the samples (e.g. 0.05), \n" );
+	fprintf( _stderr, "                     plus every sync sample of tracks that have non-sync samples \n" );
+	fprintf( _stderr, "    -samplee[very] <n> - check only every <n>th sample, plus those sync samples \n" );
+	fprintf( _stderr, "    -samples[eed] <seed> - which samples -samplefraction and -sampleevery pick (default 0) \n" );
+	fprintf( _stderr, "    -ta[blemode] <mode> - how sample size and chunk offset tables are kept in memory \n" );
+	fprintf( _stderr, "                     auto: compact for large tables only (default) \n" );
+	fprintf( _stderr, "                     flat: always expand to one entry per sample/chunk \n" );
+	fprintf( _stderr, "                     compact: always pack into run/difference-coded blocks \n" );
+	fprintf( _stderr, "                     mapped: map the file and read tables in place \n" );
+	fprintf( _stderr, "    -ti[merange] <start>-<end> - limit sample checking or printing operations to the samples \n" );
+	fprintf( _stderr, "                     presented between <start> and <end> seconds of media time (e.g. 1800-1830) \n" );
+	fprintf( _stderr, "    -co[verage] - report 'mdat' bytes that no chunk of any track refers to \n" );
+	fprintf( _stderr, "    -k[eyframeindex] <file> - write the sample number, file offset and decode time \n" );
+	fprintf( _stderr, "                     of every sync sample of every track to <file> \n" );
+	fprintf( _stderr, "    -fa[ststart] <file> - write a copy of inputfile to <file> with the 'moov' ahead of \n" );
+	fprintf( _stderr, "                     the media data, so playback can start before the whole file is there \n" );
+	fprintf( _stderr, "    -op[timize] <file> - write a copy of inputfile to <file> with the sample tables in \n" );
+	fprintf( _stderr, "                     the 'moov' rebuilt as small as they go, and report the bytes saved \n" );
+	fprintf( _stderr, "    -ex[tract] <trackID>:<file> - write the samples of a track to <file> as an elementary \n" );
+	fprintf( _stderr, "                     stream: H.264 as Annex B, AAC as ADTS, or MPEG-4 Visual \n" );
+	fprintf( _stderr, "    -di[gest] <file> - write a manifest of sample (XXH64), track and 'mdat' (SHA-256) \n" );
+	fprintf( _stderr, "                     digests to <file>; implies -checklevel 2.  An 'mdat' is hashed as its \n" );
+	fprintf( _stderr, "                     samples are read, as far as they are read in file order; the rest (e.g. \n" );
+	fprintf( _stderr, "                     the other tracks of an interleaved file) is read a second time at the end \n" );
+	fprintf( _stderr, "    -verifyd[igest] <file> - check the content against a manifest written by -digest \n" );
+	fprintf( _stderr, "                     and report what differs as errors; implies -checklevel 2 \n" );
+	fprintf( _stderr, "    -j[obs] <n> - check movie fragments ('moof') and hint track samples on <n> threads \n" );
+	fprintf( _stderr, "                     (default 1) \n" );
+	fprintf( _stderr, "    -sp[ool] <megabytes> - how much 'mdat' payload to keep for sample checks when \n" );
+	fprintf( _stderr, "                     reading from a pipe (default 64) \n" );
+	fprintf( _stderr, "    -fo[llow] <seconds> - check a file while it is being written, validating what is \n" );
+	fprintf( _stderr, "                     appended as it arrives, until it stops growing for <seconds> \n" );
+	fprintf( _stderr, "    -se[rver] <socket> - listen on the Unix domain socket <socket> and check the files \n" );
+	fprintf( _stderr, "                     that clients send, with the options they send \n" );
+	fprintf( _stderr, "    -wo[rkers] <n> - how many files the server checks at once (default 4) \n" );
+	fprintf( _stderr, "    -cl[ient] <socket> - have the server on <socket> check inputfile with the other options \n" );
+	fprintf( _stderr, "    -timeo[ut] <seconds> - stop a server job that runs longer than <seconds> \n" );
+	fprintf( _stderr, "                     (with -server, the default for jobs that don't set one) \n" );
+
+	fprintf( _stderr, "    -h[elp] - print this usage message \n" );
 
 
 	//=====================
 
 bail:
-	if (infile) {
+	UnmapInputFile();
+	if (infile && (infile != vg.inData)) {
 		fclose(infile);
 	}
 	
@@ -331,14 +619,6 @@ bail:
 //==========================================================================================
 
 #include <stdarg.h>
-// change here if you want to send both types of output to stdout to get interleaved output
-#if 1
-	#define _stdout stdout
-	#define _stderr stderr
-#else
-	#define _stdout stdout
-	#define _stderr stdout
-#endif
 
 void toggleprintatom( Boolean onOff )
 {
@@ -406,6 +686,21 @@ void atomprint(const char *formatStr, ...)
 	va_end(ap);
 }
 
+//   for reports that were asked for explicitly; printed whatever -printtype says
+void reportprint(const char *formatStr, ...)
+{
+	va_list 		ap;
+	long tabcnt = vg.tabcnt;
+	va_start(ap, formatStr);
+	
+	while (tabcnt-- > 0) {
+		fprintf(_stdout,myTAB);
+	}
+	vfprintf( _stdout, formatStr, (void *)ap );
+	
+	va_end(ap);
+}
+
 void atomprinthexdata(char *dataP, UInt32 size)
 {
 	char hexstr[4] = "12 ";
@@ -570,7 +865,9 @@ void warnprint(const char *formatStr, ...)
 	va_list 		ap;
 	va_start(ap, formatStr);
 	
-	if (vg.warnings)
+	if (vg.library)
+		LibraryMessage( validatemp4_warning, formatStr, ap );
+	else if (vg.warnings)
 		vfprintf( _stderr, formatStr, (void *)ap );
 	
 	va_end(ap);
@@ -582,8 +879,12 @@ void errprint(const char *formatStr, ...)
 	va_list 		ap;
 	va_start(ap, formatStr);
 	
-	fprintf( _stderr, "### error: %s \n###        ",vg.curatompath);
-	vfprintf( _stderr, formatStr, (void *)ap );
+	if (vg.library) {
+		LibraryMessage( validatemp4_error, formatStr, ap );
+	} else {
+		fprintf( _stderr, "### error: %s \n###        ",vg.curatompath);
+		vfprintf( _stderr, formatStr, (void *)ap );
+	}
 	
 	va_end(ap);
 }
@@ -601,7 +902,7 @@ int my_stricmp(const char* p, const char* q)
 
 char *ostypetostr(UInt32 num)
 {
-	static char str[sizeof(num)+1] = {0};
+	static THREAD_LOCAL char str[sizeof(num)+1] = {0};
 	
 	str[0] = (num >> 24) & 0xff;
 	str[1] = (num >> 16) & 0xff;
@@ -626,7 +927,7 @@ char *ostypetostr_r(UInt32 num, char * buffer)
 //    for cases where you need it more than once in the same print statment, use int64toxstr_r() instead
 char *int64toxstr(UInt64 num)
 {
-	static char str[20];
+	static THREAD_LOCAL char str[20];
 	UInt32 hi,lo;
 	
 	hi = num>>32;
@@ -657,7 +958,7 @@ char *int64toxstr_r(UInt64 num, char * str)
 //    for cases where you need it more than once in the same print statment, use int64toxstr_r() instead
 char *int64todstr(UInt64 num)
 {
-	static char str[40];
+	static THREAD_LOCAL char str[40];
 	sprintf(str,"%lld",(long long) num);
 	return str;
 }
@@ -672,7 +973,7 @@ char *int64todstr_r(UInt64 num, char * str)
 //  careful about using more than one call to this in the same print statement, they end up all being the same
 char *langtodstr(UInt16 num)
 {
-	static char str[4];
+	static THREAD_LOCAL char str[4];
 
 	str[3] = 0;
 	
@@ -693,7 +994,7 @@ char *langtodstr(UInt16 num)
 //    for cases where you need it more than once in the same print statment, use fixed16str_r() instead
 char *fixed16str(SInt16 num)
 {
-	static char str[40];
+	static THREAD_LOCAL char str[40];
 	float f;
 	
 	f = num;
@@ -721,7 +1022,7 @@ char *fixed16str_r(SInt16 num, char * str)
 //    for cases where you need it more than once in the same print statment, use fixed32str_r() instead
 char *fixed32str(SInt32 num)
 {
-	static char str[40];
+	static THREAD_LOCAL char str[40];
 	double f;
 	
 	f = num;
@@ -750,7 +1051,7 @@ char *fixed32str_r(SInt32 num, char * str)
 //    for cases where you need it more than once in the same print statment, use fixedU32str_r() instead
 char *fixedU32str(UInt32 num)
 {
-	static char str[40];
+	static THREAD_LOCAL char str[40];
 	double f;
 	
 	f = num;
@@ -23,6 +23,9 @@ limitations under the License.
 #include <ctype.h>
 #include <string.h>
 #include <stdint.h>
+#include <stdarg.h>
+
+#include "ValidateMP4Lib.h"
 
 #if defined(__GNUC__) && ( defined(__APPLE_CPP__) || defined(__APPLE_CC__) || defined(__MACOS_CLASSIC__) )
  #if defined(__i386__) || defined(__x86_64__) 
@@ -60,6 +63,13 @@ typedef short OSErr;
 	#define fieldOffset(type, field) ((short) &((type *) 0)->field)
 #endif
 
+// the validator state is per thread so movie fragments and hint samples can be checked on worker threads (-jobs)
+#if defined(_MSC_VER)
+	#define THREAD_LOCAL __declspec(thread)
+#else
+	#define THREAD_LOCAL __thread
+#endif
+
 enum {
 	kSkipUnknownAtoms = 1L<<0
 };
@@ -124,7 +134,9 @@ enum {
 
 enum {
 	noErr = 0,
+	ioErr = -36,
 	paramErr = -50,
+	userCanceledErr = -128,
 	allocFailedErr = -2019,
 	outOfDataErr = -2020,
 	tooMuchDataErr = -2021,
@@ -217,6 +229,11 @@ typedef struct TimeToSampleNum {
 	TimeValue	sampleDuration;  // duration for a single sample, not total duration
 } TimeToSampleNum;
 
+typedef struct CompositionTimeToSampleNum {
+	UInt32	sampleCount;
+	TimeValue	sampleOffset;
+} CompositionTimeToSampleNum;
+
 typedef struct ChunkOffsetRecord {
     UInt32	chunkOffset;
 } ChunkOffsetRecord;
@@ -266,6 +283,27 @@ typedef struct VideoSampleDescriptionInfo {
 } VideoSampleDescriptionInfo;
 
 
+//===========================
+
+// a table of integers packed in blocks of fixed-width differences (see ValidateSampleTables.c)
+typedef struct PackedTableBlock {
+	UInt64	base;				// smallest entry in the block
+	UInt32	wordIndex;			// first word of the block's packed entries
+	UInt32	width;				// bits per entry; 0 if every entry equals base
+} PackedTableBlock;
+
+typedef struct PackedTable {
+	UInt32	entryCnt;
+	UInt32	blockCnt;
+	PackedTableBlock *blocks;
+	UInt64	*words;
+} PackedTable;
+
+typedef struct TimelineRun {
+	UInt64	decodeTime;			// decode time of the first sample of the 'stts' entry
+	UInt32	firstSample;		// 1 based
+} TimelineRun;
+
 //===========================
 
 typedef struct {
@@ -276,6 +314,8 @@ typedef struct {
 	Fixed sampleDescWidth, sampleDescHeight;
 	UInt32	trackID;
 	UInt32	hintRefTrackID;
+	UInt32	hintMaxBitrate;			// from the 'hmhd' (bits per second over any one second)
+	UInt32	externalDataRefCnt;		// 'dref' entries that point outside this file
 
 	UInt32	mediaTimeScale;
 	UInt64	mediaDuration;
@@ -289,31 +329,99 @@ typedef struct {
 	
 	UInt32 sampleSizeEntryCnt;			// number of sample size entries
 	UInt32 singleSampleSize;			// set if there is a constant sample size
-	SampleSizeRecord *sampleSize;		// 1 based array of sample sizes
+	SampleSizeRecord *sampleSize;		// 1 based array of sample sizes (nil if packed or mapped)
+	PackedTable packedSampleSize;		// sample sizes when the table is kept compact
+	const UInt8 *sampleSizeView;		// big-endian table in the mapped file (-tablemode mapped)
+	UInt32 sampleSizeViewBits;			// 32 for 'stsz', 4/8/16 for 'stz2'
 
 	UInt32 chunkOffsetEntryCnt;			// number of chunk offset entries
-	ChunkOffset64Record *chunkOffset;	// 1 based array of chunk offsets
+	ChunkOffset64Record *chunkOffset;	// 1 based array of chunk offsets (nil if packed or mapped)
+	PackedTable packedChunkOffset;		// chunk offsets when the table is kept compact
+	const UInt8 *chunkOffsetView;		// big-endian table in the mapped file
+	UInt32 chunkOffsetViewBits;			// 32 for 'stco', 64 for 'co64'
 
 	UInt32 sampleToChunkEntryCnt;			// number of sampleToChunk entries
-	SampleToChunk *sampleToChunk;			// 1-based array of sampleToChunk entries
+	SampleToChunk *sampleToChunk;			// 1-based array of sampleToChunk entries (nil if mapped)
+	const UInt8 *sampleToChunkView;			// big-endian table in the mapped file
 	UInt32 sampleToChunkSampleSubTotal;		// total accounted for all but last entry
 
 	UInt32 timeToSampleEntryCnt;            // number of timeToSample entries
-	TimeToSampleNum *timeToSample;             // 1-based array of TimeToSampleNum entries
+	TimeToSampleNum *timeToSample;             // 1-based array of TimeToSampleNum entries (nil if mapped)
+	const UInt8 *timeToSampleView;			// big-endian table in the mapped file
+
+	UInt32 compositionTimeToSampleEntryCnt;				// number of 'ctts' entries, 0 if there is none
+	CompositionTimeToSampleNum *compositionTimeToSample;	// 1-based array of 'ctts' entries (nil if mapped)
+	const UInt8 *compositionTimeToSampleView;			// big-endian table in the mapped file
 
 	UInt32 timeToSampleSampleCnt;			// number of samples described in the timeToSampleAtom
 	UInt64 timeToSampleDuration;			// duration described by timeToSampleAtom (this is Total duration of all samples, 
 											//   not a single sample's duration)
+
+	Boolean hasSyncSampleTable;				// false if there is no 'stss' (every sample is a sync sample)
+	UInt32 syncSampleEntryCnt;
+	UInt32 *syncSample;						// 0 based, sorted array of sync sample numbers
+
+	TimelineRun *timeline;					// one checkpoint per 'stts' entry, built by BuildTrackTimeline
+	UInt32 *compositionRunFirstSample;		// first sample of each 'ctts' entry (0 based array)
+	UInt32 minCompositionOffset;
+	UInt32 maxCompositionOffset;
+
+	//==== movie fragments
+	Boolean hasTrackExtends;				// there is a 'trex' for this track
+	UInt32 defaultSampleDescriptionIndex;	// defaults from the 'trex'
+	UInt32 defaultSampleDuration;
+	UInt32 defaultSampleSize;
+	UInt32 defaultSampleFlags;
+	UInt32 fragmentSampleCnt;				// samples seen so far in movie fragments
+	UInt64 fragmentDecodeTime;				// decode time of the next sample in a movie fragment
+	Boolean hasFragmentDecodeTime;			// fragmentDecodeTime was last set by a 'tfdt'
+
+	struct TrackDigest *digest;				// -digest/-verifydigest hashes of the samples checked so far
 } TrackInfoRec;
 
 int GetSampleOffsetSize( TrackInfoRec *tir, UInt32 sampleNum, UInt64 *offsetOut, UInt32 *sizeOut, UInt32 *sampleDescriptionIndexOut );
 int GetChunkOffsetSize( TrackInfoRec *tir, UInt32 chunkNum, UInt64 *offsetOut, UInt32 *sizeOut, UInt32 *sampleDescriptionIndexOut );
 
+OSErr PackedTable_Build32( PackedTable *pt, const UInt32 *values, UInt32 entryCnt );
+OSErr PackedTable_Build64( PackedTable *pt, const UInt64 *values, UInt32 entryCnt );
+UInt64 PackedTable_Get( const PackedTable *pt, UInt32 index );
+void PackedTable_Dispose( PackedTable *pt );
+
+OSErr SetSampleSizeTable( TrackInfoRec *tir, SampleSizeRecord *listP, UInt32 entryCount );
+OSErr SetChunkOffsetTable( TrackInfoRec *tir, ChunkOffset64Record *listP, UInt32 entryCount );
+void DisposeTrackTables( TrackInfoRec *tir );
+UInt32 GetSampleSize( TrackInfoRec *tir, UInt32 sampleNum );
+UInt64 GetChunkOffset( TrackInfoRec *tir, UInt32 chunkNum );
+void GetSampleToChunk( TrackInfoRec *tir, UInt32 entryNum, SampleToChunk *entry );
+void GetTimeToSample( TrackInfoRec *tir, UInt32 entryNum, TimeToSampleNum *entry );
+void GetCompositionTimeToSample( TrackInfoRec *tir, UInt32 entryNum, CompositionTimeToSampleNum *entry );
+
+OSErr BuildTrackTimeline( TrackInfoRec *tir );
+void DisposeTrackTimeline( TrackInfoRec *tir );
+UInt64 GetSampleDecodeTime( TrackInfoRec *tir, UInt32 sampleNum, UInt32 *durationOut );
+UInt32 GetSampleCompositionOffset( TrackInfoRec *tir, UInt32 sampleNum );
+void GetSelectedSampleRange( TrackInfoRec *tir, UInt32 *firstOut, UInt32 *lastOut );
+Boolean SampleIsSelected( TrackInfoRec *tir, UInt32 sampleNum );
+Boolean SampleNumberIsSelected( TrackInfoRec *tir, UInt32 sampleNum, Boolean keepAsSync );
+UInt32 GetNextSelectedSample( TrackInfoRec *tir, UInt32 sampleNum, UInt32 lastSample );
+Boolean SampleTimeIsSelected( TrackInfoRec *tir, UInt64 decodeTime, UInt32 duration, UInt32 compositionOffset );
+
+OSErr SetSyncSampleTable( TrackInfoRec *tir, UInt32 *syncSamples, UInt32 entryCount );
+Boolean IsSyncSample( TrackInfoRec *tir, UInt32 sampleNum );
+UInt32 GetSyncSampleAtOrBefore( TrackInfoRec *tir, UInt32 sampleNum );
+UInt32 CountSyncSamplesThrough( TrackInfoRec *tir, UInt32 sampleNum );
+
 // movie Globals
 typedef struct {
 
 	long			numTIRs;
 	long			maxTIRs;
+	UInt32			chunkListCnt;
+	struct chunkOverlapRec	*chunkList;		// every chunk of every track in offset order, built by CheckChunkOverlaps
+	Boolean			hasMovieExtends;		// the 'moov' has an 'mvex', so movie fragments may follow
+	UInt32			fragmentCnt;
+	UInt32			fragmentSequenceNumber;	// sequence number of the last 'mfhd' atom
+	Boolean			hasFragmentSequenceNumber;
 	TrackInfoRec	tirList[1];
 } MovieInfoRec;
 
@@ -333,6 +441,14 @@ enum {
 	checklevel_payload = 3
 };
 
+// enums for tablemode
+enum {
+	tablemode_auto = 0,
+	tablemode_flat = 1,
+	tablemode_compact = 2,
+	tablemode_mapped = 3
+};
+
 
 
 // to validate VideoSpecificInfo and VideoProfileLevelIndication
@@ -348,8 +464,12 @@ typedef struct{
 // Validate Globals
 typedef struct {
 	FILE *inFile;
+	const char *inFilePath;			// so worker threads can open their own handle
 	long inOffset;
 	long inMaxOffset;
+	const UInt8 *inMap;				// the whole input file when it is mapped (-tablemode mapped)
+	struct StreamSource *inStream;	// what has been kept of a non-seekable input
+	FILE *inData;					// an input the caller opened (validate_buffer), used instead of the input file
 	
 	atompathType curatompath;
 	Boolean printatom; 
@@ -357,10 +477,17 @@ typedef struct {
 	long tabcnt;
 
 	atomOffsetEntry *fileaoe;		// used when you need to read file & size from the file
+	FILE *outFile;					// where the report goes, if not stdout/stderr
+	FILE *errFile;
+	volatile int *cancelled;		// set for a server job; the job stops reading once it is nonzero
+	struct LibraryRun *library;		// set for a libvalidatemp4 call; errors and warnings go to its callback
 	
 	Boolean warnings;
 	
 	MovieInfoRec	*mir;
+	struct MediaDataExtent *mdatList;	// payload extents of the top level 'mdat' atoms, in file order
+	UInt32			mdatCnt;
+	struct MediaDataDigests *mdatDigests;	// -digest/-verifydigest SHA-256 of each 'mdat' payload so far
 
 	// -----
 	atompathType atompath;
@@ -369,10 +496,43 @@ typedef struct {
 	argstr	checklevelstr;
 	argstr	samplenumberstr;
 	argstr	printtypestr;
+	argstr	tablemodestr;
+	argstr	timerangestr;
+	argstr	keyframeindexstr;
+	argstr	faststartstr;
+	argstr	optimizestr;
+	argstr	extractstr;
+	argstr	digeststr;
+	argstr	verifydigeststr;
+	argstr	jobsstr;
+	argstr	spoolstr;
+	argstr	followstr;
+	argstr	samplerangestr;
+	argstr	samplefractionstr;
+	argstr	sampleeverystr;
+	argstr	sampleseedstr;
+	argstr	serverstr;
+	argstr	clientstr;
+	argstr	workersstr;
+	argstr	timeoutstr;
 
 	long	filetype;
 	long	checklevel;
 	long	samplenumber;
+	long	tablemode;
+	long	jobs;					// worker threads for movie fragments and hint samples
+	UInt64	spoolLimit;				// bytes of 'mdat' payload kept from a non-seekable input
+	long	follow;					// seconds a followed file may go without growing (0: not followed)
+	Boolean	coverage;
+	Boolean	digest;					// -digest or -verifydigest: hash the samples as they are checked
+	Boolean	timerange;
+	double	timerangeStart;			// seconds of presentation time
+	double	timerangeEnd;
+	UInt32	samplerangeFirst;		// 0 when there is no -samplerange
+	UInt32	samplerangeLast;
+	double	sampleFraction;			// 0 when there is no -samplefraction
+	UInt32	sampleEvery;			// 0 when there is no -sampleevery
+	UInt32	sampleSeed;
 
 	long	majorBrand;
 
@@ -388,7 +548,7 @@ typedef struct {
 
 } ValidateGlobals;
 
-extern ValidateGlobals vg;
+extern THREAD_LOCAL ValidateGlobals vg;
 
 typedef struct AtomSizeType {
 	UInt32 atomSize;
@@ -412,12 +572,18 @@ typedef struct ValidateAtomDispatch {
 	short cnt;
 } ValidateAtomDispatch;
 
+int ValidateMP4Command( int argc, char *argv[] );
+int RunValidateServer( const char *socketPath, long workers, long defaultTimeout );
+int RunValidateClient( const char *socketPath, int argc, char *argv[], int clientArgn, int inputArgn, long timeout );
+void LibraryMessage( validatemp4_kind kind, const char *formatStr, va_list ap );
+
 void warnprint(const char *formatStr, ...);
 void errprint(const char *formatStr, ...);
 void atomprint(const char *formatStr, ...);
 void atomprintnotab(const char *formatStr, ...);
 void atomprintdetailed(const char *formatStr, ...);
 void atomprinthexdata(char *dataP, UInt32 size);
+void reportprint(const char *formatStr, ...);
 void sampleprint(const char *formatStr, ...);
 void sampleprintnotab(const char *formatStr, ...);
 void sampleprinthexdata(char *dataP, UInt32 size);
@@ -427,13 +593,22 @@ void toggleprintatomdetailed( Boolean onOff );
 void toggleprintsample( Boolean onOff );
 void copyCharsToStr( char *chars, char *str, UInt16 count );
 
+// change here if you want to send both types of output to stdout to get interleaved output
+#if 1
+	#define _stdout (vg.outFile ? vg.outFile : stdout)
+	#define _stderr (vg.errFile ? vg.errFile : stderr)
+#else
+	#define _stdout (vg.outFile ? vg.outFile : stdout)
+	#define _stderr (vg.outFile ? vg.outFile : stdout)
+#endif
+
 
 
 //==========================================================================================
 
 
 
-typedef struct {
+typedef struct chunkOverlapRec {
 	UInt64 chunkStart;
 	UInt64 chunkStop;
 	UInt32 trackID;
@@ -441,6 +616,33 @@ typedef struct {
 	
 } chunkOverlapRec;
 
+typedef struct MediaDataExtent {
+	UInt64	dataStart;			// first payload byte of a top level 'mdat'
+	UInt64	dataStop;			// last payload byte
+} MediaDataExtent;
+
+OSErr CheckChunkOverlaps( MovieInfoRec *mir );
+OSErr BuildMediaDataIndex( long cnt, atomOffsetEntry *list );
+OSErr AddMediaDataExtent( atomOffsetEntry *aoe );
+Boolean RangeIsInMediaData( UInt64 start, UInt64 stop );
+void ReportMediaDataCoverage( MovieInfoRec *mir );
+OSErr WriteKeyframeIndex( MovieInfoRec *mir, const char *path );
+enum {
+	kRewriteFastStart = 1 << 0,			// -faststart: the 'moov' goes ahead of the media data
+	kRewriteCompactTables = 1 << 1		// -optimize: the sample tables are rebuilt as small as they go
+};
+OSErr WriteRewrittenFile( MovieInfoRec *mir, long cnt, atomOffsetEntry *list, const char *path, UInt32 flags );
+OSErr CopyFileData( FILE *in, UInt64 offset, UInt64 size, FILE *out, UInt64 outOffset );
+OSErr WriteElementaryStream( MovieInfoRec *mir, const char *spec );
+void DigestSample( TrackInfoRec *tir, UInt32 sampleNum, const void *data, UInt32 size );
+void DisposeTrackDigest( TrackInfoRec *tir );
+OSErr StartMediaDataDigests( void );
+void DisposeMediaDataDigests( void );
+void DigestFileData( UInt64 offset, const void *data, UInt64 size );
+OSErr FinishContentDigests( MovieInfoRec *mir );
+OSErr KeepLibraryMovie( MovieInfoRec *mir );
+void DisposeMediaDataIndex( void );
+
 
 
 typedef struct AvcConfigInfo {
@@ -647,11 +849,22 @@ int GetFileDataN64( atomOffsetEntry *aoe, void *dataP, UInt64 offset64, UInt64 *
 int GetFileDataN32( atomOffsetEntry *aoe, void *dataP, UInt64 offset64, UInt64 *newoffset64 );
 int GetFileDataN16( atomOffsetEntry *aoe, void *dataP, UInt64 offset64, UInt64 *newoffset64 );
 int GetFileData( atomOffsetEntry *aoe, void *dataP, UInt64 offset64, UInt64 size64, UInt64 *newoffset64 );
+int GetStreamData( void *dataP, UInt64 offset64, UInt64 size64 );
 int GetFileCString( atomOffsetEntry *aoe, char **strP, UInt64 offset64, UInt64 maxSize64, UInt64 *newoffset64 );
 int GetFileUTFString( atomOffsetEntry *aoe, char **strP, UInt64 offset64, UInt64 maxSize64, UInt64 *newoffset64 );
 int GetFileBitStreamData( atomOffsetEntry *aoe, Ptr bsDataP, UInt32 bsSize, UInt64 offset64, UInt64 *newoffset64 );
 int GetFileBitStreamDataToEndOfAtom( atomOffsetEntry *aoe, Ptr *bsDataPout, UInt32 *bsSizeout, UInt64 offset64, UInt64 *newoffset64 );
 int GetFileStartCode( atomOffsetEntry *aoe, UInt32 *startCode, UInt64 offset64, UInt64 *newoffset64 );
+OSErr MapInputFile( void );
+void UnmapInputFile( void );
+const UInt8 *GetMappedTable( UInt64 offset64, UInt64 size64 );
+
+void SwapBigEndian32( UInt32 *p, UInt32 count );
+void SwapBigEndian64( UInt64 *p, UInt32 count );
+void WidenBigEndian32To64( const UInt32 *src, UInt64 *dst, UInt32 count );
+void UnpackSampleSizes4( const UInt8 *src, UInt32 *dst, UInt32 count );
+void UnpackSampleSizes8( const UInt8 *src, UInt32 *dst, UInt32 count );
+void UnpackSampleSizes16( const UInt8 *src, UInt32 *dst, UInt32 count );
 
 OSErr Base64DecodeToBuffer(const char *inData, UInt32 *ioEncodedLength, char *outDecodedData, UInt32 *ioDecodedDataLength);
 
@@ -678,6 +891,21 @@ OSErr Validate_loci_Atom( atomOffsetEntry *aoe, void *refcon );
 OSErr Validate_moovhnti_Atom( atomOffsetEntry *aoe, void *refcon );
 OSErr Validate_Movie_SDP( char *inSDP );
 
+OSErr Validate_mvex_Atom( atomOffsetEntry *aoe, void *refcon );
+OSErr Validate_mehd_Atom( atomOffsetEntry *aoe, void *refcon );
+OSErr Validate_trex_Atom( atomOffsetEntry *aoe, void *refcon );
+OSErr Validate_moof_Atom( atomOffsetEntry *aoe, void *refcon );
+OSErr Validate_mfhd_Atom( atomOffsetEntry *aoe, void *refcon );
+OSErr Validate_traf_Atom( atomOffsetEntry *aoe, void *refcon );
+OSErr Validate_tfhd_Atom( atomOffsetEntry *aoe, void *refcon );
+OSErr Validate_tfdt_Atom( atomOffsetEntry *aoe, void *refcon );
+OSErr Validate_trun_Atom( atomOffsetEntry *aoe, void *refcon );
+OSErr Validate_sidx_Atom( atomOffsetEntry *aoe, void *refcon );
+OSErr Validate_mfra_Atom( atomOffsetEntry *aoe, void *refcon );
+OSErr Validate_tfra_Atom( atomOffsetEntry *aoe, void *refcon );
+OSErr Validate_mfro_Atom( atomOffsetEntry *aoe, void *refcon );
+OSErr ValidateMovieFragments( long cnt, atomOffsetEntry *list );
+
 OSErr Validate_url_Entry( atomOffsetEntry *aoe, void *refcon );
 OSErr Validate_urn_Entry( atomOffsetEntry *aoe, void *refcon );
 OSErr Validate_dref_Atom( atomOffsetEntry *aoe, void *refcon );
@@ -714,6 +942,9 @@ OSErr Validate_stdp_Atom( atomOffsetEntry *aoe, void *refcon );
 OSErr Validate_sdtp_Atom( atomOffsetEntry *aoe, void *refcon );
 
 OSErr ValidateFileAtoms( atomOffsetEntry *aoe, void *refcon );
+OSErr ValidateFileMovieAtoms( long cnt, atomOffsetEntry *list );
+OSErr ValidateFileRemainingAtoms( long cnt, atomOffsetEntry *list );
+OSErr ValidateStream( atomOffsetEntry *aoe );
 OSErr Validate_co64_Atom( atomOffsetEntry *aoe, void *refcon );
 OSErr Validate_nmhd_Atom( atomOffsetEntry *aoe, void *refcon );
 
@@ -752,6 +983,13 @@ typedef OSErr (*ValidateAtomTypeProcPtr)( atomOffsetEntry *aoe, void *refcon );
 
 OSErr ValidateAtomOfType( OSType theType, long flags, ValidateAtomTypeProcPtr validateProc, 
 		long cnt, atomOffsetEntry *list, void *refcon );
+OSErr ValidateAtomEntry( atomOffsetEntry *entry, long typeCnt, ValidateAtomTypeProcPtr validateProc, void *refcon );
+
+// the top level atoms, for atoms that point at others ('sidx', 'tfra')
+typedef struct FileAtomList {
+	long cnt;
+	atomOffsetEntry *list;
+} FileAtomList;
 
 #define FieldMustBe( num, value, errstr ) \
 	do { if ((num) != (value)) { err = badAtomErr; errprint(errstr "\n", (value), num); }} while (false)
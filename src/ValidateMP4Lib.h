@@ -0,0 +1,126 @@
+/*
+
+This file contains Original Code and/or Modifications of Original Code
+as defined in and that are subject to the Apple Public Source License
+Version 2.0 (the 'License'). You may not use this file except in
+compliance with the License. Please obtain a copy of the License at
+http://www.opensource.apple.com/apsl/ and read it before using this
+file.
+
+The Original Code and all software distributed under the License are
+distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+Please see the License for the specific language governing rights and
+limitations under the License.
+
+*/
+
+#ifndef __VALIDATEMP4LIB__
+#define __VALIDATEMP4LIB__
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//==========================================================================================
+// libvalidatemp4 ("make lib"): the validator for use inside another process
+//
+//   Each call checks one input on the calling thread; calls on different threads may run at
+//   the same time.  Instead of the text ValidateMP4 prints on stderr, every error and warning
+//   is passed to the callback as it is found, with the atom path it was found at.  A
+//   -printtype report, when one is asked for, comes through the callback in pieces, in order
+//   with the messages.
+//
+//   Options left zero (or nil) get the command line defaults.  Set up the options with
+//   validatemp4_init_options, so a program built against this header keeps working with a
+//   library that has more of them.
+
+#if defined(__GNUC__)
+	#define VALIDATEMP4_API __attribute__((visibility("default")))
+#else
+	#define VALIDATEMP4_API
+#endif
+
+typedef enum validatemp4_kind {
+	validatemp4_error = 1,			// something the specifications don't allow
+	validatemp4_warning = 2,		// something that is allowed but suspicious
+	validatemp4_report = 3,			// part of the -printtype report; the atom path is ""
+	validatemp4_notice = 4			// anything else (e.g. about the options); the atom path is ""
+} validatemp4_kind;
+
+typedef void (*validatemp4_callback)( void *context, validatemp4_kind kind, const char *atompath, const char *message );
+
+typedef struct validatemp4_options {
+	size_t			size;				// sizeof(validatemp4_options)
+	const char		*filetype;			// the same as the command line options
+	int				checklevel;
+	const char		*printtype;
+	const char		*atompath;
+	const char		*tablemode;
+	const char		*timerange;
+	const char		*samplerange;
+	double			samplefraction;
+	unsigned long	sampleevery;
+	unsigned long	sampleseed;
+	int				coverage;			// nonzero for -coverage
+	validatemp4_callback callback;
+	void			*context;			// passed to the callback
+} validatemp4_options;
+
+VALIDATEMP4_API void validatemp4_init_options( validatemp4_options *options );
+
+//   the number of errors found, or a negative result code when the input could not be
+//   checked completely (it couldn't be opened, the options were wrong, ...)
+VALIDATEMP4_API long validate_file( const char *path, const validatemp4_options *options );
+VALIDATEMP4_API long validate_buffer( const void *data, size_t size, const validatemp4_options *options );
+
+//==========================================================================================
+// Sample access
+//
+//   validatemp4_open checks a file like validate_file (with the same callback), then keeps an
+//   index of every sample the 'moov' describes and maps the file, so that each
+//   validatemp4_get_sample is a lookup and hands back the sample's bytes without copying
+//   them.  An open movie doesn't change; any number of threads may use it at once, until
+//   validatemp4_close.  Samples in movie fragments aren't indexed.
+
+typedef struct validatemp4_movie validatemp4_movie;
+
+typedef struct validatemp4_track {
+	unsigned long	trackID;
+	unsigned long	mediaType;			// the handler type, e.g. 'vide'
+	unsigned long	timescale;
+	unsigned long long duration;		// in timescale units
+	unsigned long	sampleCount;
+} validatemp4_track;
+
+typedef struct validatemp4_sample {
+	unsigned long long offset;			// in the file
+	unsigned long	size;
+	unsigned long long decodeTime;		// in the track's timescale
+	unsigned long	duration;
+	long			compositionOffset;
+	unsigned long	descriptionIndex;	// 1 based
+	int				sync;
+	const void		*data;				// the sample's bytes; nil if they aren't all in the file
+} validatemp4_sample;
+
+//   nil (with the reason in *result) if the file couldn't be read or has no 'moov'; otherwise
+//   *result is what validate_file would have returned
+VALIDATEMP4_API validatemp4_movie *validatemp4_open( const char *path, const validatemp4_options *options, long *result );
+VALIDATEMP4_API void validatemp4_close( validatemp4_movie *movie );
+
+//   tracks are numbered from 0, in 'moov' order; samples from 1, as in the sample tables.
+//   Both return 0, or a negative result code for a track or sample that doesn't exist.
+VALIDATEMP4_API long validatemp4_track_count( const validatemp4_movie *movie );
+VALIDATEMP4_API int validatemp4_get_track( const validatemp4_movie *movie, long trackIndex, validatemp4_track *track );
+VALIDATEMP4_API int validatemp4_get_sample( const validatemp4_movie *movie, long trackIndex, unsigned long sampleNumber, validatemp4_sample *sample );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __VALIDATEMP4LIB__ */
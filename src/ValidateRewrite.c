@@ -0,0 +1,683 @@
+/*
+
+This file contains Original Code and/or Modifications of Original Code
+as defined in and that are subject to the Apple Public Source License
+Version 2.0 (the 'License'). You may not use this file except in
+compliance with the License. Please obtain a copy of the License at
+http://www.opensource.apple.com/apsl/ and read it before using this
+file.
+
+The Original Code and all software distributed under the License are
+distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+Please see the License for the specific language governing rights and
+limitations under the License.
+
+*/
+
+#if defined(__linux__)
+	#define _GNU_SOURCE 1			// copy_file_range
+#endif
+
+#include "ValidateMP4.h"
+
+#if defined(__linux__)
+	#define USE_COPY_FILE_RANGE 1
+	#include <unistd.h>
+	#include <sys/sendfile.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+	#define USE_STAT 1
+	#include <sys/stat.h>
+#endif
+
+//==========================================================================================
+// Rewriting the 'moov' (-faststart, -optimize)
+//
+//   Both write a copy of the file with a rebuilt 'moov'.  The other top level atoms keep
+//   their order and bytes; every chunk offset is moved to where its data now is, and an
+//   'stco' whose offsets no longer fit in 32 bits becomes a 'co64' (which makes the 'moov'
+//   bigger, so the layout is worked out again until it settles).  The media data is copied
+//   by the kernel where it can be (copy_file_range, then sendfile), otherwise through a
+//   buffer.
+//
+//   -faststart puts the 'moov' ahead of the first 'mdat', so a player can start before it
+//   has the whole file.  -optimize leaves it where it is and rebuilds the sample tables
+//   from what the validator read into each track, as small as they will go: runs of equal
+//   'stts'/'ctts' entries are merged, an all zero 'ctts' is dropped, 'stsc' entries that
+//   repeat the one before are dropped, sample sizes become a constant 'stsz' or an 'stz2'
+//   when they fit in 4, 8 or 16 bits, and a 'co64' whose offsets fit in 32 bits becomes an
+//   'stco'.  A table whose entry count doesn't match what was read is copied as it is.
+
+enum {
+	kRewriteMaxPasses = 8,
+	kRewriteCopySize = 1024 * 1024
+};
+
+enum {
+	kRewriteSampleSizes = 0,
+	kRewriteTimeToSample,
+	kRewriteCompositionOffsets,
+	kRewriteSampleToChunk,
+	kRewriteChunkOffsets,
+	kRewriteTableKinds
+};
+
+static const char *kRewriteTableNames[kRewriteTableKinds] = {
+	"stsz/stz2", "stts", "ctts", "stsc", "stco/co64"
+};
+
+typedef struct RewriteSegment {
+	UInt64	oldOffset;
+	UInt64	size;
+	UInt64	newOffset;
+} RewriteSegment;
+
+typedef struct RewriteLayout {
+	RewriteSegment *segments;		// the top level atoms other than the 'moov', in file order
+	long	segmentCnt;
+	long	moovBefore;				// the 'moov' goes ahead of this segment
+	UInt64	moovOffset;				// where the rebuilt 'moov' goes
+	const char *option;				// for messages
+
+	MovieInfoRec *mir;				// set to compact the sample tables
+	long	trakIndex;				// the 'trak' being rebuilt, in 'moov' order
+	UInt64	oldTableBytes[kRewriteTableKinds];
+	UInt64	newTableBytes[kRewriteTableKinds];
+} RewriteLayout;
+
+//==========================================================================================
+
+static UInt32 Rewrite32( const UInt8 *p )
+{
+	return ((UInt32)p[0] << 24) | ((UInt32)p[1] << 16) | ((UInt32)p[2] << 8) | p[3];
+}
+
+static UInt64 Rewrite64( const UInt8 *p )
+{
+	return ((UInt64)Rewrite32( p ) << 32) | Rewrite32( p + 4 );
+}
+
+static UInt8 *RewritePut32( UInt8 *p, UInt32 value )
+{
+	p[0] = (UInt8)(value >> 24);
+	p[1] = (UInt8)(value >> 16);
+	p[2] = (UInt8)(value >> 8);
+	p[3] = (UInt8)value;
+	return p + 4;
+}
+
+static UInt8 *RewritePut64( UInt8 *p, UInt64 value )
+{
+	return RewritePut32( RewritePut32( p, (UInt32)(value >> 32) ), (UInt32)value );
+}
+
+//   size, type, and the version and flags of the atom it replaces
+static UInt8 *RewritePutHeader( UInt8 *p, UInt64 size, OSType type, const UInt8 *oldAtom )
+{
+	p = RewritePut32( p, (UInt32)size );
+	p = RewritePut32( p, type );
+	memcpy( p, oldAtom + 8, 4 );
+	return p + 4;
+}
+
+static void LayOutRewrite( RewriteLayout *layout, UInt64 moovSize )
+{
+	UInt64 offset = 0;
+	long i;
+
+	for (i = 0; i < layout->segmentCnt; i++) {
+		if (i == layout->moovBefore) {
+			layout->moovOffset = offset;
+			offset += moovSize;
+		}
+		layout->segments[i].newOffset = offset;
+		offset += layout->segments[i].size;
+	}
+	if (layout->moovBefore >= layout->segmentCnt) {
+		layout->moovOffset = offset;
+	}
+}
+
+//   where the byte at old file offset lands; chunks have to be inside an atom that is copied
+static OSErr MapRewriteOffset( RewriteLayout *layout, UInt64 offset, UInt64 *newOffsetOut )
+{
+	long lo = 0, hi = layout->segmentCnt;
+
+	while (hi - lo > 1) {
+		long mid = lo + (hi - lo) / 2;
+		if (layout->segments[mid].oldOffset <= offset) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	if ((lo < layout->segmentCnt) && (offset >= layout->segments[lo].oldOffset) &&
+			(offset - layout->segments[lo].oldOffset < layout->segments[lo].size)) {
+		*newOffsetOut = offset - layout->segments[lo].oldOffset + layout->segments[lo].newOffset;
+		return noErr;
+	}
+	fprintf( _stderr, "%s: chunk offset 0x%llx is not inside an atom that can be moved\n", layout->option, (unsigned long long)offset );
+	return badAtomErr;
+}
+
+static OSErr RewriteChunkOffsets( RewriteLayout *layout, OSType type, const UInt8 *p, UInt64 size,
+									UInt8 *out, UInt64 *sizeOut )
+{
+	OSErr err = noErr;
+	UInt32 entrySize = (type == 'co64') ? 8 : 4;
+	UInt32 entryCnt, i;
+	Boolean needs64 = (type == 'co64') && !layout->mir;
+	UInt64 offset, newOffset;
+
+	BAILIF( size < 16, badAtomSize );
+	entryCnt = Rewrite32( p + 12 );
+	BAILIF( (size - 16) / entrySize < entryCnt, badAtomSize );
+
+	for (i = 0; !needs64 && (i < entryCnt); i++) {
+		offset = (entrySize == 8) ? Rewrite64( p + 16 + 8*i ) : Rewrite32( p + 16 + 4*i );
+		BAILIFERR( MapRewriteOffset( layout, offset, &newOffset ) );
+		if (newOffset > 0xFFFFFFFFUL) needs64 = true;
+	}
+
+	*sizeOut = 16 + (UInt64)entryCnt * (needs64 ? 8 : 4);
+	if (out) {
+		out = RewritePutHeader( out, *sizeOut, needs64 ? 'co64' : 'stco', p );
+		out = RewritePut32( out, entryCnt );
+		for (i = 0; i < entryCnt; i++) {
+			offset = (entrySize == 8) ? Rewrite64( p + 16 + 8*i ) : Rewrite32( p + 16 + 4*i );
+			BAILIFERR( MapRewriteOffset( layout, offset, &newOffset ) );
+			out = needs64 ? RewritePut64( out, newOffset ) : RewritePut32( out, (UInt32)newOffset );
+		}
+	}
+
+bail:
+	return err;
+}
+
+//==========================================================================================
+// Compact sample tables (-optimize)
+//
+//   Each returns false when it leaves the table alone, so the atom is copied as it is.
+
+static TrackInfoRec *RewriteTrack( RewriteLayout *layout )
+{
+	MovieInfoRec *mir = layout->mir;
+
+	if (!mir || (layout->trakIndex < 0) || (layout->trakIndex >= mir->numTIRs)) return nil;
+	return &mir->tirList[layout->trakIndex];
+}
+
+static Boolean CompactSampleSizes( RewriteLayout *layout, const UInt8 *p, UInt64 size, UInt8 *out, UInt64 *sizeOut )
+{
+	TrackInfoRec *tir = RewriteTrack( layout );
+	UInt32 entryCnt, i, sampleSize, firstSize = 0, maxSize = 0, fieldSize;
+	Boolean allSame = true;
+
+	if (!tir || (size < 20) || (Rewrite32( p + 16 ) != tir->sampleSizeEntryCnt)) return false;
+	entryCnt = tir->sampleSizeEntryCnt;
+
+	if (tir->singleSampleSize) {
+		firstSize = maxSize = tir->singleSampleSize;
+	} else {
+		for (i = 1; i <= entryCnt; i++) {
+			sampleSize = GetSampleSize( tir, i );
+			if (i == 1) firstSize = sampleSize;
+			else if (sampleSize != firstSize) allSame = false;
+			if (sampleSize > maxSize) maxSize = sampleSize;
+		}
+	}
+
+	if (allSame && firstSize) {
+		*sizeOut = 20;
+		if (out) {
+			out = RewritePutHeader( out, *sizeOut, 'stsz', p );
+			out = RewritePut32( out, firstSize );
+			RewritePut32( out, entryCnt );
+		}
+		return true;
+	}
+
+	if (maxSize < 16) fieldSize = 4;
+	else if (maxSize < 256) fieldSize = 8;
+	else if (maxSize < 65536) fieldSize = 16;
+	else fieldSize = 32;
+
+	*sizeOut = 20 + ((UInt64)entryCnt * fieldSize + 7) / 8;
+	if (out) {
+		out = RewritePutHeader( out, *sizeOut, (fieldSize == 32) ? 'stsz' : 'stz2', p );
+		if (fieldSize == 32) {
+			out = RewritePut32( out, 0 );
+		} else {
+			out[0] = out[1] = out[2] = 0;		// reserved
+			out[3] = (UInt8)fieldSize;
+			out += 4;
+		}
+		out = RewritePut32( out, entryCnt );
+		for (i = 1; i <= entryCnt; i++) {
+			sampleSize = GetSampleSize( tir, i );
+			switch (fieldSize) {
+				case 4:
+					if (i & 1) *out = (UInt8)(sampleSize << 4);
+					else *out++ |= (UInt8)sampleSize;
+					break;
+				case 8:
+					*out++ = (UInt8)sampleSize;
+					break;
+				case 16:
+					*out++ = (UInt8)(sampleSize >> 8);
+					*out++ = (UInt8)sampleSize;
+					break;
+				default:
+					out = RewritePut32( out, sampleSize );
+					break;
+			}
+		}
+	}
+	return true;
+}
+
+//   merges runs of equal deltas ('stts') or offsets ('ctts'); entries for no samples go
+static UInt32 MergeTimeRuns( TrackInfoRec *tir, Boolean composition, UInt8 *out, Boolean *allZeroOut )
+{
+	UInt32 entryCnt = composition ? tir->compositionTimeToSampleEntryCnt : tir->timeToSampleEntryCnt;
+	UInt32 i, runCnt = 0, runCount = 0;
+	TimeValue runValue = 0;
+	Boolean allZero = true;
+
+	for (i = 1; i <= entryCnt + 1; i++) {
+		UInt32 count = 0;
+		TimeValue value = 0;
+
+		if (i <= entryCnt) {
+			if (composition) {
+				CompositionTimeToSampleNum entry;
+				GetCompositionTimeToSample( tir, i, &entry );
+				count = entry.sampleCount;
+				value = entry.sampleOffset;
+			} else {
+				TimeToSampleNum entry;
+				GetTimeToSample( tir, i, &entry );
+				count = entry.sampleCount;
+				value = entry.sampleDuration;
+			}
+			if (count == 0) continue;
+			if (value != 0) allZero = false;
+			if (runCount && (value == runValue) && (runCount <= 0xFFFFFFFFUL - count)) {
+				runCount += count;
+				continue;
+			}
+		}
+		if (runCount) {
+			if (out) {
+				out = RewritePut32( out, runCount );
+				out = RewritePut32( out, (UInt32)runValue );
+			}
+			runCnt++;
+		}
+		runCount = count;
+		runValue = value;
+	}
+	if (allZeroOut) *allZeroOut = allZero;
+	return runCnt;
+}
+
+static Boolean CompactTimeTable( RewriteLayout *layout, OSType type, const UInt8 *p, UInt64 size, UInt8 *out, UInt64 *sizeOut )
+{
+	TrackInfoRec *tir = RewriteTrack( layout );
+	Boolean composition = (type == 'ctts');
+	UInt32 runCnt;
+	Boolean allZero;
+
+	if (!tir || (size < 16)) return false;
+	if (Rewrite32( p + 12 ) != (composition ? tir->compositionTimeToSampleEntryCnt : tir->timeToSampleEntryCnt)) return false;
+
+	runCnt = MergeTimeRuns( tir, composition, nil, &allZero );
+	if (composition && allZero) {
+		*sizeOut = 0;
+		return true;
+	}
+	*sizeOut = 16 + (UInt64)runCnt * 8;
+	if (out) {
+		out = RewritePutHeader( out, *sizeOut, type, p );
+		out = RewritePut32( out, runCnt );
+		MergeTimeRuns( tir, composition, out, nil );
+	}
+	return true;
+}
+
+//   drops entries for no chunks, and entries that say what the one before does
+static Boolean CompactSampleToChunk( RewriteLayout *layout, const UInt8 *p, UInt64 size, UInt8 *out, UInt64 *sizeOut )
+{
+	TrackInfoRec *tir = RewriteTrack( layout );
+	UInt32 entryCnt, i, keptCnt = 0;
+	SampleToChunk entry, next, last = {0};
+	UInt8 *entries;
+
+	if (!tir || (size < 16) || (Rewrite32( p + 12 ) != tir->sampleToChunkEntryCnt)) return false;
+	entryCnt = tir->sampleToChunkEntryCnt;
+
+	for (i = 2; i <= entryCnt; i++) {
+		GetSampleToChunk( tir, i - 1, &entry );
+		GetSampleToChunk( tir, i, &next );
+		if (next.firstChunk < entry.firstChunk) return false;		// out of order; leave it for the validator to complain about
+	}
+
+	entries = out ? out + 16 : nil;
+	for (i = 1; i <= entryCnt; i++) {
+		GetSampleToChunk( tir, i, &entry );
+		if (i < entryCnt) {
+			GetSampleToChunk( tir, i + 1, &next );
+			if (next.firstChunk == entry.firstChunk) continue;
+		}
+		if (keptCnt && (entry.samplesPerChunk == last.samplesPerChunk) &&
+				(entry.sampleDescriptionIndex == last.sampleDescriptionIndex)) continue;
+		if (entries) {
+			entries = RewritePut32( entries, entry.firstChunk );
+			entries = RewritePut32( entries, entry.samplesPerChunk );
+			entries = RewritePut32( entries, entry.sampleDescriptionIndex );
+		}
+		last = entry;
+		keptCnt++;
+	}
+
+	*sizeOut = 16 + (UInt64)keptCnt * 12;
+	if (out) {
+		out = RewritePutHeader( out, *sizeOut, 'stsc', p );
+		RewritePut32( out, keptCnt );
+	}
+	return true;
+}
+
+//==========================================================================================
+
+//   the atoms in p..p+size, rebuilt; measures only when out is nil
+static OSErr RewriteMovieAtoms( RewriteLayout *layout, const UInt8 *p, UInt64 size, UInt8 *out, UInt64 *sizeOut )
+{
+	OSErr err = noErr;
+	UInt64 total = 0;
+
+	while (size > 0) {
+		UInt64 atomSize, newSize;
+		UInt32 headerSize = 8;
+		OSType type;
+		long tableKind = -1;
+		Boolean copy = true;
+
+		BAILIF( size < 8, badAtomSize );
+		atomSize = Rewrite32( p );
+		type = Rewrite32( p + 4 );
+		if (atomSize == 1) {
+			BAILIF( size < 16, badAtomSize );
+			atomSize = Rewrite64( p + 8 );
+			headerSize = 16;
+		} else if (atomSize == 0) {
+			atomSize = size;
+		}
+		BAILIF( (atomSize < headerSize) || (atomSize > size), badAtomSize );
+
+		switch (type) {
+			case 'trak':
+				layout->trakIndex++;
+				// fall through
+			case 'moov':
+			case 'mdia':
+			case 'minf':
+			case 'stbl':
+				BAILIFERR( RewriteMovieAtoms( layout, p + headerSize, atomSize - headerSize,
+													out ? out + headerSize : nil, &newSize ) );
+				newSize += headerSize;
+				BAILIF( (headerSize == 8) && (newSize > 0xFFFFFFFFUL), noCanDoErr );
+				if (out) {
+					memcpy( out, p, headerSize );
+					if (headerSize == 8) {
+						RewritePut32( out, (UInt32)newSize );
+					} else {
+						RewritePut64( out + 8, newSize );
+					}
+				}
+				copy = false;
+				break;
+
+			case 'stco':
+			case 'co64':
+				BAILIF( headerSize != 8, badAtomSize );
+				BAILIFERR( RewriteChunkOffsets( layout, type, p, atomSize, out, &newSize ) );
+				tableKind = kRewriteChunkOffsets;
+				copy = false;
+				break;
+
+			case 'stsz':
+			case 'stz2':
+				tableKind = kRewriteSampleSizes;
+				if (headerSize == 8) copy = !CompactSampleSizes( layout, p, atomSize, out, &newSize );
+				break;
+
+			case 'stts':
+			case 'ctts':
+				tableKind = (type == 'stts') ? kRewriteTimeToSample : kRewriteCompositionOffsets;
+				if (headerSize == 8) copy = !CompactTimeTable( layout, type, p, atomSize, out, &newSize );
+				break;
+
+			case 'stsc':
+				tableKind = kRewriteSampleToChunk;
+				if (headerSize == 8) copy = !CompactSampleToChunk( layout, p, atomSize, out, &newSize );
+				break;
+		}
+		if (copy) {
+			newSize = atomSize;
+			if (out) memcpy( out, p, atomSize );
+		}
+		if (out && (tableKind >= 0)) {
+			layout->oldTableBytes[tableKind] += atomSize;
+			layout->newTableBytes[tableKind] += newSize;
+		}
+		if (out) out += newSize;
+		total += newSize;
+		p += atomSize;
+		size -= atomSize;
+	}
+
+bail:
+	*sizeOut = total;
+	return err;
+}
+
+OSErr CopyFileData( FILE *in, UInt64 offset, UInt64 size, FILE *out, UInt64 outOffset )
+{
+	OSErr err = noErr;
+	char *buf = nil;
+
+#if USE_COPY_FILE_RANGE
+	{
+		loff_t inPos = offset, outPos = outOffset;
+		off_t sendPos;
+		ssize_t n;
+
+		if (fflush( out ) != 0) return ioErr;
+		while (size > 0) {
+			n = copy_file_range( fileno(in), &inPos, fileno(out), &outPos, size, 0 );
+			if (n <= 0) break;
+			size -= n;
+		}
+		// older kernels, or file systems that can't
+		if ((size > 0) && (lseek( fileno(out), outPos, SEEK_SET ) == outPos)) {
+			sendPos = inPos;
+			while (size > 0) {
+				n = sendfile( fileno(out), fileno(in), &sendPos, size );
+				if (n <= 0) break;
+				size -= n;
+				outPos += n;
+			}
+			inPos = sendPos;
+		}
+		offset = inPos;
+		outOffset = outPos;
+		if (fseeko( out, outOffset, SEEK_SET ) != 0) return ioErr;
+	}
+#endif
+
+	if (size > 0) {
+		BAILIFNIL( buf = malloc( kRewriteCopySize ), allocFailedErr );
+		while (size > 0) {
+			size_t n = (size < kRewriteCopySize) ? (size_t)size : kRewriteCopySize;
+
+			BAILIFERR( GetFileData( nil, buf, offset, n, &offset ) );
+			BAILIF( fwrite( buf, 1, n, out ) != n, ioErr );
+			size -= n;
+		}
+	}
+
+bail:
+	if (buf) free( buf );
+	return err;
+}
+
+static Boolean IsSameFile( const char *path, const char *otherPath )
+{
+#if USE_STAT
+	struct stat info, otherInfo;
+
+	if ((stat( path, &info ) == 0) && (stat( otherPath, &otherInfo ) == 0)) {
+		return (info.st_dev == otherInfo.st_dev) && (info.st_ino == otherInfo.st_ino);
+	}
+#endif
+	return strcmp( path, otherPath ) == 0;
+}
+
+static void ReportTableSavings( RewriteLayout *layout, const char *path, UInt64 oldMoovSize, UInt64 newMoovSize )
+{
+	long i;
+	const char *sep = "";
+
+	fprintf( _stdout, "<!-- Optimized copy written to \"%s\": 'moov' %llu -> %llu bytes (%lld saved)\n",
+				path, (unsigned long long)oldMoovSize, (unsigned long long)newMoovSize,
+				(long long)oldMoovSize - (long long)newMoovSize );
+	fprintf( _stdout, "     " );
+	for (i = 0; i < kRewriteTableKinds; i++) {
+		if (!layout->oldTableBytes[i]) continue;
+		fprintf( _stdout, "%s%s %llu -> %llu", sep, kRewriteTableNames[i],
+					(unsigned long long)layout->oldTableBytes[i], (unsigned long long)layout->newTableBytes[i] );
+		sep = ", ";
+	}
+	fprintf( _stdout, " -->\n" );
+}
+
+OSErr WriteRewrittenFile( MovieInfoRec *mir, long cnt, atomOffsetEntry *list, const char *path, UInt32 flags )
+{
+	OSErr err = noErr;
+	RewriteLayout layout = {0};
+	atomOffsetEntry *moov = nil;
+	UInt8 *moovData = nil;
+	UInt8 *newMoov = nil;
+	UInt64 moovSize, newMoovSize, offset;
+	FILE *out = nil;
+	long i, pass;
+
+	layout.option = (flags & kRewriteFastStart) ? "-faststart" : "-optimize";
+
+	// what can't be moved
+	if (!mir || !vg.inFilePath) {
+		fprintf( _stderr, "%s needs a 'moov' in a file that can be read again\n", layout.option );
+		err = paramErr;
+		goto bail;
+	}
+	for (i = 0; i < mir->numTIRs; i++) {
+		if (mir->tirList[i].externalDataRefCnt) {
+			fprintf( _stderr, "%s: track %u has data in other files\n", layout.option, (unsigned)mir->tirList[i].trackID );
+			err = noCanDoErr;
+			goto bail;
+		}
+	}
+	for (i = 0, offset = 0; i < cnt; i++) {
+		if ((list[i].type == 'moof') || (list[i].type == 'mfra') || (list[i].type == 'sidx')) {
+			fprintf( _stderr, "%s doesn't rewrite fragmented files\n", layout.option );
+			err = noCanDoErr;
+			goto bail;
+		}
+		if ((list[i].type == 'moov') && moov) {
+			fprintf( _stderr, "%s: more than one 'moov'\n", layout.option );
+			err = badAtomErr;
+			goto bail;
+		}
+		if (list[i].offset != offset) break;
+		offset += list[i].size;
+		if (list[i].type == 'moov') moov = &list[i];
+	}
+	if ((i < cnt) || (offset != (UInt64)vg.inMaxOffset) || !moov) {
+		fprintf( _stderr, "%s: the top level atoms don't cover the file exactly\n", layout.option );
+		err = badAtomSize;
+		goto bail;
+	}
+	if (IsSameFile( vg.inFilePath, path )) {
+		fprintf( _stderr, "%s can't write over the file it reads\n", layout.option );
+		err = paramErr;
+		goto bail;
+	}
+
+	// for fast start the 'moov' goes ahead of the first 'mdat' (or stays put if it is already)
+	BAILIFNIL( layout.segments = calloc( cnt, sizeof(RewriteSegment) ), allocFailedErr );
+	layout.moovBefore = -1;
+	for (i = 0; i < cnt; i++) {
+		if (&list[i] == moov) {
+			if (layout.moovBefore < 0) layout.moovBefore = layout.segmentCnt;
+			continue;
+		}
+		if ((list[i].type == 'mdat') && (flags & kRewriteFastStart) && (layout.moovBefore < 0)) {
+			layout.moovBefore = layout.segmentCnt;
+		}
+		layout.segments[layout.segmentCnt].oldOffset = list[i].offset;
+		layout.segments[layout.segmentCnt].size = list[i].size;
+		layout.segmentCnt++;
+	}
+	if (flags & kRewriteCompactTables) layout.mir = mir;
+
+	BAILIFNIL( moovData = malloc( moov->size ), allocFailedErr );
+	BAILIFERR( GetFileData( moov, moovData, moov->offset, moov->size, nil ) );
+
+	// the 'moov' changing size moves everything after it, which can change which offsets need 64 bits
+	moovSize = moov->size;
+	for (pass = 0; pass < kRewriteMaxPasses; pass++) {
+		LayOutRewrite( &layout, moovSize );
+		layout.trakIndex = -1;
+		BAILIFERR( RewriteMovieAtoms( &layout, moovData, moov->size, nil, &newMoovSize ) );
+		if (newMoovSize == moovSize) break;
+		moovSize = newMoovSize;
+	}
+	BAILIF( pass == kRewriteMaxPasses, programErr );
+	BAILIFNIL( newMoov = malloc( moovSize ), allocFailedErr );
+	layout.trakIndex = -1;
+	BAILIFERR( RewriteMovieAtoms( &layout, moovData, moov->size, newMoov, &newMoovSize ) );
+
+	if (!(out = fopen( path, "wb" ))) {
+		fprintf( _stderr, "Could not create %s file \"%s\"\n", layout.option + 1, path );
+		err = ioErr;
+		goto bail;
+	}
+	for (i = 0; i <= layout.segmentCnt; i++) {
+		if (i == layout.moovBefore) {
+			BAILIF( fwrite( newMoov, 1, moovSize, out ) != moovSize, ioErr );
+		}
+		if (i < layout.segmentCnt) {
+			RewriteSegment *segment = &layout.segments[i];
+
+			BAILIFERR( CopyFileData( vg.inFile, segment->oldOffset, segment->size, out, segment->newOffset ) );
+		}
+	}
+
+bail:
+	if (out && fclose( out ) && !err) err = ioErr;
+	if (err && out) {
+		fprintf( _stderr, "Could not write %s file \"%s\" (err %d)\n", layout.option + 1, path, err );
+		remove( path );
+	} else if (!err && (flags & kRewriteCompactTables)) {
+		ReportTableSavings( &layout, path, moov->size, moovSize );
+	}
+	if (layout.segments) free( layout.segments );
+	if (moovData) free( moovData );
+	if (newMoov) free( newMoov );
+	return err;
+}
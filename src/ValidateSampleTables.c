@@ -0,0 +1,851 @@
+/*
+
+This file contains Original Code and/or Modifications of Original Code
+as defined in and that are subject to the Apple Public Source License
+Version 2.0 (the 'License'). You may not use this file except in
+compliance with the License. Please obtain a copy of the License at
+http://www.opensource.apple.com/apsl/ and read it before using this
+file.
+
+The Original Code and all software distributed under the License are
+distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+Please see the License for the specific language governing rights and
+limitations under the License.
+
+*/
+
+#include "ValidateMP4.h"
+
+//==========================================================================================
+// Packed tables
+//
+//   Entries are grouped in blocks of kPackedBlockSize.  Each block keeps its smallest entry
+//   as a checkpoint and stores every entry as a fixed-width difference from it, using just
+//   enough bits for the largest difference in the block.  A block of identical entries
+//   (a run of constant sample sizes, say) has width 0 and costs no packed bits at all.
+//   Any entry can be expanded on its own without touching the rest of the table.
+
+enum {
+	kPackedBlockShift = 6,
+	kPackedBlockSize = 1 << kPackedBlockShift,
+	kPackedBlockMask = kPackedBlockSize - 1,
+
+	kCompactTableMinEntries = 16384		// -tablemode auto leaves smaller tables alone
+};
+
+static UInt32 BitsNeeded( UInt64 value )
+{
+	UInt32 bits = 0;
+
+	while (value) {
+		bits++;
+		value >>= 1;
+	}
+	return bits;
+}
+
+//   exactly one of v32 and v64 is used as the source; both are 0 based
+static OSErr PackedTable_Build( PackedTable *pt, const UInt32 *v32, const UInt64 *v64, UInt32 entryCnt )
+{
+	OSErr err = noErr;
+	UInt32 blockCnt = (entryCnt + kPackedBlockMask) >> kPackedBlockShift;
+	UInt64 wordCnt = 0;
+	UInt32 b, i;
+
+	#define PACKED_SOURCE(n)	(v32 ? (UInt64)v32[n] : v64[n])
+
+	memset( pt, 0, sizeof(*pt) );
+	if (entryCnt == 0) goto bail;
+
+	BAILIFNIL( pt->blocks = calloc(blockCnt, sizeof(PackedTableBlock)), allocFailedErr );
+
+	for (b = 0; b < blockCnt; b++) {
+		PackedTableBlock *block = &pt->blocks[b];
+		UInt32 first = b << kPackedBlockShift;
+		UInt32 count = entryCnt - first;
+		UInt64 low, high;
+
+		if (count > kPackedBlockSize) count = kPackedBlockSize;
+		low = high = PACKED_SOURCE(first);
+		for (i = 1; i < count; i++) {
+			UInt64 v = PACKED_SOURCE(first + i);
+			if (v < low) low = v;
+			if (v > high) high = v;
+		}
+		block->base = low;
+		block->width = BitsNeeded( high - low );
+		block->wordIndex = (UInt32)wordCnt;
+		wordCnt += ((UInt64)count * block->width + 63) >> 6;
+	}
+
+	if (wordCnt > 0xFFFFFFFFUL) {
+		err = noCanDoErr;
+		goto bail;
+	}
+	if (wordCnt) {
+		BAILIFNIL( pt->words = calloc((size_t)wordCnt, sizeof(UInt64)), allocFailedErr );
+	}
+
+	for (b = 0; b < blockCnt; b++) {
+		PackedTableBlock *block = &pt->blocks[b];
+		UInt32 first = b << kPackedBlockShift;
+		UInt32 count = entryCnt - first;
+		UInt64 *w = &pt->words[block->wordIndex];
+		UInt64 bit = 0;
+
+		if (block->width == 0) continue;
+		if (count > kPackedBlockSize) count = kPackedBlockSize;
+		for (i = 0; i < count; i++, bit += block->width) {
+			UInt64 v = PACKED_SOURCE(first + i) - block->base;
+			UInt32 shift = bit & 63;
+
+			w[bit >> 6] |= v << shift;
+			if (shift + block->width > 64) {
+				w[(bit >> 6) + 1] |= v >> (64 - shift);
+			}
+		}
+	}
+
+	#undef PACKED_SOURCE
+
+	pt->entryCnt = entryCnt;
+	pt->blockCnt = blockCnt;
+
+bail:
+	if (err) {
+		PackedTable_Dispose( pt );
+	}
+	return err;
+}
+
+OSErr PackedTable_Build32( PackedTable *pt, const UInt32 *values, UInt32 entryCnt )
+{
+	return PackedTable_Build( pt, values, nil, entryCnt );
+}
+
+OSErr PackedTable_Build64( PackedTable *pt, const UInt64 *values, UInt32 entryCnt )
+{
+	return PackedTable_Build( pt, nil, values, entryCnt );
+}
+
+//   index is 0 based
+UInt64 PackedTable_Get( const PackedTable *pt, UInt32 index )
+{
+	const PackedTableBlock *block;
+	const UInt64 *w;
+	UInt64 bit;
+	UInt64 v;
+	UInt32 shift;
+
+	if (index >= pt->entryCnt) {
+		return 0;
+	}
+	block = &pt->blocks[index >> kPackedBlockShift];
+	if (block->width == 0) {
+		return block->base;
+	}
+
+	bit = (UInt64)(index & kPackedBlockMask) * block->width;
+	w = &pt->words[block->wordIndex + (bit >> 6)];
+	shift = bit & 63;
+	v = w[0] >> shift;
+	if (shift + block->width > 64) {
+		v |= w[1] << (64 - shift);
+	}
+	if (block->width < 64) {
+		v &= ((UInt64)1 << block->width) - 1;
+	}
+	return block->base + v;
+}
+
+void PackedTable_Dispose( PackedTable *pt )
+{
+	if (pt->blocks) free( pt->blocks );
+	if (pt->words) free( pt->words );
+	memset( pt, 0, sizeof(*pt) );
+}
+
+//==========================================================================================
+// Track table storage
+//
+//   The table loaders hand their 1 based arrays over to these; depending on -tablemode the
+//   array is kept as is or packed (and freed).  With -tablemode mapped the loaders instead
+//   point the track at the big-endian table in the mapped file and nothing is copied.
+//   Everything else reads entries back through the Get functions below and doesn't care
+//   which form a table is in.
+
+static Boolean UseCompactTable( UInt32 entryCount )
+{
+	switch (vg.tablemode) {
+		case tablemode_flat:		return false;
+		case tablemode_compact:		return (entryCount > 0);
+		default:					return (entryCount >= kCompactTableMinEntries);
+	}
+}
+
+OSErr SetSampleSizeTable( TrackInfoRec *tir, SampleSizeRecord *listP, UInt32 entryCount )
+{
+	OSErr err = noErr;
+
+	PackedTable_Dispose( &tir->packedSampleSize );
+	tir->sampleSize = nil;
+	tir->sampleSizeView = nil;
+
+	if (listP && UseCompactTable( entryCount )) {
+		BAILIFERR( PackedTable_Build32( &tir->packedSampleSize, &listP[1].sampleSize, entryCount ) );
+		free( listP );
+		listP = nil;
+	}
+	tir->sampleSize = listP;
+	listP = nil;
+
+bail:
+	if (listP) free( listP );
+	return err;
+}
+
+OSErr SetChunkOffsetTable( TrackInfoRec *tir, ChunkOffset64Record *listP, UInt32 entryCount )
+{
+	OSErr err = noErr;
+
+	PackedTable_Dispose( &tir->packedChunkOffset );
+	tir->chunkOffset = nil;
+	tir->chunkOffsetView = nil;
+
+	if (listP && UseCompactTable( entryCount )) {
+		BAILIFERR( PackedTable_Build64( &tir->packedChunkOffset, &listP[1].chunkOffset, entryCount ) );
+		free( listP );
+		listP = nil;
+	}
+	tir->chunkOffset = listP;
+	listP = nil;
+
+bail:
+	if (listP) free( listP );
+	return err;
+}
+
+//   everything the sample table loaders left in the track (mapped tables are not owned)
+void DisposeTrackTables( TrackInfoRec *tir )
+{
+	UInt32 i;
+
+	if (tir->sampleDescriptions) {
+		for (i = 1; i <= tir->sampleDescriptionCnt; i++) {
+			if (tir->sampleDescriptions[i]) free( tir->sampleDescriptions[i] );
+		}
+		free( tir->sampleDescriptions );
+		tir->sampleDescriptions = nil;
+	}
+	if (tir->validatedSampleDescriptionRefCons) free( tir->validatedSampleDescriptionRefCons );
+	tir->validatedSampleDescriptionRefCons = nil;
+
+	if (tir->sampleSize) free( tir->sampleSize );
+	if (tir->chunkOffset) free( tir->chunkOffset );
+	if (tir->sampleToChunk) free( tir->sampleToChunk );
+	if (tir->timeToSample) free( tir->timeToSample );
+	if (tir->compositionTimeToSample) free( tir->compositionTimeToSample );
+	tir->sampleSize = nil;
+	tir->chunkOffset = nil;
+	tir->sampleToChunk = nil;
+	tir->timeToSample = nil;
+	tir->compositionTimeToSample = nil;
+	PackedTable_Dispose( &tir->packedSampleSize );
+	PackedTable_Dispose( &tir->packedChunkOffset );
+	DisposeTrackDigest( tir );
+}
+
+//==========================================================================================
+
+static UInt32 BigEndian16At( const UInt8 *p )
+{
+	return ((UInt32)p[0] << 8) | p[1];
+}
+
+static UInt32 BigEndian32At( const UInt8 *p )
+{
+	return ((UInt32)p[0] << 24) | ((UInt32)p[1] << 16) | ((UInt32)p[2] << 8) | p[3];
+}
+
+static UInt64 BigEndian64At( const UInt8 *p )
+{
+	return ((UInt64)BigEndian32At( p ) << 32) | BigEndian32At( p + 4 );
+}
+
+UInt32 GetSampleSize( TrackInfoRec *tir, UInt32 sampleNum )
+{
+	if (tir->singleSampleSize) {
+		return tir->singleSampleSize;
+	}
+	if ((sampleNum == 0) || (sampleNum > tir->sampleSizeEntryCnt)) {
+		return 0;
+	}
+	if (tir->sampleSize) {
+		return tir->sampleSize[sampleNum].sampleSize;
+	}
+	if (tir->sampleSizeView) {
+		const UInt8 *v = tir->sampleSizeView;
+		UInt32 n = sampleNum - 1;
+
+		switch (tir->sampleSizeViewBits) {
+			case 4:		return (n & 1) ? (v[n >> 1] & 0x0F) : (v[n >> 1] >> 4);
+			case 8:		return v[n];
+			case 16:	return BigEndian16At( v + 2*n );
+			default:	return BigEndian32At( v + 4*n );
+		}
+	}
+	return (UInt32)PackedTable_Get( &tir->packedSampleSize, sampleNum - 1 );
+}
+
+UInt64 GetChunkOffset( TrackInfoRec *tir, UInt32 chunkNum )
+{
+	if ((chunkNum == 0) || (chunkNum > tir->chunkOffsetEntryCnt)) {
+		return 0;
+	}
+	if (tir->chunkOffset) {
+		return tir->chunkOffset[chunkNum].chunkOffset;
+	}
+	if (tir->chunkOffsetView) {
+		if (tir->chunkOffsetViewBits == 64) {
+			return BigEndian64At( tir->chunkOffsetView + 8*(chunkNum - 1) );
+		}
+		return BigEndian32At( tir->chunkOffsetView + 4*(chunkNum - 1) );
+	}
+	return PackedTable_Get( &tir->packedChunkOffset, chunkNum - 1 );
+}
+
+//   entries past the end of a table come back as zero
+void GetSampleToChunk( TrackInfoRec *tir, UInt32 entryNum, SampleToChunk *entry )
+{
+	if ((entryNum == 0) || (entryNum > tir->sampleToChunkEntryCnt) || (!tir->sampleToChunk && !tir->sampleToChunkView)) {
+		memset( entry, 0, sizeof(*entry) );
+	} else if (tir->sampleToChunk) {
+		*entry = tir->sampleToChunk[entryNum];
+	} else {
+		const UInt8 *v = tir->sampleToChunkView + 12*(entryNum - 1);
+
+		entry->firstChunk = BigEndian32At( v );
+		entry->samplesPerChunk = BigEndian32At( v + 4 );
+		entry->sampleDescriptionIndex = BigEndian32At( v + 8 );
+	}
+}
+
+void GetTimeToSample( TrackInfoRec *tir, UInt32 entryNum, TimeToSampleNum *entry )
+{
+	if ((entryNum == 0) || (entryNum > tir->timeToSampleEntryCnt) || (!tir->timeToSample && !tir->timeToSampleView)) {
+		memset( entry, 0, sizeof(*entry) );
+	} else if (tir->timeToSample) {
+		*entry = tir->timeToSample[entryNum];
+	} else {
+		const UInt8 *v = tir->timeToSampleView + 8*(entryNum - 1);
+
+		entry->sampleCount = BigEndian32At( v );
+		entry->sampleDuration = BigEndian32At( v + 4 );
+	}
+}
+
+void GetCompositionTimeToSample( TrackInfoRec *tir, UInt32 entryNum, CompositionTimeToSampleNum *entry )
+{
+	if ((entryNum == 0) || (entryNum > tir->compositionTimeToSampleEntryCnt) || (!tir->compositionTimeToSample && !tir->compositionTimeToSampleView)) {
+		memset( entry, 0, sizeof(*entry) );
+	} else if (tir->compositionTimeToSample) {
+		*entry = tir->compositionTimeToSample[entryNum];
+	} else {
+		const UInt8 *v = tir->compositionTimeToSampleView + 8*(entryNum - 1);
+
+		entry->sampleCount = BigEndian32At( v );
+		entry->sampleOffset = BigEndian32At( v + 4 );
+	}
+}
+
+//==========================================================================================
+// Timeline
+//
+//   Decode times are kept as one checkpoint per 'stts' entry, so the decode time of any
+//   sample, or the sample at any decode time, is a binary search over the entries plus a
+//   multiply or divide within the entry.  'ctts' entries get the same treatment, which
+//   lets -timerange find the samples it needs without walking the track from the start.
+
+OSErr BuildTrackTimeline( TrackInfoRec *tir )
+{
+	OSErr err = noErr;
+	UInt64 decodeTime = 0;
+	UInt32 firstSample = 1;
+	UInt32 i;
+
+	DisposeTrackTimeline( tir );
+
+	if (tir->timeToSampleEntryCnt) {
+		BAILIFNIL( tir->timeline = malloc(tir->timeToSampleEntryCnt * sizeof(TimelineRun)), allocFailedErr );
+		for (i = 0; i < tir->timeToSampleEntryCnt; i++) {
+			TimeToSampleNum entry;
+
+			GetTimeToSample( tir, i + 1, &entry );
+			tir->timeline[i].decodeTime = decodeTime;
+			tir->timeline[i].firstSample = firstSample;
+			decodeTime += (UInt64)entry.sampleCount * entry.sampleDuration;
+			firstSample += entry.sampleCount;
+		}
+	}
+
+	if (tir->compositionTimeToSampleEntryCnt) {
+		BAILIFNIL( tir->compositionRunFirstSample = malloc(tir->compositionTimeToSampleEntryCnt * sizeof(UInt32)), allocFailedErr );
+		firstSample = 1;
+		tir->minCompositionOffset = 0xFFFFFFFF;
+		for (i = 0; i < tir->compositionTimeToSampleEntryCnt; i++) {
+			CompositionTimeToSampleNum entry;
+
+			GetCompositionTimeToSample( tir, i + 1, &entry );
+			tir->compositionRunFirstSample[i] = firstSample;
+			firstSample += entry.sampleCount;
+			if (entry.sampleOffset < tir->minCompositionOffset) tir->minCompositionOffset = entry.sampleOffset;
+			if (entry.sampleOffset > tir->maxCompositionOffset) tir->maxCompositionOffset = entry.sampleOffset;
+		}
+	}
+
+bail:
+	if (err) {
+		DisposeTrackTimeline( tir );
+	}
+	return err;
+}
+
+void DisposeTrackTimeline( TrackInfoRec *tir )
+{
+	if (tir->timeline) free( tir->timeline );
+	if (tir->compositionRunFirstSample) free( tir->compositionRunFirstSample );
+	tir->timeline = nil;
+	tir->compositionRunFirstSample = nil;
+	tir->minCompositionOffset = tir->maxCompositionOffset = 0;
+}
+
+//   last entry whose first sample is at or before sampleNum
+static UInt32 FindRunForSample( const UInt32 *firstSamples, size_t stride, UInt32 runCnt, UInt32 sampleNum )
+{
+	UInt32 lo = 0, hi = runCnt;
+
+	while (hi - lo > 1) {
+		UInt32 mid = lo + (hi - lo) / 2;
+		if (*(const UInt32 *)((const char *)firstSamples + mid * stride) <= sampleNum) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+//   samples past the end of the 'stts' table come back at the end of the timeline with no duration
+UInt64 GetSampleDecodeTime( TrackInfoRec *tir, UInt32 sampleNum, UInt32 *durationOut )
+{
+	TimeToSampleNum entry;
+	UInt32 r;
+
+	if (durationOut) *durationOut = 0;
+	if (!tir->timeline || (sampleNum == 0)) {
+		return 0;
+	}
+	if (sampleNum > tir->timeToSampleSampleCnt) {
+		return tir->timeToSampleDuration;
+	}
+	r = FindRunForSample( &tir->timeline[0].firstSample, sizeof(TimelineRun), tir->timeToSampleEntryCnt, sampleNum );
+	GetTimeToSample( tir, r + 1, &entry );
+	if (durationOut) *durationOut = entry.sampleDuration;
+	return tir->timeline[r].decodeTime + (UInt64)(sampleNum - tir->timeline[r].firstSample) * entry.sampleDuration;
+}
+
+UInt32 GetSampleCompositionOffset( TrackInfoRec *tir, UInt32 sampleNum )
+{
+	CompositionTimeToSampleNum entry;
+	UInt32 r;
+
+	if (!tir->compositionRunFirstSample || (sampleNum == 0)) {
+		return 0;
+	}
+	r = FindRunForSample( tir->compositionRunFirstSample, sizeof(UInt32), tir->compositionTimeToSampleEntryCnt, sampleNum );
+	GetCompositionTimeToSample( tir, r + 1, &entry );
+	if (sampleNum - tir->compositionRunFirstSample[r] >= entry.sampleCount) {
+		return 0;
+	}
+	return entry.sampleOffset;
+}
+
+//   the sample whose decode interval holds decodeTime; one past the last sample if there is none
+static UInt32 FindSampleAtDecodeTime( TrackInfoRec *tir, UInt64 decodeTime )
+{
+	TimeToSampleNum entry;
+	UInt32 lo = 0, hi = tir->timeToSampleEntryCnt;
+	UInt64 index;
+
+	if (!tir->timeline) {
+		return 1;
+	}
+	while (hi - lo > 1) {
+		UInt32 mid = lo + (hi - lo) / 2;
+		if (tir->timeline[mid].decodeTime <= decodeTime) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	GetTimeToSample( tir, lo + 1, &entry );
+	if (entry.sampleDuration == 0) {
+		return tir->timeline[lo].firstSample + entry.sampleCount;
+	}
+	index = (decodeTime - tir->timeline[lo].decodeTime) / entry.sampleDuration;
+	if (index >= entry.sampleCount) {
+		return tir->timeline[lo].firstSample + entry.sampleCount;
+	}
+	return tir->timeline[lo].firstSample + (UInt32)index;
+}
+
+static void GetTimeRangeInMediaTime( TrackInfoRec *tir, UInt64 *startOut, UInt64 *endOut )
+{
+	double end = vg.timerangeEnd * tir->mediaTimeScale;
+
+	*startOut = (UInt64)(vg.timerangeStart * tir->mediaTimeScale);
+	*endOut = (UInt64)end;
+	if (*endOut < end) (*endOut)++;
+}
+
+//   the (1 based, inclusive) span of samples that -samplenumber, -samplerange and -timerange
+//   can select from; an empty span has lastOut < firstOut
+void GetSelectedSampleRange( TrackInfoRec *tir, UInt32 *firstOut, UInt32 *lastOut )
+{
+	UInt64 start, end;
+	UInt32 first = 1, last = tir->sampleSizeEntryCnt;
+
+	if (vg.timerange) {
+		GetTimeRangeInMediaTime( tir, &start, &end );
+		
+		// a sample can be presented up to maxCompositionOffset after it is decoded
+		start = (start > tir->maxCompositionOffset) ? start - tir->maxCompositionOffset : 0;
+		end = (end > tir->minCompositionOffset) ? end - tir->minCompositionOffset : 0;
+		
+		first = FindSampleAtDecodeTime( tir, start );
+		if (end == 0) {
+			last = 0;
+		} else {
+			UInt32 s = FindSampleAtDecodeTime( tir, end - 1 );
+			if (s <= last) last = s;
+		}
+		if (last > tir->timeToSampleSampleCnt) last = tir->timeToSampleSampleCnt;
+	}
+	if (vg.samplenumber) {
+		if ((UInt32)vg.samplenumber > first) first = (UInt32)vg.samplenumber;
+		if ((UInt32)vg.samplenumber < last) last = (UInt32)vg.samplenumber;
+	}
+	if (vg.samplerangeFirst) {
+		if (vg.samplerangeFirst > first) first = vg.samplerangeFirst;
+		if (vg.samplerangeLast < last) last = vg.samplerangeLast;
+	}
+	*firstOut = first;
+	*lastOut = last;
+}
+
+//   whether a sample presented over the given span passes -timerange
+Boolean SampleTimeIsSelected( TrackInfoRec *tir, UInt64 decodeTime, UInt32 duration, UInt32 compositionOffset )
+{
+	UInt64 start, end;
+	UInt64 presentationTime = decodeTime + compositionOffset;
+
+	if (!vg.timerange) {
+		return true;
+	}
+	GetTimeRangeInMediaTime( tir, &start, &end );
+	if (presentationTime >= end) {
+		return false;
+	}
+	if ((presentationTime + duration <= start) && !((duration == 0) && (presentationTime == start))) {
+		return false;
+	}
+	return true;
+}
+
+//==========================================================================================
+// Sample subsets (-sampleevery, -samplefraction)
+//
+//   A sample is picked by a hash of the seed, the track ID and the sample number, so a run
+//   picks the same samples whatever order they are visited in, and a different -sampleseed
+//   picks different ones.  The sync samples of a track that has an 'stss' (or of a track run
+//   with non-sync samples) are always picked; in a track where every sample is a sync sample
+//   that would be all of them.
+
+#define SampleSubsetIsOn() (vg.sampleEvery || (vg.sampleFraction > 0))
+
+static UInt64 MixSampleBits( UInt64 x )
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
+
+static UInt64 GetTrackSubsetBits( TrackInfoRec *tir )
+{
+	return MixSampleBits( ((UInt64)vg.sampleSeed << 32) | tir->trackID );
+}
+
+static Boolean SampleIsInSubset( TrackInfoRec *tir, UInt32 sampleNum )
+{
+	UInt64 trackBits = GetTrackSubsetBits( tir );
+
+	if (vg.sampleEvery) {
+		return ((sampleNum - 1) % vg.sampleEvery) == (UInt32)(trackBits % vg.sampleEvery);
+	}
+	if (vg.sampleFraction > 0) {
+		// the top 53 bits, so the comparison is exact in a double
+		return (double)(MixSampleBits( trackBits ^ sampleNum ) >> 11) < vg.sampleFraction * 9007199254740992.0;
+	}
+	return true;
+}
+
+//   whether -samplenumber, -samplerange and the subset pick sampleNum
+Boolean SampleNumberIsSelected( TrackInfoRec *tir, UInt32 sampleNum, Boolean keepAsSync )
+{
+	if ((vg.samplenumber != 0) && (vg.samplenumber != sampleNum)) {
+		return false;
+	}
+	if (vg.samplerangeFirst && ((sampleNum < vg.samplerangeFirst) || (sampleNum > vg.samplerangeLast))) {
+		return false;
+	}
+	return keepAsSync || SampleIsInSubset( tir, sampleNum );
+}
+
+//   the first sample from sampleNum on that the subset may pick (lastSample + 1 if there is
+//   none), so the sample loops go straight from one picked sample to the next
+UInt32 GetNextSelectedSample( TrackInfoRec *tir, UInt32 sampleNum, UInt32 lastSample )
+{
+	UInt32 next = lastSample + 1;
+	UInt32 rank;
+
+	if (!SampleSubsetIsOn()) {
+		return sampleNum;
+	}
+	if (tir->hasSyncSampleTable) {
+		rank = CountSyncSamplesThrough( tir, sampleNum - 1 );
+		if ((rank < tir->syncSampleEntryCnt) && (tir->syncSample[rank] < next)) {
+			next = tir->syncSample[rank];
+		}
+	}
+	if (vg.sampleEvery) {
+		UInt32 phase = (UInt32)(GetTrackSubsetBits( tir ) % vg.sampleEvery);
+		UInt32 s = sampleNum + (phase + vg.sampleEvery - (sampleNum - 1) % vg.sampleEvery) % vg.sampleEvery;
+
+		if (s < next) next = s;
+	} else {
+		UInt32 s;
+
+		for (s = sampleNum; s < next; s++) {
+			if (SampleIsInSubset( tir, s )) {
+				next = s;
+				break;
+			}
+		}
+	}
+	return next;
+}
+
+Boolean SampleIsSelected( TrackInfoRec *tir, UInt32 sampleNum )
+{
+	Boolean keepAsSync = SampleSubsetIsOn() && tir->hasSyncSampleTable && IsSyncSample( tir, sampleNum );
+
+	if (!SampleNumberIsSelected( tir, sampleNum, keepAsSync )) {
+		return false;
+	}
+	if (vg.timerange) {
+		UInt64 decodeTime;
+		UInt32 duration;
+		
+		if (sampleNum > tir->timeToSampleSampleCnt) {
+			return false;
+		}
+		decodeTime = GetSampleDecodeTime( tir, sampleNum, &duration );
+		return SampleTimeIsSelected( tir, decodeTime, duration, GetSampleCompositionOffset( tir, sampleNum ) );
+	}
+	return true;
+}
+
+//==========================================================================================
+// Sync samples
+//
+//   The 'stss' table is kept as it comes, a sorted list of sample numbers, so a keyframe
+//   query is a binary search.  A table that isn't in order has already been reported by
+//   then; it is sorted here (dropping zeros and duplicates) so the queries still work.
+
+static int CompareUInt32( const void *a, const void *b )
+{
+	UInt32 x = *(const UInt32 *)a;
+	UInt32 y = *(const UInt32 *)b;
+
+	return (x < y) ? -1 : (x > y);
+}
+
+//   takes ownership of syncSamples
+OSErr SetSyncSampleTable( TrackInfoRec *tir, UInt32 *syncSamples, UInt32 entryCount )
+{
+	UInt32 i, n;
+
+	if (tir->syncSample) free( tir->syncSample );
+
+	for (i = 1; i < entryCount; i++) {
+		if (syncSamples[i] <= syncSamples[i-1]) break;
+	}
+	if ((i < entryCount) || (entryCount && (syncSamples[0] == 0))) {
+		qsort( syncSamples, entryCount, sizeof(UInt32), CompareUInt32 );
+		for (i = 0, n = 0; i < entryCount; i++) {
+			if ((syncSamples[i] != 0) && ((n == 0) || (syncSamples[i] != syncSamples[n-1]))) {
+				syncSamples[n++] = syncSamples[i];
+			}
+		}
+		entryCount = n;
+	}
+
+	tir->hasSyncSampleTable = true;
+	tir->syncSample = syncSamples;
+	tir->syncSampleEntryCnt = entryCount;
+	return noErr;
+}
+
+//   the number of sync samples numbered sampleNum or lower
+UInt32 CountSyncSamplesThrough( TrackInfoRec *tir, UInt32 sampleNum )
+{
+	UInt32 lo = 0, hi;
+
+	if (!tir->hasSyncSampleTable) {
+		return (sampleNum < tir->sampleSizeEntryCnt) ? sampleNum : tir->sampleSizeEntryCnt;
+	}
+	hi = tir->syncSampleEntryCnt;
+	while (lo < hi) {
+		UInt32 mid = lo + (hi - lo) / 2;
+		if (tir->syncSample[mid] <= sampleNum) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+Boolean IsSyncSample( TrackInfoRec *tir, UInt32 sampleNum )
+{
+	return (sampleNum != 0) && (GetSyncSampleAtOrBefore( tir, sampleNum ) == sampleNum);
+}
+
+//   0 if there is no sync sample at or before sampleNum
+UInt32 GetSyncSampleAtOrBefore( TrackInfoRec *tir, UInt32 sampleNum )
+{
+	UInt32 rank;
+
+	if (!tir->hasSyncSampleTable) {
+		return (sampleNum <= tir->sampleSizeEntryCnt) ? sampleNum : tir->sampleSizeEntryCnt;
+	}
+	rank = CountSyncSamplesThrough( tir, sampleNum );
+	return rank ? tir->syncSample[rank - 1] : 0;
+}
+
+//==========================================================================================
+// Keyframe index export (-keyframeindex)
+//
+//   All fields are big-endian:
+//		'kfix', version (1), track count
+//		per track:  track ID, media time scale, keyframe count
+//		per keyframe:  sample number (32 bits), file offset (64 bits), decode time (64 bits)
+
+enum {
+	kKeyframeIndexVersion = 1,
+	kKeyframeIndexEntrySize = 20
+};
+
+static UInt8 *PutBigEndian32( UInt8 *p, UInt32 value )
+{
+	p[0] = (UInt8)(value >> 24);
+	p[1] = (UInt8)(value >> 16);
+	p[2] = (UInt8)(value >> 8);
+	p[3] = (UInt8)value;
+	return p + 4;
+}
+
+static UInt8 *PutBigEndian64( UInt8 *p, UInt64 value )
+{
+	p = PutBigEndian32( p, (UInt32)(value >> 32) );
+	return PutBigEndian32( p, (UInt32)value );
+}
+
+//   walks 'stsc' forward once for the whole track rather than starting over for each keyframe
+static OSErr WriteTrackKeyframes( FILE *f, TrackInfoRec *tir )
+{
+	UInt32 keyframeCnt = CountSyncSamplesThrough( tir, tir->sampleSizeEntryCnt );
+	UInt32 runEntry = 1;			// current 'stsc' entry
+	UInt32 runFirstSample = 1;		// first sample of the current 'stsc' entry
+	SampleToChunk run, nextRun;
+	UInt8 buf[kKeyframeIndexEntrySize];
+	UInt32 k;
+
+	PutBigEndian32( PutBigEndian32( PutBigEndian32( buf, tir->trackID ), tir->mediaTimeScale ), keyframeCnt );
+	if (fwrite( buf, 12, 1, f ) != 1) return ioErr;
+
+	GetSampleToChunk( tir, 1, &run );
+	GetSampleToChunk( tir, 2, &nextRun );
+	for (k = 1; k <= keyframeCnt; k++) {
+		UInt32 sampleNum = tir->hasSyncSampleTable ? tir->syncSample[k - 1] : k;
+		UInt32 chunkNum, chunkFirstSample;
+		UInt64 offset;
+		UInt32 s;
+
+		while ((runEntry < tir->sampleToChunkEntryCnt) &&
+				(sampleNum >= runFirstSample + (nextRun.firstChunk - run.firstChunk) * run.samplesPerChunk)) {
+			runFirstSample += (nextRun.firstChunk - run.firstChunk) * run.samplesPerChunk;
+			run = nextRun;
+			GetSampleToChunk( tir, ++runEntry + 1, &nextRun );
+		}
+		if (run.samplesPerChunk == 0) {
+			return paramErr;
+		}
+		chunkNum = run.firstChunk + (sampleNum - runFirstSample) / run.samplesPerChunk;
+		chunkFirstSample = sampleNum - (sampleNum - runFirstSample) % run.samplesPerChunk;
+
+		offset = GetChunkOffset( tir, chunkNum );
+		if (tir->singleSampleSize) {
+			offset += (UInt64)(sampleNum - chunkFirstSample) * tir->singleSampleSize;
+		} else {
+			for (s = chunkFirstSample; s < sampleNum; s++) {
+				offset += GetSampleSize( tir, s );
+			}
+		}
+
+		PutBigEndian64( PutBigEndian64( PutBigEndian32( buf, sampleNum ), offset ), GetSampleDecodeTime( tir, sampleNum, nil ) );
+		if (fwrite( buf, kKeyframeIndexEntrySize, 1, f ) != 1) return ioErr;
+	}
+	return noErr;
+}
+
+OSErr WriteKeyframeIndex( MovieInfoRec *mir, const char *path )
+{
+	OSErr err = noErr;
+	FILE *f;
+	UInt8 header[12];
+	long i;
+
+	if (!(f = fopen( path, "wb" ))) {
+		fprintf( _stderr, "Could not create keyframe index file \"%s\"\n", path );
+		return ioErr;
+	}
+
+	PutBigEndian32( PutBigEndian32( PutBigEndian32( header, 'kfix' ), kKeyframeIndexVersion ), (UInt32)mir->numTIRs );
+	if (fwrite( header, sizeof(header), 1, f ) != 1) err = ioErr;
+	for (i = 0; !err && (i < mir->numTIRs); i++) {
+		err = WriteTrackKeyframes( f, &mir->tirList[i] );
+	}
+	if (fclose( f ) && !err) err = ioErr;
+
+	if (err) {
+		fprintf( _stderr, "Could not write keyframe index file \"%s\" (err %d)\n", path, err );
+	}
+	return err;
+}
@@ -0,0 +1,629 @@
+/*
+
+This file contains Original Code and/or Modifications of Original Code
+as defined in and that are subject to the Apple Public Source License
+Version 2.0 (the 'License'). You may not use this file except in
+compliance with the License. Please obtain a copy of the License at
+http://www.opensource.apple.com/apsl/ and read it before using this
+file.
+
+The Original Code and all software distributed under the License are
+distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+Please see the License for the specific language governing rights and
+limitations under the License.
+
+*/
+
+#include "ValidateMP4.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+	#define USE_SERVER 1
+	#include <pthread.h>
+	#include <unistd.h>
+	#include <errno.h>
+	#include <limits.h>
+	#include <poll.h>
+	#include <signal.h>
+	#include <time.h>
+	#include <sys/socket.h>
+	#include <sys/stat.h>
+	#include <sys/un.h>
+#endif
+
+//==========================================================================================
+// Validation server (-server) and its client (-client)
+//
+//   The server listens on a Unix domain socket and checks files on a pool of worker threads
+//   (-workers), so a service that checks many files doesn't start a process for each one.
+//   A connection carries one job.  The client sends the job's command line, one argument
+//   per line, then its timeout if it has one, then "run":
+//
+//		arg <argument>
+//		timeout <seconds>
+//		run
+//
+//   and may send "cancel" (or just hang up) after that.  The job goes through the same
+//   option parsing as the command line, and its report comes back as records:
+//
+//		out <length>\n<length bytes of report>
+//		err <length>\n<length bytes of errors and warnings>
+//		done <ok|failed|timeout|cancelled> <result code>
+//
+//   A job that times out or is cancelled is told to stop and does so at its next file read
+//   (see GetFileData); "done" is sent right away and the rest of its report is dropped.
+//   The server opens the files, so the client sends the input file's full path.
+
+#if USE_SERVER
+
+enum {
+	kServerMaxLine = 4096,
+	kServerMaxArgs = 256,
+	kServerRelaySize = 16 * 1024,
+	kServerPollMilliseconds = 250,
+	kServerThreadStackSize = 8 * 1024 * 1024
+};
+
+typedef struct ServerJob {
+	int		argc;
+	char	*argv[kServerMaxArgs + 2];		// "ValidateMP4", the arguments, nil
+	int		outPipe[2];						// the worker writes the report into these...
+	int		errPipe[2];						// ...and the connection relays it to the client
+	volatile int cancelled;
+	int		result;
+	Boolean	finished;
+	struct ServerJob *next;
+} ServerJob;
+
+typedef struct ValidateServer {
+	pthread_mutex_t	lock;
+	pthread_cond_t	jobReady;
+	pthread_cond_t	jobFinished;
+	ServerJob		*queueHead;
+	ServerJob		*queueTail;
+	long			defaultTimeout;
+} ValidateServer;
+
+typedef struct ServerConnection {
+	ValidateServer	*server;
+	int				fd;
+} ServerConnection;
+
+typedef struct LineReader {
+	int		fd;
+	char	buf[kServerMaxLine];
+	size_t	len;
+} LineReader;
+
+static ValidateServer gServer;		// the worker threads run until the process exits
+static volatile sig_atomic_t gStopServer = 0;
+static volatile sig_atomic_t gCancelJob = 0;
+
+//==========================================================================================
+
+//   one read; 1 if something came in, 0 at the end of the input, -1 on an error (or when
+//   the buffer is full without a whole line in it)
+static int FillLineReader( LineReader *r )
+{
+	ssize_t got;
+
+	if (r->len == sizeof(r->buf)) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	got = read( r->fd, r->buf + r->len, sizeof(r->buf) - r->len );
+	if (got > 0) {
+		r->len += got;
+		return 1;
+	}
+	return (int)got;
+}
+
+//   takes the next whole line (without its newline) out of what has been read
+static Boolean NextLine( LineReader *r, char *line )
+{
+	char *end = memchr( r->buf, '\n', r->len );
+	size_t lineLen;
+
+	if (!end) return false;
+	lineLen = end - r->buf;
+	memcpy( line, r->buf, lineLen );
+	line[lineLen] = 0;
+	r->len -= lineLen + 1;
+	memmove( r->buf, end + 1, r->len );
+	return true;
+}
+
+static Boolean WriteAll( int fd, const void *data, size_t size )
+{
+	const char *p = data;
+
+	while (size > 0) {
+		ssize_t put = write( fd, p, size );
+
+		if (put < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		p += put;
+		size -= put;
+	}
+	return true;
+}
+
+static Boolean SendRecord( int fd, const char *kind, const char *data, size_t size )
+{
+	char header[64];
+
+	snprintf( header, sizeof(header), "%s %lu\n", kind, (unsigned long)size );
+	return WriteAll( fd, header, strlen(header) ) && WriteAll( fd, data, size );
+}
+
+static double MonotonicSeconds( void )
+{
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static Boolean SendDone( int fd, const char *status, int result )
+{
+	char line[64];
+
+	snprintf( line, sizeof(line), "done %s %d\n", status, result );
+	return WriteAll( fd, line, strlen(line) );
+}
+
+//==========================================================================================
+// Server
+
+static void StopServer( int sig )
+{
+	gStopServer = 1;
+}
+
+static void DisposeServerJob( ServerJob *job )
+{
+	int i;
+
+	for (i = 1; i < job->argc; i++) {
+		free( job->argv[i] );
+	}
+	free( job );
+}
+
+static int RunServerJob( ServerJob *job )
+{
+	int result = userCanceledErr;
+	FILE *outFile = fdopen( job->outPipe[1], "w" );
+	FILE *errFile = fdopen( job->errPipe[1], "w" );
+
+	if (outFile && errFile && !job->cancelled) {
+		memset( &vg, 0, sizeof(vg) );
+		vg.outFile = outFile;
+		vg.errFile = errFile;
+		vg.cancelled = &job->cancelled;
+		result = ValidateMP4Command( job->argc, job->argv );
+		memset( &vg, 0, sizeof(vg) );
+	}
+
+	// closing the write ends is what tells the connection the report is complete
+	if (outFile) fclose( outFile ); else close( job->outPipe[1] );
+	if (errFile) fclose( errFile ); else close( job->errPipe[1] );
+	return result;
+}
+
+static void *ServerWorkerMain( void *arg )
+{
+	ValidateServer *server = arg;
+
+	for (;;) {
+		ServerJob *job;
+		int result;
+
+		pthread_mutex_lock( &server->lock );
+		while (!server->queueHead) {
+			pthread_cond_wait( &server->jobReady, &server->lock );
+		}
+		job = server->queueHead;
+		server->queueHead = job->next;
+		if (!server->queueHead) server->queueTail = nil;
+		pthread_mutex_unlock( &server->lock );
+
+		result = RunServerJob( job );
+
+		pthread_mutex_lock( &server->lock );
+		job->result = result;
+		job->finished = true;
+		pthread_cond_broadcast( &server->jobFinished );
+		pthread_mutex_unlock( &server->lock );
+	}
+	return nil;
+}
+
+//   reads the request up to "run"; false if it isn't one
+static Boolean ReadServerJob( LineReader *reader, ServerJob *job, long *timeoutOut )
+{
+	char line[kServerMaxLine];
+
+	job->argv[job->argc++] = "ValidateMP4";
+	for (;;) {
+		while (NextLine( reader, line )) {
+			if (strncmp( line, "arg ", 4 ) == 0) {
+				if ((job->argc > kServerMaxArgs) || !(job->argv[job->argc] = strdup( line + 4 ))) {
+					return false;
+				}
+				job->argc++;
+			} else if (strncmp( line, "timeout ", 8 ) == 0) {
+				*timeoutOut = atol( line + 8 );
+			} else if (strcmp( line, "run" ) == 0) {
+				return true;
+			} else {
+				return false;
+			}
+		}
+		if (FillLineReader( reader ) <= 0) {
+			return false;
+		}
+	}
+}
+
+static void *ServerConnectionMain( void *arg )
+{
+	ServerConnection *conn = arg;
+	ValidateServer *server = conn->server;
+	int fd = conn->fd;
+	LineReader *reader = nil;
+	ServerJob *job = nil;
+	char *relay = nil;
+	long timeout = server->defaultTimeout;
+	double deadline;
+	const char *status = nil;		// set once the client has been told the job is over
+	Boolean queued = false;
+	Boolean clientOpen = true;
+	Boolean pipeOpen[2] = { true, true };
+	int i;
+
+	free( conn );
+	reader = calloc( 1, sizeof(LineReader) );
+	job = calloc( 1, sizeof(ServerJob) );
+	relay = malloc( kServerRelaySize );
+	if (!reader || !job || !relay) goto bail;
+	reader->fd = fd;
+	job->outPipe[0] = job->outPipe[1] = job->errPipe[0] = job->errPipe[1] = -1;
+
+	if (!ReadServerJob( reader, job, &timeout )) {
+		SendDone( fd, "failed", paramErr );
+		goto bail;
+	}
+	if ((pipe( job->outPipe ) < 0) || (pipe( job->errPipe ) < 0)) {
+		SendDone( fd, "failed", ioErr );
+		goto bail;
+	}
+	deadline = (timeout > 0) ? MonotonicSeconds() + timeout : 0;
+
+	pthread_mutex_lock( &server->lock );
+	if (server->queueTail) {
+		server->queueTail->next = job;
+	} else {
+		server->queueHead = job;
+	}
+	server->queueTail = job;
+	pthread_cond_signal( &server->jobReady );
+	pthread_mutex_unlock( &server->lock );
+	queued = true;
+
+	// relay the report until the worker is done with it, watching for "cancel" and the clock
+	while (pipeOpen[0] || pipeOpen[1]) {
+		struct pollfd fds[3];
+		int pipeIndex[2] = { -1, -1 };
+		int clientIndex = -1;
+		int n = 0;
+
+		for (i = 0; i < 2; i++) {
+			if (pipeOpen[i]) {
+				pipeIndex[i] = n;
+				fds[n].fd = i ? job->errPipe[0] : job->outPipe[0];
+				fds[n++].events = POLLIN;
+			}
+		}
+		if (clientOpen) {
+			clientIndex = n;
+			fds[n].fd = fd;
+			fds[n++].events = POLLIN;
+		}
+		if (poll( fds, n, kServerPollMilliseconds ) < 0) {
+			if (errno == EINTR) continue;
+			n = 0;
+		}
+
+		for (i = 0; i < 2; i++) {
+			if ((pipeIndex[i] >= 0) && (fds[pipeIndex[i]].revents & (POLLIN | POLLHUP | POLLERR))) {
+				ssize_t got = read( fds[pipeIndex[i]].fd, relay, kServerRelaySize );
+
+				if ((got < 0) && (errno == EINTR)) continue;
+				if (got <= 0) {
+					close( fds[pipeIndex[i]].fd );
+					pipeOpen[i] = false;
+				} else if (!status && clientOpen && !SendRecord( fd, i ? "err" : "out", relay, got )) {
+					clientOpen = false;
+				}
+			}
+		}
+		if ((clientIndex >= 0) && (fds[clientIndex].revents & (POLLIN | POLLHUP | POLLERR))) {
+			char line[kServerMaxLine];
+
+			if (FillLineReader( reader ) <= 0) {
+				clientOpen = false;
+			}
+			while (NextLine( reader, line )) {
+				if ((strcmp( line, "cancel" ) == 0) && !status) {
+					job->cancelled = 1;
+					status = "cancelled";
+					SendDone( fd, status, userCanceledErr );
+				}
+			}
+		}
+		if (!status && !clientOpen) {
+			job->cancelled = 1;
+			status = "cancelled";
+		}
+		if (!status && deadline && (MonotonicSeconds() >= deadline)) {
+			job->cancelled = 1;
+			status = "timeout";
+			SendDone( fd, status, userCanceledErr );
+		}
+	}
+
+	pthread_mutex_lock( &server->lock );
+	while (!job->finished) {
+		pthread_cond_wait( &server->jobFinished, &server->lock );
+	}
+	pthread_mutex_unlock( &server->lock );
+	if (!status) {
+		SendDone( fd, job->result ? "failed" : "ok", job->result );
+	}
+
+bail:
+	if (job) {
+		if (!queued) {
+			for (i = 0; i < 2; i++) {
+				if (job->outPipe[i] >= 0) close( job->outPipe[i] );
+				if (job->errPipe[i] >= 0) close( job->errPipe[i] );
+			}
+		}
+		DisposeServerJob( job );
+	}
+	if (reader) free( reader );
+	if (relay) free( relay );
+	close( fd );
+	return nil;
+}
+
+int RunValidateServer( const char *socketPath, long workers, long defaultTimeout )
+{
+	ValidateServer *server = &gServer;
+	struct sockaddr_un addr;
+	struct sigaction action;
+	struct stat info;
+	pthread_attr_t attr;
+	pthread_t thread;
+	int listenFd = -1;
+	Boolean bound = false;
+	int err = noErr;
+	long i;
+
+	memset( &addr, 0, sizeof(addr) );
+	if (strlen( socketPath ) >= sizeof(addr.sun_path)) {
+		fprintf( _stderr, "Socket path \"%s\" is too long\n", socketPath );
+		return paramErr;
+	}
+	addr.sun_family = AF_UNIX;
+	strcpy( addr.sun_path, socketPath );
+
+	pthread_mutex_init( &server->lock, nil );
+	pthread_cond_init( &server->jobReady, nil );
+	pthread_cond_init( &server->jobFinished, nil );
+	server->defaultTimeout = defaultTimeout;
+
+	signal( SIGPIPE, SIG_IGN );			// a client that hangs up shows up as a failed write
+	memset( &action, 0, sizeof(action) );
+	action.sa_handler = StopServer;		// without SA_RESTART, so accept() gives up
+	sigaction( SIGINT, &action, nil );
+	sigaction( SIGTERM, &action, nil );
+
+	// a socket left behind by an earlier server is replaced, but nothing else is
+	if ((lstat( socketPath, &info ) == 0) && S_ISSOCK(info.st_mode)) {
+		unlink( socketPath );
+	}
+	if ((listenFd = socket( AF_UNIX, SOCK_STREAM, 0 )) >= 0) {
+		bound = (bind( listenFd, (struct sockaddr *)&addr, sizeof(addr) ) == 0);
+	}
+	if (!bound || (listen( listenFd, SOMAXCONN ) < 0)) {
+		fprintf( _stderr, "Could not listen on \"%s\": %s\n", socketPath, strerror(errno) );
+		err = ioErr;
+		goto bail;
+	}
+
+	pthread_attr_init( &attr );
+	pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+	pthread_attr_setstacksize( &attr, kServerThreadStackSize );
+	for (i = 0; i < workers; i++) {
+		if (pthread_create( &thread, &attr, ServerWorkerMain, server ) != 0) {
+			fprintf( _stderr, "Could not start the server's worker threads\n" );
+			err = allocFailedErr;
+			goto bail;
+		}
+	}
+	fprintf( _stderr, "Listening on %s with %ld workers\n", socketPath, workers );
+
+	while (!gStopServer) {
+		ServerConnection *conn;
+		int fd = accept( listenFd, nil, nil );
+
+		if (fd < 0) {
+			if ((errno == EINTR) || (errno == ECONNABORTED)) continue;
+			fprintf( _stderr, "Could not accept a connection: %s\n", strerror(errno) );
+			err = ioErr;
+			break;
+		}
+		if ((conn = malloc( sizeof(ServerConnection) )) != nil) {
+			conn->server = server;
+			conn->fd = fd;
+			if (pthread_create( &thread, &attr, ServerConnectionMain, conn ) == 0) continue;
+			free( conn );
+		}
+		close( fd );
+	}
+
+bail:
+	if (listenFd >= 0) close( listenFd );
+	if (bound) unlink( socketPath );
+	return err;
+}
+
+//==========================================================================================
+// Client
+
+static void CancelJob( int sig )
+{
+	gCancelJob = 1;
+}
+
+//   reads more of the reply; false once the connection is gone
+static Boolean FillClientReader( LineReader *reader, int fd, Boolean *sentCancelP )
+{
+	for (;;) {
+		int got;
+
+		if (gCancelJob && !*sentCancelP) {
+			*sentCancelP = true;
+			WriteAll( fd, "cancel\n", 7 );
+		}
+		got = FillLineReader( reader );
+		if ((got < 0) && (errno == EINTR)) continue;
+		return (got > 0);
+	}
+}
+
+int RunValidateClient( const char *socketPath, int argc, char *argv[], int clientArgn, int inputArgn, long timeout )
+{
+	struct sockaddr_un addr;
+	struct sigaction action;
+	LineReader *reader = nil;
+	char line[kServerMaxLine];
+	char fullPath[PATH_MAX];
+	Boolean sentCancel = false;
+	int fd = -1;
+	int err = noErr;
+	int i;
+
+	memset( &addr, 0, sizeof(addr) );
+	if (strlen( socketPath ) >= sizeof(addr.sun_path)) {
+		fprintf( _stderr, "Socket path \"%s\" is too long\n", socketPath );
+		return paramErr;
+	}
+	addr.sun_family = AF_UNIX;
+	strcpy( addr.sun_path, socketPath );
+
+	signal( SIGPIPE, SIG_IGN );
+	if (((fd = socket( AF_UNIX, SOCK_STREAM, 0 )) < 0) ||
+			(connect( fd, (struct sockaddr *)&addr, sizeof(addr) ) < 0)) {
+		fprintf( _stderr, "Could not connect to \"%s\": %s\n", socketPath, strerror(errno) );
+		err = ioErr;
+		goto bail;
+	}
+
+	for (i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+
+		if ((i == clientArgn) || (i == clientArgn + 1)) continue;
+		if ((i == inputArgn) && realpath( arg, fullPath )) {
+			arg = fullPath;
+		}
+		if ((strlen( arg ) + 5 >= sizeof(line)) || strchr( arg, '\n' )) {
+			fprintf( _stderr, "Argument \"%s\" can't be sent to the server\n", arg );
+			err = paramErr;
+			goto bail;
+		}
+		BAILIF( !WriteAll( fd, "arg ", 4 ) || !WriteAll( fd, arg, strlen(arg) ) || !WriteAll( fd, "\n", 1 ), ioErr );
+	}
+	if (timeout) {
+		snprintf( line, sizeof(line), "timeout %ld\n", timeout );
+		BAILIF( !WriteAll( fd, line, strlen(line) ), ioErr );
+	}
+	BAILIF( !WriteAll( fd, "run\n", 4 ), ioErr );
+
+	memset( &action, 0, sizeof(action) );
+	action.sa_handler = CancelJob;		// without SA_RESTART, so read() gives up and "cancel" goes out
+	sigaction( SIGINT, &action, nil );
+	sigaction( SIGTERM, &action, nil );
+
+	BAILIFNIL( reader = calloc( 1, sizeof(LineReader) ), allocFailedErr );
+	reader->fd = fd;
+	for (;;) {
+		char kind[16];
+		unsigned long size;
+		int result;
+
+		if (!NextLine( reader, line )) {
+			BAILIF( !FillClientReader( reader, fd, &sentCancel ), ioErr );
+			continue;
+		}
+		if ((sscanf( line, "%15s %lu", kind, &size ) == 2) && ((strcmp( kind, "out" ) == 0) || (strcmp( kind, "err" ) == 0))) {
+			FILE *f = (kind[0] == 'o') ? _stdout : _stderr;
+
+			while (size > 0) {
+				size_t chunk;
+
+				if (reader->len == 0) {
+					BAILIF( !FillClientReader( reader, fd, &sentCancel ), ioErr );
+				}
+				chunk = (size < reader->len) ? size : reader->len;
+				fwrite( reader->buf, 1, chunk, f );
+				reader->len -= chunk;
+				memmove( reader->buf, reader->buf + chunk, reader->len );
+				size -= chunk;
+			}
+		} else if ((sscanf( line, "done %15s %d", kind, &result ) == 2)) {
+			if (strcmp( kind, "timeout" ) == 0) {
+				fprintf( _stderr, "The job timed out\n" );
+			} else if (strcmp( kind, "cancelled" ) == 0) {
+				fprintf( _stderr, "The job was cancelled\n" );
+			}
+			err = result;
+			break;
+		} else {
+			BAILIF( true, ioErr );
+		}
+	}
+
+bail:
+	if (err == ioErr) {
+		fprintf( _stderr, "Lost the connection to the server\n" );
+	}
+	if (reader) free( reader );
+	if (fd >= 0) close( fd );
+	return err;
+}
+
+#else
+
+int RunValidateServer( const char *socketPath, long workers, long defaultTimeout )
+{
+#pragma unused(socketPath, workers, defaultTimeout)
+	fprintf( _stderr, "-server isn't available on this platform\n" );
+	return noCanDoErr;
+}
+
+int RunValidateClient( const char *socketPath, int argc, char *argv[], int clientArgn, int inputArgn, long timeout )
+{
+#pragma unused(socketPath, argc, argv, clientArgn, inputArgn, timeout)
+	fprintf( _stderr, "-client isn't available on this platform\n" );
+	return noCanDoErr;
+}
+
+#endif
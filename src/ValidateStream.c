@@ -0,0 +1,438 @@
+/*
+
+This file contains Original Code and/or Modifications of Original Code
+as defined in and that are subject to the Apple Public Source License
+Version 2.0 (the 'License'). You may not use this file except in
+compliance with the License. Please obtain a copy of the License at
+http://www.opensource.apple.com/apsl/ and read it before using this
+file.
+
+The Original Code and all software distributed under the License are
+distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+Please see the License for the specific language governing rights and
+limitations under the License.
+
+*/
+
+#include "ValidateMP4.h"
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+	#include <unistd.h>
+	#define SleepSeconds(n) sleep(n)
+#elif defined(_WIN32)
+	#include <windows.h>
+	#define SleepSeconds(n) Sleep((n) * 1000)
+#endif
+
+//==========================================================================================
+// Streaming input
+//
+//   A pipe can only be read once, front to back, so the top level atoms are read as they
+//   arrive and what the validators will want is kept in memory: every atom but 'mdat',
+//   'free' and 'skip' whole, and 'mdat' payload only when samples are checked (-checklevel
+//   2 and up), and then only up to the spool limit (-spool).  GetFileData reads come out of
+//   what was kept.  A 'moov' that follows its 'mdat' is no different; its sample tables are
+//   kept like any other atom and the payload is not needed to check them.
+//
+//   A movie with an 'mvex' is validated as soon as its 'moov' arrives, and then each 'moof'
+//   once the next one (or the end of the stream) shows that its data is in; after that the
+//   fragment's bytes are let go, so a long fragmented stream needs about one fragment of
+//   memory.  Everything else is validated at the end of the stream.
+//
+//   A file that is still being written (-follow) is read the same way, except that running
+//   out of data means waiting for more.  Each time the reader catches up with the writer the
+//   fragment whose 'mdat' has just come in is validated, so every poll only looks at what
+//   was appended since the last one.  Following stops once the file hasn't grown for the
+//   given number of seconds, or on an interrupt, and then the rest is validated as usual.
+
+enum {
+	kStreamReadSize = 64 * 1024,
+	kFollowPollSeconds = 1
+};
+
+typedef struct StreamExtent {
+	UInt64	offset;
+	UInt64	size;					// bytes kept, which may be fewer than the atom has
+	UInt8	*data;					// nil once let go
+	OSType	type;
+	UInt64	payloadSize;			// kept 'mdat' payload, which counts against the spool limit
+} StreamExtent;
+
+typedef struct StreamSource {
+	FILE	*in;
+	UInt64	offset;					// bytes read so far
+	UInt8	*scratch;
+	StreamExtent *extents;			// one per top level atom, in offset order
+	UInt32	extentCnt;
+	UInt32	extentMax;
+	UInt64	spooledBytes;
+	Boolean	reportedSpoolLimit;
+	time_t	lastGrowth;				// when data last arrived (-follow)
+} StreamSource;
+
+static volatile sig_atomic_t gStopFollowing = 0;
+
+//==========================================================================================
+
+int GetStreamData( void *dataP, UInt64 offset64, UInt64 size64 )
+{
+	StreamSource *source = vg.inStream;
+	UInt32 lo = 0, hi = source->extentCnt;
+	StreamExtent *extent;
+
+	// the last extent that starts at or before the offset
+	while (lo < hi) {
+		UInt32 mid = lo + (hi - lo) / 2;
+		if (source->extents[mid].offset <= offset64) lo = mid + 1;
+		else hi = mid;
+	}
+	if (lo == 0) return outOfDataErr;
+	extent = &source->extents[lo - 1];
+	if (!extent->data || (offset64 - extent->offset > extent->size) ||
+			(size64 > extent->size - (offset64 - extent->offset))) {
+		return outOfDataErr;
+	}
+	memcpy( dataP, extent->data + (offset64 - extent->offset), size64 );
+	return noErr;
+}
+
+static void StopFollowing( int sig )
+{
+	gStopFollowing = 1;
+}
+
+//   false once the followed file has been idle too long (or we were interrupted)
+static Boolean WaitForStream( StreamSource *source )
+{
+	if (gStopFollowing || (difftime( time(nil), source->lastGrowth ) >= vg.follow)) {
+		return false;
+	}
+	SleepSeconds( kFollowPollSeconds );
+	clearerr( source->in );
+	return true;
+}
+
+//   true when everything written so far has been read
+static Boolean CaughtUpWithStream( StreamSource *source )
+{
+	int c = getc( source->in );
+
+	if (c == EOF) {
+		clearerr( source->in );
+		return true;
+	}
+	ungetc( c, source->in );
+	return false;
+}
+
+static UInt32 ReadStreamBytes( StreamSource *source, void *dataP, UInt32 size )
+{
+	UInt32 amtRead = 0;
+
+	for (;;) {
+		UInt32 got = fread( (UInt8 *)dataP + amtRead, 1, size - amtRead, source->in );
+
+		if (got) source->lastGrowth = time(nil);
+		amtRead += got;
+		if ((amtRead == size) || !vg.follow || !WaitForStream( source )) break;
+	}
+	source->offset += amtRead;
+	return amtRead;
+}
+
+static OSErr ReadStreamAtom( StreamSource *source, atomOffsetEntry *entry, Boolean *gotOneOut )
+{
+	OSErr err = noErr;
+	UInt8 header[8];
+	UInt32 headerSize = 8;
+	UInt64 remaining;
+	UInt8 *data = nil;
+	UInt64 used, max;
+	UInt64 payloadSize = 0;
+	Boolean isPayload, keep;
+	UInt32 amtRead;
+	StreamExtent *extent;
+
+	*gotOneOut = false;
+	memset( entry, 0, sizeof(atomOffsetEntry) );
+	entry->offset = source->offset;
+
+	amtRead = ReadStreamBytes( source, header, 8 );
+	if (amtRead == 0) goto bail;
+	if (amtRead < 8) goto endsInHeader;
+	entry->size = EndianU32_BtoN(*(UInt32 *)&header[0]);
+	entry->type = EndianU32_BtoN(*(UInt32 *)&header[4]);
+	max = 8 + 8 + sizeof(uuidType);
+	BAILIFNIL( data = malloc( max ), allocFailedErr );
+	memcpy( data, header, 8 );
+	if (entry->size == 1) {
+		if (ReadStreamBytes( source, data + headerSize, 8 ) != 8) goto endsInHeader;
+		entry->size = EndianU64_BtoN(*(UInt64 *)(data + headerSize));
+		headerSize += 8;
+	}
+	if (entry->type == 'uuid') {
+		if (ReadStreamBytes( source, data + headerSize, sizeof(uuidType) ) != sizeof(uuidType)) goto endsInHeader;
+		memcpy( &entry->uuid, data + headerSize, sizeof(uuidType) );
+		headerSize += sizeof(uuidType);
+	}
+	entry->atomStartSize = headerSize;
+	used = headerSize;
+	if (entry->size != 0) {
+		BAILIF( (entry->size < headerSize), badAtomSize );
+		remaining = entry->size - headerSize;
+	} else {
+		remaining = ~(UInt64)0;				// to the end of the stream
+	}
+
+	isPayload = (entry->type == 'mdat');
+	if (isPayload) {
+		keep = (vg.checklevel >= checklevel_samples);
+	} else {
+		keep = (entry->type != 'free') && (entry->type != 'skip');
+	}
+
+	while (remaining > 0) {
+		UInt32 want = (remaining < kStreamReadSize) ? (UInt32)remaining : kStreamReadSize;
+
+		amtRead = ReadStreamBytes( source, source->scratch, want );
+		remaining -= amtRead;
+		if (keep && amtRead) {
+			if (isPayload && (source->spooledBytes + amtRead > vg.spoolLimit)) {
+				if (!source->reportedSpoolLimit) {
+					warnprint("WARNING: the stream spool limit (%s bytes) was reached at %s; samples from there on are not checked\n",
+						int64todstr(vg.spoolLimit), int64toxstr(source->offset - amtRead));
+					source->reportedSpoolLimit = true;
+				}
+				keep = false;
+			} else {
+				if (used + amtRead > max) {
+					UInt8 *newData;
+
+					max = (isPayload || (entry->size == 0)) ? 2 * (used + amtRead) : entry->size;
+					if ((newData = realloc( data, max )) == nil) {
+						errprint("couldn't keep the %s bytes of the '%s' atom at %s\n",
+							int64todstr(entry->size), ostypetostr(entry->type), int64toxstr(entry->offset));
+						keep = false;
+					} else {
+						data = newData;
+					}
+				}
+				if (keep) {
+					memcpy( data + used, source->scratch, amtRead );
+					used += amtRead;
+					if (isPayload) {
+						payloadSize += amtRead;
+						source->spooledBytes += amtRead;
+					}
+				}
+			}
+		}
+		if (amtRead < want) break;
+	}
+
+	if (entry->size == 0) {
+		entry->size = source->offset - entry->offset;
+	} else if (remaining > 0) {
+		errprint("The stream ends inside the '%s' atom at %s\n", ostypetostr(entry->type), int64toxstr(entry->offset));
+	}
+	entry->maxOffset = entry->offset + entry->size;
+
+	if (source->extentCnt >= source->extentMax) {
+		UInt32 newMax = source->extentMax ? 2 * source->extentMax : 64;
+		StreamExtent *newExtents;
+
+		BAILIFNIL( newExtents = realloc( source->extents, newMax * sizeof(StreamExtent) ), allocFailedErr );
+		source->extents = newExtents;
+		source->extentMax = newMax;
+	}
+	extent = &source->extents[source->extentCnt++];
+	extent->offset = entry->offset;
+	extent->size = used;
+	extent->data = data;
+	extent->type = entry->type;
+	extent->payloadSize = payloadSize;
+	data = nil;
+
+	*gotOneOut = true;
+	goto bail;
+
+endsInHeader:
+	errprint("The stream ends inside an atom header at %s\n", int64toxstr(entry->offset));
+	err = outOfDataErr;
+bail:
+	if (data) free( data );
+	return err;
+}
+
+//   lets go of the 'moof' and 'mdat' atoms that start in [start, stop)
+static void ReleaseStreamFragment( StreamSource *source, UInt64 start, UInt64 stop )
+{
+	UInt32 i;
+
+	for (i = source->extentCnt; i > 0; i--) {
+		StreamExtent *extent = &source->extents[i - 1];
+
+		if (extent->offset < start) break;
+		if ((extent->offset < stop) && extent->data && ((extent->type == 'moof') || (extent->type == 'mdat'))) {
+			free( extent->data );
+			extent->data = nil;
+			source->spooledBytes -= extent->payloadSize;
+			extent->payloadSize = 0;
+		}
+	}
+}
+
+//==========================================================================================
+
+static Boolean MovieHasExtends( atomOffsetEntry *aoe )
+{
+	long cnt = 0;
+	atomOffsetEntry *list = nil;
+	long i;
+	Boolean hasMovieExtends = false;
+
+	if (FindAtomOffsets( aoe, aoe->offset + aoe->atomStartSize, aoe->offset + aoe->size - aoe->atomStartSize, &cnt, &list ) == noErr) {
+		for (i = 0; i < cnt; i++) {
+			if (list[i].type == 'mvex') hasMovieExtends = true;
+		}
+	}
+	if (list) free( list );
+	return hasMovieExtends;
+}
+
+//   the rest of the stream hasn't arrived, so chunks aren't checked against the 'mdat'
+//   atoms or the end of the file; a movie with an 'mvex' seldom has any
+static OSErr ValidateStreamMovie( long cnt, atomOffsetEntry *list )
+{
+	OSErr err;
+	MediaDataExtent *mdatList = vg.mdatList;
+	UInt32 mdatCnt = vg.mdatCnt;
+	long inMaxOffset = vg.inMaxOffset;
+
+	vg.mdatList = nil;
+	vg.mdatCnt = 0;
+	vg.inMaxOffset = LONG_MAX;
+	err = ValidateFileMovieAtoms( cnt, list );
+	vg.mdatList = mdatList;
+	vg.mdatCnt = mdatCnt;
+	vg.inMaxOffset = inMaxOffset;
+	return err;
+}
+
+static OSErr ValidateStreamFragment( StreamSource *source, atomOffsetEntry *moof, long moofNum, UInt64 stop )
+{
+	OSErr err;
+
+	err = ValidateAtomEntry( moof, moofNum, Validate_moof_Atom, nil );
+	ReleaseStreamFragment( source, moof->offset, stop );
+	return err;
+}
+
+OSErr ValidateStream( atomOffsetEntry *aoe )
+{
+	OSErr err = noErr;
+	OSErr atomerr = noErr;
+	StreamSource source = {0};
+	atomOffsetEntry *list = nil;
+	long cnt = 0;
+	long max = 0;
+	atomOffsetEntry entry;
+	Boolean gotOne;
+	Boolean movieValidated = false;
+	long pendingMoof = -1;				// the 'moof' whose data may still be arriving
+	long moofNum = 0;
+	UInt32 i;
+
+	source.in = vg.inFile;
+	BAILIFNIL( source.scratch = malloc( kStreamReadSize ), allocFailedErr );
+	vg.inStream = &source;
+	vg.inMaxOffset = 0;
+	vg.mir = NULL;
+	if (vg.follow) {
+		source.lastGrowth = time(nil);
+		signal( SIGINT, StopFollowing );
+	}
+
+	for (;;) {
+		if (vg.follow && CaughtUpWithStream( &source )) {
+			// the writer is between atoms, so a fragment followed by its 'mdat' is complete
+			if ((pendingMoof >= 0) && (pendingMoof < cnt - 1) && (list[cnt - 1].type == 'mdat')) {
+				atomerr = ValidateStreamFragment( &source, &list[pendingMoof], ++moofNum, source.offset );
+				if (!err) err = atomerr;
+				pendingMoof = -1;
+			}
+			fflush( _stdout );
+			fflush( _stderr );
+			if (!WaitForStream( &source )) break;
+			continue;
+		}
+
+		atomerr = ReadStreamAtom( &source, &entry, &gotOne );
+		if (!err) err = atomerr;
+		if (!gotOne) break;
+
+		if (cnt >= max) {
+			atomOffsetEntry *newList;
+
+			max += 64;
+			BAILIFNIL( newList = realloc( list, max * sizeof(atomOffsetEntry) ), allocFailedErr );
+			list = newList;
+		}
+		list[cnt++] = entry;
+		vg.inMaxOffset = source.offset;
+		if (entry.type == 'mdat') {
+			BAILIFERR( AddMediaDataExtent( &list[cnt - 1] ) );
+		}
+
+		if ((entry.type == 'moof') && movieValidated) {
+			if (pendingMoof >= 0) {
+				atomerr = ValidateStreamFragment( &source, &list[pendingMoof], ++moofNum, entry.offset );
+				if (!err) err = atomerr;
+			}
+			pendingMoof = cnt - 1;
+		} else if ((entry.type == 'moov') && !movieValidated && MovieHasExtends( &list[cnt - 1] )) {
+			atomerr = ValidateStreamMovie( cnt, list );
+			if (!err) err = atomerr;
+			movieValidated = true;
+		}
+	}
+	if (vg.follow) {
+		signal( SIGINT, SIG_DFL );
+	}
+	if (pendingMoof >= 0) {
+		atomerr = ValidateStreamFragment( &source, &list[pendingMoof], ++moofNum, source.offset );
+		if (!err) err = atomerr;
+	}
+
+	// the rest needs the whole stream
+	aoe->size = source.offset;
+	aoe->maxOffset = source.offset;
+	vg.inMaxOffset = source.offset;
+	if (!movieValidated) {
+		atomerr = ValidateFileMovieAtoms( cnt, list );
+		if (!err) err = atomerr;
+	}
+	atomerr = ValidateFileRemainingAtoms( cnt, list );
+	if (!err) err = atomerr;
+
+	aoe->aoeflags |= kAtomValidated;
+bail:
+	if (vg.mir != NULL) {
+		dispose_mir(vg.mir);
+	}
+	DisposeMediaDataIndex();
+	vg.inStream = nil;
+	for (i = 0; i < source.extentCnt; i++) {
+		if (source.extents[i].data) free( source.extents[i].data );
+	}
+	if (source.extents) free( source.extents );
+	if (source.scratch) free( source.scratch );
+	if (list) free( list );
+	return err;
+}